@@ -48,8 +48,13 @@
 #include <libkern/OSKextLibPrivate.h>
 
 #include <kern/chunklist.h>
+#include <kern/chunklist_pipeline.h>
 #include <kern/kalloc.h>
+#include <kern/locks.h>
+#include <kern/thread.h>
+#include <kern/clock.h>
 
+#include <machine/machine_routines.h>
 #include <pexpert/pexpert.h>
 
 extern int read_file(const char *path, void **bufp, size_t *bufszp); /* implemented in imageboot.c */
@@ -59,6 +64,23 @@ extern vnode_t imgboot_get_image_file(const char *path, off_t *fsize, int *errp)
 #define AUTHPRNT(fmt, args...) do { printf("%s: " fmt "\n", __func__, ##args); } while (0)
 #define kfree_safe(x) do { if ((x)) { kfree_addr((x)); (x) = NULL; } } while (0)
 
+#define CHUNKLIST_VERIFY_THREADS        4       /* default, "chunklist_threads" boot-arg */
+#define CHUNKLIST_VERIFY_THREADS_MAX    16
+
+_Static_assert(sizeof(struct clp_chunk) == sizeof(struct chunklist_chunk),
+    "clp_chunk must match chunklist_chunk");
+
+/*
+ * State shared by the threads verifying a root image.
+ */
+struct chunklist_verify {
+	lck_mtx_t       cv_lock;
+	struct clp_pipeline cv_pipeline;        /* protected by cv_lock */
+	vnode_t         cv_vp;
+	int             cv_error;               /* first error, protected by cv_lock */
+	int             cv_running;             /* helper threads still running */
+};
+
 static const char *libkern_path = "/System/Library/Extensions/System.kext/PlugIns/Libkern.kext/Libkern";
 static const char *libkern_bundle = "com.apple.kpi.libkern";
 
@@ -183,23 +205,131 @@ out:
 	}
 }
 
+static void
+chunklist_verify_fail(struct chunklist_verify *cv, int err)
+{
+	lck_mtx_lock(&cv->cv_lock);
+	if (cv->cv_error == 0) {
+		cv->cv_error = err;
+	}
+	clp_fail(&cv->cv_pipeline);
+	lck_mtx_unlock(&cv->cv_lock);
+}
+
+/*
+ * Claims batches of chunks until there are none left or one fails to
+ * verify, reading each batch in a single I/O and checking the SHA256 of
+ * every chunk in it.  Runs on the thread validating the root image and
+ * on each helper thread.
+ */
+static void
+chunklist_verify_batches(struct chunklist_verify *cv)
+{
+	const struct clp_chunk *chk;
+	struct clp_batch batch;
+	uint8_t *buf = NULL;
+	uint64_t ch, off;
+	int err, resid, r;
+
+	vfs_context_t ctx = vfs_context_kernel();
+	kauth_cred_t kerncred = vfs_context_ucred(ctx);
+	proc_t p = vfs_context_proc(ctx);
+
+	buf = kalloc(cv->cv_pipeline.clp_batch_max);
+	if (buf == NULL) {
+		chunklist_verify_fail(cv, ENOMEM);
+		return;
+	}
+
+	for (;;) {
+		lck_mtx_lock(&cv->cv_lock);
+		r = clp_claim(&cv->cv_pipeline, &batch);
+		lck_mtx_unlock(&cv->cv_lock);
+		if (r == CLP_DONE) {
+			break;
+		}
+		if (r == CLP_INVALID) {
+			AUTHPRNT("chunk size too big");
+			chunklist_verify_fail(cv, EINVAL);
+			break;
+		}
+
+		resid = 0;
+		err = vn_rdwr(UIO_READ, cv->cv_vp, (caddr_t)buf, (int)batch.clb_length, (off_t)batch.clb_offset,
+		    UIO_SYSSPACE, IO_NODELOCKED, kerncred, &resid, p);
+		if (err) {
+			AUTHPRNT("vn_rdrw fail (err = %d, resid = %d)", err, resid);
+			chunklist_verify_fail(cv, err);
+			break;
+		}
+		if (resid) {
+			AUTHPRNT("chunk covered non-existant part of image");
+			chunklist_verify_fail(cv, EINVAL);
+			break;
+		}
+
+		/* calculate the SHA256 of each chunk and check it matches the chunk list */
+		off = 0;
+		for (ch = batch.clb_first; ch < batch.clb_first + batch.clb_count; ch++) {
+			uint8_t sha_digest[SHA256_DIGEST_LENGTH];
+			SHA256_CTX sha_ctx;
+
+			chk = &cv->cv_pipeline.clp_chunks[ch];
+			SHA256_Init(&sha_ctx);
+			SHA256_Update(&sha_ctx, buf + off, chk->clc_size);
+			SHA256_Final(sha_digest, &sha_ctx);
+
+			if (bcmp(sha_digest, chk->clc_sha256, SHA256_DIGEST_LENGTH) != 0) {
+				AUTHPRNT("SHA mismatch on chunk %llu (offset %llu, size %u)", ch,
+				    batch.clb_offset + off, chk->clc_size);
+				chunklist_verify_fail(cv, EINVAL);
+				goto out;
+			}
+			off += chk->clc_size;
+		}
+	}
+
+out:
+	kfree_safe(buf);
+}
+
+static void
+chunklist_verify_thread(void *arg, __unused wait_result_t wr)
+{
+	struct chunklist_verify *cv = arg;
+
+	chunklist_verify_batches(cv);
+
+	lck_mtx_lock(&cv->cv_lock);
+	if (--cv->cv_running == 0) {
+		wakeup(&cv->cv_running);
+	}
+	lck_mtx_unlock(&cv->cv_lock);
+
+	thread_terminate(current_thread());
+}
+
+/*
+ * Checks every chunk of the root image against the chunklist.  The chunks
+ * are read and hashed by several threads at once, so the reads of some
+ * overlap the hashing of others.
+ */
 static int
 validate_root_image(const char *root_path, void *chunklist)
 {
 	int err = 0;
 	struct chunklist_hdr *hdr = chunklist;
 	struct chunklist_chunk *chk = NULL;
-	size_t ch = 0;
 	struct vnode *vp = NULL;
 	off_t fsize = 0;
-	off_t offset = 0;
 	bool doclose = false;
-	size_t bufsz = 0;
-	void *buf = NULL;
+	struct chunklist_verify *cv = NULL;
+	lck_grp_t *grp = NULL;
+	uint32_t nthreads = CHUNKLIST_VERIFY_THREADS;
+	uint32_t i;
+	uint64_t start, elapsed;
 
 	vfs_context_t ctx = vfs_context_kernel();
-	kauth_cred_t kerncred = vfs_context_ucred(ctx);
-	proc_t p = vfs_context_proc(ctx);
 
 	AUTHDBG("validating root dmg %s", root_path);
 
@@ -214,69 +344,74 @@ validate_root_image(const char *root_path, void *chunklist)
 	}
 	doclose = true;
 
-	/*
-	 * Iterate the chunk list and check each chunk
-	 */
-	chk = chunklist + hdr->cl_chunk_offset;
-	for (ch = 0; ch < hdr->cl_chunk_count; ch++) {
-		int resid = 0;
-
-		if (!buf) {
-			/* allocate buffer based on first chunk size */
-			buf = kalloc(chk->chunk_size);
-			if (buf == NULL) {
-				err = ENOMEM;
-				goto out;
-			}
-			bufsz = chk->chunk_size;
-		}
-
-		if (chk->chunk_size > bufsz) {
-			AUTHPRNT("chunk size too big");
+	if (hdr->cl_chunk_count == 0) {
+		if (fsize != 0) {
+			AUTHPRNT("chunklist did not cover entire file (offset = 0, fsize = %lld)", fsize);
 			err = EINVAL;
-			goto out;
 		}
+		goto out;
+	}
 
-		err = vn_rdwr(UIO_READ, vp, (caddr_t)buf, chk->chunk_size, offset, UIO_SYSSPACE, IO_NODELOCKED, kerncred, &resid, p);
-		if (err) {
-			AUTHPRNT("vn_rdrw fail (err = %d, resid = %d)", err, resid);
-			goto out;
-		}
-		if (resid) {
-			err = EINVAL;
-			AUTHPRNT("chunk covered non-existant part of image");
-			goto out;
-		}
+	cv = kalloc(sizeof(*cv));
+	if (cv == NULL) {
+		err = ENOMEM;
+		goto out;
+	}
+	bzero(cv, sizeof(*cv));
+	grp = lck_grp_alloc_init("chunklist", LCK_GRP_ATTR_NULL);
+	lck_mtx_init(&cv->cv_lock, grp, LCK_ATTR_NULL);
+	cv->cv_vp = vp;
 
-		/* calculate the SHA256 of this chunk */
-		uint8_t sha_digest[SHA256_DIGEST_LENGTH];
-		SHA256_CTX sha_ctx;
-		SHA256_Init(&sha_ctx);
-		SHA256_Update(&sha_ctx, buf, chk->chunk_size);
-		SHA256_Final(sha_digest, &sha_ctx);
+	/* every thread's buffer holds a chunk the size of the first one */
+	chk = chunklist + hdr->cl_chunk_offset;
+	clp_init(&cv->cv_pipeline, chk, hdr->cl_chunk_count, chk->chunk_size);
 
-		/* Check the calculated SHA matches the chunk list */
-		if (bcmp(sha_digest, chk->chunk_sha256, SHA256_DIGEST_LENGTH) != 0) {
-			AUTHPRNT("SHA mismatch on chunk %lu (offset %lld, size %u)", ch, offset, chk->chunk_size);
-			err = EINVAL;
-			goto out;
-		}
+	PE_parse_boot_argn("chunklist_threads", &nthreads, sizeof(nthreads));
+	nthreads = MIN(nthreads, MIN(ml_get_max_cpus(), CHUNKLIST_VERIFY_THREADS_MAX));
+	nthreads = (uint32_t)MIN((uint64_t)MAX(nthreads, 1), hdr->cl_chunk_count);
 
-		if (os_add_overflow(offset, chk->chunk_size, &offset)) {
-			err = EINVAL;
-			goto out;
+	start = mach_absolute_time();
+
+	/* this thread verifies too, so start one fewer helper */
+	lck_mtx_lock(&cv->cv_lock);
+	for (i = 1; i < nthreads; i++) {
+		thread_t thread;
+
+		if (kernel_thread_start(chunklist_verify_thread, cv, &thread) != KERN_SUCCESS) {
+			AUTHPRNT("failed to start verification thread %u", i);
+			break;
 		}
-		chk++;
+		thread_deallocate(thread);
+		cv->cv_running++;
+	}
+	nthreads = i;
+	lck_mtx_unlock(&cv->cv_lock);
+
+	chunklist_verify_batches(cv);
+
+	lck_mtx_lock(&cv->cv_lock);
+	while (cv->cv_running > 0) {
+		msleep(&cv->cv_running, &cv->cv_lock, PRIBIO, "chunklist_verify", NULL);
 	}
+	lck_mtx_unlock(&cv->cv_lock);
+
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &elapsed);
+	AUTHDBG("checked %llu chunks on %u threads in %llu ms", hdr->cl_chunk_count,
+	    nthreads, elapsed / NSEC_PER_MSEC);
 
-	if (offset != fsize) {
-		AUTHPRNT("chunklist did not cover entire file (offset = %lld, fsize = %lld)", offset, fsize);
+	err = cv->cv_error;
+	if (err == 0 && !clp_covers(&cv->cv_pipeline, (uint64_t)fsize)) {
+		AUTHPRNT("chunklist did not cover entire file (offset = %llu, fsize = %lld)",
+		    cv->cv_pipeline.clp_offset, fsize);
 		err = EINVAL;
-		goto out;
 	}
 
 out:
-	kfree_safe(buf);
+	if (cv) {
+		lck_mtx_destroy(&cv->cv_lock, grp);
+		lck_grp_free(grp);
+		kfree_safe(cv);
+	}
 	if (doclose) {
 		VNOP_CLOSE(vp, FREAD, ctx);
 	}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Hands out the chunks of a chunklist to the threads verifying a root
+ * image against it (validate_root_image()).
+ *
+ * Chunks go out in file order, in batches of consecutive chunks no larger
+ * than the threads' buffers, so each thread reads one contiguous range of
+ * the image and hashes it while the other threads have their reads in
+ * flight.  Nothing here depends on the kernel, so that
+ * tests/chunklist_verify.c can run synthetic chunklists through the same
+ * distribution in user space.  Callers serialize calls on a pipeline.
+ */
+
+#ifndef _KERN_CHUNKLIST_PIPELINE_H_
+#define _KERN_CHUNKLIST_PIPELINE_H_
+
+#include <stdint.h>
+
+#define CLP_SHA256_LEN          32
+
+/* same layout as struct chunklist_chunk */
+struct clp_chunk {
+	uint32_t        clc_size;
+	uint8_t         clc_sha256[CLP_SHA256_LEN];
+} __attribute__((packed));
+
+struct clp_batch {
+	uint64_t        clb_first;      /* index of the first chunk */
+	uint64_t        clb_count;      /* chunks in the batch */
+	uint64_t        clb_offset;     /* image offset of the first chunk */
+	uint64_t        clb_length;     /* bytes the batch covers */
+};
+
+struct clp_pipeline {
+	const struct clp_chunk *clp_chunks;
+	uint64_t        clp_count;      /* chunks in the chunklist */
+	uint64_t        clp_next;       /* first chunk not handed out */
+	uint64_t        clp_offset;     /* image offset of clp_next */
+	uint64_t        clp_batch_max;  /* largest batch, in bytes */
+	int             clp_failed;     /* stop handing out chunks */
+};
+
+#define CLP_DONE        0       /* every chunk has been handed out */
+#define CLP_BATCH       1       /* *batch is the next batch */
+#define CLP_INVALID     (-1)    /* a chunk is larger than a batch, or runs past 2^63 */
+
+static inline void
+clp_init(struct clp_pipeline *clp, const void *chunks, uint64_t count,
+    uint64_t batch_max)
+{
+	clp->clp_chunks = (const struct clp_chunk *)chunks;
+	clp->clp_count = count;
+	clp->clp_next = 0;
+	clp->clp_offset = 0;
+	clp->clp_batch_max = batch_max;
+	clp->clp_failed = 0;
+}
+
+/*
+ * Hands out the next batch: as many of the following chunks as fit in
+ * clp_batch_max bytes, and always at least one.
+ */
+static inline int
+clp_claim(struct clp_pipeline *clp, struct clp_batch *batch)
+{
+	uint64_t size;
+
+	if (clp->clp_failed || clp->clp_next >= clp->clp_count) {
+		return CLP_DONE;
+	}
+
+	batch->clb_first = clp->clp_next;
+	batch->clb_count = 0;
+	batch->clb_offset = clp->clp_offset;
+	batch->clb_length = 0;
+	while (clp->clp_next < clp->clp_count) {
+		size = clp->clp_chunks[clp->clp_next].clc_size;
+		if (batch->clb_length + size > clp->clp_batch_max) {
+			if (batch->clb_count == 0) {
+				clp->clp_failed = 1;
+				return CLP_INVALID;
+			}
+			break;
+		}
+		if (clp->clp_offset + size > (uint64_t)INT64_MAX) {
+			clp->clp_failed = 1;
+			return CLP_INVALID;
+		}
+		batch->clb_count++;
+		batch->clb_length += size;
+		clp->clp_offset += size;
+		clp->clp_next++;
+	}
+	return CLP_BATCH;
+}
+
+/*
+ * A batch failed to verify: hand out nothing more.
+ */
+static inline void
+clp_fail(struct clp_pipeline *clp)
+{
+	clp->clp_failed = 1;
+}
+
+/*
+ * Once every batch has been handed out and verified, whether the chunks
+ * covered exactly image_size bytes.
+ */
+static inline int
+clp_covers(const struct clp_pipeline *clp, uint64_t image_size)
+{
+	return !clp->clp_failed && clp->clp_next == clp->clp_count &&
+	       clp->clp_offset == image_size;
+}
+
+#endif /* _KERN_CHUNKLIST_PIPELINE_H_ */
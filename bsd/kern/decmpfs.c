@@ -69,8 +69,11 @@ UNUSED_SYMBOL(decmpfs_validate_compressed_file)
 #include <sys/ubc.h>
 #include <sys/decmpfs.h>
 #include <sys/uio_internal.h>
+#include <sys/sysctl.h>
 #include <libkern/OSByteOrder.h>
 #include <libkern/section_keywords.h>
+#include <kern/thread.h>
+#include <machine/machine_routines.h>
 
 #pragma mark --- debugging ---
 
@@ -208,6 +211,72 @@ static lck_mtx_t *decompress_channel_mtx;
 
 vfs_context_t decmpfs_ctx;
 
+/*
+ * Read-ahead: sequential readers of a compressed file get the chunks past
+ * the one they are reading queued to a pool of worker threads, which
+ * decompress them in parallel, push the pages into the UBC and keep a copy
+ * in the chunk cache for fetches that miss the UBC.
+ */
+#define DECMPFS_RA_CHUNK        (64 * 1024)     /* read-ahead and chunk cache granularity */
+#define DECMPFS_RA_THREADS_MAX  8
+#define DECMPFS_RA_QUEUE_MAX    256
+#define DECMPFS_CACHE_HASH      256             /* power of 2 */
+
+struct decmpfs_ra_req {
+	TAILQ_ENTRY(decmpfs_ra_req) rr_link;
+	vnode_t         rr_vp;
+	uint32_t        rr_vid;
+	decmpfs_cnode   *rr_cp;
+	off_t           rr_offset;      /* multiple of DECMPFS_RA_CHUNK */
+};
+
+struct decmpfs_chunk {
+	TAILQ_ENTRY(decmpfs_chunk) dc_lru;
+	LIST_ENTRY(decmpfs_chunk) dc_hash;
+	vnode_t         dc_vp;
+	uint32_t        dc_vid;
+	off_t           dc_offset;      /* multiple of DECMPFS_RA_CHUNK */
+	uint32_t        dc_size;        /* short only for the last chunk of a file */
+	char            *dc_data;
+};
+
+static lck_mtx_t *decmpfs_ra_mtx;      /* protects the read-ahead queue */
+static TAILQ_HEAD(, decmpfs_ra_req) decmpfs_ra_queue;
+static int decmpfs_ra_queued;
+static int decmpfs_ra_nthreads;
+
+static lck_mtx_t *decmpfs_cache_mtx;   /* protects the chunk cache */
+static TAILQ_HEAD(, decmpfs_chunk) decmpfs_cache_lru;
+static LIST_HEAD(decmpfs_chunk_head, decmpfs_chunk) decmpfs_cache_hash[DECMPFS_CACHE_HASH];
+static int decmpfs_cache_count;
+
+static int decmpfs_ra_chunks = 8;      /* chunks kept queued ahead of a sequential reader, 0 disables */
+static int decmpfs_cache_max = 128;    /* chunks kept in the chunk cache */
+
+static uint64_t decmpfs_ra_issued;
+static uint64_t decmpfs_ra_dropped;
+static uint64_t decmpfs_ra_done;
+static uint64_t decmpfs_cache_hits;
+
+SYSCTL_NODE(_vfs, OID_AUTO, decmpfs, CTLFLAG_RW | CTLFLAG_LOCKED, NULL, "compressed files");
+
+SYSCTL_INT(_vfs_decmpfs, OID_AUTO, ra_chunks, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &decmpfs_ra_chunks, 0, "64KB chunks decompressed ahead of a sequential reader");
+SYSCTL_INT(_vfs_decmpfs, OID_AUTO, ra_threads, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &decmpfs_ra_nthreads, 0, "read-ahead worker threads");
+SYSCTL_INT(_vfs_decmpfs, OID_AUTO, cache_max, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &decmpfs_cache_max, 0, "64KB chunks kept decompressed");
+SYSCTL_INT(_vfs_decmpfs, OID_AUTO, cache_count, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &decmpfs_cache_count, 0, "64KB chunks currently kept decompressed");
+SYSCTL_QUAD(_vfs_decmpfs, OID_AUTO, ra_issued, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &decmpfs_ra_issued, "chunks queued for read-ahead");
+SYSCTL_QUAD(_vfs_decmpfs, OID_AUTO, ra_dropped, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &decmpfs_ra_dropped, "chunks not queued because the queue was full");
+SYSCTL_QUAD(_vfs_decmpfs, OID_AUTO, ra_done, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &decmpfs_ra_done, "chunks decompressed by read-ahead");
+SYSCTL_QUAD(_vfs_decmpfs, OID_AUTO, cache_hits, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &decmpfs_cache_hits, "fetches served from the chunk cache");
+
 #pragma mark --- decmp_get_func ---
 
 #define offsetof_func(func) ((uintptr_t)(&(((decmpfs_registration*)NULL)->func)))
@@ -1198,8 +1267,228 @@ compression_type_valid(vnode_t vp, decmpfs_header *hdr)
 	return ret;
 }
 
+#pragma mark --- chunk cache ---
+
+static struct decmpfs_chunk_head *
+decmpfs_cache_bucket(vnode_t vp, off_t offset)
+{
+	uintptr_t h = ((uintptr_t)vp >> 6) ^ (uintptr_t)(offset / DECMPFS_RA_CHUNK);
+
+	return &decmpfs_cache_hash[h & (DECMPFS_CACHE_HASH - 1)];
+}
+
+static struct decmpfs_chunk *
+decmpfs_cache_lookup_locked(vnode_t vp, uint32_t vid, off_t offset)
+{
+	struct decmpfs_chunk *dc;
+
+	LIST_FOREACH(dc, decmpfs_cache_bucket(vp, offset), dc_hash) {
+		if (dc->dc_vp == vp && dc->dc_vid == vid && dc->dc_offset == offset) {
+			return dc;
+		}
+	}
+	return NULL;
+}
+
+static void
+decmpfs_cache_remove_locked(struct decmpfs_chunk *dc)
+{
+	TAILQ_REMOVE(&decmpfs_cache_lru, dc, dc_lru);
+	LIST_REMOVE(dc, dc_hash);
+	decmpfs_cache_count--;
+}
+
+static void
+decmpfs_cache_free(struct decmpfs_chunk *dc)
+{
+	FREE(dc->dc_data, M_TEMP);
+	FREE(dc, M_TEMP);
+}
+
+static bool
+decmpfs_cache_present(vnode_t vp, off_t offset)
+{
+	bool present;
+
+	lck_mtx_lock(decmpfs_cache_mtx);
+	present = decmpfs_cache_lookup_locked(vp, vnode_vid(vp), offset) != NULL;
+	lck_mtx_unlock(decmpfs_cache_mtx);
+	return present;
+}
+
+/*
+ * Evicts the least recently used chunks until at most keep are left, and
+ * frees them once the cache lock is dropped.
+ */
+static void
+decmpfs_cache_trim(int keep)
+{
+	TAILQ_HEAD(, decmpfs_chunk) evicted = TAILQ_HEAD_INITIALIZER(evicted);
+	struct decmpfs_chunk *dc;
+
+	lck_mtx_lock(decmpfs_cache_mtx);
+	while (decmpfs_cache_count > keep && (dc = TAILQ_FIRST(&decmpfs_cache_lru)) != NULL) {
+		decmpfs_cache_remove_locked(dc);
+		TAILQ_INSERT_TAIL(&evicted, dc, dc_lru);
+	}
+	lck_mtx_unlock(decmpfs_cache_mtx);
+
+	while ((dc = TAILQ_FIRST(&evicted)) != NULL) {
+		TAILQ_REMOVE(&evicted, dc, dc_lru);
+		decmpfs_cache_free(dc);
+	}
+}
+
+/*
+ * Drops every chunk of vp, for when its compressed data goes away.
+ */
+static void
+decmpfs_cache_purge(vnode_t vp)
+{
+	TAILQ_HEAD(, decmpfs_chunk) evicted = TAILQ_HEAD_INITIALIZER(evicted);
+	struct decmpfs_chunk *dc, *next;
+
+	if (decmpfs_cache_count == 0) {
+		return;
+	}
+	lck_mtx_lock(decmpfs_cache_mtx);
+	TAILQ_FOREACH_SAFE(dc, &decmpfs_cache_lru, dc_lru, next) {
+		if (dc->dc_vp == vp) {
+			decmpfs_cache_remove_locked(dc);
+			TAILQ_INSERT_TAIL(&evicted, dc, dc_lru);
+		}
+	}
+	lck_mtx_unlock(decmpfs_cache_mtx);
+
+	while ((dc = TAILQ_FIRST(&evicted)) != NULL) {
+		TAILQ_REMOVE(&evicted, dc, dc_lru);
+		decmpfs_cache_free(dc);
+	}
+}
+
+/*
+ * Adds the chunk of vp at offset, taking ownership of data, which was
+ * allocated DECMPFS_RA_CHUNK bytes long from M_TEMP.
+ */
+static void
+decmpfs_cache_insert(vnode_t vp, off_t offset, char *data, uint32_t size)
+{
+	struct decmpfs_chunk *dc;
+	uint32_t vid = vnode_vid(vp);
+
+	MALLOC(dc, struct decmpfs_chunk *, sizeof(*dc), M_TEMP, M_WAITOK);
+	dc->dc_vp = vp;
+	dc->dc_vid = vid;
+	dc->dc_offset = offset;
+	dc->dc_size = size;
+	dc->dc_data = data;
+
+	lck_mtx_lock(decmpfs_cache_mtx);
+	if (decmpfs_cache_max <= 0 || decmpfs_cache_lookup_locked(vp, vid, offset) != NULL) {
+		lck_mtx_unlock(decmpfs_cache_mtx);
+		decmpfs_cache_free(dc);
+		return;
+	}
+	TAILQ_INSERT_TAIL(&decmpfs_cache_lru, dc, dc_lru);
+	LIST_INSERT_HEAD(decmpfs_cache_bucket(vp, offset), dc, dc_hash);
+	decmpfs_cache_count++;
+	lck_mtx_unlock(decmpfs_cache_mtx);
+
+	if (decmpfs_cache_count > decmpfs_cache_max) {
+		decmpfs_cache_trim(decmpfs_cache_max);
+	}
+}
+
+/*
+ * Memory pressure callout from the buffer cache: drop everything when
+ * asked to, else the older half of the chunks.
+ */
+static void
+decmpfs_cache_gc(int all, __unused void *context)
+{
+	decmpfs_cache_trim(all ? 0 : decmpfs_cache_count / 2);
+}
+
+/*
+ * Copies len bytes of src to byte pos of the region described by vec.
+ */
+static void
+decmpfs_vec_copy(int nvec, decmpfs_vector *vec, uint64_t pos, const char *src, uint64_t len)
+{
+	uint64_t n;
+	int i;
+
+	for (i = 0; i < nvec && len > 0; i++) {
+		if (pos >= vec[i].size) {
+			pos -= vec[i].size;
+			continue;
+		}
+		n = MIN(len, vec[i].size - pos);
+		memcpy((char *)vec[i].buf + pos, src, n);
+		src += n;
+		len -= n;
+		pos = 0;
+	}
+}
+
+/*
+ * Fills the region [offset, offset + size) of vp from the chunk cache.
+ * Returns false, having copied an arbitrary part of it, unless every
+ * chunk the region touches is cached.
+ */
+static bool
+decmpfs_cache_copyout(vnode_t vp, off_t offset, user_ssize_t size, int nvec, decmpfs_vector *vec, uint64_t *bytes_read)
+{
+	struct decmpfs_chunk *dc;
+	uint32_t vid = vnode_vid(vp);
+	uint64_t done = 0, skip, len;
+	off_t chunk;
+
+	if (decmpfs_cache_count == 0) {
+		return false;
+	}
+	while (done < (uint64_t)size) {
+		chunk = (offset + done) & ~((off_t)DECMPFS_RA_CHUNK - 1);
+		skip = offset + done - chunk;
+
+		lck_mtx_lock(decmpfs_cache_mtx);
+		dc = decmpfs_cache_lookup_locked(vp, vid, chunk);
+		if (dc == NULL || skip >= dc->dc_size) {
+			lck_mtx_unlock(decmpfs_cache_mtx);
+			return false;
+		}
+		len = MIN(dc->dc_size - skip, (uint64_t)size - done);
+		decmpfs_vec_copy(nvec, vec, done, dc->dc_data + skip, len);
+		TAILQ_REMOVE(&decmpfs_cache_lru, dc, dc_lru);
+		TAILQ_INSERT_TAIL(&decmpfs_cache_lru, dc, dc_lru);
+		lck_mtx_unlock(decmpfs_cache_mtx);
+
+		done += len;
+	}
+	*bytes_read = done;
+	OSIncrementAtomic64((SInt64 *)&decmpfs_cache_hits);
+	return true;
+}
+
 #pragma mark --- compression/decompression routines ---
 
+static void
+decmpfs_flush_vec(decmpfs_cnode *cp, int nvec, decmpfs_vector *vec)
+{
+	uint64_t decompression_flags = decmpfs_cnode_get_decompression_flags(cp);
+	if (decompression_flags & DECMPFS_FLAGS_FORCE_FLUSH_ON_DECOMPRESS) {
+#if     !defined(__i386__) && !defined(__x86_64__)
+		int i;
+		for (i = 0; i < nvec; i++) {
+			flush_dcache64((addr64_t)(uintptr_t)vec[i].buf, vec[i].size, FALSE);
+		}
+#else
+		(void)nvec;
+		(void)vec;
+#endif
+	}
+}
+
 static int
 decmpfs_fetch_uncompressed_data(vnode_t vp, decmpfs_cnode *cp, decmpfs_header *hdr, off_t offset, user_ssize_t size, int nvec, decmpfs_vector *vec, uint64_t *bytes_read)
 {
@@ -1228,6 +1517,12 @@ decmpfs_fetch_uncompressed_data(vnode_t vp, decmpfs_cnode *cp, decmpfs_header *h
 		err = 0;
 		goto out;
 	}
+	if (decmpfs_cache_copyout(vp, offset, size, nvec, vec, bytes_read)) {
+		/* every chunk of the region was decompressed ahead of time */
+		decmpfs_flush_vec(cp, nvec, vec);
+		err = 0;
+		goto out;
+	}
 
 	/*
 	 * Trace the following parameters on entry with event-id 0x03120008.
@@ -1248,15 +1543,7 @@ decmpfs_fetch_uncompressed_data(vnode_t vp, decmpfs_cnode *cp, decmpfs_header *h
 		err = fetch(vp, decmpfs_ctx, hdr, offset, size, nvec, vec, bytes_read);
 		lck_rw_unlock_shared(decompressorsLock);
 		if (err == 0) {
-			uint64_t decompression_flags = decmpfs_cnode_get_decompression_flags(cp);
-			if (decompression_flags & DECMPFS_FLAGS_FORCE_FLUSH_ON_DECOMPRESS) {
-#if     !defined(__i386__) && !defined(__x86_64__)
-				int i;
-				for (i = 0; i < nvec; i++) {
-					flush_dcache64((addr64_t)(uintptr_t)vec[i].buf, vec[i].size, FALSE);
-				}
-#endif
-			}
+			decmpfs_flush_vec(cp, nvec, vec);
 		}
 	} else {
 		err = ENOTSUP;
@@ -1303,6 +1590,215 @@ commit_upl(upl_t upl, upl_offset_t pl_offset, size_t uplSize, int flags, int abo
 	return kr;
 }
 
+#pragma mark --- read-ahead ---
+
+/*
+ * Places the decompressed chunk of vp at offset in the UBC, on the pages
+ * that are not resident yet.  Pages already in the UBC are left alone.
+ */
+static void
+decmpfs_ra_push(vnode_t vp, off_t offset, const char *buf, uint64_t size)
+{
+	upl_t upl = NULL;
+	upl_page_info_t *pl = NULL;
+	vm_offset_t data = 0;
+	kern_return_t kr;
+	uint64_t pg_off, len;
+	int pages = (int)(round_page_64(size) / PAGE_SIZE);
+	int i, run, present = 0;
+
+	kr = ubc_create_upl_kernel(vp, offset, pages * PAGE_SIZE, &upl, &pl,
+	    UPL_RET_ONLY_ABSENT | UPL_SET_LITE, VM_KERN_MEMORY_FILE);
+	if (kr != KERN_SUCCESS || upl == NULL) {
+		return;
+	}
+	for (i = 0; i < pages; i++) {
+		if (upl_page_present(pl, i)) {
+			present++;
+		}
+	}
+	if (present == 0) {
+		ubc_upl_abort(upl, 0);
+		return;
+	}
+	kr = ubc_upl_map(upl, &data);
+	if (kr != KERN_SUCCESS || data == 0) {
+		ErrorLogWithPath("ubc_upl_map error %d\n", (int)kr);
+		ubc_upl_abort(upl, UPL_ABORT_FREE_ON_EMPTY);
+		return;
+	}
+	for (i = 0; i < pages; i++) {
+		if (!upl_page_present(pl, i)) {
+			continue;
+		}
+		pg_off = (uint64_t)i * PAGE_SIZE;
+		len = MIN(PAGE_SIZE, size - pg_off);
+		memcpy((char *)data + pg_off, buf + pg_off, len);
+		if (len < PAGE_SIZE) {
+			/* zero the end of the last page */
+			memset((char *)data + pg_off + len, 0, PAGE_SIZE - len);
+		}
+	}
+	kr = ubc_upl_unmap(upl);
+	if (kr != KERN_SUCCESS) {
+		ErrorLogWithPath("ubc_upl_unmap error %d\n", (int)kr);
+		ubc_upl_abort(upl, UPL_ABORT_FREE_ON_EMPTY);
+		return;
+	}
+
+	/* commit each run of pages we filled */
+	for (i = 0; i < pages; i = run) {
+		if (!upl_page_present(pl, i)) {
+			run = i + 1;
+			continue;
+		}
+		for (run = i + 1; run < pages && upl_page_present(pl, run); run++) {
+			;
+		}
+		commit_upl(upl, i * PAGE_SIZE, (run - i) * PAGE_SIZE,
+		    UPL_COMMIT_FREE_ON_EMPTY | UPL_COMMIT_INACTIVATE, 0);
+	}
+}
+
+/*
+ * Runs on a read-ahead worker: decompresses one chunk into the UBC and the
+ * chunk cache, unless the file is busy or no longer compressed.
+ */
+static void
+decmpfs_ra_chunk(vnode_t vp, decmpfs_cnode *cp, off_t offset)
+{
+	decmpfs_header *hdr = NULL;
+	decmpfs_vector vec;
+	uint64_t did_read = 0, size;
+	char *buf = NULL;
+	int err;
+
+	if (!decmpfs_trylock_compressed_data(cp, 0)) {
+		/* being decompressed or having its compressed data changed */
+		return;
+	}
+	if (decmpfs_fast_get_state(cp) != FILE_IS_COMPRESSED ||
+	    decmpfs_cache_present(vp, offset)) {
+		goto out;
+	}
+	err = decmpfs_fetch_compressed_header(vp, cp, &hdr, 0);
+	if (err != 0 || !compression_type_valid(vp, hdr) ||
+	    (uint64_t)offset >= hdr->uncompressed_size) {
+		goto out;
+	}
+	size = MIN(DECMPFS_RA_CHUNK, hdr->uncompressed_size - offset);
+
+	MALLOC(buf, char *, DECMPFS_RA_CHUNK, M_TEMP, M_WAITOK);
+	vec = (decmpfs_vector){ .buf = buf, .size = size };
+	err = decmpfs_fetch_uncompressed_data(vp, cp, hdr, offset, size, 1, &vec, &did_read);
+	if (err != 0 || did_read != size) {
+		DebugLogWithPath("read-ahead of %lld: err %d, %llu of %llu bytes\n",
+		    (int64_t)offset, err, did_read, size);
+		goto out;
+	}
+	OSIncrementAtomic64((SInt64 *)&decmpfs_ra_done);
+
+	decmpfs_ra_push(vp, offset, buf, size);
+	decmpfs_cache_insert(vp, offset, buf, (uint32_t)size);
+	buf = NULL;
+out:
+	if (buf) {
+		FREE(buf, M_TEMP);
+	}
+	if (hdr) {
+		FREE(hdr, M_TEMP);
+	}
+	decmpfs_unlock_compressed_data(cp, 0);
+}
+
+static void
+decmpfs_ra_thread(__unused void *arg, __unused wait_result_t wr)
+{
+	struct decmpfs_ra_req *rr;
+
+	for (;;) {
+		lck_mtx_lock(decmpfs_ra_mtx);
+		while ((rr = TAILQ_FIRST(&decmpfs_ra_queue)) == NULL) {
+			msleep(&decmpfs_ra_queue, decmpfs_ra_mtx, PRIBIO, "decmpfs_ra", NULL);
+		}
+		TAILQ_REMOVE(&decmpfs_ra_queue, rr, rr_link);
+		decmpfs_ra_queued--;
+		lck_mtx_unlock(decmpfs_ra_mtx);
+
+		/* the vnode may have been recycled since the request was queued */
+		if (vnode_getwithvid(rr->rr_vp, rr->rr_vid) == 0) {
+			decmpfs_ra_chunk(rr->rr_vp, rr->rr_cp, rr->rr_offset);
+			vnode_put(rr->rr_vp);
+		}
+		FREE(rr, M_TEMP);
+	}
+}
+
+/*
+ * Called with the compressed data lock held for every read of
+ * [offset, offset + size) of a compressed file of uncompressed size eof.
+ * Reads continuing where the previous one ended keep the next
+ * decmpfs_ra_chunks chunks past the read queued to the workers.
+ */
+static void
+decmpfs_ra_note(vnode_t vp, decmpfs_cnode *cp, off_t offset, user_ssize_t size, uint64_t eof)
+{
+	struct decmpfs_ra_req *rr;
+	uint64_t end = offset + size, start, limit;
+	uint32_t vid;
+	int window = decmpfs_ra_chunks;
+
+	if (size <= 0 || offset < 0) {
+		return;
+	}
+	if ((uint64_t)offset > cp->ra_last || end <= cp->ra_last) {
+		/* not a continuation of the previous read */
+		cp->ra_last = end;
+		cp->ra_next = 0;
+		return;
+	}
+	cp->ra_last = end;
+	if (window <= 0 || decmpfs_ra_nthreads == 0 || vnode_isnoreadahead(vp)) {
+		return;
+	}
+
+	start = (end + DECMPFS_RA_CHUNK - 1) & ~((uint64_t)DECMPFS_RA_CHUNK - 1);
+	limit = MIN(start + (uint64_t)window * DECMPFS_RA_CHUNK, eof);
+	if (cp->ra_next > start) {
+		if (cp->ra_next - start >= (uint64_t)window * DECMPFS_RA_CHUNK / 2) {
+			/* still at least half a window queued ahead */
+			return;
+		}
+		start = cp->ra_next;
+	}
+	if (start >= limit) {
+		return;
+	}
+	cp->ra_next = limit;
+
+	vid = vnode_vid(vp);
+	for (; start < limit; start += DECMPFS_RA_CHUNK) {
+		if (decmpfs_cache_present(vp, start)) {
+			continue;
+		}
+		if (decmpfs_ra_queued >= DECMPFS_RA_QUEUE_MAX) {
+			OSIncrementAtomic64((SInt64 *)&decmpfs_ra_dropped);
+			continue;
+		}
+		MALLOC(rr, struct decmpfs_ra_req *, sizeof(*rr), M_TEMP, M_WAITOK);
+		rr->rr_vp = vp;
+		rr->rr_vid = vid;
+		rr->rr_cp = cp;
+		rr->rr_offset = start;
+
+		lck_mtx_lock(decmpfs_ra_mtx);
+		TAILQ_INSERT_TAIL(&decmpfs_ra_queue, rr, rr_link);
+		decmpfs_ra_queued++;
+		lck_mtx_unlock(decmpfs_ra_mtx);
+		wakeup_one((caddr_t)&decmpfs_ra_queue);
+		OSIncrementAtomic64((SInt64 *)&decmpfs_ra_issued);
+	}
+}
 
 errno_t
 decmpfs_pagein_compressed(struct vnop_pagein_args *ap, int *is_compressed, decmpfs_cnode *cp)
@@ -1390,6 +1886,9 @@ decompress:
 		did_read = 0;
 	} else {
 		err = decmpfs_fetch_uncompressed_data(vp, cp, hdr, uplPos, uplSize, 1, &vec, &did_read);
+		if (err == 0 && !(flags & UPL_NORDAHEAD)) {
+			decmpfs_ra_note(vp, cp, uplPos, uplSize, cachedSize);
+		}
 	}
 	if (err) {
 		DebugLogWithPath("decmpfs_fetch_uncompressed_data err %d\n", err);
@@ -1493,6 +1992,9 @@ decmpfs_read_compressed(struct vnop_read_args *ap, int *is_compressed, decmpfs_c
 		uplSize = cachedSize - uplPos;
 	}
 
+	/* queue read-ahead before the reads served from the UBC, so it keeps ahead of them */
+	decmpfs_ra_note(vp, cp, uplPos, uplSize, cachedSize);
+
 	/* give the cluster layer a chance to fill in whatever it already has */
 	countInt = (uplSize > INT_MAX) ? INT_MAX : uplSize;
 	err = cluster_copy_ubc_data(vp, uio, &countInt, 0);
@@ -1727,6 +2229,9 @@ decmpfs_free_compressed_data(vnode_t vp, decmpfs_cnode *cp)
 	 */
 	DECMPFS_EMIT_TRACE_ENTRY(DECMPDBG_FREE_COMPRESSED_DATA, vp->v_id);
 
+	/* the decompressed chunks we kept are about to be stale */
+	decmpfs_cache_purge(vp);
+
 	int err = decmpfs_fetch_compressed_header(vp, cp, &hdr, 0);
 	if (err) {
 		ErrorLogWithPath("decmpfs_fetch_compressed_header err %d\n", err);
@@ -2125,6 +2630,28 @@ decmpfs_init()
 
 	register_decmpfs_decompressor(CMP_Type1, &Type1Reg);
 
+	decmpfs_ra_mtx = lck_mtx_alloc_init(decmpfs_lockgrp, NULL);
+	decmpfs_cache_mtx = lck_mtx_alloc_init(decmpfs_lockgrp, NULL);
+	TAILQ_INIT(&decmpfs_ra_queue);
+	TAILQ_INIT(&decmpfs_cache_lru);
+	for (int i = 0; i < DECMPFS_CACHE_HASH; i++) {
+		LIST_INIT(&decmpfs_cache_hash[i]);
+	}
+	fs_buffer_cache_gc_register(decmpfs_cache_gc, NULL);
+
+	/* half the CPUs decompress ahead, leaving the rest to the readers */
+	int nthreads = MIN(MAX((int)ml_get_max_cpus() / 2, 1), DECMPFS_RA_THREADS_MAX);
+	for (int i = 0; i < nthreads; i++) {
+		thread_t thread;
+
+		if (kernel_thread_start(decmpfs_ra_thread, NULL, &thread) != KERN_SUCCESS) {
+			ErrorLog("failed to start read-ahead thread %d\n", i);
+			break;
+		}
+		thread_deallocate(thread);
+		decmpfs_ra_nthreads++;
+	}
+
 	done = 1;
 }
 #endif /* FS_COMPRESSION */
@@ -57,7 +57,10 @@
 #include <sys/user.h>
 
 #include <sys/aio_kern.h>
+#include <sys/aio_ring.h>
 #include <sys/sysproto.h>
+#include <sys/ubc_internal.h>
+#include <sys/uio_internal.h>
 
 #include <machine/limits.h>
 
@@ -72,6 +75,10 @@
 
 #include <libkern/OSAtomic.h>
 
+#if CONFIG_MACF
+#include <security/mac_framework.h>
+#endif
+
 #include <sys/kdebug.h>
 #define AIO_work_queued                                 1
 #define AIO_worker_wake                                 2
@@ -105,6 +112,9 @@
 #define AIO_suspend                                             110
 #define AIO_suspend_sleep                               111
 #define AIO_worker_thread                               120
+#define AIO_ring_setup                                  130
+#define AIO_ring_enter                                  131
+#define AIO_ring_post                                   132
 
 #if 0
 #undef KERNEL_DEBUG
@@ -147,6 +157,46 @@ struct aio_lio_context {
 typedef struct aio_lio_context aio_lio_context;
 
 
+/*
+ * A submission / completion ring (see sys/aio_ring.h).  The ring's memory
+ * belongs to the process; the kernel reads submissions from it and posts
+ * completions to it with copyin / copyout, from a worker thread by
+ * switching to ar_map.  Rings are identified by their user address, as
+ * aiocbs are, and live on aio_ring_hash rather than in the proc.
+ *
+ * ar_sq_mtx serializes submitters.  ar_mtx protects the completion side:
+ * ar_cq_next, ar_cq_tail, ar_inflight and ar_flags, but is not held
+ * across the copyouts that post a completion, see aio_ring_post().
+ * A ring is referenced by its
+ * registration, by each aio_ring_enter() using it and by each request
+ * queued from it.
+ */
+struct aio_ring {
+	TAILQ_ENTRY(aio_ring)   ar_link;        /* aio_ring_hash, aio_ring_mtx */
+	proc_t                  ar_proc;        /* process that registered the ring */
+	user_addr_t             ar_uaddr;       /* struct aio_ring_header in ar_proc */
+	vm_map_t                ar_map;         /* reference on ar_proc's map */
+	lck_mtx_t               ar_sq_mtx;
+	lck_mtx_t               ar_mtx;
+	volatile int32_t        ar_refcount;
+	uint32_t                ar_entries;     /* submission entries, a power of 2 */
+	uint32_t                ar_sq_head;     /* the kernel's copies of the indices it owns */
+	uint32_t                ar_cq_next;     /* next completion to hand out */
+	uint32_t                ar_cq_tail;     /* completions posted so far */
+	uint32_t                ar_inflight;    /* consumed and not yet posted */
+	int                     ar_signo;       /* sent when completions are posted, or 0 */
+	int                     ar_flags;
+	int                     ar_waiters;     /* threads waiting for completions */
+};
+
+#define AIO_RING_DEAD           0x1     /* unregistered, post nothing more */
+
+#define AIO_RING_MAX_PER_PROC   16
+
+#define AIO_RING_HASH_SIZE      64      /* power of 2 */
+#define AIO_RING_HASH(p, uaddr) \
+	(&aio_ring_hash[(((uintptr_t)(p) >> 4) ^ ((uaddr) >> 3)) & (AIO_RING_HASH_SIZE - 1)])
+
 /*
  * Notes on aio sleep / wake channels.
  * We currently pick a couple fields within the proc structure that will allow
@@ -225,6 +275,16 @@ static user_addr_t *aio_copy_in_list(proc_t procp, user_addr_t aiocblist, int ne
 static void             free_lio_context(aio_lio_context* context);
 static void             aio_enqueue_work( proc_t procp, aio_workq_entry *entryp, int proc_locked);
 
+static struct aio_ring *aio_ring_lookup(proc_t procp, user_addr_t uaddr);
+static void             aio_ring_release(struct aio_ring *ring);
+static boolean_t        aio_ring_unlink(struct aio_ring *ring);
+static void             aio_ring_destroy(struct aio_ring *ring);
+static void             aio_ring_exit(proc_t procp);
+static int              aio_ring_submit(struct aio_ring *ring, struct aio_ring_sqe *sqe);
+static int              aio_ring_queue(struct aio_ring *ring, struct aio_ring_sqe *sqe, int kindOfIO);
+static boolean_t        aio_ring_read_cached(proc_t procp, struct aio_ring_sqe *sqe, user_ssize_t *retval, int *errorp);
+static void             aio_ring_post(struct aio_ring *ring, uint64_t user_data, int64_t res, boolean_t disabled);
+
 #define ASSERT_AIO_PROC_LOCK_OWNED(p)   lck_mtx_assert(aio_proc_mutex((p)), LCK_MTX_ASSERT_OWNED)
 #define ASSERT_AIO_WORKQ_LOCK_OWNED(q)  lck_mtx_assert(aio_workq_mutex((q)), LCK_MTX_ASSERT_OWNED)
 #define ASSERT_AIO_ENTRY_LOCK_OWNED(e)  lck_mtx_assert(aio_entry_mutex((e)), LCK_MTX_ASSERT_OWNED)
@@ -264,6 +324,9 @@ static lck_grp_attr_t   *aio_lock_grp_attr;
 static struct zone      *aio_workq_zonep;
 static lck_mtx_t        aio_entry_mtx;
 static lck_mtx_t        aio_proc_mtx;
+static lck_mtx_t        aio_ring_mtx;
+static TAILQ_HEAD(, aio_ring) aio_ring_hash[AIO_RING_HASH_SIZE];
+static int              aio_ring_count;         /* rings on aio_ring_hash, aio_ring_mtx */
 
 static void
 aio_entry_lock(__unused aio_workq_entry *entryp)
@@ -357,8 +420,19 @@ aio_proc_move_done_locked(proc_t procp, aio_workq_entry *entryp)
 	ASSERT_AIO_PROC_LOCK_OWNED(procp);
 
 	TAILQ_REMOVE(&procp->p_aio_activeq, entryp, aio_proc_link );
-	TAILQ_INSERT_TAIL( &procp->p_aio_doneq, entryp, aio_proc_link);
 	procp->p_aio_active_count--;
+
+	if (entryp->flags & AIO_RING) {
+		/*
+		 * ring requests are reaped from the ring, never with
+		 * aio_return(), so they are done with the proc here.
+		 * AIO_DO_FREE is already set so the last unref frees it.
+		 */
+		aio_decrement_total_count();
+		procp->p_aio_total_count--;
+		return;
+	}
+	TAILQ_INSERT_TAIL( &procp->p_aio_doneq, entryp, aio_proc_link);
 	OSIncrementAtomic(&aio_anchor.aio_done_count);
 }
 
@@ -862,6 +936,8 @@ _aio_exit(proc_t p )
 	int                                             error;
 	aio_workq_entry                 *entryp;
 
+	/* the rings' memory is going away, stop posting to it */
+	aio_ring_exit(p);
 
 	/* quick check to see if there are any async IO requests queued up */
 	if (aio_get_all_queues_count() < 1) {
@@ -2127,6 +2203,11 @@ aio_free_request(aio_workq_entry *entryp)
 		thread_deallocate( entryp->thread );
 	}
 
+	/* and to the ring the request came from */
+	if (NULL != entryp->aio_ring) {
+		aio_ring_release( entryp->aio_ring );
+	}
+
 	entryp->aio_refcount = -1; /* A bit of poisoning in case of bad refcounting. */
 
 	zfree( aio_workq_zonep, entryp );
@@ -2246,6 +2327,12 @@ do_aio_completion( aio_workq_entry *entryp )
 	aio_lio_context *lio_context = NULL;
 	int waiter = 0;
 
+	if (entryp->flags & AIO_RING) {
+		aio_ring_post(entryp->aio_ring, entryp->aio_ring_data,
+		    entryp->errorval ? -entryp->errorval : entryp->returnval,
+		    (entryp->flags & AIO_DISABLE) != 0);
+	}
+
 	lio_context = (aio_lio_context *)entryp->group_tag;
 
 	if (lio_context != NULL) {
@@ -2582,6 +2669,653 @@ free_lio_context(aio_lio_context* context)
 } /* free_lio_context */
 
 
+/*
+ * aio_ring_setup - register the caller's memory at uap->ring as a
+ * submission / completion ring with uap->entries submission entries (see
+ * sys/aio_ring.h).  If uap->signo is not 0 it is sent to the process
+ * whenever completions are posted to the ring.
+ */
+int
+aio_ring_setup(proc_t p, struct aio_ring_setup_args *uap, __unused int *retval)
+{
+	struct aio_ring_header  hdr;
+	struct aio_ring         *ring, *other;
+	uint32_t                entries = uap->entries;
+	int                     count = 0;
+	int                     error = 0;
+	int                     i;
+
+	KERNEL_DEBUG((BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_setup)) | DBG_FUNC_START,
+	    (int)p, (int)uap->ring, entries, uap->signo, 0 );
+
+	if (entries == 0 || entries > AIO_RING_MAX_ENTRIES ||
+	    (entries & (entries - 1)) != 0 ||
+	    uap->size < AIO_RING_SIZE(entries) ||
+	    (uap->ring & (sizeof(uint64_t) - 1)) != 0 ||
+	    uap->signo < 0 || uap->signo >= NSIG ||
+	    uap->signo == SIGKILL || uap->signo == SIGSTOP) {
+		error = EINVAL;
+		goto ExitRoutine;
+	}
+
+	MALLOC(ring, struct aio_ring *, sizeof(*ring), M_TEMP, M_WAITOK | M_ZERO);
+	ring->ar_proc = p;
+	ring->ar_uaddr = uap->ring;
+	ring->ar_entries = entries;
+	ring->ar_signo = uap->signo;
+	ring->ar_refcount = 2;  /* the registration's and ours */
+	lck_mtx_init(&ring->ar_sq_mtx, aio_queue_lock_grp, aio_lock_attr);
+	lck_mtx_init(&ring->ar_mtx, aio_queue_lock_grp, aio_lock_attr);
+
+	/* get a reference to the user land map so we can post from the workers */
+	ring->ar_map = get_task_map( p->task );
+	vm_map_reference( ring->ar_map );
+
+	lck_mtx_lock(&aio_ring_mtx);
+	for (i = 0; i < AIO_RING_HASH_SIZE && error == 0; i++) {
+		TAILQ_FOREACH(other, &aio_ring_hash[i], ar_link) {
+			if (other->ar_proc != p) {
+				continue;
+			}
+			if (other->ar_uaddr == uap->ring) {
+				error = EBUSY;
+				break;
+			}
+			if (++count >= AIO_RING_MAX_PER_PROC) {
+				error = EAGAIN;
+				break;
+			}
+		}
+	}
+	if (error == 0) {
+		TAILQ_INSERT_TAIL(AIO_RING_HASH(p, uap->ring), ring, ar_link);
+		aio_ring_count++;
+	}
+	lck_mtx_unlock(&aio_ring_mtx);
+
+	if (error == 0) {
+		bzero(&hdr, sizeof(hdr));
+		hdr.ar_entries = entries;
+
+		error = copyout(&hdr, uap->ring, sizeof(hdr));
+		if (error != 0 && aio_ring_unlink(ring)) {
+			aio_ring_release(ring);
+		}
+	} else {
+		/* never registered */
+		aio_ring_release(ring);
+	}
+	aio_ring_release(ring);
+
+ExitRoutine:
+	KERNEL_DEBUG((BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_setup)) | DBG_FUNC_END,
+	    (int)p, (int)uap->ring, error, 0, 0 );
+
+	return error;
+} /* aio_ring_setup */
+
+
+/*
+ * aio_ring_enter - consume up to uap->to_submit submissions from the ring
+ * at uap->ring, then wait until uap->min_complete completions are ready
+ * to reap or nothing is left in flight.  Returns the number of
+ * submissions consumed; each gets exactly one completion.
+ *
+ * Reads of ranges the UBC holds, opens and invalid requests complete
+ * before we return.  Everything else goes to the aio worker threads like
+ * any other aio request, and completes to the ring from there.
+ */
+int
+aio_ring_enter(proc_t p, struct aio_ring_enter_args *uap, int *retval)
+{
+	struct aio_ring_header  hdr;
+	struct aio_ring_sqe     sqe;
+	struct aio_ring         *ring;
+	user_addr_t             sqes;
+	uint32_t                submitted = 0;
+	uint32_t                cq_head;
+	int                     error = 0;
+
+	ring = aio_ring_lookup(p, uap->ring);
+	if (ring == NULL) {
+		return EINVAL;
+	}
+
+	KERNEL_DEBUG((BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_enter)) | DBG_FUNC_START,
+	    (int)p, (int)uap->ring, uap->to_submit, uap->min_complete, 0 );
+
+	if ((uap->flags & ~AIO_RING_ENTER_DESTROY) != 0) {
+		error = EINVAL;
+		goto ExitRoutine;
+	}
+	if (uap->flags & AIO_RING_ENTER_DESTROY) {
+		aio_ring_destroy(ring);
+		goto ExitRoutine;
+	}
+
+	if (uap->to_submit != 0) {
+		sqes = ring->ar_uaddr + AIO_RING_SQES_OFFSET;
+
+		lck_mtx_lock(&ring->ar_sq_mtx);
+
+		error = copyin(ring->ar_uaddr, &hdr, sizeof(hdr));
+		if (error == 0 && hdr.ar_sq_tail - ring->ar_sq_head > ring->ar_entries) {
+			error = EINVAL;
+		}
+		while (error == 0 && submitted < uap->to_submit &&
+		    ring->ar_sq_head != hdr.ar_sq_tail) {
+			/*
+			 * reserve a completion for the request... if the
+			 * unreaped and in flight requests would fill the
+			 * completion array, leave the rest for later
+			 */
+			lck_mtx_lock_spin(&ring->ar_mtx);
+			if ((ring->ar_flags & AIO_RING_DEAD) ||
+			    (ring->ar_cq_tail - hdr.ar_cq_head) + ring->ar_inflight >= 2 * ring->ar_entries) {
+				lck_mtx_unlock(&ring->ar_mtx);
+				break;
+			}
+			ring->ar_inflight++;
+			lck_mtx_unlock(&ring->ar_mtx);
+
+			error = copyin(sqes + (ring->ar_sq_head & (ring->ar_entries - 1)) * sizeof(sqe),
+			    &sqe, sizeof(sqe));
+			if (error == 0) {
+				error = aio_ring_submit(ring, &sqe);
+			}
+			if (error != 0) {
+				/* not consumed, give the reservation back */
+				lck_mtx_lock_spin(&ring->ar_mtx);
+				ring->ar_inflight--;
+				if (ring->ar_waiters) {
+					wakeup(&ring->ar_cq_tail);
+				}
+				lck_mtx_unlock(&ring->ar_mtx);
+				break;
+			}
+			ring->ar_sq_head++;
+			submitted++;
+		}
+		if (submitted != 0) {
+			(void)copyout(&ring->ar_sq_head,
+			    ring->ar_uaddr + offsetof(struct aio_ring_header, ar_sq_head),
+			    sizeof(ring->ar_sq_head));
+			error = 0;
+		}
+
+		lck_mtx_unlock(&ring->ar_sq_mtx);
+	}
+
+	while (error == 0 && uap->min_complete != 0) {
+		error = copyin(ring->ar_uaddr + offsetof(struct aio_ring_header, ar_cq_head),
+		    &cq_head, sizeof(cq_head));
+		if (error != 0) {
+			break;
+		}
+
+		lck_mtx_lock(&ring->ar_mtx);
+		if (ring->ar_cq_tail - cq_head >= uap->min_complete ||
+		    ring->ar_inflight == 0 || (ring->ar_flags & AIO_RING_DEAD)) {
+			lck_mtx_unlock(&ring->ar_mtx);
+			break;
+		}
+		ring->ar_waiters++;
+		error = msleep(&ring->ar_cq_tail, &ring->ar_mtx, PRIBIO | PCATCH, "aio_ring_enter", 0);
+		ring->ar_waiters--;
+		lck_mtx_unlock(&ring->ar_mtx);
+	}
+	if (submitted != 0) {
+		/* the caller must learn what was consumed, interrupted or not */
+		error = 0;
+	}
+	*retval = submitted;
+
+ExitRoutine:
+	KERNEL_DEBUG((BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_enter)) | DBG_FUNC_END,
+	    (int)p, (int)uap->ring, error, submitted, 0 );
+
+	aio_ring_release(ring);
+
+	return error;
+} /* aio_ring_enter */
+
+
+/*
+ * aio_ring_lookup - find the ring the process registered at uaddr and
+ * return it with a reference, or NULL.
+ */
+static struct aio_ring *
+aio_ring_lookup(proc_t procp, user_addr_t uaddr)
+{
+	struct aio_ring *ring;
+
+	lck_mtx_lock_spin(&aio_ring_mtx);
+	TAILQ_FOREACH(ring, AIO_RING_HASH(procp, uaddr), ar_link) {
+		if (ring->ar_proc == procp && ring->ar_uaddr == uaddr) {
+			OSIncrementAtomic(&ring->ar_refcount);
+			break;
+		}
+	}
+	lck_mtx_unlock(&aio_ring_mtx);
+
+	return ring;
+}
+
+
+static void
+aio_ring_release(struct aio_ring *ring)
+{
+	if (OSDecrementAtomic(&ring->ar_refcount) != 1) {
+		return;
+	}
+	vm_map_deallocate(ring->ar_map);
+	lck_mtx_destroy(&ring->ar_sq_mtx, aio_queue_lock_grp);
+	lck_mtx_destroy(&ring->ar_mtx, aio_queue_lock_grp);
+	FREE(ring, M_TEMP);
+}
+
+
+/*
+ * aio_ring_unlink - take the ring off the hash so it can no longer be
+ * looked up.  Returns TRUE for the one caller that did, which owns
+ * the registration's reference.
+ */
+static boolean_t
+aio_ring_unlink(struct aio_ring *ring)
+{
+	boolean_t       unlinked = FALSE;
+
+	lck_mtx_lock_spin(&aio_ring_mtx);
+	if (ring->ar_link.tqe_prev != NULL) {
+		TAILQ_REMOVE(AIO_RING_HASH(ring->ar_proc, ring->ar_uaddr), ring, ar_link);
+		ring->ar_link.tqe_prev = NULL;
+		aio_ring_count--;
+		unlinked = TRUE;
+	}
+	lck_mtx_unlock(&aio_ring_mtx);
+
+	return unlinked;
+}
+
+
+/*
+ * aio_ring_destroy - unregister the ring for aio_ring_enter() with
+ * AIO_RING_ENTER_DESTROY.  Waits for the requests in flight to post
+ * their completions, so the caller may free the ring's memory as soon
+ * as we return.
+ */
+static void
+aio_ring_destroy(struct aio_ring *ring)
+{
+	if (!aio_ring_unlink(ring)) {
+		return;
+	}
+
+	/* no submitter can be part way through the ring after this */
+	lck_mtx_lock(&ring->ar_sq_mtx);
+	lck_mtx_lock(&ring->ar_mtx);
+	while (ring->ar_inflight != 0) {
+		ring->ar_waiters++;
+		msleep(&ring->ar_cq_tail, &ring->ar_mtx, PRIBIO, "aio_ring_destroy", 0);
+		ring->ar_waiters--;
+	}
+	ring->ar_flags |= AIO_RING_DEAD;
+	lck_mtx_unlock(&ring->ar_mtx);
+	lck_mtx_unlock(&ring->ar_sq_mtx);
+
+	aio_ring_release(ring);
+}
+
+
+/*
+ * aio_ring_exit - unregister all the rings of a process that is exiting
+ * or exec'ing.  Requests still in flight complete without posting, their
+ * rings' memory is going away.
+ */
+static void
+aio_ring_exit(proc_t procp)
+{
+	struct aio_ring *dead[AIO_RING_MAX_PER_PROC];
+	struct aio_ring *ring, *next;
+	int             ndead = 0;
+	int             i;
+
+	if (aio_ring_count == 0) {
+		return;
+	}
+
+	lck_mtx_lock(&aio_ring_mtx);
+	for (i = 0; i < AIO_RING_HASH_SIZE; i++) {
+		TAILQ_FOREACH_SAFE(ring, &aio_ring_hash[i], ar_link, next) {
+			if (ring->ar_proc == procp && ndead < AIO_RING_MAX_PER_PROC) {
+				TAILQ_REMOVE(&aio_ring_hash[i], ring, ar_link);
+				ring->ar_link.tqe_prev = NULL;
+				aio_ring_count--;
+				dead[ndead++] = ring;
+			}
+		}
+	}
+	lck_mtx_unlock(&aio_ring_mtx);
+
+	for (i = 0; i < ndead; i++) {
+		ring = dead[i];
+
+		lck_mtx_lock(&ring->ar_mtx);
+		ring->ar_flags |= AIO_RING_DEAD;
+		if (ring->ar_waiters) {
+			wakeup(&ring->ar_cq_tail);
+		}
+		lck_mtx_unlock(&ring->ar_mtx);
+
+		aio_ring_release(ring);
+	}
+}
+
+
+/*
+ * aio_ring_submit - start the request described by a submission entry.
+ * Returns 0 if the entry was consumed: it completed, or failed, and its
+ * completion has been posted, or it was queued to the workers.  Returns
+ * EAGAIN if we are out of aio resources and it should stay on the ring.
+ */
+static int
+aio_ring_submit(struct aio_ring *ring, struct aio_ring_sqe *sqe)
+{
+	proc_t          procp = ring->ar_proc;
+	user_ssize_t    res = 0;
+	int             error = 0;
+
+	if (sqe->sqe_flags != 0 || sqe->sqe_reserved != 0) {
+		error = EINVAL;
+		goto post;
+	}
+
+	switch (sqe->sqe_opcode) {
+	case AIO_RING_OP_NOP:
+		break;
+
+	case AIO_RING_OP_OPEN: {
+		struct openat_nocancel_args oargs = {
+			.fd = sqe->sqe_fd,
+			.path = (user_addr_t)sqe->sqe_addr,
+			.flags = (int)sqe->sqe_op_flags,
+			.mode = (int)sqe->sqe_len,
+		};
+		int32_t fd = -1;
+
+		/* the descriptor belongs to the caller, so open it here */
+		error = openat_nocancel(procp, &oargs, &fd);
+		res = fd;
+		break;
+	}
+
+	case AIO_RING_OP_READ:
+		if (aio_ring_read_cached(procp, sqe, &res, &error)) {
+			break;
+		}
+		return aio_ring_queue(ring, sqe, AIO_READ);
+
+	case AIO_RING_OP_WRITE:
+		return aio_ring_queue(ring, sqe, AIO_WRITE);
+
+	case AIO_RING_OP_FSYNC:
+		return aio_ring_queue(ring, sqe,
+		           (sqe->sqe_op_flags & O_DSYNC) ? AIO_DSYNC : AIO_FSYNC);
+
+	default:
+		error = EINVAL;
+		break;
+	}
+
+post:
+	aio_ring_post(ring, sqe->sqe_user_data, error ? -error : res, FALSE);
+	return 0;
+} /* aio_ring_submit */
+
+
+/*
+ * aio_ring_queue - queue a ring request to the aio worker threads.  The
+ * entry is accounted and cancelled like any other aio request, but it
+ * is never on the done queue: do_aio_completion() posts it to the ring
+ * and the last reference frees it.
+ */
+static int
+aio_ring_queue(struct aio_ring *ring, struct aio_ring_sqe *sqe, int kindOfIO)
+{
+	proc_t          procp = ring->ar_proc;
+	aio_workq_entry *entryp;
+	int             result;
+
+	if (aio_increment_total_count() >= aio_max_requests) {
+		aio_decrement_total_count();
+		return EAGAIN;
+	}
+
+	entryp = (aio_workq_entry *) zalloc( aio_workq_zonep );
+	if (entryp == NULL) {
+		aio_decrement_total_count();
+		return EAGAIN;
+	}
+	bzero( entryp, sizeof(*entryp));
+
+	entryp->procp = procp;
+	entryp->uaiocbp = USER_ADDR_NULL;
+	entryp->flags = kindOfIO | AIO_RING | AIO_DO_FREE;
+	entryp->aio_ring = ring;
+	entryp->aio_ring_data = sqe->sqe_user_data;
+	OSIncrementAtomic(&ring->ar_refcount);
+
+	entryp->aiocb.aio_fildes = sqe->sqe_fd;
+	entryp->aiocb.aio_offset = (off_t)sqe->sqe_offset;
+	entryp->aiocb.aio_buf = (user_addr_t)sqe->sqe_addr;
+	entryp->aiocb.aio_nbytes = sqe->sqe_len;
+
+	/* get a reference to the user land map in order to keep it around */
+	entryp->aio_map = get_task_map( procp->task );
+	vm_map_reference( entryp->aio_map );
+
+	result = aio_validate( entryp );
+	if (result == 0) {
+		/* get a reference on the current_thread, which is passed in vfs_context. */
+		entryp->thread = current_thread();
+		thread_reference( entryp->thread );
+
+		aio_proc_lock(procp);
+		if (aio_get_process_count( procp ) >= aio_max_requests_per_process) {
+			result = EAGAIN;
+		} else {
+			aio_enqueue_work(procp, entryp, 1);
+		}
+		aio_proc_unlock(procp);
+
+		if (result == 0) {
+			KERNEL_DEBUG((BSDDBG_CODE(DBG_BSD_AIO, AIO_work_queued)) | DBG_FUNC_NONE,
+			    (int)procp, (int)ring->ar_uaddr, entryp->flags, entryp->aiocb.aio_fildes, 0 );
+			return 0;
+		}
+	}
+
+	/* never queued, so no one else has seen it */
+	aio_free_request(entryp);
+	aio_decrement_total_count();
+
+	if (result == EAGAIN) {
+		return EAGAIN;
+	}
+	aio_ring_post(ring, sqe->sqe_user_data, -result, FALSE);
+
+	return 0;
+} /* aio_ring_queue */
+
+
+/*
+ * aio_ring_read_cached - do a ring read in the submitting thread when
+ * every page it covers is resident in the UBC of a file on a local file
+ * system, so that VNOP_READ() only has to copy them.  Returns TRUE with
+ * the result in *retval and *errorp if it did, or FALSE if the read may
+ * have to wait for I/O, in which case it goes to the workers.  Remote
+ * file systems revalidate their cache in VNOP_READ() and may block doing
+ * it, so their reads always go to the workers.  Small random reads of a
+ * warm local file never leave this thread.
+ */
+static boolean_t
+aio_ring_read_cached(proc_t procp, struct aio_ring_sqe *sqe, user_ssize_t *retval, int *errorp)
+{
+	struct fileproc *fp;
+	vnode_t         vp;
+	vfs_context_t   ctx = vfs_context_current();
+	uio_t           auio;
+	off_t           offset = (off_t)sqe->sqe_offset;
+	off_t           filesize, start, end;
+	int             range;
+	int             error = 0;
+	boolean_t       done = FALSE;
+	char            uio_buf[UIO_SIZEOF(1)];
+
+	if (sqe->sqe_len > INT_MAX || sqe->sqe_addr == 0 || offset < 0) {
+		/* aio_validate() reports these */
+		return FALSE;
+	}
+	if (fp_getfvp(procp, sqe->sqe_fd, &fp, &vp) != 0) {
+		return FALSE;
+	}
+	if ((fp->f_fglob->fg_flag & (FREAD | FNOCACHE | FENCRYPTED | FUNENCRYPTED)) != FREAD ||
+	    vnode_getwithref(vp) != 0) {
+		fp_drop(procp, sqe->sqe_fd, fp, 0);
+		return FALSE;
+	}
+
+	if (vnode_vtype(vp) == VREG && UBCINFOEXISTS(vp) &&
+	    (vfs_flags(vnode_mount(vp)) & MNT_LOCAL) &&
+	    !vnode_isnocache(vp) && !vnode_isswap(vp)) {
+		filesize = ubc_getsize(vp);
+
+		if (offset >= filesize || sqe->sqe_len == 0) {
+			/* nothing to wait for, VNOP_READ() reads nothing */
+			done = TRUE;
+		} else {
+			start = trunc_page_64(offset);
+			end = round_page_64(MIN(offset + (off_t)sqe->sqe_len, filesize));
+			done = (ubc_range_op(vp, start, end, UPL_ROP_PRESENT, &range) == KERN_SUCCESS &&
+			    (off_t)range >= end - start);
+		}
+	}
+	if (done) {
+		*retval = 0;
+#if CONFIG_MACF
+		error = mac_vnode_check_read(ctx, fp->f_fglob->fg_cred, vp);
+#endif
+		if (error == 0) {
+			auio = uio_createwithbuffer(1, offset,
+			    proc_is64bit(procp) ? UIO_USERSPACE64 : UIO_USERSPACE32,
+			    UIO_READ, &uio_buf[0], sizeof(uio_buf));
+			uio_addiov(auio, (user_addr_t)sqe->sqe_addr, (user_size_t)sqe->sqe_len);
+
+			error = VNOP_READ(vp, auio, 0, ctx);
+			*retval = (user_ssize_t)sqe->sqe_len - uio_resid(auio);
+		}
+	}
+	(void)vnode_put(vp);
+	fp_drop(procp, sqe->sqe_fd, fp, 0);
+
+	*errorp = error;
+	return done;
+} /* aio_ring_read_cached */
+
+
+/*
+ * aio_ring_post - post the completion of a ring request and release
+ * the completion it reserved.  Called from the submitting thread, or
+ * from do_aio_completion() on a worker, in which case we switch to the
+ * ring owner's map to reach the ring.  Nothing is written to a ring that
+ * has been unregistered, or for requests cancelled by exit or exec.
+ *
+ * The completion's slot is handed out under ar_mtx, but the copyouts,
+ * which may fault, are done without it.  Tails are published in slot
+ * order: a completion waits for the ones before it to be posted first.
+ */
+static void
+aio_ring_post(struct aio_ring *ring, uint64_t user_data, int64_t res, boolean_t disabled)
+{
+	struct aio_ring_cqe     cqe;
+	vm_map_t                currentmap = VM_MAP_NULL;
+	vm_map_t                oldmap = VM_MAP_NULL;
+	user_addr_t             cqes;
+	uint32_t                slot = 0, tail;
+	int                     signo = 0;
+	int                     error = 0;
+
+	cqe.cqe_user_data = user_data;
+	cqe.cqe_res = res;
+	cqes = ring->ar_uaddr + AIO_RING_CQES_OFFSET(ring->ar_entries);
+
+	lck_mtx_lock_spin(&ring->ar_mtx);
+	if (ring->ar_flags & AIO_RING_DEAD) {
+		disabled = TRUE;
+	}
+	if (!disabled) {
+		slot = ring->ar_cq_next++;
+	}
+	lck_mtx_unlock(&ring->ar_mtx);
+
+	if (!disabled) {
+		currentmap = get_task_map((current_proc())->task );
+		if (currentmap != ring->ar_map) {
+			oldmap = vm_map_switch( ring->ar_map );
+		}
+
+		error = copyout(&cqe, cqes + (slot & (2 * ring->ar_entries - 1)) * sizeof(cqe),
+		    sizeof(cqe));
+
+		lck_mtx_lock(&ring->ar_mtx);
+		while (ring->ar_cq_tail != slot && (ring->ar_flags & AIO_RING_DEAD) == 0) {
+			ring->ar_waiters++;
+			msleep(&ring->ar_cq_tail, &ring->ar_mtx, PRIBIO, "aio_ring_post", 0);
+			ring->ar_waiters--;
+		}
+		if (error != 0) {
+			/* the ring's memory is gone, later completions can't follow this one */
+			ring->ar_flags |= AIO_RING_DEAD;
+		}
+		if (ring->ar_flags & AIO_RING_DEAD) {
+			disabled = TRUE;
+		}
+		lck_mtx_unlock(&ring->ar_mtx);
+
+		if (!disabled) {
+			/* the entry must be visible before the tail that publishes it */
+			OSMemoryBarrier();
+			tail = slot + 1;
+			error = copyout(&tail,
+			    ring->ar_uaddr + offsetof(struct aio_ring_header, ar_cq_tail),
+			    sizeof(tail));
+			signo = ring->ar_signo;
+		}
+
+		if (currentmap != ring->ar_map) {
+			(void) vm_map_switch( oldmap );
+		}
+	}
+
+	lck_mtx_lock_spin(&ring->ar_mtx);
+	if (!disabled) {
+		ring->ar_cq_tail = slot + 1;
+	}
+	ring->ar_inflight--;
+	if (ring->ar_waiters) {
+		wakeup(&ring->ar_cq_tail);
+	}
+	lck_mtx_unlock(&ring->ar_mtx);
+
+	if (signo != 0) {
+		psignal(ring->ar_proc, signo);
+	}
+
+	KERNEL_DEBUG((BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_post)) | DBG_FUNC_NONE,
+	    (int)ring->ar_proc, (int)ring->ar_uaddr, (int)res, error, 0 );
+} /* aio_ring_post */
+
+
 /*
  * aio initialization
  */
@@ -2598,6 +3332,10 @@ aio_init( void )
 
 	lck_mtx_init(&aio_entry_mtx, aio_entry_lock_grp, aio_lock_attr);
 	lck_mtx_init(&aio_proc_mtx, aio_proc_lock_grp, aio_lock_attr);
+	lck_mtx_init(&aio_ring_mtx, aio_queue_lock_grp, aio_lock_attr);
+	for (i = 0; i < AIO_RING_HASH_SIZE; i++) {
+		TAILQ_INIT(&aio_ring_hash[i]);
+	}
 
 	aio_anchor.aio_inflight_count = 0;
 	aio_anchor.aio_done_count = 0;
@@ -4790,6 +4790,66 @@ SYSCTL_PROC(_kern, OID_AUTO, test_mtx_contended, CTLTYPE_STRING | CTLFLAG_MASKED
 SYSCTL_PROC(_kern, OID_AUTO, test_mtx_uncontended, CTLTYPE_STRING | CTLFLAG_MASKED | CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
     0, 0, sysctl_test_mtx_uncontended, "A", "get statistics for uncontended mtx test");
 
+static int
+sysctl_test_rw_hold_exclusive SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	int error, hold_ms = 0, max_pri;
+
+	if (!req->newptr || req->newlen != sizeof(hold_ms)) {
+		return EINVAL;
+	}
+
+	error = SYSCTL_IN(req, &hold_ms, sizeof(hold_ms));
+	if (error) {
+		return error;
+	}
+	if (hold_ms < 0 || hold_ms > 60 * 1000) {
+		return EINVAL;
+	}
+
+	lck_mtx_test_init();
+
+	max_pri = lck_rw_test_hold_exclusive(hold_ms);
+
+	return SYSCTL_OUT(req, &max_pri, sizeof(max_pri));
+}
+
+static int
+sysctl_test_rw_shared_max_wait SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	int error, iter = 0;
+	uint64_t max_wait;
+
+	if (!req->newptr || req->newlen != sizeof(iter)) {
+		return EINVAL;
+	}
+
+	error = SYSCTL_IN(req, &iter, sizeof(iter));
+	if (error) {
+		return error;
+	}
+	if (iter <= 0) {
+		return EINVAL;
+	}
+
+	lck_mtx_test_init();
+
+	max_wait = lck_rw_test_shared_max_wait(iter);
+
+	return SYSCTL_OUT(req, &max_wait, sizeof(max_wait));
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, test_rw_hold_exclusive, CTLTYPE_INT | CTLFLAG_MASKED | CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    0, 0, sysctl_test_rw_hold_exclusive, "I", "hold the test rw lock exclusive for N ms, returns max priority seen");
+
+SYSCTL_PROC(_kern, OID_AUTO, test_rw_shared_max_wait, CTLTYPE_QUAD | CTLFLAG_MASKED | CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    0, 0, sysctl_test_rw_shared_max_wait, "Q", "take the test rw lock shared N times, returns max wait in ns");
+
+SYSCTL_QUAD(_kern, OID_AUTO, test_rw_readers_starved, CTLFLAG_MASKED | CTLFLAG_RD | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    &lck_rw_readers_starved, "number of rw lock readers that stopped deferring to writers");
+
 extern uint64_t MutexSpin;
 
 SYSCTL_QUAD(_kern, OID_AUTO, mutex_spin_us, CTLFLAG_RW, &MutexSpin,
@@ -4874,6 +4934,44 @@ SYSCTL_PROC(_kern, OID_AUTO, test_panic_with_thread, CTLFLAG_MASKED | CTLFLAG_KE
 
 #endif /* DEVELOPMENT || DEBUG */
 
+static int
+sysctl_lck_mtx_contention SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	char *buffer;
+	int size, buffer_size, error;
+
+	for (;;) {
+		buffer_size = lck_mtx_prof_string_size();
+		buffer = kalloc(buffer_size);
+		if (!buffer) {
+			return ENOMEM;
+		}
+
+		size = lck_mtx_prof_string(buffer, buffer_size);
+		if (size >= 0) {
+			break;
+		}
+		/* lock groups were added meanwhile, size the buffer again */
+		kfree(buffer, buffer_size);
+	}
+
+	error = sysctl_io_string(req, buffer, size, 0, NULL);
+
+	kfree(buffer, buffer_size);
+
+	return error;
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, lck_mtx_contention, CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    0, 0, sysctl_lck_mtx_contention, "A", "sampled mutex contention profile per lock group");
+
+SYSCTL_UINT(_kern, OID_AUTO, lck_mtx_prof_sample_rate, CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    &lck_mtx_prof_sample_rate, 0, "profile 1 in N contended mutex acquisitions (0 disables)");
+
+SYSCTL_UINT(_kern, OID_AUTO, lck_mtx_adaptive_spin_tuning, CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    &lck_mtx_adaptive_spin_tuning, 0, "tune mutex spin duration per lock group from contention samples");
+
 static int
 sysctl_get_owned_vmobjects SYSCTL_HANDLER_ARGS
 {
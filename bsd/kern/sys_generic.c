@@ -110,6 +110,7 @@
 #include <kern/waitq.h>
 #include <kern/sched_prim.h>
 #include <kern/mpsc_queue.h>
+#include <kern/mpmc_queue.h>
 
 #include <sys/mbuf.h>
 #include <sys/domain.h>
@@ -3927,6 +3928,30 @@ sysctl_mpsc_test_pingpong SYSCTL_HANDLER_ARGS
 SYSCTL_PROC(_kern, OID_AUTO, mpsc_test_pingpong, CTLTYPE_QUAD | CTLFLAG_RW | CTLFLAG_LOCKED,
     0, 0, sysctl_mpsc_test_pingpong, "Q", "MPSC tests: pingpong");
 
+static int
+sysctl_mpmc_test SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	uint64_t value = 0;
+	int error;
+
+	error = SYSCTL_IN(req, &value, sizeof(value));
+	if (error) {
+		return error;
+	}
+
+	if (error == 0 && req->newptr) {
+		error = mpmc_test_ring(value, &value);
+		if (error == 0) {
+			error = SYSCTL_OUT(req, &value, sizeof(value));
+		}
+	}
+
+	return error;
+}
+SYSCTL_PROC(_kern, OID_AUTO, mpmc_test_ring, CTLTYPE_QUAD | CTLFLAG_RW | CTLFLAG_LOCKED,
+    0, 0, sysctl_mpmc_test, "Q", "MPMC tests: ring");
+
 #endif /* DEVELOPMENT || DEBUG */
 
 /*Remote Time api*/
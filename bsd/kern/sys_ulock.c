@@ -39,6 +39,7 @@
 #include <sys/malloc.h>
 #include <sys/sysproto.h>
 #include <sys/pthread_shims.h>
+#include <sys/mcache.h>
 
 #include <mach/mach_types.h>
 
@@ -59,6 +60,8 @@
 #include <kern/zalloc.h>
 #include <kern/debug.h>
 
+#include <machine/machine_routines.h>
+
 #include <pexpert/pexpert.h>
 
 #define XNU_TEST_BITMAP
@@ -199,10 +202,18 @@ ull_dump(ull_t *ull)
 }
 #endif
 
+/*
+ * Buckets are padded to a cache line so that waiters on unrelated ulocks
+ * hashing to neighbouring buckets don't bounce each other's lock.
+ */
 typedef struct ull_bucket {
 	queue_head_t ulb_head;
 	lck_spin_t   ulb_lock;
-} ull_bucket_t;
+} __attribute__((aligned(MAX_CPU_CACHE_LINE_SIZE))) ull_bucket_t;
+
+/* minimum number of hash buckets per CPU, up to ULL_BUCKETS_CPU_MAX in all */
+#define ULL_BUCKETS_PER_CPU     64
+#define ULL_BUCKETS_CPU_MAX     8192
 
 static int ull_hash_buckets;
 static ull_bucket_t *ull_bucket;
@@ -235,11 +246,28 @@ ulock_initialize(void)
 	 */
 	ull_hash_buckets = (1 << (bit_ceiling(thread_max) - 2));
 
-	kprintf("%s>thread_max=%d, ull_hash_buckets=%d\n", __FUNCTION__, thread_max, ull_hash_buckets);
+	/*
+	 * Make sure there are enough buckets for all CPUs to be waiting
+	 * on different ulocks without colliding, within reason.
+	 */
+	unsigned int ncpus = ml_get_max_cpus();
+	int cpu_buckets = (int)MIN(ncpus * ULL_BUCKETS_PER_CPU, ULL_BUCKETS_CPU_MAX);
+	if (ull_hash_buckets < cpu_buckets) {
+		ull_hash_buckets = (1 << bit_ceiling(cpu_buckets));
+	}
+
+	kprintf("%s>thread_max=%d, ncpus=%d, ull_hash_buckets=%d\n", __FUNCTION__,
+	    thread_max, ncpus, ull_hash_buckets);
 	assert(ull_hash_buckets >= thread_max / 4);
 
-	ull_bucket = (ull_bucket_t *)kalloc(sizeof(ull_bucket_t) * ull_hash_buckets);
-	assert(ull_bucket != NULL);
+	/*
+	 * kalloc() doesn't guarantee cache line alignment, so align by hand.
+	 * The table lives as long as the kernel, so the base isn't kept.
+	 */
+	vm_offset_t base = (vm_offset_t)kalloc(sizeof(ull_bucket_t) *
+	    (vm_size_t)ull_hash_buckets + MAX_CPU_CACHE_LINE_SIZE);
+	assert(base != 0);
+	ull_bucket = (ull_bucket_t *)roundup(base, MAX_CPU_CACHE_LINE_SIZE);
 
 	for (int i = 0; i < ull_hash_buckets; i++) {
 		queue_init(&ull_bucket[i].ulb_head);
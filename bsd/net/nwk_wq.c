@@ -28,8 +28,10 @@
 #include <stddef.h>
 #include <kern/debug.h>
 #include <kern/locks.h>
+#include <kern/mpmc_queue.h>
 #include <kern/thread.h>
 #include <kern/thread_call.h>
+#include <machine/machine_routines.h>
 #include <net/nwk_wq.h>
 #include <sys/proc_internal.h>
 #include <sys/systm.h>
@@ -37,8 +39,33 @@
 
 MALLOC_DEFINE(M_NWKWQ, "nwkwq", "Network work-queue");
 
+/*
+ * nwk_wq_enqueue() items are run one at a time, in order, by a single
+ * thread: producers rely on events being handled in the order they were
+ * posted.
+ *
+ * nwk_wq_enqueue_concurrent() items are handed to a small pool of worker
+ * threads through a lock-free MPMC ring, and may run concurrently and
+ * complete out of order. When the ring is full, items spill over to
+ * nwk_wq_pool_head, which is protected by nwk_wq_pool_lock. The ring and
+ * the workers are only set up by the first such item, so that systems
+ * that never use the pool don't pay for it.
+ *
+ * nwk_wq_pool_lock also serializes pool workers going to sleep against
+ * enqueuers waking them up: a worker publishes itself in nwk_wq_pool_idle
+ * before checking for work one last time, and enqueuers only take the lock
+ * to wake a worker up if they see an idle one.
+ */
+#define NWK_WQ_RING_SIZE        1024
+#define NWK_WQ_MAX_THREADS      4
+
 static TAILQ_HEAD(, nwk_wq_entry) nwk_wq_head;
-decl_lck_mtx_data(static, nwk_wq_lock);
+
+static struct mpmc_ring nwk_wq_ring;
+static TAILQ_HEAD(, nwk_wq_entry) nwk_wq_pool_head;
+static uint32_t _Atomic nwk_wq_overflow_count;
+static uint32_t _Atomic nwk_wq_pool_idle;
+static bool _Atomic nwk_wq_pool_started;
 
 /* Lock group and attributes */
 static lck_grp_attr_t *nwk_wq_lock_grp_attributes = NULL;
@@ -47,13 +74,16 @@ static lck_grp_t *nwk_wq_lock_group = NULL;
 /* Lock and lock attributes */
 static lck_attr_t *nwk_wq_lock_attributes = NULL;
 decl_lck_mtx_data(static, nwk_wq_lock);
+decl_lck_mtx_data(static, nwk_wq_pool_lock);
 
-/* Wait channel for Network work queue */
+/* Wait channels for Network work queue */
 static void *nwk_wq_waitch = NULL;
-static void nwk_wq_thread_func(void *, wait_result_t);
+static void *nwk_wq_pool_waitch = NULL;
 
 static int nwk_wq_thread_cont(int err);
 static void nwk_wq_thread_func(void *v, wait_result_t w);
+static int nwk_wq_pool_thread_cont(int err);
+static void nwk_wq_pool_thread_func(void *v, wait_result_t w);
 
 void
 nwk_wq_init(void)
@@ -61,12 +91,14 @@ nwk_wq_init(void)
 	thread_t nwk_wq_thread = THREAD_NULL;
 
 	TAILQ_INIT(&nwk_wq_head);
+	TAILQ_INIT(&nwk_wq_pool_head);
 	nwk_wq_lock_grp_attributes = lck_grp_attr_alloc_init();
 	nwk_wq_lock_group = lck_grp_alloc_init("Network work queue lock",
 	    nwk_wq_lock_grp_attributes);
 
 	nwk_wq_lock_attributes = lck_attr_alloc_init();
 	lck_mtx_init(&nwk_wq_lock, nwk_wq_lock_group, nwk_wq_lock_attributes);
+	lck_mtx_init(&nwk_wq_pool_lock, nwk_wq_lock_group, nwk_wq_lock_attributes);
 	if (kernel_thread_start(nwk_wq_thread_func,
 	    NULL, &nwk_wq_thread) != KERN_SUCCESS) {
 		panic_plain("%s: couldn't create network work queue thread", __func__);
@@ -75,6 +107,49 @@ nwk_wq_init(void)
 	thread_deallocate(nwk_wq_thread);
 }
 
+/*
+ * Set up the ring and the workers of the pool, the first time an item
+ * is enqueued for it.
+ */
+static void
+nwk_wq_pool_start(void)
+{
+	thread_t nwk_wq_thread = THREAD_NULL;
+	unsigned int nthreads;
+
+	lck_mtx_lock(&nwk_wq_pool_lock);
+	if (os_atomic_load(&nwk_wq_pool_started, relaxed)) {
+		lck_mtx_unlock(&nwk_wq_pool_lock);
+		return;
+	}
+	if (mpmc_ring_init(&nwk_wq_ring, NWK_WQ_RING_SIZE) != KERN_SUCCESS) {
+		panic_plain("%s: couldn't allocate network work queue ring", __func__);
+		/* NOTREACHED */
+	}
+
+	nthreads = MIN(ml_get_max_cpus(), NWK_WQ_MAX_THREADS);
+	for (unsigned int i = 0; i < nthreads; i++) {
+		if (kernel_thread_start(nwk_wq_pool_thread_func,
+		    NULL, &nwk_wq_thread) != KERN_SUCCESS) {
+			panic_plain("%s: couldn't create network work queue thread", __func__);
+			/* NOTREACHED */
+		}
+		thread_deallocate(nwk_wq_thread);
+	}
+	os_atomic_store(&nwk_wq_pool_started, true, release);
+	lck_mtx_unlock(&nwk_wq_pool_lock);
+}
+
+static void
+nwk_wq_run(struct nwk_wq_entry *nwk_item)
+{
+	nwk_item->func(nwk_item->arg);
+	if (nwk_item->is_arg_managed == FALSE) {
+		FREE(nwk_item->arg, M_NWKWQ);
+	}
+	FREE(nwk_item, M_NWKWQ);
+}
+
 static int
 nwk_wq_thread_cont(int err)
 {
@@ -102,11 +177,7 @@ nwk_wq_thread_cont(int err)
 
 		VERIFY(TAILQ_FIRST(&temp_nwk_wq_head) != NULL);
 		TAILQ_FOREACH_SAFE(nwk_item, &temp_nwk_wq_head, nwk_wq_link, nwk_item_next) {
-			nwk_item->func(nwk_item->arg);
-			if (nwk_item->is_arg_managed == FALSE) {
-				FREE(nwk_item->arg, M_NWKWQ);
-			}
-			FREE(nwk_item, M_NWKWQ);
+			nwk_wq_run(nwk_item);
 		}
 		lck_mtx_lock(&nwk_wq_lock);
 	}
@@ -128,6 +199,77 @@ nwk_wq_thread_func(void *v, wait_result_t w)
 	VERIFY(0);
 }
 
+static struct nwk_wq_entry *
+nwk_wq_pool_dequeue(void)
+{
+	struct nwk_wq_entry *nwk_item;
+
+	nwk_item = mpmc_ring_dequeue(&nwk_wq_ring);
+	if (nwk_item != NULL ||
+	    os_atomic_load(&nwk_wq_overflow_count, relaxed) == 0) {
+		return nwk_item;
+	}
+
+	lck_mtx_lock(&nwk_wq_pool_lock);
+	nwk_item = TAILQ_FIRST(&nwk_wq_pool_head);
+	if (nwk_item != NULL) {
+		TAILQ_REMOVE(&nwk_wq_pool_head, nwk_item, nwk_wq_link);
+		os_atomic_dec(&nwk_wq_overflow_count, relaxed);
+	}
+	lck_mtx_unlock(&nwk_wq_pool_lock);
+	return nwk_item;
+}
+
+static bool
+nwk_wq_pool_pending(void)
+{
+	return !mpmc_ring_empty(&nwk_wq_ring) ||
+	       os_atomic_load(&nwk_wq_overflow_count, relaxed) != 0;
+}
+
+static int
+nwk_wq_pool_thread_cont(int err)
+{
+	struct nwk_wq_entry *nwk_item;
+
+#pragma unused(err)
+	for (;;) {
+		LCK_MTX_ASSERT(&nwk_wq_pool_lock, LCK_MTX_ASSERT_OWNED);
+		os_atomic_dec(&nwk_wq_pool_idle, relaxed);
+		lck_mtx_unlock(&nwk_wq_pool_lock);
+
+		while ((nwk_item = nwk_wq_pool_dequeue()) != NULL) {
+			nwk_wq_run(nwk_item);
+		}
+
+		lck_mtx_lock(&nwk_wq_pool_lock);
+		/* pairs with the fence in nwk_wq_enqueue_concurrent() */
+		os_atomic_inc(&nwk_wq_pool_idle, seq_cst);
+		if (!nwk_wq_pool_pending()) {
+			(void) msleep0(&nwk_wq_pool_waitch, &nwk_wq_pool_lock,
+			    (PZERO - 1), "nwk_wq_pool_thread_cont", 0,
+			    nwk_wq_pool_thread_cont);
+			/* NOTREACHED */
+		}
+	}
+}
+
+__dead2
+static void
+nwk_wq_pool_thread_func(void *v, wait_result_t w)
+{
+#pragma unused(v, w)
+	lck_mtx_lock(&nwk_wq_pool_lock);
+	os_atomic_inc(&nwk_wq_pool_idle, relaxed);
+	(void) nwk_wq_pool_thread_cont(0);
+	/*
+	 * nwk_wq_pool_thread_cont() only ever blocks with a continuation;
+	 * therefore assert in this case.
+	 */
+	lck_mtx_unlock(&nwk_wq_pool_lock);
+	VERIFY(0);
+}
+
 void
 nwk_wq_enqueue(struct nwk_wq_entry *nwk_item)
 {
@@ -136,3 +278,26 @@ nwk_wq_enqueue(struct nwk_wq_entry *nwk_item)
 	lck_mtx_unlock(&nwk_wq_lock);
 	wakeup((caddr_t)&nwk_wq_waitch);
 }
+
+void
+nwk_wq_enqueue_concurrent(struct nwk_wq_entry *nwk_item)
+{
+	if (!os_atomic_load(&nwk_wq_pool_started, acquire)) {
+		nwk_wq_pool_start();
+	}
+
+	if (!mpmc_ring_enqueue(&nwk_wq_ring, nwk_item)) {
+		lck_mtx_lock(&nwk_wq_pool_lock);
+		TAILQ_INSERT_TAIL(&nwk_wq_pool_head, nwk_item, nwk_wq_link);
+		os_atomic_inc(&nwk_wq_overflow_count, relaxed);
+		lck_mtx_unlock(&nwk_wq_pool_lock);
+	}
+
+	/* pairs with the increment of nwk_wq_pool_idle in nwk_wq_pool_thread_cont() */
+	os_atomic_thread_fence(seq_cst);
+	if (os_atomic_load(&nwk_wq_pool_idle, relaxed) != 0) {
+		lck_mtx_lock(&nwk_wq_pool_lock);
+		wakeup_one((caddr_t)&nwk_wq_pool_waitch);
+		lck_mtx_unlock(&nwk_wq_pool_lock);
+	}
+}
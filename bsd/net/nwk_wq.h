@@ -31,6 +31,12 @@
 #include <kern/kern_types.h>
 
 #ifdef BSD_KERNEL_PRIVATE
+/*
+ * nwk_wq_enqueue() runs work items one at a time, in the order they were
+ * enqueued.  Items that don't depend on each other's ordering can use
+ * nwk_wq_enqueue_concurrent() instead, which runs them on a pool of
+ * threads: such items may run concurrently and complete out of order.
+ */
 struct nwk_wq_entry {
 	void (* func) (void *);
 	void *arg;
@@ -40,5 +46,6 @@ struct nwk_wq_entry {
 
 void nwk_wq_init(void);
 void nwk_wq_enqueue(struct nwk_wq_entry *nwk_item);
+void nwk_wq_enqueue_concurrent(struct nwk_wq_entry *nwk_item);
 #endif /* BSD_KERNEL_PRIVATE */
 #endif /* NWK_WQ_H */
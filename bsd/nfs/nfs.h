@@ -100,6 +100,8 @@ extern int nfs_ticks;
 #define NFS_READDIRSIZE 32768           /* Def. readdir size */
 #define NFS_DEFRAHEAD   16              /* Def. read ahead # blocks */
 #define NFS_MAXRAHEAD   128             /* Max. read ahead # blocks */
+#define NFS_MAXRWINDOW  1024            /* Max. adaptive read window # blocks */
+#define NFS_MAXNCONNECT 16              /* Max. TCP connections per mount */
 #define NFS_DEFMAXASYNCWRITES   128     /* Def. max # concurrent async write RPCs */
 #define NFS_DEFASYNCTHREAD      16      /* Def. # nfsiod threads */
 #define NFS_MAXASYNCTHREAD      64      /* max # nfsiod threads */
@@ -702,6 +704,8 @@ extern int nfsrv_fmod_pending, nfsrv_fsevents_enabled;
 
 extern int nfsrv_async, nfsrv_export_hash_size,
     nfsrv_reqcache_size, nfsrv_sock_max_rec_queue_length;
+extern int nfsrv_reqcache_max, nfsrv_reqcache_count;
+extern uint32_t nfsrv_reqcache_keep;
 extern uint32_t nfsrv_gss_context_ttl;
 extern struct nfsstats nfsstats;
 #define NFS_UC_Q_DEBUG
@@ -939,6 +943,7 @@ struct nfsreq {
 	time_t                  r_start;        /* request start time */
 	time_t                  r_lastmsg;      /* time of last tprintf */
 	time_t                  r_resendtime;   /* time of next jukebox error resend */
+	uint64_t                r_senttime;     /* uptime (usec) of first transmit */
 	struct nfs_gss_clnt_ctx *r_gss_ctx;     /* RPCSEC_GSS context */
 	SLIST_HEAD(, gss_seq)   r_gss_seqlist;  /* RPCSEC_GSS sequence numbers */
 	uint32_t                r_gss_argoff;   /* RPCSEC_GSS offset to args */
@@ -1000,6 +1005,7 @@ extern int nfs_tprintf_initial_delay, nfs_tprintf_delay;
 extern int nfsiod_thread_count, nfsiod_thread_max, nfs_max_async_writes;
 extern int nfs_idmap_ctrl, nfs_callback_port;
 extern int nfs_is_mobile, nfs_readlink_nocache, nfs_root_steals_ctx;
+extern int nfs_nconnect, nfs_read_window_max;
 extern uint32_t nfs_squishy_flags;
 extern uint32_t nfs_debug_ctl;
 
@@ -1747,6 +1747,7 @@ nfs_buf_read_rpc_finish(struct nfsreq *req)
 	struct nfsreq_cbinfo cb;
 	struct nfsbuf *bp;
 	int error = 0, nfsvers, offset, length, eof = 0, multasyncrpc, finished;
+	uint64_t senttime;
 	void *wakeme = NULL;
 	struct nfsreq *rreq = NULL;
 	nfsnode_t np;
@@ -1763,6 +1764,7 @@ finish:
 		kauth_cred_ref(cred);
 	}
 	cb = req->r_callback;
+	senttime = req->r_senttime;
 	bp = cb.rcb_bp;
 	if (cb.rcb_func) { /* take an extra reference on the nfsreq in case we want to resend it later due to grace error */
 		nfs_request_ref(req, 0);
@@ -1852,6 +1854,7 @@ finish:
 		bp->nb_error = error;
 		goto out;
 	}
+	nfs_buf_read_sample(nmp, senttime, rlen);
 
 	if ((rlen > 0) && (bp->nb_endio < (offset + (int)rlen))) {
 		bp->nb_endio = offset + rlen;
@@ -1949,6 +1952,79 @@ out:
 	}
 }
 
+/*
+ * Adaptive read-ahead window.
+ *
+ * Sequential reads keep enough READs in flight to cover twice the
+ * bandwidth-delay product of the path to the server.  Both halves come
+ * from READ completions: the lowest RTT seen on the connection (so that
+ * queueing behind our own READs doesn't inflate it) and the smoothed
+ * rate at which replies arrive.  The window never drops below the
+ * mount's readahead setting and is capped by the read_window_max
+ * sysctl; setting that to zero turns the adaptation off.
+ */
+#define NFS_RDSAMPLE_MIN        10000           /* min. bandwidth sample period (usec) */
+#define NFS_RDSAMPLE_IDLE       1000000         /* longer gaps start a new sample (usec) */
+
+int nfs_read_window_max = NFS_MAXRWINDOW;
+
+/*
+ * Return the number of blocks to read ahead of a sequential reader.
+ */
+uint32_t
+nfs_read_window(struct nfsmount *nmp)
+{
+	uint32_t window = nmp->nm_readahead;
+
+	if ((window > 0) && (nfs_read_window_max > 0) && (nmp->nm_rd_window > window)) {
+		window = MAX(window, MIN(nmp->nm_rd_window, (uint32_t)MIN(nfs_read_window_max, NFS_MAXRWINDOW)));
+	}
+	return window;
+}
+
+/*
+ * Feed a completed READ of len bytes, first sent at sent, into the
+ * mount's RTT and bandwidth estimates.
+ */
+void
+nfs_buf_read_sample(struct nfsmount *nmp, uint64_t sent, size_t len)
+{
+	struct timeval now;
+	uint64_t usec, rtt, elapsed, bw, bdp;
+
+	if (!sent || (nfs_read_window_max <= 0)) {
+		return;
+	}
+	microuptime(&now);
+	usec = (uint64_t)now.tv_sec * USEC_PER_SEC + now.tv_usec;
+	rtt = (usec > sent) ? (usec - sent) : 1;
+
+	lck_mtx_lock(&nmp->nm_lock);
+	if (!nmp->nm_rd_minrtt || (rtt < nmp->nm_rd_minrtt)) {
+		nmp->nm_rd_minrtt = rtt;
+	}
+	elapsed = usec - nmp->nm_rd_stamp;
+	if (!nmp->nm_rd_stamp || (elapsed > NFS_RDSAMPLE_IDLE)) {
+		/* reader was idle, start a new bandwidth sample here */
+		nmp->nm_rd_stamp = usec;
+		nmp->nm_rd_bytes = 0;
+		lck_mtx_unlock(&nmp->nm_lock);
+		return;
+	}
+	nmp->nm_rd_bytes += len;
+	if (elapsed >= MAX(nmp->nm_rd_minrtt, NFS_RDSAMPLE_MIN)) {
+		bw = nmp->nm_rd_bytes * USEC_PER_SEC / elapsed;
+		nmp->nm_rd_bw = nmp->nm_rd_bw ? ((3 * nmp->nm_rd_bw) + bw) / 4 : bw;
+		nmp->nm_rd_stamp = usec;
+		nmp->nm_rd_bytes = 0;
+		bdp = 2 * nmp->nm_rd_bw * nmp->nm_rd_minrtt / USEC_PER_SEC;
+		nmp->nm_rd_window = (uint32_t)MIN(howmany(bdp, nmp->nm_biosize), NFS_MAXRWINDOW);
+		NFS_BIO_DBG("read window %u: bw %llu B/s minrtt %llu us\n", nmp->nm_rd_window,
+		    nmp->nm_rd_bw, nmp->nm_rd_minrtt);
+	}
+	lck_mtx_unlock(&nmp->nm_lock);
+}
+
 /*
  * Do buffer readahead.
  * Initiate async I/O to read buffers not in cache.
@@ -1959,7 +2035,7 @@ nfs_buf_readahead(nfsnode_t np, int ioflag, daddr64_t *rabnp, daddr64_t lastrabn
 	struct nfsmount *nmp = NFSTONMP(np);
 	struct nfsbuf *bp;
 	int error = 0;
-	uint32_t nra;
+	uint32_t nra, window;
 
 	if (nfs_mount_gone(nmp)) {
 		return ENXIO;
@@ -1971,7 +2047,8 @@ nfs_buf_readahead(nfsnode_t np, int ioflag, daddr64_t *rabnp, daddr64_t lastrabn
 		return 0;
 	}
 
-	for (nra = 0; (nra < nmp->nm_readahead) && (*rabnp <= lastrabn); nra++, *rabnp = *rabnp + 1) {
+	window = nfs_read_window(nmp);
+	for (nra = 0; (nra < window) && (*rabnp <= lastrabn); nra++, *rabnp = *rabnp + 1) {
 		/* check if block exists and is valid. */
 		if ((*rabnp * nmp->nm_biosize) >= (off_t)np->n_size) {
 			/* stop reading ahead if we're beyond EOF */
@@ -2027,6 +2104,7 @@ nfs_bioread(nfsnode_t np, uio_t uio, int ioflag, vfs_context_t ctx)
 	off_t diff;
 	int error = 0, n = 0, on = 0;
 	int nfsvers, biosize, modified, readaheads = 0;
+	uint32_t window;
 	thread_t thd;
 	kauth_cred_t cred;
 	int64_t io_resid;
@@ -2035,6 +2113,7 @@ nfs_bioread(nfsnode_t np, uio_t uio, int ioflag, vfs_context_t ctx)
 
 	nfsvers = nmp->nm_vers;
 	biosize = nmp->nm_biosize;
+	window = nfs_read_window(nmp);
 	thd = vfs_context_thread(ctx);
 	cred = vfs_context_ucred(ctx);
 
@@ -2115,7 +2194,7 @@ nfs_bioread(nfsnode_t np, uio_t uio, int ioflag, vfs_context_t ctx)
 		nfs_node_lock_force(np);
 		if (!(ioflag & IO_NOCACHE) &&
 		    (!rabn || (rabn == np->n_lastread) || (rabn == (np->n_lastread + 1)))) {
-			maxrabn += nmp->nm_readahead;
+			maxrabn += window;
 			if ((maxrabn * biosize) >= (off_t)np->n_size) {
 				maxrabn = ((off_t)np->n_size - 1) / biosize;
 			}
@@ -2181,7 +2260,7 @@ nfs_bioread(nfsnode_t np, uio_t uio, int ioflag, vfs_context_t ctx)
 		if (rabn < lbn) {
 			rabn = lbn;
 		}
-		lastrabn = MIN(maxrabn, lbn + nmp->nm_readahead);
+		lastrabn = MIN(maxrabn, lbn + window);
 		if (rabn <= lastrabn) { /* start readaheads */
 			error = nfs_buf_readahead(np, ioflag, &rabn, lastrabn, thd, cred);
 			if (error) {
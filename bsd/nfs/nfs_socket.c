@@ -155,6 +155,8 @@ nfs_sockaddr_cmp(struct sockaddr *sa1, struct sockaddr *sa2)
 
 #if NFSCLIENT
 
+int nfs_nconnect = 1;   /* TCP connections per NFSv2/v3 mount */
+
 int     nfs_connect_search_new_socket(struct nfsmount *, struct nfs_socket_search *, struct timeval *);
 int     nfs_connect_search_socket_connect(struct nfsmount *, struct nfs_socket *, int);
 int     nfs_connect_search_ping(struct nfsmount *, struct nfs_socket *, struct timeval *);
@@ -163,6 +165,8 @@ void    nfs_connect_search_socket_reap(struct nfsmount *, struct nfs_socket_sear
 int     nfs_connect_search_check(struct nfsmount *, struct nfs_socket_search *, struct timeval *);
 int     nfs_reconnect(struct nfsmount *);
 int     nfs_connect_setup(struct nfsmount *);
+void    nfs_connect_extra(struct nfsmount *);
+struct nfs_socket *nfs_mount_socket(struct nfsmount *, socket_t);
 void    nfs_mount_sock_thread(void *, wait_result_t);
 void    nfs_udp_rcv(socket_t, void*, int);
 void    nfs_tcp_rcv(socket_t, void*, int);
@@ -1772,6 +1776,10 @@ keepsearching:
 	} else if (nso->nso_sotype == SOCK_STREAM) {
 		nmp->nm_timeouts = 0;
 	}
+	/* the path may have changed, so start the read estimates over */
+	nmp->nm_rd_minrtt = nmp->nm_rd_bw = 0;
+	nmp->nm_rd_bytes = nmp->nm_rd_stamp = 0;
+	nmp->nm_rd_window = 0;
 	nmp->nm_sockflags &= ~NMSOCK_CONNECTING;
 	nmp->nm_sockflags |= NMSOCK_SETUP;
 	/* move the socket to the mount structure */
@@ -1852,10 +1860,85 @@ keepsearching:
 	if (path) {
 		FREE_ZONE(path, MAXPATHLEN, M_NAMEI);
 	}
+	nfs_connect_extra(nmp);
 	NFS_SOCK_DBG("nfs connect %s success\n", vfs_statfs(nmp->nm_mountp)->f_mntfromname);
 	return 0;
 }
 
+/*
+ * Open the additional connections asked for by the nconnect sysctl.
+ *
+ * These only carry NFSv2/v3 READs (see nfs_send()), so they go to the
+ * same address as the mount's socket and need no setup RPCs of their
+ * own.  Failing to open one isn't an error: the mount just runs with
+ * fewer connections.
+ */
+void
+nfs_connect_extra(struct nfsmount *nmp)
+{
+	struct nfs_socket *nso, *mso = nmp->nm_nso;
+	struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+	in_port_t port = 0;
+	int error, want;
+
+	want = MIN(nfs_nconnect, NFS_MAXNCONNECT) - 1;
+	if ((want <= 0) || !mso || (mso->nso_sotype != SOCK_STREAM) || (nmp->nm_vers >= NFS_VER4)) {
+		return;
+	}
+	if (mso->nso_saddr->sa_family == AF_INET) {
+		port = ntohs(((struct sockaddr_in*)mso->nso_saddr)->sin_port);
+	} else if (mso->nso_saddr->sa_family == AF_INET6) {
+		port = ntohs(((struct sockaddr_in6*)mso->nso_saddr)->sin6_port);
+	}
+
+	while (nmp->nm_nso_nextra < (uint32_t)want) {
+		error = nfs_socket_create(nmp, mso->nso_saddr, SOCK_STREAM, port,
+		    NFS_PROG, nmp->nm_vers, NMFLAG(nmp, RESVPORT), &nso);
+		if (error) {
+			break;
+		}
+		error = sock_connect(nso->nso_so, nso->nso_saddr, MSG_DONTWAIT);
+		if (error == EINPROGRESS) {
+			error = sock_connectwait(nso->nso_so, &tv);
+		}
+		if (!error) {
+			nfs_socket_options(nmp, nso);
+			error = sock_setupcall(nso->nso_so, nfs_tcp_rcv, nmp);
+		}
+		if (error) {
+			NFS_SOCK_DBG("nfs connect %s extra socket %p error %d\n",
+			    vfs_statfs(nmp->nm_mountp)->f_mntfromname, nso, error);
+			nfs_socket_destroy(nso);
+			break;
+		}
+		nso->nso_flags |= (NSO_CONNECTED | NSO_VERIFIED);
+		lck_mtx_lock(&nmp->nm_lock);
+		nmp->nm_nso_extra[nmp->nm_nso_nextra++] = nso;
+		lck_mtx_unlock(&nmp->nm_lock);
+	}
+	NFS_SOCK_DBG("nfs connect %s using %d connections\n",
+	    vfs_statfs(nmp->nm_mountp)->f_mntfromname, nmp->nm_nso_nextra + 1);
+}
+
+/*
+ * Find which of the mount's connections a socket belongs to.
+ */
+struct nfs_socket *
+nfs_mount_socket(struct nfsmount *nmp, socket_t so)
+{
+	uint32_t i;
+
+	if (nmp->nm_nso && (nmp->nm_nso->nso_so == so)) {
+		return nmp->nm_nso;
+	}
+	for (i = 0; i < nmp->nm_nso_nextra; i++) {
+		if (nmp->nm_nso_extra[i]->nso_so == so) {
+			return nmp->nm_nso_extra[i];
+		}
+	}
+	return NULL;
+}
+
 
 /* setup & confirm socket connection is functional */
 int
@@ -1990,7 +2073,8 @@ nfs_reconnect(struct nfsmount *nmp)
 void
 nfs_disconnect(struct nfsmount *nmp)
 {
-	struct nfs_socket *nso;
+	struct nfs_socket *nso, *extra[NFS_MAXNCONNECT - 1];
+	uint32_t i, nextra;
 
 	lck_mtx_lock(&nmp->nm_lock);
 tryagain:
@@ -2012,8 +2096,14 @@ tryagain:
 		if (nso->nso_saddr == nmp->nm_saddr) {
 			nso->nso_saddr = NULL;
 		}
+		nextra = nmp->nm_nso_nextra;
+		bcopy(nmp->nm_nso_extra, extra, nextra * sizeof(extra[0]));
+		nmp->nm_nso_nextra = 0;
 		lck_mtx_unlock(&nmp->nm_lock);
 		nfs_socket_destroy(nso);
+		for (i = 0; i < nextra; i++) {
+			nfs_socket_destroy(extra[i]);
+		}
 		lck_mtx_lock(&nmp->nm_lock);
 		nmp->nm_sockflags &= ~NMSOCK_DISCONNECTING;
 		lck_mtx_unlock(&nmp->nm_lock);
@@ -3414,6 +3504,18 @@ again:
 		goto again;
 	}
 	nso = nmp->nm_nso;
+	/*
+	 * Spread NFSv2/v3 READs over any additional connections.  They're
+	 * idempotent, so a resend on another connection is harmless, and
+	 * there's no RPCSEC_GSS sequence window to keep on one connection.
+	 */
+	if (nso && nmp->nm_nso_nextra && (req->r_procnum == NFSPROC_READ) &&
+	    (nmp->nm_vers < NFS_VER4) && !nfs_request_using_gss(req)) {
+		uint32_t i = nmp->nm_nso_next++ % (nmp->nm_nso_nextra + 1);
+		if (i > 0) {
+			nso = nmp->nm_nso_extra[i - 1];
+		}
+	}
 	/* note that we're using the mount's socket to do the send */
 	nmp->nm_state |= NFSSTA_SENDING;  /* will be cleared by nfs_sndunlock() */
 	lck_mtx_unlock(&nmp->nm_lock);
@@ -3529,6 +3631,10 @@ again:
 		req->r_flags &= ~R_RESENDERR;
 		if (rexmit) {
 			OSAddAtomic64(1, &nfsstats.rpcretries);
+		} else {
+			struct timeval now;
+			microuptime(&now);
+			req->r_senttime = (uint64_t)now.tv_sec * USEC_PER_SEC + now.tv_usec;
 		}
 		req->r_flags |= R_SENT;
 		if (req->r_flags & R_WAITSENT) {
@@ -3596,7 +3702,7 @@ again:
 		needrecon = 1;
 		break;
 	}
-	if (needrecon && (nso == nmp->nm_nso)) { /* mark socket as needing reconnect */
+	if (needrecon && (nfs_mount_socket(nmp, nso->nso_so) == nso)) { /* mark socket as needing reconnect */
 		NFS_SOCK_DBG("nfs_send: 0x%llx need reconnect %d\n", req->r_xid, error);
 		nfs_need_reconnect(nmp);
 	}
@@ -3708,10 +3814,10 @@ nfs_tcp_rcv(socket_t so, void *arg, __unused int waitflag)
 		return;
 	}
 
-	/* make sure we're on the current socket */
+	/* make sure we're on one of the mount's current sockets */
 	lck_mtx_lock(&nmp->nm_lock);
-	nso = nmp->nm_nso;
-	if (!nso || (nso->nso_so != so) || (nmp->nm_sockflags & (NMSOCK_DISCONNECTING))) {
+	nso = nfs_mount_socket(nmp, so);
+	if (!nso || (nmp->nm_sockflags & (NMSOCK_DISCONNECTING))) {
 		lck_mtx_unlock(&nmp->nm_lock);
 		return;
 	}
@@ -87,16 +87,32 @@
 #include <nfs/nfsproto.h>
 #include <nfs/nfs.h>
 #include <nfs/nfsrvcache.h>
+#include <nfs/nfsrvcache_stripe.h>
 
 extern int nfsv2_procid[NFS_NPROCS];
-static int nfsrv_reqcache_count;
+int nfsrv_reqcache_count;
 int nfsrv_reqcache_size = NFSRVCACHESIZ;
+int nfsrv_reqcache_max = NFSRVCACHEMAX;
+uint32_t nfsrv_reqcache_keep = NFSRC_MINAGE;
 
-#define NFSRCHASH(xid) \
-	(&nfsrv_reqcache_hashtbl[((xid) + ((xid) >> 24)) & nfsrv_reqcache_hash])
-LIST_HEAD(nfsrv_reqcache_hash, nfsrvcache) * nfsrv_reqcache_hashtbl;
-TAILQ_HEAD(nfsrv_reqcache_lru, nfsrvcache) nfsrv_reqcache_lruhead;
-u_long nfsrv_reqcache_hash;
+/*
+ * The cache is striped by client and XID, with a lock, hash table and
+ * LRU list per stripe; see nfsrvcache_stripe.h for how it's sized.
+ */
+struct nfsrv_reqcache_stripe {
+	lck_mtx_t       rcs_lock;
+	LIST_HEAD(nfsrv_reqcache_hash, nfsrvcache) * rcs_hashtbl;
+	u_long          rcs_hash;               /* hash table mask */
+	TAILQ_HEAD(nfsrv_reqcache_lru, nfsrvcache) rcs_lru;
+	uint32_t        rcs_count;              /* entries in the stripe */
+} __attribute__((aligned(64)));
+
+static struct nfsrv_reqcache_stripe nfsrv_reqcache_stripes[NFSRC_STRIPES];
+static int nfsrv_reqcache_stripes_initted;
+static struct nfsrc_age nfsrv_reqcache_age;     /* protected by nfsrv_reqcache_mutex */
+
+#define NFSRCSTRIPE(hash)       (&nfsrv_reqcache_stripes[nfsrc_stripe(hash)])
+#define NFSRCHASH(rcs, hash)    (&(rcs)->rcs_hashtbl[nfsrc_bucket((hash), (rcs)->rcs_hash)])
 
 lck_grp_t *nfsrv_reqcache_lck_grp;
 lck_mtx_t *nfsrv_reqcache_mutex;
@@ -152,21 +168,100 @@ static int nfsv2_repstat[NFS_NPROCS] = {
 	FALSE,
 };
 
+/*
+ * Uptime in milliseconds, the clock the cache ages entries by.
+ */
+static uint64_t
+nfsrv_reqcache_now(void)
+{
+	struct timeval now;
+
+	microuptime(&now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+/*
+ * Fold a client's address into the 32 bits the cache hashes on.
+ */
+static uint32_t
+nfsrv_reqcache_client(mbuf_t nam)
+{
+	struct sockaddr *saddr = mbuf_data(nam);
+	struct in6_addr *in6;
+
+	switch (saddr->sa_family) {
+	case AF_INET:
+		return ((struct sockaddr_in*)saddr)->sin_addr.s_addr;
+	case AF_INET6:
+		in6 = &((struct sockaddr_in6*)saddr)->sin6_addr;
+		return in6->s6_addr32[0] ^ in6->s6_addr32[1] ^
+		       in6->s6_addr32[2] ^ in6->s6_addr32[3];
+	}
+	return 0;
+}
+
+static void
+nfsrv_reqcache_free(struct nfsrvcache *rp)
+{
+	if (rp->rc_flag & RC_REPMBUF) {
+		mbuf_freem(rp->rc_reply);
+	}
+	if (rp->rc_flag & RC_NAM) {
+		mbuf_freem(rp->rc_nam);
+	}
+	FREE(rp, M_NFSD);
+}
+
+/*
+ * A retransmission showed up interval ms after its request was last seen.
+ */
+static void
+nfsrv_reqcache_rexmit(uint64_t interval, uint64_t now)
+{
+	lck_mtx_lock(nfsrv_reqcache_mutex);
+	nfsrc_age_sample(&nfsrv_reqcache_age, interval, now);
+	nfsrv_reqcache_keep = nfsrv_reqcache_age.nra_keep;
+	lck_mtx_unlock(nfsrv_reqcache_mutex);
+}
+
 /*
  * Initialize the server request cache list
  */
 void
 nfsrv_initcache(void)
 {
+	struct nfsrv_reqcache_stripe *rcs;
+	void *hashtbl;
+	u_long hash;
+	int i, buckets;
+
 	if (nfsrv_reqcache_size <= 0) {
 		return;
 	}
 
 	lck_mtx_lock(nfsrv_reqcache_mutex);
-	/* init nfs server request cache hash table */
-	nfsrv_reqcache_hashtbl = hashinit(nfsrv_reqcache_size, M_NFSD, &nfsrv_reqcache_hash);
-	TAILQ_INIT(&nfsrv_reqcache_lruhead);
+	if (!nfsrv_reqcache_stripes_initted) {
+		for (i = 0; i < NFSRC_STRIPES; i++) {
+			lck_mtx_init(&nfsrv_reqcache_stripes[i].rcs_lock, nfsrv_reqcache_lck_grp, LCK_ATTR_NULL);
+		}
+		nfsrv_reqcache_stripes_initted = 1;
+	}
+	nfsrc_age_init(&nfsrv_reqcache_age, nfsrv_reqcache_now());
+	nfsrv_reqcache_keep = nfsrv_reqcache_age.nra_keep;
 	lck_mtx_unlock(nfsrv_reqcache_mutex);
+
+	/* init each stripe's hash table, sized for the most it may grow to */
+	buckets = nfsrc_share(MAX(nfsrv_reqcache_size, nfsrv_reqcache_max));
+	for (i = 0; i < NFSRC_STRIPES; i++) {
+		rcs = &nfsrv_reqcache_stripes[i];
+		hashtbl = hashinit(buckets, M_NFSD, &hash);
+		lck_mtx_lock(&rcs->rcs_lock);
+		rcs->rcs_hashtbl = hashtbl;
+		rcs->rcs_hash = hash;
+		TAILQ_INIT(&rcs->rcs_lru);
+		rcs->rcs_count = 0;
+		lck_mtx_unlock(&rcs->rcs_lock);
+	}
 }
 
 /*
@@ -217,7 +312,7 @@ netaddr_match(
  * - if completed within DELAY of the current time, return DROP it
  * - if completed a longer time ago return REPLY if the reply was cached or
  *   return DOIT
- * Update/add new request at end of lru list
+ * Update/add new request at end of its stripe's lru list
  */
 int
 nfsrv_getcache(
@@ -225,9 +320,12 @@ nfsrv_getcache(
 	struct nfsrv_sock *slp,
 	mbuf_t *mrepp)
 {
-	struct nfsrvcache *rp;
+	struct nfsrv_reqcache_stripe *rcs;
+	struct nfsrvcache *rp, *frp;
 	struct nfsm_chain nmrep;
 	struct sockaddr *saddr;
+	uint64_t now, interval;
+	uint32_t hash, share, cap, keep;
 	int ret, error;
 
 	/*
@@ -237,22 +335,32 @@ nfsrv_getcache(
 	if (!nd->nd_nam2) {
 		return RC_DOIT;
 	}
-	lck_mtx_lock(nfsrv_reqcache_mutex);
+	hash = nfsrc_hash(nfsrv_reqcache_client(nd->nd_nam), nd->nd_retxid);
+	rcs = NFSRCSTRIPE(hash);
+	now = nfsrv_reqcache_now();
+	lck_mtx_lock(&rcs->rcs_lock);
+	if (!rcs->rcs_hashtbl) {
+		lck_mtx_unlock(&rcs->rcs_lock);
+		return RC_DOIT;
+	}
 loop:
-	for (rp = NFSRCHASH(nd->nd_retxid)->lh_first; rp != 0;
+	for (rp = NFSRCHASH(rcs, hash)->lh_first; rp != 0;
 	    rp = rp->rc_hash.le_next) {
 		if (nd->nd_retxid == rp->rc_xid && nd->nd_procnum == rp->rc_proc &&
 		    netaddr_match(rp->rc_family, &rp->rc_haddr, nd->nd_nam)) {
 			if ((rp->rc_flag & RC_LOCKED) != 0) {
 				rp->rc_flag |= RC_WANTED;
-				msleep(rp, nfsrv_reqcache_mutex, PZERO - 1, "nfsrc", NULL);
+				msleep(rp, &rcs->rcs_lock, PZERO - 1, "nfsrc", NULL);
 				goto loop;
 			}
 			rp->rc_flag |= RC_LOCKED;
+			/* a retransmission: note how long the client took to send it */
+			interval = now - rp->rc_timestamp;
+			rp->rc_timestamp = now;
 			/* If not at end of LRU chain, move it there */
 			if (rp->rc_lru.tqe_next) {
-				TAILQ_REMOVE(&nfsrv_reqcache_lruhead, rp, rc_lru);
-				TAILQ_INSERT_TAIL(&nfsrv_reqcache_lruhead, rp, rc_lru);
+				TAILQ_REMOVE(&rcs->rcs_lru, rp, rc_lru);
+				TAILQ_INSERT_TAIL(&rcs->rcs_lru, rp, rc_lru);
 			}
 			if (rp->rc_state == RC_UNUSED) {
 				panic("nfsrv cache");
@@ -291,39 +399,58 @@ loop:
 				rp->rc_flag &= ~RC_WANTED;
 				wakeup(rp);
 			}
-			lck_mtx_unlock(nfsrv_reqcache_mutex);
+			lck_mtx_unlock(&rcs->rcs_lock);
+			nfsrv_reqcache_rexmit(interval, now);
 			return ret;
 		}
 	}
 	OSAddAtomic64(1, &nfsstats.srvcache_misses);
-	if (nfsrv_reqcache_count < nfsrv_reqcache_size) {
+	if (nfsrc_age_stale(&nfsrv_reqcache_age, now)) {
+		/* no retransmissions lately, let the cache shrink back */
+		lck_mtx_lock(nfsrv_reqcache_mutex);
+		if (nfsrc_age_stale(&nfsrv_reqcache_age, now)) {
+			nfsrc_age_decay(&nfsrv_reqcache_age, now);
+			nfsrv_reqcache_keep = nfsrv_reqcache_age.nra_keep;
+		}
+		lck_mtx_unlock(nfsrv_reqcache_mutex);
+	}
+	keep = nfsrv_reqcache_keep;
+	share = nfsrc_share(nfsrv_reqcache_size);
+	cap = MAX(share, nfsrc_share(nfsrv_reqcache_max));
+	rp = rcs->rcs_lru.tqh_first;
+	switch (nfsrc_admit(rcs->rcs_count, share, cap, rp != NULL,
+	    rp ? rp->rc_timestamp : 0, now, keep)) {
+	case NFSRC_NEW:
 		/* try to allocate a new entry */
 		MALLOC(rp, struct nfsrvcache *, sizeof *rp, M_NFSD, M_WAITOK);
 		if (rp) {
 			bzero((char *)rp, sizeof *rp);
-			nfsrv_reqcache_count++;
+			rcs->rcs_count++;
+			OSAddAtomic(1, &nfsrv_reqcache_count);
 			rp->rc_flag = RC_LOCKED;
+			break;
 		}
-	} else {
-		rp = NULL;
-	}
-	if (!rp) {
-		/* try to reuse the least recently used entry */
-		rp = nfsrv_reqcache_lruhead.tqh_first;
+		rp = rcs->rcs_lru.tqh_first;
 		if (!rp) {
-			/* no entry to reuse? */
 			/* OK, we just won't be able to cache this request */
-			lck_mtx_unlock(nfsrv_reqcache_mutex);
+			lck_mtx_unlock(&rcs->rcs_lock);
 			return RC_DOIT;
 		}
-		while ((rp->rc_flag & RC_LOCKED) != 0) {
+	/* FALLTHROUGH */
+	case NFSRC_RECYCLE:
+		/* reuse the least recently used entry */
+		while (rp && (rp->rc_flag & RC_LOCKED) != 0) {
 			rp->rc_flag |= RC_WANTED;
-			msleep(rp, nfsrv_reqcache_mutex, PZERO - 1, "nfsrc", NULL);
-			rp = nfsrv_reqcache_lruhead.tqh_first;
+			msleep(rp, &rcs->rcs_lock, PZERO - 1, "nfsrc", NULL);
+			rp = rcs->rcs_lru.tqh_first;
+		}
+		if (!rp) {
+			lck_mtx_unlock(&rcs->rcs_lock);
+			return RC_DOIT;
 		}
 		rp->rc_flag |= RC_LOCKED;
 		LIST_REMOVE(rp, rc_hash);
-		TAILQ_REMOVE(&nfsrv_reqcache_lruhead, rp, rc_lru);
+		TAILQ_REMOVE(&rcs->rcs_lru, rp, rc_lru);
 		if (rp->rc_flag & RC_REPMBUF) {
 			mbuf_freem(rp->rc_reply);
 		}
@@ -331,10 +458,15 @@ loop:
 			mbuf_freem(rp->rc_nam);
 		}
 		rp->rc_flag &= (RC_LOCKED | RC_WANTED);
+		break;
+	default:
+		lck_mtx_unlock(&rcs->rcs_lock);
+		return RC_DOIT;
 	}
-	TAILQ_INSERT_TAIL(&nfsrv_reqcache_lruhead, rp, rc_lru);
+	TAILQ_INSERT_TAIL(&rcs->rcs_lru, rp, rc_lru);
 	rp->rc_state = RC_INPROG;
 	rp->rc_xid = nd->nd_retxid;
+	rp->rc_timestamp = now;
 	saddr = mbuf_data(nd->nd_nam);
 	rp->rc_family = saddr->sa_family;
 	switch (saddr->sa_family) {
@@ -357,13 +489,28 @@ loop:
 	}
 	;
 	rp->rc_proc = nd->nd_procnum;
-	LIST_INSERT_HEAD(NFSRCHASH(nd->nd_retxid), rp, rc_hash);
+	LIST_INSERT_HEAD(NFSRCHASH(rcs, hash), rp, rc_hash);
 	rp->rc_flag &= ~RC_LOCKED;
 	if (rp->rc_flag & RC_WANTED) {
 		rp->rc_flag &= ~RC_WANTED;
 		wakeup(rp);
 	}
-	lck_mtx_unlock(nfsrv_reqcache_mutex);
+
+	/* if the stripe has grown, give back an entry that has aged out */
+	frp = rcs->rcs_lru.tqh_first;
+	if (frp && !(frp->rc_flag & RC_LOCKED) &&
+	    nfsrc_shrink(rcs->rcs_count, share, frp->rc_timestamp, now, keep)) {
+		LIST_REMOVE(frp, rc_hash);
+		TAILQ_REMOVE(&rcs->rcs_lru, frp, rc_lru);
+		rcs->rcs_count--;
+		OSAddAtomic(-1, &nfsrv_reqcache_count);
+	} else {
+		frp = NULL;
+	}
+	lck_mtx_unlock(&rcs->rcs_lock);
+	if (frp) {
+		nfsrv_reqcache_free(frp);
+	}
 	return RC_DOIT;
 }
 
@@ -376,21 +523,29 @@ nfsrv_updatecache(
 	int repvalid,
 	mbuf_t repmbuf)
 {
+	struct nfsrv_reqcache_stripe *rcs;
 	struct nfsrvcache *rp;
+	uint32_t hash;
 	int error;
 
 	if (!nd->nd_nam2) {
 		return;
 	}
-	lck_mtx_lock(nfsrv_reqcache_mutex);
+	hash = nfsrc_hash(nfsrv_reqcache_client(nd->nd_nam), nd->nd_retxid);
+	rcs = NFSRCSTRIPE(hash);
+	lck_mtx_lock(&rcs->rcs_lock);
+	if (!rcs->rcs_hashtbl) {
+		lck_mtx_unlock(&rcs->rcs_lock);
+		return;
+	}
 loop:
-	for (rp = NFSRCHASH(nd->nd_retxid)->lh_first; rp != 0;
+	for (rp = NFSRCHASH(rcs, hash)->lh_first; rp != 0;
 	    rp = rp->rc_hash.le_next) {
 		if (nd->nd_retxid == rp->rc_xid && nd->nd_procnum == rp->rc_proc &&
 		    netaddr_match(rp->rc_family, &rp->rc_haddr, nd->nd_nam)) {
 			if ((rp->rc_flag & RC_LOCKED) != 0) {
 				rp->rc_flag |= RC_WANTED;
-				msleep(rp, nfsrv_reqcache_mutex, PZERO - 1, "nfsrc", NULL);
+				msleep(rp, &rcs->rcs_lock, PZERO - 1, "nfsrc", NULL);
 				goto loop;
 			}
 			rp->rc_flag |= RC_LOCKED;
@@ -428,11 +583,11 @@ loop:
 				rp->rc_flag &= ~RC_WANTED;
 				wakeup(rp);
 			}
-			lck_mtx_unlock(nfsrv_reqcache_mutex);
+			lck_mtx_unlock(&rcs->rcs_lock);
 			return;
 		}
 	}
-	lck_mtx_unlock(nfsrv_reqcache_mutex);
+	lck_mtx_unlock(&rcs->rcs_lock);
 }
 
 /*
@@ -441,18 +596,30 @@ loop:
 void
 nfsrv_cleancache(void)
 {
+	struct nfsrv_reqcache_stripe *rcs;
 	struct nfsrvcache *rp, *nextrp;
+	int i;
 
-	lck_mtx_lock(nfsrv_reqcache_mutex);
-	for (rp = nfsrv_reqcache_lruhead.tqh_first; rp != 0; rp = nextrp) {
-		nextrp = rp->rc_lru.tqe_next;
-		LIST_REMOVE(rp, rc_hash);
-		TAILQ_REMOVE(&nfsrv_reqcache_lruhead, rp, rc_lru);
-		_FREE(rp, M_NFSD);
+	if (!nfsrv_reqcache_stripes_initted) {
+		return;
+	}
+	for (i = 0; i < NFSRC_STRIPES; i++) {
+		rcs = &nfsrv_reqcache_stripes[i];
+		lck_mtx_lock(&rcs->rcs_lock);
+		for (rp = rcs->rcs_lru.tqh_first; rp != 0; rp = nextrp) {
+			nextrp = rp->rc_lru.tqe_next;
+			LIST_REMOVE(rp, rc_hash);
+			TAILQ_REMOVE(&rcs->rcs_lru, rp, rc_lru);
+			nfsrv_reqcache_free(rp);
+		}
+		rcs->rcs_count = 0;
+		if (rcs->rcs_hashtbl) {
+			FREE(rcs->rcs_hashtbl, M_NFSD);
+			rcs->rcs_hashtbl = NULL;
+		}
+		lck_mtx_unlock(&rcs->rcs_lock);
 	}
 	nfsrv_reqcache_count = 0;
-	FREE(nfsrv_reqcache_hashtbl, M_TEMP);
-	lck_mtx_unlock(nfsrv_reqcache_mutex);
 }
 
 #endif /* NFSSERVER */
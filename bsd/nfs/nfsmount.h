@@ -343,6 +343,9 @@ struct nfsmount {
 	char    *nm_mount_localport;    /* Unix domain address (port) for mountd */
 	struct nfs_socket_search *nm_nss; /* current socket search structure */
 	struct nfs_socket *nm_nso;      /* current socket */
+	struct nfs_socket *nm_nso_extra[NFS_MAXNCONNECT - 1]; /* additional READ connections */
+	uint32_t nm_nso_nextra;         /* # of additional connections */
+	uint32_t nm_nso_next;           /* round robin index for READs */
 	struct sockaddr *nm_saddr;      /* Address of server */
 	u_short nm_sockflags;           /* socket state flags */
 	time_t  nm_deadto_start;        /* dead timeout start time */
@@ -354,6 +357,12 @@ struct nfsmount {
 	int     nm_srtt[4];             /* Timers for RPCs */
 	int     nm_sdrtt[4];
 	int     nm_timeouts;            /* Request timeouts */
+	/* read pipeline estimates */
+	uint64_t nm_rd_minrtt;          /* min READ RTT on this connection (usec) */
+	uint64_t nm_rd_bw;              /* smoothed READ bandwidth (bytes/sec) */
+	uint64_t nm_rd_bytes;           /* bytes read since nm_rd_stamp */
+	uint64_t nm_rd_stamp;           /* start of current bandwidth sample */
+	uint32_t nm_rd_window;          /* adaptive read-ahead window (# blocks) */
 	int     nm_jbreqs;              /* # R_JBTPRINTFMSG requests */
 	int     nm_mounterror;          /* status of mount connect */
 	TAILQ_ENTRY(nfsmount) nm_pokeq; /* mount poke queue chain */
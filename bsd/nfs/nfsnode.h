@@ -873,6 +873,8 @@ void nfs_buf_itercomplete(nfsnode_t, struct nfsbuflists *, int);
 
 int nfs_bioread(nfsnode_t, uio_t, int, vfs_context_t);
 int nfs_buf_readahead(nfsnode_t, int, daddr64_t *, daddr64_t, thread_t, kauth_cred_t);
+uint32_t nfs_read_window(struct nfsmount *);
+void nfs_buf_read_sample(struct nfsmount *, uint64_t, size_t);
 int nfs_buf_readdir(struct nfsbuf *, vfs_context_t);
 int nfs_buf_read(struct nfsbuf *);
 void nfs_buf_read_finish(struct nfsbuf *);
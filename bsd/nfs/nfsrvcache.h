@@ -84,6 +84,7 @@ union nethostaddr {
 };
 
 #define NFSRVCACHESIZ   64
+#define NFSRVCACHEMAX   2048            /* most it grows to for slow retransmitters */
 
 struct nfsrvcache {
 	TAILQ_ENTRY(nfsrvcache) rc_lru;         /* LRU chain */
@@ -98,6 +99,7 @@ struct nfsrvcache {
 	u_int32_t rc_proc;                      /* rpc proc number */
 	u_char  rc_state;               /* Current state of request */
 	u_char  rc_flag;                /* Flag bits */
+	uint64_t rc_timestamp;          /* when last seen, in ms of uptime */
 };
 
 #define rc_reply        rc_un.ru_repmb
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Placement and sizing policy for the NFS server request cache
+ * (nfs_srvcache.c).
+ *
+ * The cache is split into NFSRC_STRIPES stripes, each with its own lock,
+ * hash table and LRU list, and a request lives in the stripe picked by a
+ * hash of its client address and XID.  A stripe holds its share of
+ * nfsrv_reqcache_size entries; past that it recycles its least recently
+ * seen entry, unless that entry is younger than the time clients have
+ * lately been taking to retransmit, in which case the stripe grows, up
+ * to its share of nfsrv_reqcache_max.  Grown stripes give entries back
+ * once they age out.  So the cache stays as large as it needs to be to
+ * still hold a request when its retransmission arrives, and no larger.
+ * It learns that time only from retransmissions it catches, so entries
+ * are kept for at least NFSRC_MINAGE, twice the usual initial client
+ * timeout of a second; as clients back off by doubling, keeping entries
+ * for twice the observed interval catches the later retransmissions too.
+ *
+ * Nothing here depends on the kernel, so that tests/nfsrv_reqcache.c can
+ * run the same policy in user space.  Times are in milliseconds.
+ */
+
+#ifndef _NFS_NFSRVCACHE_STRIPE_H_
+#define _NFS_NFSRVCACHE_STRIPE_H_
+
+#include <stdint.h>
+
+#define NFSRC_STRIPES           32      /* lock stripes, a power of 2 */
+#define NFSRC_STRIPE_SHIFT      5       /* log2(NFSRC_STRIPES) */
+#define NFSRC_MINAGE            2000    /* keep entries at least this long */
+#define NFSRC_MAXAGE            120000  /* and never longer than this */
+
+/* what to do with a request that missed in the cache */
+#define NFSRC_NEW               0       /* allocate a new entry for it */
+#define NFSRC_RECYCLE           1       /* reuse the stripe's LRU entry */
+#define NFSRC_NONE              2       /* don't cache it */
+
+struct nfsrc_age {
+	uint32_t        nra_rexmit;     /* smoothed retransmit interval */
+	uint32_t        nra_keep;       /* keep entries this long */
+	uint64_t        nra_stamp;      /* time of the last retransmit seen */
+};
+
+/*
+ * Hashes a request's client (its folded address) and XID.  The low
+ * NFSRC_STRIPE_SHIFT bits pick the stripe and the rest the hash chain,
+ * so retransmissions from one client don't all pile onto one lock.
+ */
+static inline uint32_t
+nfsrc_hash(uint32_t client, uint32_t xid)
+{
+	uint32_t h = xid ^ (client * 0x9e3779b1U);
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+static inline uint32_t
+nfsrc_stripe(uint32_t hash)
+{
+	return hash & (NFSRC_STRIPES - 1);
+}
+
+static inline uint32_t
+nfsrc_bucket(uint32_t hash, unsigned long mask)
+{
+	return (uint32_t)((hash >> NFSRC_STRIPE_SHIFT) & mask);
+}
+
+/*
+ * A stripe's share of a cache-wide limit, at least one entry.
+ */
+static inline uint32_t
+nfsrc_share(int limit)
+{
+	return (limit > NFSRC_STRIPES) ? (uint32_t)limit / NFSRC_STRIPES : 1;
+}
+
+static inline void
+nfsrc_age_init(struct nfsrc_age *nra, uint64_t now)
+{
+	nra->nra_rexmit = 0;
+	nra->nra_keep = NFSRC_MINAGE;
+	nra->nra_stamp = now;
+}
+
+static inline void
+nfsrc_age_update(struct nfsrc_age *nra)
+{
+	uint32_t keep = 2 * nra->nra_rexmit;
+
+	if (keep < NFSRC_MINAGE) {
+		keep = NFSRC_MINAGE;
+	} else if (keep > NFSRC_MAXAGE) {
+		keep = NFSRC_MAXAGE;
+	}
+	nra->nra_keep = keep;
+}
+
+/*
+ * A retransmission arrived interval after the request was last seen.
+ * Follow longer intervals quickly and shorter ones slowly, since it's
+ * the slow retransmitters the cache has to wait for, and keep entries
+ * for twice the result.
+ */
+static inline void
+nfsrc_age_sample(struct nfsrc_age *nra, uint64_t interval, uint64_t now)
+{
+	uint32_t ms = (interval > NFSRC_MAXAGE) ? NFSRC_MAXAGE : (uint32_t)interval;
+
+	if (ms > nra->nra_rexmit) {
+		nra->nra_rexmit += (ms - nra->nra_rexmit + 1) / 2;
+	} else {
+		nra->nra_rexmit -= (nra->nra_rexmit - ms) / 16;
+	}
+	nra->nra_stamp = now;
+	nfsrc_age_update(nra);
+}
+
+/*
+ * Whether no retransmission has been seen for NFSRC_MAXAGE, in which case
+ * nfsrc_age_decay() should be called.
+ */
+static inline int
+nfsrc_age_stale(const struct nfsrc_age *nra, uint64_t now)
+{
+	return (nra->nra_rexmit > 0) && (now - nra->nra_stamp >= NFSRC_MAXAGE);
+}
+
+/*
+ * Halves the retransmit interval, so that the cache shrinks back once
+ * clients stop retransmitting.
+ */
+static inline void
+nfsrc_age_decay(struct nfsrc_age *nra, uint64_t now)
+{
+	nra->nra_rexmit /= 2;
+	nra->nra_stamp = now;
+	nfsrc_age_update(nra);
+}
+
+/*
+ * Decides where a request that missed goes.  The stripe holds count
+ * entries, may hold share of them unconditionally and up to cap while
+ * its entries are younger than keep; lru_time is when its least recently
+ * seen entry was last seen, if it has one (have_lru).
+ */
+static inline int
+nfsrc_admit(uint32_t count, uint32_t share, uint32_t cap, int have_lru,
+    uint64_t lru_time, uint64_t now, uint32_t keep)
+{
+	if (count < share) {
+		return NFSRC_NEW;
+	}
+	if (have_lru && (now - lru_time >= keep)) {
+		return NFSRC_RECYCLE;
+	}
+	if (count < cap) {
+		return NFSRC_NEW;
+	}
+	return have_lru ? NFSRC_RECYCLE : NFSRC_NONE;
+}
+
+/*
+ * Whether a stripe holding more than its share should free its least
+ * recently seen entry, last seen at lru_time.
+ */
+static inline int
+nfsrc_shrink(uint32_t count, uint32_t share, uint64_t lru_time, uint64_t now,
+    uint32_t keep)
+{
+	return (count > share) && (now - lru_time >= keep);
+}
+
+#endif /* _NFS_NFSRVCACHE_STRIPE_H_ */
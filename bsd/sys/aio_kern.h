@@ -47,6 +47,10 @@ struct aio_workq_entry {
 	/* Proc lock */
 	void            *group_tag;     /* identifier used to group IO requests */
 
+	/* Initialized and never changed, set for AIO_RING requests */
+	struct aio_ring *aio_ring;      /* ring the completion is posted to */
+	uint64_t        aio_ring_data;  /* sqe_user_data of the request */
+
 	/* Initialized and never changed, safe to access */
 	struct proc     *procp;         /* user proc that queued this request */
 	user_addr_t     uaiocbp;        /* pointer passed in from user land */
@@ -71,7 +75,8 @@ typedef struct aio_workq_entry aio_workq_entry;
 #define AIO_DSYNC               0x00000008      /* aio_fsync with op = O_DSYNC (not supported yet) */
 #define AIO_LIO                 0x00000010      /* lio_listio generated IO */
 #define AIO_DO_FREE             0x00000800      /* entry should be freed when last reference is dropped. */
-                                                /*      set by aio_return() and _aio_exit() */
+                                                /*      set by aio_return() and _aio_exit(), */
+                                                /*      and at creation for AIO_RING */
 #define AIO_DISABLE             0x00002000      /* process is trying to exit or exec and we need */
                                                 /*      to not try to send a signal from do_aio_completion() */
 #define AIO_CLOSE_WAIT          0x00004000      /* process is trying to close and is */
@@ -82,6 +87,8 @@ typedef struct aio_workq_entry aio_workq_entry;
                                                 /*	complete */
 
 #define AIO_LIO_NOTIFY          0x00010000      /* wait for list complete */
+#define AIO_RING                0x00020000      /* submitted through aio_ring_enter(), completes */
+                                                /*      to the ring instead of the proc done queue */
 
 /*
  * Prototypes
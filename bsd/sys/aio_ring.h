@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Submission and completion rings for asynchronous file I/O.
+ *
+ * A ring is a region of the caller's memory registered with
+ * aio_ring_setup().  It holds a struct aio_ring_header, followed by an
+ * array of 'entries' submission entries and then an array of
+ * 2 * 'entries' completion entries; AIO_RING_SIZE() gives its size.
+ *
+ * The caller fills submission entries at ar_sq_tail and advances it,
+ * then calls aio_ring_enter() to submit them; the kernel consumes them
+ * from ar_sq_head.  The kernel posts a completion at ar_cq_tail for every
+ * submission it consumes and advances ar_cq_tail; the caller reaps them
+ * from ar_cq_head, without a system call, and advances it.  Indices run
+ * freely and are masked by the array size.  Completions are posted in
+ * the order requests finish, not the order they were submitted.
+ *
+ * The kernel never has more completions outstanding than the completion
+ * array holds: aio_ring_enter() stops consuming submissions while the
+ * unreaped and in flight requests would fill it.
+ */
+
+#ifndef _SYS_AIO_RING_H_
+#define _SYS_AIO_RING_H_
+
+#include <sys/cdefs.h>
+#include <stdint.h>
+
+#ifdef PRIVATE
+
+#define AIO_RING_MAX_ENTRIES    4096
+
+/* sqe_opcode */
+#define AIO_RING_OP_NOP         0
+#define AIO_RING_OP_READ        1       /* pread(sqe_fd, sqe_addr, sqe_len, sqe_offset) */
+#define AIO_RING_OP_WRITE       2       /* pwrite(sqe_fd, sqe_addr, sqe_len, sqe_offset) */
+#define AIO_RING_OP_FSYNC       3       /* fsync(sqe_fd), or fdatasync() with O_DSYNC in sqe_op_flags */
+#define AIO_RING_OP_OPEN        4       /* openat(sqe_fd, sqe_addr, sqe_op_flags, sqe_len) */
+
+/* aio_ring_enter() flags */
+#define AIO_RING_ENTER_DESTROY  0x00000001      /* wait for in flight requests, then unregister */
+
+struct aio_ring_sqe {
+	uint8_t         sqe_opcode;     /* AIO_RING_OP_* */
+	uint8_t         sqe_flags;      /* must be 0 */
+	uint16_t        sqe_reserved;
+	int32_t         sqe_fd;         /* file, or directory for AIO_RING_OP_OPEN */
+	uint64_t        sqe_offset;     /* file offset */
+	uint64_t        sqe_addr;       /* buffer, or path for AIO_RING_OP_OPEN */
+	uint32_t        sqe_len;        /* buffer size, or mode for AIO_RING_OP_OPEN */
+	uint32_t        sqe_op_flags;   /* open flags, or O_DSYNC for AIO_RING_OP_FSYNC */
+	uint64_t        sqe_user_data;  /* returned in the completion */
+};
+
+struct aio_ring_cqe {
+	uint64_t        cqe_user_data;  /* sqe_user_data of the request */
+	int64_t         cqe_res;        /* bytes transferred or the new descriptor, or -errno */
+};
+
+struct aio_ring_header {
+	uint32_t        ar_sq_head;     /* next submission the kernel consumes */
+	uint32_t        ar_sq_tail;     /* next submission the caller fills */
+	uint32_t        ar_cq_head;     /* next completion the caller reaps */
+	uint32_t        ar_cq_tail;     /* next completion the kernel posts */
+	uint32_t        ar_entries;     /* submission entries, set by aio_ring_setup() */
+	uint32_t        ar_reserved[3];
+};
+
+#define AIO_RING_SQES_OFFSET            sizeof(struct aio_ring_header)
+#define AIO_RING_CQES_OFFSET(entries)   (AIO_RING_SQES_OFFSET + \
+	                                 (entries) * sizeof(struct aio_ring_sqe))
+#define AIO_RING_SIZE(entries)          (AIO_RING_CQES_OFFSET(entries) + \
+	                                 2 * (entries) * sizeof(struct aio_ring_cqe))
+
+#ifndef KERNEL
+
+__BEGIN_DECLS
+
+/*
+ * Registers the AIO_RING_SIZE(entries) bytes at 'ring' as a ring with
+ * 'entries' submission entries, a power of 2.  If 'signo' is not 0, that
+ * signal is sent to the process whenever completions are posted; it can
+ * be watched for with an EVFILT_SIGNAL kevent.
+ */
+int aio_ring_setup(void *ring, size_t size, uint32_t entries, int signo);
+
+/*
+ * Submits up to 'to_submit' entries from the ring and then waits until
+ * at least 'min_complete' completions are ready to reap, or no requests
+ * remain in flight.  Returns the number of entries submitted.
+ */
+int aio_ring_enter(void *ring, uint32_t to_submit, uint32_t min_complete,
+    uint32_t flags);
+
+__END_DECLS
+
+#endif /* KERNEL */
+
+#endif /* PRIVATE */
+
+#endif /* _SYS_AIO_RING_H_ */
@@ -554,6 +554,9 @@ typedef struct vol_attributes_attr {
 /* Required attributes for getattrlistbulk(2) */
 #define ATTR_BULK_REQUIRED (ATTR_CMN_NAME | ATTR_CMN_RETURNED_ATTRS)
 
+/* Largest path list getattrlistatv(2) accepts in one call */
+#define ATTR_MAX_PATHS_BUFFER   (1024 * 1024)
+
 /*
  * Searchfs
  */
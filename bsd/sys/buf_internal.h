@@ -106,8 +106,9 @@ struct buf {
 	int     b_timestamp;            /* timestamp for queuing operation */
 	struct timeval b_timestamp_tv; /* microuptime for disk conditioner */
 	int     b_whichq;               /* the free list the buffer belongs to */
+	int     b_stripe;               /* buffer cache stripe whose lock protects the buffer */
 	volatile uint32_t       b_flags;        /* B_* flags. */
-	volatile uint32_t       b_lflags;       /* BL_BUSY | BL_WANTED flags... protected by buf_mtx */
+	volatile uint32_t       b_lflags;       /* BL_BUSY | BL_WANTED flags... protected by the stripe lock */
 	int     b_error;                /* errno value. */
 	int     b_bufsize;              /* Allocated buffer size. */
 	int     b_bcount;               /* Valid bytes in buffer. */
@@ -167,7 +168,8 @@ extern vm_offset_t buf_kernel_addrperm;
 
 /*
  * These flags are kept in b_lflags...
- * buf_mtxp must be held before examining/updating
+ * the lock of the buffer's stripe (b_stripe) must be held
+ * before examining/updating
  */
 #define BL_BUSY         0x00000001      /* I/O in progress. */
 #define BL_WANTED       0x00000002      /* Process wants this buffer. */
@@ -188,6 +188,8 @@ struct decmpfs_cnode {
 	uint64_t total_size __attribute__((aligned(8)));/* for dataless directories (incl. packages) */
 	uint64_t decompression_flags;
 	lck_rw_t compressed_data_lock;
+	uint64_t ra_last __attribute__((aligned(8)));   /* end of the last fetch, to spot sequential access */
+	uint64_t ra_next __attribute__((aligned(8)));   /* end of the region queued for read-ahead */
 };
 
 #endif // XNU_KERNEL_PRIVATE
@@ -127,6 +127,100 @@ typedef struct fsevent_dev_filter_args {
 #define FSEVENTS_GET_CURRENT_ID         _IOR('s', 103, uint64_t)
 #define FSEVENTS_UNMOUNT_PENDING_ACK    _IOW('s', 104, dev_t)
 
+//
+// Only report events whose path (or, for renames and clones, either
+// path) is one of the given directories or lies below it.  The prefixes
+// are NUL-terminated paths packed back to back; zero prefixes turns the
+// filter off.
+//
+typedef struct fsevent_prefix_filter_args {
+	uint32_t  num_prefixes;
+	uint32_t  size;          // bytes at prefixes
+	uint64_t  prefixes;      // user address of the packed paths
+} fsevent_prefix_filter_args;
+
+#define FSEVENTS_PREFIX_FILTER          _IOW('s', 105, fsevent_prefix_filter_args)
+#define FSEVENTS_MAX_PREFIXES           64
+
+//
+// Map a ring of events shared with the kernel into the caller, instead
+// of read()ing them.  Once mapped, events are written to the ring as
+// they happen and read() returns EINVAL; select() and kevent() report
+// the fd readable while the ring is not empty.
+//
+// The ring holds variable sized records, each a multiple of 8 bytes
+// and starting with a struct fsevent_ring_rec.  fr_head and fr_tail
+// count bytes ever written and consumed; the record at position p is
+// at offset p % fr_size of the record area that follows the header.
+// The consumer reads records from fr_tail up to fr_head, then stores
+// the new fr_tail.  Events that do not fit are dropped and reported
+// with an FSE_EVENTS_DROPPED record.
+//
+// Paths are split into a directory and a leaf name.  Directories are
+// interned: an FSE_RING_DIR record assigns a directory path to an id,
+// and events name their directory by id.  An id keeps its path until
+// a later FSE_RING_DIR record reassigns it.
+//
+typedef struct fsevent_ring_args {
+	uint32_t  size;          // in: bytes wanted, out: bytes mapped
+	uint32_t  reserved;
+	uint64_t  addr;          // out: where the ring was mapped
+} fsevent_ring_args;
+
+#define FSEVENTS_MAP_RING               _IOWR('s', 106, fsevent_ring_args)
+
+#define FSE_RING_MAGIC          0x46535252   // 'FSRR'
+#define FSE_RING_MIN_SIZE       (64 * 1024)
+#define FSE_RING_MAX_SIZE       (64 * 1024 * 1024)
+#define FSE_RING_DIRS           1024         // directory ids are below this
+#define FSE_RING_NO_DIR         0xffff       // fre_name is the whole path
+
+struct fsevent_ring_hdr {
+	uint32_t  fr_magic;
+	uint32_t  fr_hdr_size;   // the record area starts this far into the mapping
+	uint64_t  fr_size;       // bytes in the record area, a power of 2
+	uint64_t  fr_dropped;    // events dropped because the ring was full
+	uint64_t  fr_head __attribute__((aligned(64)));   // written by the kernel
+	uint64_t  fr_tail __attribute__((aligned(64)));   // written by the consumer
+};
+
+// record kinds
+#define FSE_RING_PAD            0   // skip to the end of the record area
+#define FSE_RING_DIR            1   // struct fsevent_ring_dir
+#define FSE_RING_EVENT          2   // struct fsevent_ring_event
+#define FSE_RING_DEST           3   // struct fsevent_ring_event, second path of the previous event
+
+struct fsevent_ring_rec {
+	uint16_t  frr_kind;
+	uint16_t  frr_len;       // bytes in the record, a multiple of 8
+};
+
+struct fsevent_ring_dir {
+	uint16_t  frd_kind;      // FSE_RING_DIR
+	uint16_t  frd_len;
+	uint16_t  frd_id;
+	uint16_t  frd_pathlen;   // without the NUL
+	char      frd_path[];    // NUL terminated
+};
+
+struct fsevent_ring_event {
+	uint16_t  fre_kind;      // FSE_RING_EVENT or FSE_RING_DEST
+	uint16_t  fre_len;
+	uint16_t  fre_type;      // FSE_* type, FSE_*_EVENTS flags above FSE_FLAG_SHIFT
+	uint16_t  fre_dir;       // directory id, or FSE_RING_NO_DIR
+	pid_t     fre_pid;
+	int32_t   fre_mode;
+	dev_t     fre_dev;
+	uid_t     fre_uid;
+	gid_t     fre_gid;
+	uint16_t  fre_namelen;   // without the NUL
+	uint16_t  fre_reserved;
+	uint64_t  fre_ino;
+	uint64_t  fre_docid;     // FSE_DOCID_* only
+	uint64_t  fre_time;      // mach_absolute_time() of the event
+	char      fre_name[];    // NUL terminated
+};
+
 
 #ifdef BSD_KERNEL_PRIVATE
 
@@ -802,6 +802,20 @@ OS_ENUM(vfs_roles, uint32_t,
 
 #endif /* KERNEL */
 
+#ifdef PRIVATE
+/*
+ * Name cache counters of one mounted file system, as returned
+ * (one per mount) by the vfs.namecache.mountstats sysctl.
+ */
+struct namecache_mount_stats {
+	fsid_t          nms_fsid;
+	uint64_t        nms_hits;               /* positive hits */
+	uint64_t        nms_neghits;            /* negative hits */
+	uint64_t        nms_misses;             /* lookups not in the cache */
+	uint64_t        nms_evictions;          /* live entries recycled to make room */
+};
+#endif /* PRIVATE */
+
 /*
  * flags passed into vfs_iterate
  */
@@ -104,6 +104,21 @@ typedef uint32_t  pending_io_t;
  */
 TAILQ_HEAD(vnodelst, vnode);
 
+/*
+ * Name cache counters, kept per mount and striped by CPU so that
+ * lookups running on different cores do not write the same cache line.
+ * Only kept while vfs.namecache.mountstats_enable is set, see the
+ * vfs.namecache.mountstats sysctl.
+ */
+#define NC_STAT_STRIPES         8
+
+struct nc_mount_stats {
+	uint64_t        ncm_hits;               /* positive hits */
+	uint64_t        ncm_neghits;            /* negative hits */
+	uint64_t        ncm_misses;             /* lookups not in the cache */
+	uint64_t        ncm_evictions;          /* live entries recycled */
+} __attribute__((aligned(64)));
+
 struct mount {
 	TAILQ_ENTRY(mount)      mnt_list;                   /* mount list */
 	int32_t                 mnt_count;                  /* reference on the mount */
@@ -132,6 +147,7 @@ struct mount {
 	uint32_t                mnt_devblocksize;           /* the underlying device block size */
 	uint32_t                mnt_ioqueue_depth;          /* the maxiumum number of commands a device can accept */
 	uint32_t                mnt_ioscale;                /* scale the various throttles/limits imposed on the amount of I/O in flight */
+	uint32_t                mnt_read_latency;           /* smoothed latency of demand reads in usecs, sizes read-ahead */
 	uint32_t                mnt_ioflags;                /* flags for  underlying device */
 	uint32_t                mnt_minsaturationbytecount; /* if non-zero, mininum amount of writes (in bytes) needed to max out throughput */
 	pending_io_t            mnt_pending_write_size __attribute__((aligned(sizeof(pending_io_t))));  /* byte count of pending writes */
@@ -199,6 +215,8 @@ struct mount {
 	void                    *mnt_disk_conditioner_info;
 
 	lck_mtx_t               mnt_iter_lock;              /* mutex that protects iteration of vnodes */
+
+	struct nc_mount_stats   mnt_ncstats[NC_STAT_STRIPES]; /* name cache counters */
 };
 
 /*
@@ -248,6 +248,8 @@ struct  namecache {
 	vnode_t                 nc_dvp;         /* vnode of parent of name */
 	vnode_t                 nc_vp;          /* vnode the name refers to */
 	unsigned int            nc_hashval;     /* hashval of stringname */
+	unsigned short          nc_ref;         /* CLOCK reference bit, set by lookups */
+	unsigned short          nc_hash_stripe; /* sequence count stripe of nc_hash */
 	const char              *nc_name;       /* pointer to segment name in string cache */
 };
 
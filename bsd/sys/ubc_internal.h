@@ -50,6 +50,7 @@
 
 #include <kern/locks.h>
 #include <mach/memory_object_types.h>
+#include <vfs/vfs_cluster_ra.h>
 
 
 #define UBC_INFO_NULL   ((struct ubc_info *) 0)
@@ -76,11 +77,17 @@ struct cl_wextent {
 	int             io_flags;
 };
 
+/*
+ * cl_lastr, cl_maxra and cl_ralen describe the stream the current read
+ * continues; cluster_ra_select() parks them in cl_ras and loads the
+ * next read's stream.
+ */
 struct cl_readahead {
 	lck_mtx_t       cl_lockr;
 	daddr64_t       cl_lastr;                       /* last block read by client */
 	daddr64_t       cl_maxra;                       /* last block prefetched by the read ahead */
 	int             cl_ralen;                       /* length of last prefetch */
+	struct cl_rastreams cl_ras;                     /* per-stream read ahead state */
 };
 
 struct cl_writebehind {
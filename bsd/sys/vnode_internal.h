@@ -120,7 +120,8 @@ typedef struct vnode_resolve *vnode_resolve_t;
  * Reading or writing any of these items requires holding the appropriate lock.
  * v_freelist is locked by the global vnode_list_lock
  * v_mntvnodes is locked by the mount_lock
- * v_nclinks and v_ncchildren are protected by the global name_cache_lock
+ * v_nclinks and v_ncchildren are protected by the global name_cache_lock held
+ *	exclusive, or held shared together with namecache_list_mtx
  * v_cleanblkhd and v_dirtyblkhd and v_iterblkflags are locked via the global buf_mtxp
  * the rest of the structure is protected by the vnode_lock
  */
@@ -557,6 +558,7 @@ void SPECHASH_LOCK(void);
 void SPECHASH_UNLOCK(void);
 
 void    vnode_authorize_init(void);
+void    attrlist_init(void);
 
 void    vfsinit(void);
 void vnode_lock(vnode_t);
@@ -49,7 +49,11 @@
 #include <sys/sysproto.h>
 #include <sys/xattr.h>
 #include <sys/fsevents.h>
+#include <sys/sysctl.h>
+#include <kern/clock.h>
 #include <kern/kalloc.h>
+#include <kern/thread.h>
+#include <pexpert/pexpert.h>
 #include <miscfs/specfs/specdev.h>
 #include <security/audit/audit.h>
 
@@ -3599,7 +3603,7 @@ direntry_done(struct fd_vn_data *fvd)
  *  has also asked for ATTR_CMN_ERROR, it is filled in as well.
  *
  *  Input
- *       vp - vnode pointer
+ *       vp - vnode pointer (may be NULLVP if the lookup itself failed)
  *       alp - pointer to attrlist struct.
  *       options - options passed to getattrlistbulk(2)
  *       kern_attr_buf - Kernel buffer to fill data (assumes offset 0 in
@@ -3654,7 +3658,8 @@ get_error_attributes(vnode_t vp, struct attrlist *alp, uint64_t options,
 	fsiz = 0;
 	(void)getattrlist_setupvattr(&al, NULL, (ssize_t *)&fsiz,
 	    &action, proc_is64bit(vfs_context_proc(ctx)),
-	    (vnode_vtype(vp) == VDIR), (options & FSOPT_ATTR_CMN_EXTENDED));
+	    (vp != NULLVP && vnode_vtype(vp) == VDIR),
+	    (options & FSOPT_ATTR_CMN_EXTENDED));
 
 	namelen = strlen(namebuf);
 	vsiz = namelen + 1;
@@ -3728,6 +3733,641 @@ out:
 #define MIN_BUF_SIZE_REQUIRED  (sizeof(uint32_t) + sizeof(attribute_set_t) +\
     sizeof(attrreference_t))
 
+/*
+ * Copies out one entry packed by getattrlist_internal (with
+ * FSOPT_REPORT_FULLSIZE) or get_error_attributes into kern_attr_buf,
+ * padded to 8 bytes as getattrlistbulk(2) lays entries out.
+ *
+ * Returns ENOBUFS, having copied nothing, if the entry does not fit in
+ * what is left of auio.
+ */
+static int
+attrlist_bulk_copyout(caddr_t kern_attr_buf, size_t kern_attr_buf_siz,
+    uio_t auio)
+{
+	size_t entlen;
+	size_t bytes_left;
+	size_t pad_bytes;
+	ssize_t new_resid;
+	int error;
+
+	/*
+	 * Because FSOPT_REPORT_FULLSIZE was set, the first 4 bytes
+	 * of the buffer returned by getattrlist contains the size
+	 * (even if the provided buffer isn't sufficiently big). Use
+	 * that to check if we've run out of buffer space.
+	 *
+	 * resid is a signed type, and the size of the buffer etc
+	 * are unsigned types. It is theoretically possible for
+	 * resid to be < 0 and in which case we would be assigning
+	 * an out of bounds value to bytes_left (which is unsigned)
+	 * uiomove takes care to not ever set resid to < 0, so it
+	 * is safe to do this here.
+	 */
+	bytes_left = (size_t)((user_size_t)uio_resid(auio));
+	entlen = (size_t)(*((uint32_t *)(kern_attr_buf)));
+	if (!entlen || (entlen > bytes_left)) {
+		return ENOBUFS;
+	}
+
+	/*
+	 * Will the pad bytes fit as well  ? If they can't be, still use
+	 * this entry but this will be the last entry returned.
+	 */
+	pad_bytes = ((entlen + 7) & ~0x07) - entlen;
+	new_resid = 0;
+	if (pad_bytes && (entlen + pad_bytes <= bytes_left)) {
+		/*
+		 * While entlen can never be > ATTR_MAX_BUFFER,
+		 * (entlen + pad_bytes) can be, handle that and
+		 * zero out the pad bytes. N.B. - Only zero
+		 * out information in the kernel buffer that is
+		 * going to be uiomove'ed out.
+		 */
+		if (entlen + pad_bytes <= kern_attr_buf_siz) {
+			/* This is the normal case. */
+			bzero(kern_attr_buf + entlen, pad_bytes);
+		} else {
+			bzero(kern_attr_buf + entlen,
+			    kern_attr_buf_siz - entlen);
+			/*
+			 * Pad bytes left over, change the resid value
+			 * manually. We only got in here because
+			 * bytes_left >= entlen + pad_bytes so
+			 * new_resid (which is a signed type) is
+			 * always positive.
+			 */
+			new_resid = (ssize_t)(bytes_left -
+			    (entlen + pad_bytes));
+		}
+		entlen += pad_bytes;
+	}
+	*((uint32_t *)kern_attr_buf) = (uint32_t)entlen;
+	error = uiomove(kern_attr_buf, min(entlen, kern_attr_buf_siz),
+	    auio);
+
+	if (error) {
+		return error;
+	}
+
+	if (new_resid) {
+		uio_setresid(auio, (user_ssize_t)new_resid);
+	}
+	return 0;
+}
+
+/*
+ * Listing a directory without VNOP_GETATTRLISTBULK support costs a lookup
+ * and a getattr per entry.  Where those are round trips to a server they,
+ * not the CPU, bound how fast a big directory lists, so on such mounts
+ * readdirattr() takes the entries of the directory buffer a window at a
+ * time and hands the lookups and getattrs of a window to a pool of worker
+ * threads, to have them in flight together; the caller works through its
+ * own window as well, so it never waits behind other listings.  Entries
+ * are still copied out in directory order.
+ *
+ * The entries packed there are kept in an attribute cache, so that
+ * listing the same directory again does not look up (and create a vnode
+ * for) every entry again.  A cached entry is only used for the same
+ * directory, credential, attribute list and options, while the directory's
+ * modification time is unchanged and for at most vfs.attrlist.cache_ttl_ms,
+ * which bounds how stale the attributes of an entry can be, as the
+ * attribute caches of network filesystems already do.
+ *
+ * Both apply to mounts that are not MNT_LOCAL, unless vfs.attrlist.local
+ * is set.
+ */
+#define ATTRLIST_PREFETCH_THREADS       16      /* default, "attrlist_threads" boot-arg */
+#define ATTRLIST_PREFETCH_THREADS_MAX   64
+#define ATTRLIST_PREFETCH_WINDOW_MAX    32
+#define ATTRLIST_CACHE_HASH             1024    /* power of 2 */
+#define ATTRLIST_CACHE_ENTRY_MAX        1024    /* largest packed entry kept */
+
+/* states of a prefetch job */
+#define AJ_SKIP         0       /* not an entry to return */
+#define AJ_IDLE         1       /* not run yet, nor queued */
+#define AJ_QUEUED       2       /* on attrlist_prefetch_queue */
+#define AJ_RUNNING      3
+#define AJ_DONE         4
+
+struct attrlist_prefetch_window;
+
+struct attrlist_prefetch_job {
+	TAILQ_ENTRY(attrlist_prefetch_job) aj_link;
+	struct attrlist_prefetch_window *aj_window;
+	int             aj_state;
+	int             aj_error;       /* the lookup failed, leave the entry out */
+	char            *aj_name;       /* NUL terminated, MAXPATHLEN bytes */
+	caddr_t         aj_buf;         /* the packed entry, aw_bufsiz bytes */
+};
+
+struct attrlist_prefetch_window {
+	vnode_t         aw_dvp;         /* the caller holds an iocount */
+	uint32_t        aw_dvid;
+	kauth_cred_t    aw_cred;        /* the caller's */
+	struct attrlist *aw_alp;
+	uint64_t        aw_options;
+	size_t          aw_bufsiz;
+	int             aw_cache;       /* aw_mtime is valid, use the cache */
+	struct timespec aw_mtime;       /* of the directory */
+	int             aw_pending;     /* jobs queued or running on the pool */
+};
+
+struct attrlist_cache_entry {
+	TAILQ_ENTRY(attrlist_cache_entry) ace_lru;
+	LIST_ENTRY(attrlist_cache_entry) ace_hash;
+	vnode_t         ace_dvp;
+	uint32_t        ace_dvid;
+	struct timespec ace_mtime;
+	uint64_t        ace_expires;    /* mach_absolute_time() */
+	kauth_cred_t    ace_cred;       /* holds a reference */
+	struct attrlist ace_al;
+	uint64_t        ace_options;
+	uint32_t        ace_namelen;
+	uint32_t        ace_len;        /* of the packed entry */
+	char            *ace_name;      /* follows the packed entry */
+	char            ace_data[];
+};
+
+static lck_grp_t *attrlist_lck_grp;
+static lck_mtx_t *attrlist_prefetch_mtx;        /* protects the queue, job states and aw_pending */
+static TAILQ_HEAD(, attrlist_prefetch_job) attrlist_prefetch_queue;
+static int attrlist_prefetch_nthreads;
+
+static lck_mtx_t *attrlist_cache_mtx;           /* protects the attribute cache */
+static TAILQ_HEAD(, attrlist_cache_entry) attrlist_cache_lru;
+static LIST_HEAD(attrlist_cache_head, attrlist_cache_entry) attrlist_cache_hash[ATTRLIST_CACHE_HASH];
+static int attrlist_cache_count;
+
+static int attrlist_prefetch_window = 16;       /* entries in flight per listing, 0 or 1 disables */
+static int attrlist_local = 0;                  /* prefetch and cache on local mounts too */
+static int attrlist_cache_ttl_ms = 1000;        /* 0 disables the cache */
+static int attrlist_cache_max = 8192;
+
+static uint64_t attrlist_prefetched;
+static uint64_t attrlist_cache_hits;
+static uint64_t attrlist_cache_misses;
+
+SYSCTL_NODE(_vfs, OID_AUTO, attrlist, CTLFLAG_RW | CTLFLAG_LOCKED, NULL, "getattrlistbulk");
+
+SYSCTL_INT(_vfs_attrlist, OID_AUTO, prefetch_window, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &attrlist_prefetch_window, 0, "entries whose attributes are fetched concurrently");
+SYSCTL_INT(_vfs_attrlist, OID_AUTO, prefetch_threads, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &attrlist_prefetch_nthreads, 0, "attribute prefetch worker threads");
+SYSCTL_INT(_vfs_attrlist, OID_AUTO, local, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &attrlist_local, 0, "prefetch and cache attributes on local mounts too");
+SYSCTL_INT(_vfs_attrlist, OID_AUTO, cache_ttl_ms, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &attrlist_cache_ttl_ms, 0, "milliseconds a cached entry stays valid");
+SYSCTL_INT(_vfs_attrlist, OID_AUTO, cache_max, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &attrlist_cache_max, 0, "entries kept in the attribute cache");
+SYSCTL_INT(_vfs_attrlist, OID_AUTO, cache_count, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &attrlist_cache_count, 0, "entries currently in the attribute cache");
+SYSCTL_QUAD(_vfs_attrlist, OID_AUTO, prefetched, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &attrlist_prefetched, "entries handled by the prefetch workers");
+SYSCTL_QUAD(_vfs_attrlist, OID_AUTO, cache_hits, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &attrlist_cache_hits, "entries served from the attribute cache");
+SYSCTL_QUAD(_vfs_attrlist, OID_AUTO, cache_misses, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &attrlist_cache_misses, "entries looked up with the attribute cache on");
+
+static struct attrlist_cache_head *
+attrlist_cache_bucket(vnode_t dvp, const char *name, uint32_t namelen)
+{
+	uint32_t h = 2166136261U;
+
+	for (uint32_t i = 0; i < namelen; i++) {
+		h = (h ^ (uint8_t)name[i]) * 16777619U;
+	}
+	h ^= (uint32_t)((uintptr_t)dvp >> 6);
+	return &attrlist_cache_hash[h & (ATTRLIST_CACHE_HASH - 1)];
+}
+
+static void
+attrlist_cache_remove_locked(struct attrlist_cache_entry *ace)
+{
+	TAILQ_REMOVE(&attrlist_cache_lru, ace, ace_lru);
+	LIST_REMOVE(ace, ace_hash);
+	attrlist_cache_count--;
+}
+
+static void
+attrlist_cache_free(struct attrlist_cache_entry *ace)
+{
+	kauth_cred_unref(&ace->ace_cred);
+	FREE(ace, M_TEMP);
+}
+
+/*
+ * Evicts the least recently used entries until at most keep are left, and
+ * frees them once the cache lock is dropped.
+ */
+static void
+attrlist_cache_trim(int keep)
+{
+	TAILQ_HEAD(, attrlist_cache_entry) evicted = TAILQ_HEAD_INITIALIZER(evicted);
+	struct attrlist_cache_entry *ace;
+
+	lck_mtx_lock(attrlist_cache_mtx);
+	while (attrlist_cache_count > keep &&
+	    (ace = TAILQ_FIRST(&attrlist_cache_lru)) != NULL) {
+		attrlist_cache_remove_locked(ace);
+		TAILQ_INSERT_TAIL(&evicted, ace, ace_lru);
+	}
+	lck_mtx_unlock(attrlist_cache_mtx);
+
+	while ((ace = TAILQ_FIRST(&evicted)) != NULL) {
+		TAILQ_REMOVE(&evicted, ace, ace_lru);
+		attrlist_cache_free(ace);
+	}
+}
+
+/*
+ * Memory pressure callout from the buffer cache: drop everything when
+ * asked to, else the older half of the entries.
+ */
+static void
+attrlist_cache_gc(int all, __unused void *context)
+{
+	attrlist_cache_trim(all ? 0 : attrlist_cache_count / 2);
+}
+
+/*
+ * Copies the cached entry for name into buf, if there is a valid one for
+ * the window's listing.
+ */
+static int
+attrlist_cache_lookup(struct attrlist_prefetch_window *aw, const char *name,
+    caddr_t buf)
+{
+	struct attrlist_cache_entry *ace, *expired = NULL;
+	uint32_t namelen = (uint32_t)strlen(name);
+	int hit = 0;
+
+	lck_mtx_lock(attrlist_cache_mtx);
+	LIST_FOREACH(ace, attrlist_cache_bucket(aw->aw_dvp, name, namelen), ace_hash) {
+		if (ace->ace_dvp != aw->aw_dvp || ace->ace_dvid != aw->aw_dvid ||
+		    ace->ace_namelen != namelen || ace->ace_cred != aw->aw_cred ||
+		    ace->ace_options != aw->aw_options ||
+		    bcmp(ace->ace_name, name, namelen) != 0 ||
+		    bcmp(&ace->ace_al, aw->aw_alp, sizeof(struct attrlist)) != 0) {
+			continue;
+		}
+		if (ace->ace_mtime.tv_sec != aw->aw_mtime.tv_sec ||
+		    ace->ace_mtime.tv_nsec != aw->aw_mtime.tv_nsec ||
+		    ace->ace_expires < mach_absolute_time()) {
+			/* the directory changed since, or it is too old */
+			attrlist_cache_remove_locked(ace);
+			expired = ace;
+		} else if (ace->ace_len <= aw->aw_bufsiz) {
+			bcopy(ace->ace_data, buf, ace->ace_len);
+			TAILQ_REMOVE(&attrlist_cache_lru, ace, ace_lru);
+			TAILQ_INSERT_TAIL(&attrlist_cache_lru, ace, ace_lru);
+			hit = 1;
+		}
+		break;
+	}
+	lck_mtx_unlock(attrlist_cache_mtx);
+
+	if (expired) {
+		attrlist_cache_free(expired);
+	}
+	OSIncrementAtomic64(hit ? (SInt64 *)&attrlist_cache_hits :
+	    (SInt64 *)&attrlist_cache_misses);
+	return hit;
+}
+
+/*
+ * Keeps the entry packed in buf for name, unless it is too big or was
+ * only partly packed.
+ */
+static void
+attrlist_cache_insert(struct attrlist_prefetch_window *aw, const char *name,
+    caddr_t buf)
+{
+	struct attrlist_cache_entry *ace, *old;
+	uint32_t namelen = (uint32_t)strlen(name);
+	uint32_t len = *(uint32_t *)buf;
+	uint64_t ttl;
+
+	if (len == 0 || len > aw->aw_bufsiz || len > ATTRLIST_CACHE_ENTRY_MAX ||
+	    attrlist_cache_max <= 0) {
+		return;
+	}
+
+	MALLOC(ace, struct attrlist_cache_entry *, sizeof(*ace) + len + namelen + 1,
+	    M_TEMP, M_WAITOK);
+	if (ace == NULL) {
+		return;
+	}
+	nanoseconds_to_absolutetime((uint64_t)attrlist_cache_ttl_ms * NSEC_PER_MSEC, &ttl);
+	ace->ace_dvp = aw->aw_dvp;
+	ace->ace_dvid = aw->aw_dvid;
+	ace->ace_mtime = aw->aw_mtime;
+	ace->ace_expires = mach_absolute_time() + ttl;
+	ace->ace_cred = aw->aw_cred;
+	kauth_cred_ref(ace->ace_cred);
+	ace->ace_al = *aw->aw_alp;
+	ace->ace_options = aw->aw_options;
+	ace->ace_namelen = namelen;
+	ace->ace_len = len;
+	bcopy(buf, ace->ace_data, len);
+	ace->ace_name = ace->ace_data + len;
+	bcopy(name, ace->ace_name, namelen + 1);
+
+	lck_mtx_lock(attrlist_cache_mtx);
+	LIST_FOREACH(old, attrlist_cache_bucket(aw->aw_dvp, name, namelen), ace_hash) {
+		if (old->ace_dvp == aw->aw_dvp && old->ace_dvid == aw->aw_dvid &&
+		    old->ace_namelen == namelen && old->ace_cred == aw->aw_cred &&
+		    old->ace_options == aw->aw_options &&
+		    bcmp(old->ace_name, name, namelen) == 0 &&
+		    bcmp(&old->ace_al, aw->aw_alp, sizeof(struct attrlist)) == 0) {
+			attrlist_cache_remove_locked(old);
+			break;
+		}
+	}
+	TAILQ_INSERT_TAIL(&attrlist_cache_lru, ace, ace_lru);
+	LIST_INSERT_HEAD(attrlist_cache_bucket(aw->aw_dvp, name, namelen), ace, ace_hash);
+	attrlist_cache_count++;
+	lck_mtx_unlock(attrlist_cache_mtx);
+
+	if (old) {
+		attrlist_cache_free(old);
+	}
+	if (attrlist_cache_count > attrlist_cache_max) {
+		attrlist_cache_trim(attrlist_cache_max);
+	}
+}
+
+/*
+ * Looks up name in dvp and packs its attributes into buf as
+ * getattrlistbulk(2) returns them, or an error entry if they cannot be
+ * had.  Returns the error, having packed nothing, if the lookup fails, in
+ * which case the entry is left out of the listing.
+ */
+static int
+readdirattr_entry(struct attrlist_prefetch_window *aw, char *name, caddr_t buf,
+    vfs_context_t ctx)
+{
+	struct nameidata nd;
+	struct attrlist al;
+	vnode_t vp;
+	int error;
+
+	if (aw->aw_cache && attrlist_cache_lookup(aw, name, buf)) {
+		return 0;
+	}
+
+	/*
+	 * We have an iocount on the directory already.
+	 *
+	 * Note that we supply NOCROSSMOUNT to the namei call as we attempt to acquire
+	 * a vnode for this particular entry.  This is because the native call will
+	 * (likely) attempt to emit attributes based on its own metadata in order to avoid
+	 * creating vnodes where posssible.  If the native call is not going to  walk
+	 * up the vnode mounted-on chain in order to find the top-most mount point, then we
+	 * should not either in this emulated readdir+getattrlist() approach.  We
+	 * will be responsible for setting DIR_MNTSTATUS_MNTPOINT on that directory that
+	 * contains a mount point.
+	 */
+	NDINIT(&nd, LOOKUP, OP_GETATTR, (AUDITVNPATH1 | USEDVP | NOCROSSMOUNT),
+	    UIO_SYSSPACE, CAST_USER_ADDR_T(name), ctx);
+
+	nd.ni_dvp = aw->aw_dvp;
+	error = namei(&nd);
+	if (error) {
+		return error;
+	}
+
+	vp = nd.ni_vp;
+
+	/*
+	 * getattrlist_internal can change the values of the
+	 * the required attribute list. Copy the current values
+	 * and use that one instead.
+	 */
+	al = *aw->aw_alp;
+
+	error = getattrlist_internal(ctx, vp, &al,
+	    CAST_USER_ADDR_T(buf), aw->aw_bufsiz,
+	    aw->aw_options | FSOPT_REPORT_FULLSIZE, UIO_SYSSPACE,
+	    name, NOCRED);
+
+	nameidone(&nd);
+
+	if (error) {
+		get_error_attributes(vp, aw->aw_alp, aw->aw_options,
+		    CAST_USER_ADDR_T(buf), aw->aw_bufsiz, error, name, ctx);
+	} else if (aw->aw_cache) {
+		attrlist_cache_insert(aw, name, buf);
+	}
+
+	/* Done with vnode now */
+	vnode_put(vp);
+
+	return 0;
+}
+
+static void
+attrlist_prefetch_thread(__unused void *arg, __unused wait_result_t wr)
+{
+	uthread_t ut = get_bsdthread_info(current_thread());
+	struct attrlist_prefetch_window *aw;
+	struct attrlist_prefetch_job *aj;
+	struct vfs_context context;
+
+	/* vnodes created for a listing are not expected to be used again */
+	ut->uu_flag |= UT_KERN_RAGE_VNODES;
+
+	for (;;) {
+		lck_mtx_lock(attrlist_prefetch_mtx);
+		while ((aj = TAILQ_FIRST(&attrlist_prefetch_queue)) == NULL) {
+			msleep(&attrlist_prefetch_queue, attrlist_prefetch_mtx, PRIBIO,
+			    "attrlist_prefetch", NULL);
+		}
+		TAILQ_REMOVE(&attrlist_prefetch_queue, aj, aj_link);
+		aj->aj_state = AJ_RUNNING;
+		lck_mtx_unlock(attrlist_prefetch_mtx);
+
+		/* look up and authorize as the lister */
+		aw = aj->aj_window;
+		context.vc_thread = current_thread();
+		context.vc_ucred = aw->aw_cred;
+		aj->aj_error = readdirattr_entry(aw, aj->aj_name, aj->aj_buf, &context);
+		OSIncrementAtomic64((SInt64 *)&attrlist_prefetched);
+
+		lck_mtx_lock(attrlist_prefetch_mtx);
+		aj->aj_state = AJ_DONE;
+		if (--aw->aw_pending == 0) {
+			wakeup(aw);
+		}
+		lck_mtx_unlock(attrlist_prefetch_mtx);
+	}
+}
+
+/*
+ * Packs every entry of the window.  With more than one, they go to the
+ * pool, and the caller runs the ones no worker has picked up yet, in
+ * order, before waiting for the rest.
+ */
+static void
+readdirattr_window(struct attrlist_prefetch_window *aw,
+    struct attrlist_prefetch_job *jobs, int njobs, vfs_context_t ctx)
+{
+	struct attrlist_prefetch_job *aj;
+	int i, nqueue = 0;
+
+	if (njobs > 1 && attrlist_prefetch_nthreads > 0) {
+		lck_mtx_lock(attrlist_prefetch_mtx);
+		for (i = 0; i < njobs; i++) {
+			aj = &jobs[i];
+			if (aj->aj_state == AJ_IDLE) {
+				aj->aj_state = AJ_QUEUED;
+				TAILQ_INSERT_TAIL(&attrlist_prefetch_queue, aj, aj_link);
+				nqueue++;
+			}
+		}
+		aw->aw_pending += nqueue;
+		lck_mtx_unlock(attrlist_prefetch_mtx);
+		if (nqueue > 1) {
+			wakeup(&attrlist_prefetch_queue);
+		}
+	}
+
+	for (i = 0; i < njobs; i++) {
+		aj = &jobs[i];
+		if (aj->aj_state == AJ_QUEUED) {
+			lck_mtx_lock(attrlist_prefetch_mtx);
+			if (aj->aj_state != AJ_QUEUED) {
+				/* a worker has it */
+				lck_mtx_unlock(attrlist_prefetch_mtx);
+				continue;
+			}
+			TAILQ_REMOVE(&attrlist_prefetch_queue, aj, aj_link);
+			aj->aj_state = AJ_RUNNING;
+			aw->aw_pending--;
+			lck_mtx_unlock(attrlist_prefetch_mtx);
+		} else if (aj->aj_state != AJ_IDLE) {
+			continue;
+		}
+		aj->aj_error = readdirattr_entry(aw, aj->aj_name, aj->aj_buf, ctx);
+		aj->aj_state = AJ_DONE;
+	}
+
+	if (nqueue) {
+		lck_mtx_lock(attrlist_prefetch_mtx);
+		while (aw->aw_pending > 0) {
+			msleep(aw, attrlist_prefetch_mtx, PRIBIO, "attrlist_window", NULL);
+		}
+		lck_mtx_unlock(attrlist_prefetch_mtx);
+	}
+}
+
+/*
+ * Sets up the next njobs entries of the directory buffer, from the
+ * current one on, as a window, without consuming them.  Returns how many
+ * there were, at most njobs and never past the end of the buffer.
+ */
+static int
+readdirattr_fill_window(struct fd_vn_data *fvd, struct attrlist_prefetch_window *aw,
+    struct attrlist_prefetch_job *jobs, int njobs)
+{
+	struct direntry *dp;
+	size_t off = fvd->fv_bufdone;
+	int n;
+
+	for (n = 0; n < njobs && off < fvd->fv_bufsiz; n++) {
+		struct attrlist_prefetch_job *aj = &jobs[n];
+
+		dp = (struct direntry *)(fvd->fv_buf + off);
+		aj->aj_window = aw;
+		aj->aj_error = 0;
+
+		/*
+		 * skip "." and ".." (and a bunch of other invalid conditions.)
+		 */
+		if (!dp->d_reclen || dp->d_ino == 0 || dp->d_namlen == 0 ||
+		    (dp->d_namlen == 1 && dp->d_name[0] == '.') ||
+		    (dp->d_namlen == 2 && dp->d_name[0] == '.' &&
+		    dp->d_name[1] == '.')) {
+			aj->aj_state = AJ_SKIP;
+		} else {
+			/* the name need not be NUL terminated */
+			bcopy(dp->d_name, aj->aj_name, MIN(dp->d_namlen, MAXPATHLEN - 1));
+			aj->aj_name[MIN(dp->d_namlen, MAXPATHLEN - 1)] = '\0';
+			aj->aj_state = AJ_IDLE;
+		}
+
+		/* advance as direntry_done() will */
+		if (!dp->d_reclen) {
+			off = fvd->fv_bufsiz;
+		} else {
+			off += dp->d_reclen;
+		}
+	}
+	return n;
+}
+
+/*
+ * How many entries readdirattr() packs at a time in dvp: one, unless
+ * prefetching applies.  Also sets up the window for the attribute cache
+ * if that applies.
+ */
+static int
+readdirattr_window_size(vnode_t dvp, struct attrlist_prefetch_window *aw,
+    vfs_context_t ctx)
+{
+	struct vnode_attr va;
+	mount_t mp = vnode_mount(dvp);
+
+	if (mp == NULL || (!attrlist_local && (vfs_flags(mp) & MNT_LOCAL))) {
+		return 1;
+	}
+
+	if (attrlist_cache_ttl_ms > 0 && attrlist_cache_max > 0) {
+		VATTR_INIT(&va);
+		VATTR_WANTED(&va, va_modify_time);
+		if (vnode_getattr(dvp, &va, ctx) == 0 &&
+		    VATTR_IS_SUPPORTED(&va, va_modify_time)) {
+			aw->aw_mtime = va.va_modify_time;
+			aw->aw_cache = 1;
+		}
+	}
+
+	if (attrlist_prefetch_nthreads == 0) {
+		return 1;
+	}
+	return MAX(MIN(attrlist_prefetch_window, ATTRLIST_PREFETCH_WINDOW_MAX), 1);
+}
+
+void
+attrlist_init(void)
+{
+	int nthreads = ATTRLIST_PREFETCH_THREADS;
+
+	attrlist_lck_grp = lck_grp_alloc_init("attrlist", LCK_GRP_ATTR_NULL);
+	attrlist_prefetch_mtx = lck_mtx_alloc_init(attrlist_lck_grp, LCK_ATTR_NULL);
+	attrlist_cache_mtx = lck_mtx_alloc_init(attrlist_lck_grp, LCK_ATTR_NULL);
+	TAILQ_INIT(&attrlist_prefetch_queue);
+	TAILQ_INIT(&attrlist_cache_lru);
+	for (int i = 0; i < ATTRLIST_CACHE_HASH; i++) {
+		LIST_INIT(&attrlist_cache_hash[i]);
+	}
+	fs_buffer_cache_gc_register(attrlist_cache_gc, NULL);
+
+	/* the workers mostly wait on servers, so more of them than CPUs is fine */
+	PE_parse_boot_argn("attrlist_threads", &nthreads, sizeof(nthreads));
+	nthreads = MIN(MAX(nthreads, 0), ATTRLIST_PREFETCH_THREADS_MAX);
+	for (int i = 0; i < nthreads; i++) {
+		thread_t thread;
+
+		if (kernel_thread_start(attrlist_prefetch_thread, NULL, &thread) != KERN_SUCCESS) {
+			printf("attrlist: failed to start prefetch thread %d\n", i);
+			break;
+		}
+		thread_deallocate(thread);
+		attrlist_prefetch_nthreads++;
+	}
+}
+
 /*
  * Read directory entries and get attributes filled in for each directory
  */
@@ -3736,9 +4376,12 @@ readdirattr(vnode_t dvp, struct fd_vn_data *fvd, uio_t auio,
     struct attrlist *alp, uint64_t options, int *count, int *eofflagp,
     vfs_context_t ctx)
 {
-	caddr_t kern_attr_buf;
+	struct attrlist_prefetch_window aw;
+	struct attrlist_prefetch_job *jobs = NULL;
+	caddr_t kern_attr_buf = NULL;
+	char *names = NULL;
 	size_t kern_attr_buf_siz;
-	caddr_t max_path_name_buf = NULL;
+	int window, njobs, i;
 	int error = 0;
 
 	*count = 0;
@@ -3749,8 +4392,9 @@ readdirattr(vnode_t dvp, struct fd_vn_data *fvd, uio_t auio,
 	}
 
 	/*
-	 * We fill in a kernel buffer for the attributes and uiomove each
-	 * entry's attributes (as returned by getattrlist_internal)
+	 * We fill in a kernel buffer for the attributes of each entry of
+	 * the window and uiomove each entry's attributes (as returned by
+	 * getattrlist_internal)
 	 */
 	kern_attr_buf_siz = uio_resid(auio);
 	if (kern_attr_buf_siz > ATTR_MAX_BUFFER) {
@@ -3760,18 +4404,26 @@ readdirattr(vnode_t dvp, struct fd_vn_data *fvd, uio_t auio,
 		return error;
 	}
 
-	MALLOC(kern_attr_buf, caddr_t, kern_attr_buf_siz, M_TEMP, M_WAITOK);
+	bzero(&aw, sizeof(aw));
+	aw.aw_dvp = dvp;
+	aw.aw_dvid = vnode_vid(dvp);
+	aw.aw_cred = vfs_context_ucred(ctx);
+	aw.aw_alp = alp;
+	aw.aw_options = options;
+	aw.aw_bufsiz = kern_attr_buf_siz;
+	window = readdirattr_window_size(dvp, &aw, ctx);
+
+	MALLOC(jobs, struct attrlist_prefetch_job *, window * sizeof(*jobs),
+	    M_TEMP, M_WAITOK | M_ZERO);
+	MALLOC(kern_attr_buf, caddr_t, window * kern_attr_buf_siz, M_TEMP, M_WAITOK);
+	MALLOC(names, char *, window * MAXPATHLEN, M_TEMP, M_WAITOK);
+	for (i = 0; i < window; i++) {
+		jobs[i].aj_buf = kern_attr_buf + i * kern_attr_buf_siz;
+		jobs[i].aj_name = names + i * MAXPATHLEN;
+	}
 
 	while (uio_resid(auio) > (user_ssize_t)MIN_BUF_SIZE_REQUIRED) {
 		struct direntry *dp;
-		user_addr_t name_buffer;
-		struct nameidata nd;
-		vnode_t vp;
-		struct attrlist al;
-		size_t entlen;
-		size_t bytes_left;
-		size_t pad_bytes;
-		ssize_t new_resid;
 
 		/*
 		 * get_direntry returns the current direntry and does not
@@ -3783,163 +4435,43 @@ readdirattr(vnode_t dvp, struct fd_vn_data *fvd, uio_t auio,
 			break;
 		}
 
-		/*
-		 * skip "." and ".." (and a bunch of other invalid conditions.)
-		 */
-		if (!dp->d_reclen || dp->d_ino == 0 || dp->d_namlen == 0 ||
-		    (dp->d_namlen == 1 && dp->d_name[0] == '.') ||
-		    (dp->d_namlen == 2 && dp->d_name[0] == '.' &&
-		    dp->d_name[1] == '.')) {
-			direntry_done(fvd);
-			continue;
-		}
+		njobs = readdirattr_fill_window(fvd, &aw, jobs, window);
+		readdirattr_window(&aw, jobs, njobs, ctx);
 
-		/*
-		 * try to deal with not-null terminated filenames.
-		 */
-		if (dp->d_name[dp->d_namlen] != '\0') {
-			if (!max_path_name_buf) {
-				MALLOC(max_path_name_buf, caddr_t, MAXPATHLEN,
-				    M_TEMP, M_WAITOK);
+		for (i = 0; i < njobs; i++) {
+			if (jobs[i].aj_state == AJ_SKIP || jobs[i].aj_error) {
+				direntry_done(fvd);
+				continue;
 			}
-			bcopy(dp->d_name, max_path_name_buf, dp->d_namlen);
-			max_path_name_buf[dp->d_namlen] = '\0';
-			name_buffer = CAST_USER_ADDR_T(max_path_name_buf);
-		} else {
-			name_buffer = CAST_USER_ADDR_T(&(dp->d_name));
-		}
-
-		/*
-		 * We have an iocount on the directory already.
-		 *
-		 * Note that we supply NOCROSSMOUNT to the namei call as we attempt to acquire
-		 * a vnode for this particular entry.  This is because the native call will
-		 * (likely) attempt to emit attributes based on its own metadata in order to avoid
-		 * creating vnodes where posssible.  If the native call is not going to  walk
-		 * up the vnode mounted-on chain in order to find the top-most mount point, then we
-		 * should not either in this emulated readdir+getattrlist() approach.  We
-		 * will be responsible for setting DIR_MNTSTATUS_MNTPOINT on that directory that
-		 * contains a mount point.
-		 */
-		NDINIT(&nd, LOOKUP, OP_GETATTR, (AUDITVNPATH1 | USEDVP | NOCROSSMOUNT),
-		    UIO_SYSSPACE, CAST_USER_ADDR_T(name_buffer), ctx);
 
-		nd.ni_dvp = dvp;
-		error = namei(&nd);
+			error = attrlist_bulk_copyout(jobs[i].aj_buf,
+			    kern_attr_buf_siz, auio);
+			if (error) {
+				break;
+			}
 
-		if (error) {
+			/*
+			 * At this point, the directory entry has been consumed,
+			 * proceed to the next one.
+			 */
+			(*count)++;
 			direntry_done(fvd);
-			error = 0;
-			continue;
 		}
-
-		vp = nd.ni_vp;
-
-		/*
-		 * getattrlist_internal can change the values of the
-		 * the required attribute list. Copy the current values
-		 * and use that one instead.
-		 */
-		al = *alp;
-
-		error = getattrlist_internal(ctx, vp, &al,
-		    CAST_USER_ADDR_T(kern_attr_buf), kern_attr_buf_siz,
-		    options | FSOPT_REPORT_FULLSIZE, UIO_SYSSPACE,
-		    CAST_DOWN_EXPLICIT(char *, name_buffer),
-		    NOCRED);
-
-		nameidone(&nd);
-
 		if (error) {
-			get_error_attributes(vp, alp, options,
-			    CAST_USER_ADDR_T(kern_attr_buf),
-			    kern_attr_buf_siz, error, (caddr_t)name_buffer,
-			    ctx);
-			error = 0;
-		}
-
-		/* Done with vnode now */
-		vnode_put(vp);
-
-		/*
-		 * Because FSOPT_REPORT_FULLSIZE was set, the first 4 bytes
-		 * of the buffer returned by getattrlist contains the size
-		 * (even if the provided buffer isn't sufficiently big). Use
-		 * that to check if we've run out of buffer space.
-		 *
-		 * resid is a signed type, and the size of the buffer etc
-		 * are unsigned types. It is theoretically possible for
-		 * resid to be < 0 and in which case we would be assigning
-		 * an out of bounds value to bytes_left (which is unsigned)
-		 * uiomove takes care to not ever set resid to < 0, so it
-		 * is safe to do this here.
-		 */
-		bytes_left = (size_t)((user_size_t)uio_resid(auio));
-		entlen = (size_t)(*((uint32_t *)(kern_attr_buf)));
-		if (!entlen || (entlen > bytes_left)) {
-			break;
-		}
-
-		/*
-		 * Will the pad bytes fit as well  ? If they can't be, still use
-		 * this entry but this will be the last entry returned.
-		 */
-		pad_bytes = ((entlen + 7) & ~0x07) - entlen;
-		new_resid = 0;
-		if (pad_bytes && (entlen + pad_bytes <= bytes_left)) {
 			/*
-			 * While entlen can never be > ATTR_MAX_BUFFER,
-			 * (entlen + pad_bytes) can be, handle that and
-			 * zero out the pad bytes. N.B. - Only zero
-			 * out information in the kernel buffer that is
-			 * going to be uiomove'ed out.
+			 * The rest of the window stays in the directory
+			 * buffer for the next call.
 			 */
-			if (entlen + pad_bytes <= kern_attr_buf_siz) {
-				/* This is the normal case. */
-				bzero(kern_attr_buf + entlen, pad_bytes);
-			} else {
-				bzero(kern_attr_buf + entlen,
-				    kern_attr_buf_siz - entlen);
-				/*
-				 * Pad bytes left over, change the resid value
-				 * manually. We only got in here because
-				 * bytes_left >= entlen + pad_bytes so
-				 * new_resid (which is a signed type) is
-				 * always positive.
-				 */
-				new_resid = (ssize_t)(bytes_left -
-				    (entlen + pad_bytes));
+			if (error == ENOBUFS) {
+				error = 0;
 			}
-			entlen += pad_bytes;
-		}
-		*((uint32_t *)kern_attr_buf) = (uint32_t)entlen;
-		error = uiomove(kern_attr_buf, min(entlen, kern_attr_buf_siz),
-		    auio);
-
-		if (error) {
 			break;
 		}
-
-		if (new_resid) {
-			uio_setresid(auio, (user_ssize_t)new_resid);
-		}
-
-		/*
-		 * At this point, the directory entry has been consumed, proceed
-		 * to the next one.
-		 */
-		(*count)++;
-		direntry_done(fvd);
-	}
-
-	if (max_path_name_buf) {
-		FREE(max_path_name_buf, M_TEMP);
 	}
 
-	/*
-	 * At this point, kern_attr_buf is always allocated
-	 */
+	FREE(names, M_TEMP);
 	FREE(kern_attr_buf, M_TEMP);
+	FREE(jobs, M_TEMP);
 
 	/*
 	 * Always set the offset to the last succesful offset
@@ -4198,6 +4730,186 @@ out:
 	return error;
 }
 
+/*
+ * int getattrlistatv(int dirfd, const char *paths, size_t pathsSize,
+ *    struct attrlist *alist, void *attributeBuffer, size_t bufferSize,
+ *    uint64_t options)
+ *
+ * Gets the attributes of a list of file system objects, named by paths
+ * relative to dirfd, in the format getattrlistbulk(2) uses for
+ * directory entries.  paths holds pathsSize bytes of NUL terminated
+ * paths back to back.  One entry is returned per path, in order, with
+ * ATTR_CMN_NAME set to the path as passed in; a path that cannot be
+ * looked up still gets an entry, with ATTR_CMN_ERROR set if requested.
+ *
+ * The paths are copied in at once and dirfd is resolved once for the
+ * whole call, so what remains per path is the name cache walk (whose
+ * search checks hit the per-vnode authorization cache) and the getattr.
+ *
+ * On non error returns, retval will hold the count of entries returned,
+ * which is less than the number of paths if attributeBuffer filled up.
+ */
+int
+getattrlistatv(proc_t p, struct getattrlistatv_args *uap, int32_t *retval)
+{
+	struct attrlist al, cur_al;
+	struct nameidata nd;
+	vnode_t dvp = NULLVP;
+	vnode_t vp;
+	vfs_context_t ctx;
+	enum uio_seg segflg;
+	uio_t auio;
+	char uio_buf[UIO_SIZEOF(1)];
+	char *paths = NULL;
+	char *path, *end;
+	caddr_t kern_attr_buf = NULL;
+	size_t kern_attr_buf_siz;
+	uint64_t options;
+	int32_t nameiflags;
+	int count;
+	int error;
+
+	*retval = 0;
+	count = 0;
+	ctx = vfs_context_current();
+	segflg = IS_64BIT_PROCESS(p) ? UIO_USERSPACE64 : UIO_USERSPACE32;
+
+	if (uap->pathsSize == 0 || uap->pathsSize > ATTR_MAX_PATHS_BUFFER) {
+		return EINVAL;
+	}
+	if (uap->bufferSize < MIN_BUF_SIZE_REQUIRED) {
+		return ERANGE;
+	}
+
+	if ((error = copyin(CAST_USER_ADDR_T(uap->alist), &al,
+	    sizeof(struct attrlist)))) {
+		return error;
+	}
+
+	if (al.bitmapcount != ATTR_BIT_MAP_COUNT || al.volattr ||
+	    ((al.commonattr & ATTR_BULK_REQUIRED) != ATTR_BULK_REQUIRED)) {
+		return EINVAL;
+	}
+
+	options = uap->options | FSOPT_ATTR_CMN_EXTENDED;
+
+	MALLOC(paths, char *, uap->pathsSize, M_TEMP, M_WAITOK);
+	if (paths == NULL) {
+		return ENOMEM;
+	}
+	error = copyin(uap->paths, paths, uap->pathsSize);
+	if (error) {
+		goto out;
+	}
+
+	/*
+	 * Every path must be NUL terminated and fit in MAXPATHLEN, as
+	 * namei would have it, before anything is returned.
+	 */
+	end = paths + uap->pathsSize;
+	if (end[-1] != '\0') {
+		error = EINVAL;
+		goto out;
+	}
+	for (path = paths; path < end; path += strlen(path) + 1) {
+		if (strlen(path) >= MAXPATHLEN) {
+			error = ENAMETOOLONG;
+			goto out;
+		}
+	}
+
+	if (uap->dirfd != AT_FDCWD) {
+		error = vnode_getfromfd(ctx, uap->dirfd, &dvp);
+		if (error) {
+			dvp = NULLVP;
+			goto out;
+		}
+		if (vnode_vtype(dvp) != VDIR) {
+			error = ENOTDIR;
+			goto out;
+		}
+	}
+
+	kern_attr_buf_siz = MIN(uap->bufferSize, ATTR_MAX_BUFFER);
+	MALLOC(kern_attr_buf, caddr_t, kern_attr_buf_siz, M_TEMP, M_WAITOK);
+
+	auio = uio_createwithbuffer(1, 0, segflg, UIO_READ,
+	    &uio_buf[0], sizeof(uio_buf));
+	uio_addiov(auio, uap->attributeBuffer, (user_size_t)uap->bufferSize);
+
+	nameiflags = 0;
+	if (!(options & FSOPT_NOFOLLOW)) {
+		nameiflags |= FOLLOW;
+	}
+
+	for (path = paths; path < end; path += strlen(path) + 1) {
+		if (uio_resid(auio) <= (user_ssize_t)MIN_BUF_SIZE_REQUIRED) {
+			break;
+		}
+
+		NDINIT(&nd, LOOKUP, OP_GETATTR, nameiflags, UIO_SYSSPACE,
+		    CAST_USER_ADDR_T(path), ctx);
+		if (dvp != NULLVP && path[0] != '/') {
+			nd.ni_dvp = dvp;
+			nd.ni_cnd.cn_flags |= USEDVP;
+		}
+
+		vp = NULLVP;
+		error = namei(&nd);
+		if (error == 0) {
+			vp = nd.ni_vp;
+
+			/*
+			 * getattrlist_internal can change the values of the
+			 * the required attribute list, so use a copy.
+			 */
+			cur_al = al;
+			error = getattrlist_internal(ctx, vp, &cur_al,
+			    CAST_USER_ADDR_T(kern_attr_buf), kern_attr_buf_siz,
+			    options | FSOPT_REPORT_FULLSIZE, UIO_SYSSPACE,
+			    path, NOCRED);
+			nameidone(&nd);
+		}
+		if (error) {
+			get_error_attributes(vp, &al, options,
+			    CAST_USER_ADDR_T(kern_attr_buf), kern_attr_buf_siz,
+			    error, path, ctx);
+		}
+		if (vp != NULLVP) {
+			vnode_put(vp);
+		}
+
+		error = attrlist_bulk_copyout(kern_attr_buf, kern_attr_buf_siz,
+		    auio);
+		if (error) {
+			if (error == ENOBUFS) {
+				error = 0;
+			}
+			break;
+		}
+		count++;
+	}
+
+	if (count) {
+		*retval = count;
+		error = 0;
+	} else if (!error) {
+		/* the buffer cannot hold even the first entry */
+		error = ERANGE;
+	}
+
+out:
+	if (kern_attr_buf) {
+		FREE(kern_attr_buf, M_TEMP);
+	}
+	if (dvp) {
+		vnode_put(dvp);
+	}
+	FREE(paths, M_TEMP);
+
+	return error;
+}
+
 static int
 attrlist_unpack_fixed(char **cursor, char *end, void *buf, ssize_t size)
 {
@@ -86,6 +86,7 @@
 #include <miscfs/specfs/specdev.h>
 #include <sys/ubc.h>
 #include <sys/kauth.h>
+#include <sys/sysctl.h>
 #if DIAGNOSTIC
 #include <kern/assert.h>
 #endif /* DIAGNOSTIC */
@@ -93,6 +94,9 @@
 #include <kern/zalloc.h>
 #include <kern/locks.h>
 #include <kern/thread.h>
+#include <kern/cpu_number.h>
+#include <machine/machine_routines.h>
+#include <pexpert/pexpert.h>
 
 #include <sys/fslog.h>          /* fslog_io_error() */
 #include <sys/disk.h>           /* dk_error_description_t */
@@ -116,10 +120,11 @@ int     bcleanbuf(buf_t bp, boolean_t discard);
 static int      brecover_data(buf_t bp);
 static boolean_t incore(vnode_t vp, daddr64_t blkno);
 /* timeout is in msecs */
-static buf_t    getnewbuf(int slpflag, int slptimeo, int *queue);
+static buf_t    getnewbuf(int slpflag, int slptimeo, int *queue, int stripe);
 static void     bremfree_locked(buf_t bp);
 static void     buf_reassign(buf_t bp, vnode_t newvp);
 static errno_t  buf_acquire_locked(buf_t bp, int flags, int slpflag, int slptimeo);
+static errno_t  buf_acquire_common(buf_t bp, int flags, int slpflag, int slptimeo, boolean_t list_locked);
 static int      buf_iterprepare(vnode_t vp, struct buflists *, int flags);
 static void     buf_itercomplete(vnode_t vp, struct buflists *, int flags);
 static boolean_t buffer_cache_gc(int);
@@ -146,11 +151,18 @@ static int      buf_hdr_count;
 /*
  * Definitions for the buffer hash lists.
  */
-#define BUFHASH(dvp, lbn)       \
-	(&bufhashtbl[((long)(dvp) / sizeof(*(dvp)) + (int)(lbn)) & bufhash])
-LIST_HEAD(bufhashhdr, buf) * bufhashtbl, invalhash;
+#define BUFHASHINDEX(dvp, lbn)  \
+	(((long)(dvp) / sizeof(*(dvp)) + (int)(lbn)) & bufhash)
+#define BUFHASH(dvp, lbn)       (&bufhashtbl[BUFHASHINDEX(dvp, lbn)])
+LIST_HEAD(bufhashhdr, buf) * bufhashtbl;
 u_long  bufhash;
 
+/*
+ * A buffer that isn't hashed (empty or invalid) is on no hash chain
+ * at all, with b_hash.le_prev set to 0xdeadbeef by BLISTNONE()
+ */
+#define BUFHASHED(bp)   ((bp)->b_hash.le_prev != (struct buf **)0xdeadbeef)
+
 static buf_t    incore_locked(vnode_t vp, daddr64_t blkno, struct bufhashhdr *dp);
 
 /* Definitions for the buffer stats. */
@@ -164,7 +176,7 @@ static int boot_nbuf_headers = 0;
 static TAILQ_HEAD(delayqueue, buf) delaybufqueue;
 
 static TAILQ_HEAD(ioqueue, buf) iobufqueue;
-static TAILQ_HEAD(bqueues, buf) bufqueues[BQUEUES];
+TAILQ_HEAD(bqueues, buf);
 static int needbuffer;
 static int need_iobuffer;
 
@@ -177,6 +189,105 @@ static lck_mtx_t        *buf_gc_callout;
 
 static int buf_busycount;
 
+/*
+ * The buffer cache is split into stripes, one per cpu rounded up to a
+ * power of 2 by default (boot-arg "bufstripes" overrides it).  Hash
+ * bucket i belongs to stripe (i % buf_nstripes), and every buffer
+ * belongs to the stripe in b_stripe: the one of the bucket it is
+ * hashed on, or wherever it was last put if it isn't hashed.  The
+ * stripe's lock protects its hash chains, its free queues, and the
+ * b_lflags, b_whichq, b_freelist and b_shadow state of its buffers, so
+ * finding a buffer in the cache and releasing it back only take the
+ * lock of its stripe.
+ *
+ * buf_mtxp still protects the vnode buffer lists, creating and
+ * recycling buffers, and needbuffer.  b_stripe only changes with
+ * buf_mtxp held: on a buffer that is busy and on no list, or on an
+ * empty buffer moved between two stripes with both their locks held,
+ * which nothing can reach but through those stripes' queues.  So
+ * anyone holding buf_mtxp or owning the buffer, or who found it
+ * through its stripe, can lock bp->b_stripe without rechecking it.
+ *
+ * Lock order: buf_mtxp, then a stripe lock, then a second stripe lock
+ * of higher index.
+ */
+#define BUF_STRIPES_MAX         64
+#define BUF_STRIPE_BATCH        16      /* empty headers moved per refill */
+
+static struct bufstripe {
+	lck_mtx_t       bs_mtx;
+	struct bqueues  bs_queues[BQUEUES];
+	uint64_t        bs_locks;               /* times bs_mtx was taken */
+	uint64_t        bs_contended;           /* ... and was held by someone else */
+} __attribute__((aligned(128))) buf_stripes[BUF_STRIPES_MAX];  /* one cache line each */
+
+static int buf_nstripes = 1;
+static int buf_gc_stripe;
+
+#define BUFSTRIPE(dvp, lbn)     ((int)(BUFHASHINDEX(dvp, lbn) & (buf_nstripes - 1)))
+
+static __inline__ struct bufstripe *
+buf_stripe_lock(int stripe)
+{
+	struct bufstripe *bs = &buf_stripes[stripe];
+
+	if (!lck_mtx_try_lock_spin(&bs->bs_mtx)) {
+		lck_mtx_lock_spin(&bs->bs_mtx);
+		bs->bs_contended++;
+	}
+	bs->bs_locks++;
+
+	return bs;
+}
+
+static __inline__ void
+buf_stripe_unlock(struct bufstripe *bs)
+{
+	lck_mtx_unlock(&bs->bs_mtx);
+}
+
+/* the stripe the current cpu prefers when no bucket is involved */
+static __inline__ int
+buf_stripe_local(void)
+{
+	return cpu_number() & (buf_nstripes - 1);
+}
+
+/*
+ * Sum of a stripe lock counter (arg2 is its offset) over all the
+ * stripes... racy, but the counters only go up
+ */
+static int
+sysctl_buf_stripe_count SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1)
+	uint64_t count = 0;
+	int i;
+
+	if (req->newptr != USER_ADDR_NULL) {
+		return EPERM;
+	}
+	for (i = 0; i < buf_nstripes; i++) {
+		count += *(uint64_t *)((char *)&buf_stripes[i] + arg2);
+	}
+	return SYSCTL_OUT(req, &count, sizeof(count));
+}
+
+SYSCTL_NODE(_vfs, OID_AUTO, bufcache, CTLFLAG_RW | CTLFLAG_LOCKED, NULL, "buffer cache");
+
+SYSCTL_INT(_vfs_bufcache, OID_AUTO, stripes, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &buf_nstripes, 0, "number of buffer cache stripes");
+
+SYSCTL_PROC(_vfs_bufcache, OID_AUTO, lock_acquisitions,
+    CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+    NULL, offsetof(struct bufstripe, bs_locks), sysctl_buf_stripe_count, "Q",
+    "times a buffer cache stripe lock was taken");
+
+SYSCTL_PROC(_vfs_bufcache, OID_AUTO, lock_contended,
+    CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,
+    NULL, offsetof(struct bufstripe, bs_contended), sysctl_buf_stripe_count, "Q",
+    "times a buffer cache stripe lock was found held by someone else");
+
 #define FS_BUFFER_CACHE_GC_CALLOUTS_MAX_SIZE 16
 typedef struct {
 	void (* callout)(int, void *);
@@ -195,6 +306,7 @@ buf_timestamp(void)
 
 /*
  * Insq/Remq for the buffer free lists.
+ * dp is one of the queues of the buffer's stripe, whose lock is held.
  */
 #define binsheadfree(bp, dp, whichq)    do { \
 	                            TAILQ_INSERT_HEAD(dp, bp, b_freelist); \
@@ -287,15 +399,15 @@ bremhash(buf_t  bp)
 }
 
 /*
- * buf_mtxp held.
+ * buf_mtxp and the buffer's stripe lock held.
  */
 static __inline__ void
 bmovelaundry(buf_t bp)
 {
 	bp->b_whichq = BQ_LAUNDRY;
 	bp->b_timestamp = buf_timestamp();
-	binstailfree(bp, &bufqueues[BQ_LAUNDRY], BQ_LAUNDRY);
-	blaundrycnt++;
+	binstailfree(bp, &buf_stripes[bp->b_stripe].bs_queues[BQ_LAUNDRY], BQ_LAUNDRY);
+	OSAddAtomic(1, &blaundrycnt);
 }
 
 static __inline__ void
@@ -865,6 +977,7 @@ buf_create_shadow(buf_t bp, boolean_t force_copy, uintptr_t external_storage, vo
 static buf_t
 buf_create_shadow_internal(buf_t bp, boolean_t force_copy, uintptr_t external_storage, void (*iodone)(buf_t, void *), void *arg, int priv)
 {
+	struct bufstripe *bs;
 	buf_t   io_bp;
 
 	KERNEL_DEBUG(0xbbbbc000 | DBG_FUNC_START, bp, 0, 0, 0, 0);
@@ -906,7 +1019,7 @@ buf_create_shadow_internal(buf_t bp, boolean_t force_copy, uintptr_t external_st
 		}
 		*(buf_t *)(&io_bp->b_orig) = bp;
 
-		lck_mtx_lock_spin(buf_mtxp);
+		bs = buf_stripe_lock(bp->b_stripe);
 
 		io_bp->b_lflags |= BL_SHADOW;
 		io_bp->b_shadow = bp->b_shadow;
@@ -920,7 +1033,7 @@ buf_create_shadow_internal(buf_t bp, boolean_t force_copy, uintptr_t external_st
 			bp->b_data_ref++;
 		}
 #endif
-		lck_mtx_unlock(buf_mtxp);
+		buf_stripe_unlock(bs);
 	} else {
 		if (external_storage) {
 #ifdef BUF_MAKE_PRIVATE
@@ -950,6 +1063,7 @@ buf_create_shadow_internal(buf_t bp, boolean_t force_copy, uintptr_t external_st
 errno_t
 buf_make_private(buf_t bp)
 {
+	struct bufstripe *bs;
 	buf_t   ds_bp;
 	buf_t   t_bp;
 	struct buf my_buf;
@@ -966,7 +1080,7 @@ buf_make_private(buf_t bp)
 
 	bcopy((caddr_t)bp->b_datap, (caddr_t)my_buf.b_datap, bp->b_bcount);
 
-	lck_mtx_lock_spin(buf_mtxp);
+	bs = buf_stripe_lock(bp->b_stripe);
 
 	for (t_bp = bp->b_shadow; t_bp; t_bp = t_bp->b_shadow) {
 		if (!ISSET(bp->b_lflags, BL_EXTERNAL)) {
@@ -984,7 +1098,7 @@ buf_make_private(buf_t bp)
 	}
 
 	if (ds_bp == NULL) {
-		lck_mtx_unlock(buf_mtxp);
+		buf_stripe_unlock(bs);
 
 		buf_free_meta_store(&my_buf);
 
@@ -1001,7 +1115,7 @@ buf_make_private(buf_t bp)
 	bp->b_data_ref = 0;
 	bp->b_datap = my_buf.b_datap;
 
-	lck_mtx_unlock(buf_mtxp);
+	buf_stripe_unlock(bs);
 
 	KERNEL_DEBUG(0xbbbbc004 | DBG_FUNC_END, bp, bp->b_shadow_ref, 0, 0, 0);
 	return 0;
@@ -1946,6 +2060,10 @@ buf_itercomplete(vnode_t vp, struct buflists *iterheadp, int flags)
 }
 
 
+/*
+ * Take a buffer off its free list.
+ * the buffer's stripe lock must be held
+ */
 static void
 bremfree_locked(buf_t bp)
 {
@@ -1973,7 +2091,7 @@ bremfree_locked(buf_t bp)
 	 * NB: This makes an assumption about how tailq's are implemented.
 	 */
 	if (bp->b_freelist.tqe_next == NULL) {
-		dp = &bufqueues[whichq];
+		dp = &buf_stripes[bp->b_stripe].bs_queues[whichq];
 
 		if (dp->tqh_last != &bp->b_freelist.tqe_next) {
 			panic("bremfree: lost tail");
@@ -1982,7 +2100,7 @@ bremfree_locked(buf_t bp)
 	TAILQ_REMOVE(dp, bp, b_freelist);
 
 	if (whichq == BQ_LAUNDRY) {
-		blaundrycnt--;
+		OSAddAtomic(-1, &blaundrycnt);
 	}
 
 	bp->b_whichq = -1;
@@ -2086,29 +2204,46 @@ bufinit(void)
 {
 	buf_t   bp;
 	struct bqueues *dp;
-	int     i;
+	int     nstripes;
+	int     i, q;
 
 	nbuf_headers = 0;
-	/* Initialize the buffer queues ('freelists') and the hash table */
-	for (dp = bufqueues; dp < &bufqueues[BQUEUES]; dp++) {
-		TAILQ_INIT(dp);
-	}
 	bufhashtbl = hashinit(nbuf_hashelements, M_CACHE, &bufhash);
 
+	/*
+	 * one stripe per cpu, rounded up to a power of 2... but no more
+	 * stripes than hash buckets
+	 */
+	if (!PE_parse_boot_argn("bufstripes", &nstripes, sizeof(nstripes))) {
+		nstripes = ml_get_max_cpus();
+	}
+	nstripes = MAX(1, MIN(nstripes, BUF_STRIPES_MAX));
+	nstripes = MIN(nstripes, (int)(bufhash + 1));
+	for (buf_nstripes = 1; buf_nstripes < nstripes; buf_nstripes <<= 1) {
+		;
+	}
+
+	/* Initialize the buffer queues ('freelists') of each stripe */
+	for (i = 0; i < buf_nstripes; i++) {
+		for (q = 0; q < BQUEUES; q++) {
+			TAILQ_INIT(&buf_stripes[i].bs_queues[q]);
+		}
+	}
+
 	buf_busycount = 0;
 
-	/* Initialize the buffer headers */
+	/* Initialize the buffer headers, spread across the stripes */
 	for (i = 0; i < max_nbuf_headers; i++) {
 		nbuf_headers++;
 		bp = &buf_headers[i];
 		bufhdrinit(bp);
 
 		BLISTNONE(bp);
-		dp = &bufqueues[BQ_EMPTY];
+		bp->b_stripe = i & (buf_nstripes - 1);
+		dp = &buf_stripes[bp->b_stripe].bs_queues[BQ_EMPTY];
 		bp->b_whichq = BQ_EMPTY;
 		bp->b_timestamp = buf_timestamp();
 		binsheadfree(bp, dp, BQ_EMPTY);
-		binshash(bp, &invalhash);
 	}
 	boot_nbuf_headers = nbuf_headers;
 
@@ -2118,6 +2253,8 @@ bufinit(void)
 	for (; i < nbuf_headers + niobuf_headers; i++) {
 		bp = &buf_headers[i];
 		bufhdrinit(bp);
+		/* only buf_biowait() and buf_biodone() use an I/O buffer's stripe */
+		bp->b_stripe = i & (buf_nstripes - 1);
 		bp->b_whichq = -1;
 		binsheadfree(bp, &iobufqueue, -1);
 	}
@@ -2152,13 +2289,17 @@ bufinit(void)
 		panic("couldn't create buf_gc_callout mutex");
 	}
 
+	for (i = 0; i < buf_nstripes; i++) {
+		lck_mtx_init(&buf_stripes[i].bs_mtx, buf_mtx_grp, buf_mtx_attr);
+	}
+
 	/*
 	 * allocate and initialize cluster specific global locks...
 	 */
 	cluster_init();
 
-	printf("using %d buffer headers and %d cluster IO buffer headers\n",
-	    nbuf_headers, niobuf_headers);
+	printf("using %d buffer headers and %d cluster IO buffer headers in %d stripes\n",
+	    nbuf_headers, niobuf_headers, buf_nstripes);
 
 	/* Set up zones used by the buffer cache */
 	bufzoneinit();
@@ -2593,6 +2734,7 @@ buf_free_meta_store(buf_t bp)
 static buf_t
 buf_brelse_shadow(buf_t bp)
 {
+	struct bufstripe *bs;
 	buf_t   bp_head;
 	buf_t   bp_temp;
 	buf_t   bp_return = NULL;
@@ -2602,10 +2744,10 @@ buf_brelse_shadow(buf_t bp)
 #endif
 	int need_wakeup = 0;
 
-	lck_mtx_lock_spin(buf_mtxp);
-
 	__IGNORE_WCASTALIGN(bp_head = (buf_t)bp->b_orig);
 
+	bs = buf_stripe_lock(bp_head->b_stripe);
+
 	if (bp_head->b_whichq != -1) {
 		panic("buf_brelse_shadow: bp_head on freelist %d\n", bp_head->b_whichq);
 	}
@@ -2666,10 +2808,10 @@ buf_brelse_shadow(buf_t bp)
 
 			if (ISSET(bp_head->b_flags, B_LOCKED)) {
 				bp_head->b_whichq = BQ_LOCKED;
-				binstailfree(bp_head, &bufqueues[BQ_LOCKED], BQ_LOCKED);
+				binstailfree(bp_head, &bs->bs_queues[BQ_LOCKED], BQ_LOCKED);
 			} else {
 				bp_head->b_whichq = BQ_META;
-				binstailfree(bp_head, &bufqueues[BQ_META], BQ_META);
+				binstailfree(bp_head, &bs->bs_queues[BQ_META], BQ_META);
 			}
 		} else if (ISSET(bp_head->b_lflags, BL_WAITSHADOW)) {
 			CLR(bp_head->b_lflags, BL_WAITSHADOW);
@@ -2681,7 +2823,7 @@ buf_brelse_shadow(buf_t bp)
 			need_wakeup = 1;
 		}
 	}
-	lck_mtx_unlock(buf_mtxp);
+	buf_stripe_unlock(bs);
 
 	if (need_wakeup) {
 		wakeup(bp_head);
@@ -2707,11 +2849,13 @@ buf_brelse_shadow(buf_t bp)
 void
 buf_brelse(buf_t bp)
 {
+	struct bufstripe *bs;
 	struct bqueues *bufq;
 	long    whichq;
 	upl_t   upl;
 	int need_wakeup = 0;
 	int need_bp_wakeup = 0;
+	int list_locked = 0;
 
 
 	if (bp->b_whichq != -1 || !(bp->b_lflags & BL_BUSY)) {
@@ -2871,34 +3015,42 @@ buf_brelse(buf_t bp)
 		 */
 		buf_release_credentials(bp);
 
+		/* dissociating it from its vnode needs buf_mtxp as well */
 		lck_mtx_lock_spin(buf_mtxp);
+		bs = buf_stripe_lock(bp->b_stripe);
 
 		if (bp->b_shadow_ref) {
 			SET(bp->b_lflags, BL_WAITSHADOW);
 
+			buf_stripe_unlock(bs);
 			lck_mtx_unlock(buf_mtxp);
 
 			return;
 		}
 		if (delayed_buf_free_meta_store == TRUE) {
+			buf_stripe_unlock(bs);
 			lck_mtx_unlock(buf_mtxp);
 finish_shadow_master:
 			buf_free_meta_store(bp);
 
 			lck_mtx_lock_spin(buf_mtxp);
+			bs = buf_stripe_lock(bp->b_stripe);
 		}
+		list_locked = 1;
+
 		CLR(bp->b_flags, (B_META | B_ZALLOC | B_DELWRI | B_LOCKED | B_AGE | B_ASYNC | B_NOCACHE | B_FUA));
 
 		if (bp->b_vp) {
 			brelvp_locked(bp);
 		}
 
-		bremhash(bp);
-		BLISTNONE(bp);
-		binshash(bp, &invalhash);
+		if (BUFHASHED(bp)) {
+			bremhash(bp);
+			BLISTNONE(bp);
+		}
 
 		bp->b_whichq = BQ_EMPTY;
-		binsheadfree(bp, &bufqueues[BQ_EMPTY], BQ_EMPTY);
+		binsheadfree(bp, &bs->bs_queues[BQ_EMPTY], BQ_EMPTY);
 	} else {
 		/*
 		 * It has valid data.  Put it on the end of the appropriate
@@ -2913,16 +3065,15 @@ finish_shadow_master:
 		} else {
 			whichq = BQ_LRU;                /* valid data */
 		}
-		bufq = &bufqueues[whichq];
-
 		bp->b_timestamp = buf_timestamp();
 
-		lck_mtx_lock_spin(buf_mtxp);
+		bs = buf_stripe_lock(bp->b_stripe);
+		bufq = &bs->bs_queues[whichq];
 
 		/*
 		 * the buf_brelse_shadow routine doesn't take 'ownership'
 		 * of the parent buf_t... it updates state that is protected by
-		 * the buf_mtxp, and checks for BL_BUSY to determine whether to
+		 * the stripe lock, and checks for BL_BUSY to determine whether to
 		 * put the buf_t back on a free list.  b_shadow_ref is protected
 		 * by the lock, and since we have not yet cleared B_BUSY, we need
 		 * to check it while holding the lock to insure that one of us
@@ -2942,20 +3093,10 @@ finish_shadow_master:
 			CLR(bp->b_flags, (B_ASYNC | B_NOCACHE));
 		}
 	}
-	if (needbuffer) {
-		/*
-		 * needbuffer is a global
-		 * we're currently using buf_mtxp to protect it
-		 * delay doing the actual wakeup until after
-		 * we drop buf_mtxp
-		 */
-		needbuffer = 0;
-		need_wakeup = 1;
-	}
 	if (ISSET(bp->b_lflags, BL_WANTED)) {
 		/*
 		 * delay the actual wakeup until after we
-		 * clear BL_BUSY and we've dropped buf_mtxp
+		 * clear BL_BUSY and we've dropped the stripe lock
 		 */
 		need_bp_wakeup = 1;
 	}
@@ -2963,9 +3104,31 @@ finish_shadow_master:
 	 * Unlock the buffer.
 	 */
 	CLR(bp->b_lflags, (BL_BUSY | BL_WANTED));
-	buf_busycount--;
+	OSAddAtomic(-1, &buf_busycount);
 
-	lck_mtx_unlock(buf_mtxp);
+	buf_stripe_unlock(bs);
+
+	/*
+	 * needbuffer is a global protected by buf_mtxp... getnewbuf()
+	 * sets it and then looks at the free lists once more before it
+	 * sleeps, so either it sees the buffer we just freed or we see
+	 * needbuffer.  Delay the actual wakeup until after we drop
+	 * buf_mtxp.
+	 */
+	if (!list_locked) {
+		OSMemoryBarrier();
+		if (needbuffer) {
+			lck_mtx_lock_spin(buf_mtxp);
+			list_locked = 1;
+		}
+	}
+	if (list_locked) {
+		if (needbuffer) {
+			needbuffer = 0;
+			need_wakeup = 1;
+		}
+		lck_mtx_unlock(buf_mtxp);
+	}
 
 	if (need_wakeup) {
 		/*
@@ -2995,17 +3158,18 @@ incore(vnode_t vp, daddr64_t blkno)
 {
 	boolean_t retval;
 	struct  bufhashhdr *dp;
+	struct bufstripe *bs;
 
 	dp = BUFHASH(vp, blkno);
 
-	lck_mtx_lock_spin(buf_mtxp);
+	bs = buf_stripe_lock(BUFSTRIPE(vp, blkno));
 
 	if (incore_locked(vp, blkno, dp)) {
 		retval = TRUE;
 	} else {
 		retval = FALSE;
 	}
-	lck_mtx_unlock(buf_mtxp);
+	buf_stripe_unlock(bs);
 
 	return retval;
 }
@@ -3032,10 +3196,11 @@ buf_wait_for_shadow_io(vnode_t vp, daddr64_t blkno)
 {
 	buf_t bp;
 	struct  bufhashhdr *dp;
+	struct bufstripe *bs;
 
 	dp = BUFHASH(vp, blkno);
 
-	lck_mtx_lock_spin(buf_mtxp);
+	bs = buf_stripe_lock(BUFSTRIPE(vp, blkno));
 
 	for (;;) {
 		if ((bp = incore_locked(vp, blkno, dp)) == NULL) {
@@ -3048,9 +3213,9 @@ buf_wait_for_shadow_io(vnode_t vp, daddr64_t blkno)
 
 		SET(bp->b_lflags, BL_WANTED_REF);
 
-		(void) msleep(bp, buf_mtxp, PSPIN | (PRIBIO + 1), "buf_wait_for_shadow", NULL);
+		(void) msleep(bp, &bs->bs_mtx, PSPIN | (PRIBIO + 1), "buf_wait_for_shadow", NULL);
 	}
-	lck_mtx_unlock(buf_mtxp);
+	buf_stripe_unlock(bs);
 }
 
 /* XXX FIXME -- Update the comment to reflect the UBC changes (please) -- */
@@ -3074,6 +3239,8 @@ buf_getblk(vnode_t vp, daddr64_t blkno, int size, int slpflag, int slptimeo, int
 	struct timespec ts;
 	int upl_flags;
 	struct  bufhashhdr *dp;
+	struct bufstripe *bs;
+	int stripe;
 
 	KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 386)) | DBG_FUNC_START,
 	    (uintptr_t)(blkno * PAGE_SIZE), size, operation, 0, 0);
@@ -3081,8 +3248,9 @@ buf_getblk(vnode_t vp, daddr64_t blkno, int size, int slpflag, int slptimeo, int
 	ret_only_valid = operation & BLK_ONLYVALID;
 	operation &= ~BLK_ONLYVALID;
 	dp = BUFHASH(vp, blkno);
+	stripe = BUFSTRIPE(vp, blkno);
 start:
-	lck_mtx_lock_spin(buf_mtxp);
+	bs = buf_stripe_lock(stripe);
 
 	if ((bp = incore_locked(vp, blkno, dp))) {
 		/*
@@ -3097,7 +3265,7 @@ start:
 			case BLK_WRITE:
 			case BLK_META:
 				SET(bp->b_lflags, BL_WANTED);
-				bufstats.bufs_busyincore++;
+				OSAddAtomicLong(1, &bufstats.bufs_busyincore);
 
 				/*
 				 * don't retake the mutex after being awakened...
@@ -3109,7 +3277,7 @@ start:
 				KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 396)) | DBG_FUNC_NONE,
 				    (uintptr_t)blkno, size, operation, 0, 0);
 
-				err = msleep(bp, buf_mtxp, slpflag | PDROP | (PRIBIO + 1), "buf_getblk", &ts);
+				err = msleep(bp, &bs->bs_mtx, slpflag | PDROP | (PRIBIO + 1), "buf_getblk", &ts);
 
 				/*
 				 * Callers who call with PCATCH or timeout are
@@ -3137,12 +3305,13 @@ start:
 			 */
 			SET(bp->b_lflags, BL_BUSY);
 			SET(bp->b_flags, B_CACHE);
-			buf_busycount++;
+			OSAddAtomic(1, &buf_busycount);
 
 			bremfree_locked(bp);
-			bufstats.bufs_incore++;
 
-			lck_mtx_unlock(buf_mtxp);
+			buf_stripe_unlock(bs);
+
+			OSAddAtomicLong(1, &bufstats.bufs_incore);
 #ifdef JOE_DEBUG
 			bp->b_owner = current_thread();
 			bp->b_tag   = 1;
@@ -3251,29 +3420,35 @@ start:
 	} else { /* not incore() */
 		int queue = BQ_EMPTY; /* Start with no preference */
 
+		buf_stripe_unlock(bs);
+
 		if (ret_only_valid) {
-			lck_mtx_unlock(buf_mtxp);
 			return NULL;
 		}
 		if ((vnode_isreg(vp) == 0) || (UBCINFOEXISTS(vp) == 0) /*|| (vnode_issystem(vp) == 1)*/) {
 			operation = BLK_META;
 		}
 
-		if ((bp = getnewbuf(slpflag, slptimeo, &queue)) == NULL) {
+		lck_mtx_lock_spin(buf_mtxp);
+
+		if ((bp = getnewbuf(slpflag, slptimeo, &queue, stripe)) == NULL) {
 			goto start;
 		}
+		bs = buf_stripe_lock(stripe);
 
 		/*
 		 * getnewbuf may block for a number of different reasons...
 		 * if it does, it's then possible for someone else to
 		 * create a buffer for the same block and insert it into
 		 * the hash... if we see it incore at this point we dump
-		 * the buffer we were working on and start over
+		 * the buffer we were working on and start over... we
+		 * dropped the stripe lock to call it, so someone may
+		 * have done so even if it didn't block
 		 */
 		if (incore_locked(vp, blkno, dp)) {
 			SET(bp->b_flags, B_INVAL);
-			binshash(bp, &invalhash);
 
+			buf_stripe_unlock(bs);
 			lck_mtx_unlock(buf_mtxp);
 
 			buf_brelse(bp);
@@ -3294,11 +3469,14 @@ start:
 
 		bp->b_blkno = bp->b_lblkno = blkno;
 		bp->b_vp = vp;
+		bp->b_stripe = stripe;
 
 		/*
 		 * Insert in the hash so that incore() can find it
 		 */
-		binshash(bp, BUFHASH(vp, blkno));
+		binshash(bp, dp);
+
+		buf_stripe_unlock(bs);
 
 		bgetvp_locked(vp, bp);
 
@@ -3314,9 +3492,10 @@ start:
 			 *
 			 * I don't want to have to retake buf_mtxp,
 			 * so the miss and vmhits counters are done
-			 * with Atomic updates... all other counters
-			 * in bufstats are protected with either
-			 * buf_mtxp or iobuffer_mtxp
+			 * with Atomic updates... so are the incore
+			 * counters, which are bumped under a stripe
+			 * lock... all other counters in bufstats are
+			 * protected with either buf_mtxp or iobuffer_mtxp
 			 */
 			OSAddAtomicLong(1, &bufstats.bufs_miss);
 			break;
@@ -3453,7 +3632,7 @@ buf_geteblk(int size)
 	do {
 		lck_mtx_lock_spin(buf_mtxp);
 
-		bp = getnewbuf(0, 0, &queue);
+		bp = getnewbuf(0, 0, &queue, buf_stripe_local());
 	} while (bp == NULL);
 
 	SET(bp->b_flags, (B_META | B_INVAL));
@@ -3463,7 +3642,6 @@ buf_geteblk(int size)
 #endif /* DIAGNOSTIC */
 	/* XXX need to implement logic to deal with other queues */
 
-	binshash(bp, &invalhash);
 	bufstats.bufs_eblk++;
 
 	lck_mtx_unlock(buf_mtxp);
@@ -3498,18 +3676,30 @@ recycle_buf_from_pool(int nsize)
 {
 	buf_t   bp;
 	void    *ptr = NULL;
+	struct bufstripe *bs;
+	int     i, stripe;
 
 	lck_mtx_lock_spin(buf_mtxp);
 
-	TAILQ_FOREACH(bp, &bufqueues[BQ_META], b_freelist) {
-		if (ISSET(bp->b_flags, B_DELWRI) || bp->b_bufsize != nsize) {
-			continue;
-		}
-		ptr = (void *)bp->b_datap;
-		bp->b_bufsize = 0;
+	stripe = buf_stripe_local();
+
+	for (i = 0; i < buf_nstripes && ptr == NULL; i++, stripe = (stripe + 1) & (buf_nstripes - 1)) {
+		bs = buf_stripe_lock(stripe);
 
-		bcleanbuf(bp, TRUE);
-		break;
+		TAILQ_FOREACH(bp, &bs->bs_queues[BQ_META], b_freelist) {
+			if (ISSET(bp->b_flags, B_DELWRI) || bp->b_bufsize != nsize) {
+				continue;
+			}
+			ptr = (void *)bp->b_datap;
+			bp->b_bufsize = 0;
+
+			/* drops the stripe lock */
+			bcleanbuf(bp, TRUE);
+			break;
+		}
+		if (ptr == NULL) {
+			buf_stripe_unlock(bs);
+		}
 	}
 	lck_mtx_unlock(buf_mtxp);
 
@@ -3655,6 +3845,129 @@ allocbuf(buf_t bp, int size)
 	return 0;
 }
 
+/*
+ * Pick the buffer getnewbuf() would recycle from a stripe: the head of
+ * its AGE or LRU queue, whichever is staler, or the head of its META
+ * queue if that has gone stale first.  Returns NULL if the stripe has
+ * nothing to recycle.  It only reads queue heads and timestamps, and
+ * buffer headers are never freed, so it may also be used to peek at a
+ * stripe without holding its lock.
+ */
+static buf_t
+buf_stripe_victim(struct bufstripe *bs, int *queue)
+{
+	buf_t   bp;
+	buf_t   lru_bp;
+	buf_t   age_bp;
+	buf_t   meta_bp;
+	int     age_time, lru_time, bp_time, meta_time;
+
+	age_bp = bs->bs_queues[BQ_AGE].tqh_first;
+	lru_bp = bs->bs_queues[BQ_LRU].tqh_first;
+	meta_bp = bs->bs_queues[BQ_META].tqh_first;
+
+	/* Buffer available either on AGE or LRU or META */
+	bp = NULL;
+	*queue = -1;
+
+	/* Buffer available either on AGE or LRU */
+	if (!age_bp) {
+		bp = lru_bp;
+		*queue = BQ_LRU;
+	} else if (!lru_bp) {
+		bp = age_bp;
+		*queue = BQ_AGE;
+	} else { /* buffer available on both AGE and LRU */
+		int             t = buf_timestamp();
+
+		age_time = t - age_bp->b_timestamp;
+		lru_time = t - lru_bp->b_timestamp;
+		if ((age_time < 0) || (lru_time < 0)) { /* time set backwards */
+			bp = age_bp;
+			*queue = BQ_AGE;
+			/*
+			 * we should probably re-timestamp eveything in the
+			 * queues at this point with the current time
+			 */
+		} else {
+			if ((lru_time >= lru_is_stale) && (age_time < age_is_stale)) {
+				bp = lru_bp;
+				*queue = BQ_LRU;
+			} else {
+				bp = age_bp;
+				*queue = BQ_AGE;
+			}
+		}
+	}
+
+	if (!bp) { /* Neither on AGE nor on LRU */
+		bp = meta_bp;
+		*queue = BQ_META;
+	} else if (meta_bp) {
+		int             t = buf_timestamp();
+
+		bp_time = t - bp->b_timestamp;
+		meta_time = t - meta_bp->b_timestamp;
+
+		if (!(bp_time < 0) && !(meta_time < 0)) {
+			/* time not set backwards */
+			int bp_is_stale;
+			bp_is_stale = (*queue == BQ_LRU) ?
+			    lru_is_stale : age_is_stale;
+
+			if ((meta_time >= meta_is_stale) &&
+			    (bp_time < bp_is_stale)) {
+				bp = meta_bp;
+				*queue = BQ_META;
+			}
+		}
+	}
+	return bp;
+}
+
+/*
+ * Move up to BUF_STRIPE_BATCH empty buffer headers to a stripe that has
+ * run out of them, from the next stripe that has some, so that one
+ * stripe doing most of the allocation doesn't go to another stripe
+ * for every header it needs.
+ *
+ * buf_mtxp is held, no stripe lock is.  Returns the number moved.
+ */
+static int
+buf_stripe_refill(int stripe)
+{
+	struct bufstripe *dst = &buf_stripes[stripe];
+	struct bufstripe *src;
+	buf_t   bp;
+	int     i, donor;
+	int     moved = 0;
+
+	for (i = 1; i < buf_nstripes && moved == 0; i++) {
+		donor = (stripe + i) & (buf_nstripes - 1);
+		src = &buf_stripes[donor];
+
+		if (src->bs_queues[BQ_EMPTY].tqh_first == NULL) {
+			continue;
+		}
+		if (donor < stripe) {
+			buf_stripe_lock(donor);
+			buf_stripe_lock(stripe);
+		} else {
+			buf_stripe_lock(stripe);
+			buf_stripe_lock(donor);
+		}
+		while (moved < BUF_STRIPE_BATCH && (bp = src->bs_queues[BQ_EMPTY].tqh_first)) {
+			TAILQ_REMOVE(&src->bs_queues[BQ_EMPTY], bp, b_freelist);
+			bp->b_stripe = stripe;
+			binsheadfree(bp, &dst->bs_queues[BQ_EMPTY], BQ_EMPTY);
+			moved++;
+		}
+		buf_stripe_unlock(src);
+		buf_stripe_unlock(dst);
+	}
+	return moved;
+}
+
 /*
  *	Get a new buffer from one of the free lists.
  *
@@ -3672,20 +3985,24 @@ allocbuf(buf_t bp, int size)
  *	Remove the buffer from the hash. Return the buffer and the queue
  *	on which it was found.
  *
+ *	Empty headers and the requested queue are taken from the stripe
+ *	passed in, the one the caller is going to hash the buffer on, with
+ *	empty headers brought over in batches from other stripes when it
+ *	runs out.  Buffers to recycle are picked across all the stripes.
+ *
  *	buf_mtxp is held upon entry
  *	returns with buf_mtxp locked if new buf available
  *	returns with buf_mtxp UNlocked if new buf NOT available
  */
 
 static buf_t
-getnewbuf(int slpflag, int slptimeo, int * queue)
+getnewbuf(int slpflag, int slptimeo, int * queue, int stripe)
 {
 	buf_t   bp;
-	buf_t   lru_bp;
-	buf_t   age_bp;
-	buf_t   meta_bp;
-	int     age_time, lru_time, bp_time, meta_time;
+	buf_t   vbp;
 	int     req = *queue;   /* save it for restarts */
+	int     i, vqueue, victim;
+	struct bufstripe *bs;
 	struct timespec ts;
 
 start:
@@ -3697,9 +4014,16 @@ start:
 		*queue = BQ_EMPTY;
 	}
 
+	if (*queue == BQ_EMPTY) {
+		if (buf_stripes[stripe].bs_queues[BQ_EMPTY].tqh_first == NULL) {
+			buf_stripe_refill(stripe);
+		}
+		bs = buf_stripe_lock(stripe);
 
-	if (*queue == BQ_EMPTY && (bp = bufqueues[*queue].tqh_first)) {
-		goto found;
+		if ((bp = bs->bs_queues[BQ_EMPTY].tqh_first)) {
+			goto found;
+		}
+		buf_stripe_unlock(bs);
 	}
 
 	/*
@@ -3715,132 +4039,117 @@ start:
 		goto add_newbufs;
 	}
 	/* Try for the requested queue first */
-	bp = bufqueues[*queue].tqh_first;
+	bs = buf_stripe_lock(stripe);
+
+	bp = bs->bs_queues[*queue].tqh_first;
 	if (bp) {
 		goto found;
 	}
+	buf_stripe_unlock(bs);
 
-	/* Unable to use requested queue */
-	age_bp = bufqueues[BQ_AGE].tqh_first;
-	lru_bp = bufqueues[BQ_LRU].tqh_first;
-	meta_bp = bufqueues[BQ_META].tqh_first;
-
-	if (!age_bp && !lru_bp && !meta_bp) {
-		/*
-		 * Unavailble on AGE or LRU or META queues
-		 * Try the empty list first
-		 */
-		bp = bufqueues[BQ_EMPTY].tqh_first;
-		if (bp) {
-			*queue = BQ_EMPTY;
-			goto found;
-		}
-		/*
-		 * We have seen is this is hard to trigger.
-		 * This is an overcommit of nbufs but needed
-		 * in some scenarios with diskiamges
-		 */
+	/*
+	 * Unable to use requested queue... peek at every stripe
+	 * for the stalest buffer it has to recycle, then lock
+	 * that stripe and pick again, since its queues may have
+	 * changed in the meantime
+	 */
+	victim = -1;
+	vbp = NULL;
 
-add_newbufs:
-		lck_mtx_unlock(buf_mtxp);
+	for (i = 0; i < buf_nstripes; i++) {
+		int s = (stripe + i) & (buf_nstripes - 1);
 
-		/* Create a new temporary buffer header */
-		bp = (struct buf *)zalloc(buf_hdr_zone);
+		bp = buf_stripe_victim(&buf_stripes[s], &vqueue);
 
-		if (bp) {
-			bufhdrinit(bp);
-			bp->b_whichq = BQ_EMPTY;
-			bp->b_timestamp = buf_timestamp();
-			BLISTNONE(bp);
-			SET(bp->b_flags, B_HDRALLOC);
-			*queue = BQ_EMPTY;
+		if (bp && (vbp == NULL || bp->b_timestamp < vbp->b_timestamp)) {
+			vbp = bp;
+			victim = s;
 		}
-		lck_mtx_lock_spin(buf_mtxp);
+	}
+	if (victim != -1) {
+		bs = buf_stripe_lock(victim);
 
-		if (bp) {
-			binshash(bp, &invalhash);
-			binsheadfree(bp, &bufqueues[BQ_EMPTY], BQ_EMPTY);
-			buf_hdr_count++;
+		if ((bp = buf_stripe_victim(bs, queue))) {
 			goto found;
 		}
-		/* subtract already accounted bufcount */
-		nbuf_headers--;
+		buf_stripe_unlock(bs);
+	}
+	/*
+	 * Unavailble on AGE or LRU or META queues
+	 * Try the empty list first
+	 */
+	if (buf_stripe_refill(stripe)) {
+		*queue = BQ_EMPTY;
+		goto start;
+	}
+	/*
+	 * We have seen is this is hard to trigger.
+	 * This is an overcommit of nbufs but needed
+	 * in some scenarios with diskiamges
+	 */
 
-		bufstats.bufs_sleeps++;
+add_newbufs:
+	lck_mtx_unlock(buf_mtxp);
 
-		/* wait for a free buffer of any kind */
-		needbuffer = 1;
-		/* hz value is 100 */
-		ts.tv_sec = (slptimeo / 1000);
-		/* the hz value is 100; which leads to 10ms */
-		ts.tv_nsec = (slptimeo % 1000) * NSEC_PER_USEC * 1000 * 10;
+	/* Create a new temporary buffer header */
+	bp = (struct buf *)zalloc(buf_hdr_zone);
 
-		msleep(&needbuffer, buf_mtxp, slpflag | PDROP | (PRIBIO + 1), "getnewbuf", &ts);
-		return NULL;
+	if (bp) {
+		bufhdrinit(bp);
+		bp->b_whichq = BQ_EMPTY;
+		bp->b_timestamp = buf_timestamp();
+		bp->b_stripe = stripe;
+		BLISTNONE(bp);
+		SET(bp->b_flags, B_HDRALLOC);
+		*queue = BQ_EMPTY;
 	}
+	lck_mtx_lock_spin(buf_mtxp);
 
-	/* Buffer available either on AGE or LRU or META */
-	bp = NULL;
-	*queue = -1;
-
-	/* Buffer available either on AGE or LRU */
-	if (!age_bp) {
-		bp = lru_bp;
-		*queue = BQ_LRU;
-	} else if (!lru_bp) {
-		bp = age_bp;
-		*queue = BQ_AGE;
-	} else { /* buffer available on both AGE and LRU */
-		int             t = buf_timestamp();
-
-		age_time = t - age_bp->b_timestamp;
-		lru_time = t - lru_bp->b_timestamp;
-		if ((age_time < 0) || (lru_time < 0)) { /* time set backwards */
-			bp = age_bp;
-			*queue = BQ_AGE;
-			/*
-			 * we should probably re-timestamp eveything in the
-			 * queues at this point with the current time
-			 */
-		} else {
-			if ((lru_time >= lru_is_stale) && (age_time < age_is_stale)) {
-				bp = lru_bp;
-				*queue = BQ_LRU;
-			} else {
-				bp = age_bp;
-				*queue = BQ_AGE;
-			}
-		}
+	if (bp) {
+		bs = buf_stripe_lock(stripe);
+		binsheadfree(bp, &bs->bs_queues[BQ_EMPTY], BQ_EMPTY);
+		buf_hdr_count++;
+		goto found;
 	}
+	/* subtract already accounted bufcount */
+	nbuf_headers--;
 
-	if (!bp) { /* Neither on AGE nor on LRU */
-		bp = meta_bp;
-		*queue = BQ_META;
-	} else if (meta_bp) {
-		int             t = buf_timestamp();
+	bufstats.bufs_sleeps++;
 
-		bp_time = t - bp->b_timestamp;
-		meta_time = t - meta_bp->b_timestamp;
+	/* wait for a free buffer of any kind */
+	needbuffer = 1;
 
-		if (!(bp_time < 0) && !(meta_time < 0)) {
-			/* time not set backwards */
-			int bp_is_stale;
-			bp_is_stale = (*queue == BQ_LRU) ?
-			    lru_is_stale : age_is_stale;
+	/*
+	 * buf_brelse() frees a buffer under its stripe lock alone and
+	 * only then looks at needbuffer, so look at the free lists once
+	 * more now that it's set... either we see the buffer or it
+	 * sees needbuffer and waits on buf_mtxp to wake us up
+	 */
+	OSMemoryBarrier();
 
-			if ((meta_time >= meta_is_stale) &&
-			    (bp_time < bp_is_stale)) {
-				bp = meta_bp;
-				*queue = BQ_META;
-			}
+	for (i = 0; i < buf_nstripes; i++) {
+		bs = &buf_stripes[i];
+
+		if (bs->bs_queues[BQ_EMPTY].tqh_first || bs->bs_queues[BQ_AGE].tqh_first ||
+		    bs->bs_queues[BQ_LRU].tqh_first || bs->bs_queues[BQ_META].tqh_first) {
+			lck_mtx_unlock(buf_mtxp);
+			return NULL;
 		}
 	}
+	/* hz value is 100 */
+	ts.tv_sec = (slptimeo / 1000);
+	/* the hz value is 100; which leads to 10ms */
+	ts.tv_nsec = (slptimeo % 1000) * NSEC_PER_USEC * 1000 * 10;
+
+	msleep(&needbuffer, buf_mtxp, slpflag | PDROP | (PRIBIO + 1), "getnewbuf", &ts);
+	return NULL;
+
 found:
 	if (ISSET(bp->b_flags, B_LOCKED) || ISSET(bp->b_lflags, BL_BUSY)) {
 		panic("getnewbuf: bp @ %p is LOCKED or BUSY! (flags 0x%x)\n", bp, bp->b_flags);
 	}
 
-	/* Clean it */
+	/* Clean it... drops the stripe lock */
 	if (bcleanbuf(bp, FALSE)) {
 		/*
 		 * moved to the laundry thread, buffer not ready
@@ -3858,12 +4167,14 @@ found:
  * Returns 1 if issued a buf_bawrite() to indicate
  * that the buffer is not ready.
  *
- * buf_mtxp is held upon entry
- * returns with buf_mtxp locked
+ * buf_mtxp and the buffer's stripe lock are held upon entry
+ * returns with buf_mtxp locked and the stripe lock dropped
  */
 int
 bcleanbuf(buf_t bp, boolean_t discard)
 {
+	struct bufstripe *bs = &buf_stripes[bp->b_stripe];
+
 	/* Remove from the queue */
 	bremfree_locked(bp);
 
@@ -3882,9 +4193,10 @@ bcleanbuf(buf_t bp, boolean_t discard)
 
 		bmovelaundry(bp);
 
+		buf_stripe_unlock(bs);
 		lck_mtx_unlock(buf_mtxp);
 
-		wakeup(&bufqueues[BQ_LAUNDRY]);
+		wakeup(&blaundrycnt);
 		/*
 		 * and give it a chance to run
 		 */
@@ -3902,9 +4214,12 @@ bcleanbuf(buf_t bp, boolean_t discard)
 	 * Buffer is no longer on any free list... we own it
 	 */
 	SET(bp->b_lflags, BL_BUSY);
-	buf_busycount++;
+	OSAddAtomic(1, &buf_busycount);
 
-	bremhash(bp);
+	if (BUFHASHED(bp)) {
+		bremhash(bp);
+	}
+	buf_stripe_unlock(bs);
 
 	/*
 	 * disassociate us from our vnode, if we had one...
@@ -3928,12 +4243,13 @@ bcleanbuf(buf_t bp, boolean_t discard)
 	/* If discarding, just move to the empty queue */
 	if (discard) {
 		lck_mtx_lock_spin(buf_mtxp);
+		bs = buf_stripe_lock(bp->b_stripe);
 		CLR(bp->b_flags, (B_META | B_ZALLOC | B_DELWRI | B_LOCKED | B_AGE | B_ASYNC | B_NOCACHE | B_FUA));
 		bp->b_whichq = BQ_EMPTY;
-		binshash(bp, &invalhash);
-		binsheadfree(bp, &bufqueues[BQ_EMPTY], BQ_EMPTY);
+		binsheadfree(bp, &bs->bs_queues[BQ_EMPTY], BQ_EMPTY);
 		CLR(bp->b_lflags, BL_BUSY);
-		buf_busycount--;
+		OSAddAtomic(-1, &buf_busycount);
+		buf_stripe_unlock(bs);
 	} else {
 		/* Not discarding: clean up and prepare for reuse */
 		bp->b_bufsize = 0;
@@ -3976,24 +4292,25 @@ buf_invalblkno(vnode_t vp, daddr64_t lblkno, int flags)
 	buf_t   bp;
 	errno_t error;
 	struct bufhashhdr *dp;
+	struct bufstripe *bs;
 
 	dp = BUFHASH(vp, lblkno);
 
 relook:
-	lck_mtx_lock_spin(buf_mtxp);
+	bs = buf_stripe_lock(BUFSTRIPE(vp, lblkno));
 
 	if ((bp = incore_locked(vp, lblkno, dp)) == (struct buf *)0) {
-		lck_mtx_unlock(buf_mtxp);
+		buf_stripe_unlock(bs);
 		return 0;
 	}
 	if (ISSET(bp->b_lflags, BL_BUSY)) {
 		if (!ISSET(flags, BUF_WAIT)) {
-			lck_mtx_unlock(buf_mtxp);
+			buf_stripe_unlock(bs);
 			return EBUSY;
 		}
 		SET(bp->b_lflags, BL_WANTED);
 
-		error = msleep((caddr_t)bp, buf_mtxp, PDROP | (PRIBIO + 1), "buf_invalblkno", NULL);
+		error = msleep((caddr_t)bp, &bs->bs_mtx, PDROP | (PRIBIO + 1), "buf_invalblkno", NULL);
 
 		if (error) {
 			return error;
@@ -4003,12 +4320,12 @@ relook:
 	bremfree_locked(bp);
 	SET(bp->b_lflags, BL_BUSY);
 	SET(bp->b_flags, B_INVAL);
-	buf_busycount++;
+	OSAddAtomic(1, &buf_busycount);
 #ifdef JOE_DEBUG
 	bp->b_owner = current_thread();
 	bp->b_tag   = 4;
 #endif
-	lck_mtx_unlock(buf_mtxp);
+	buf_stripe_unlock(bs);
 	buf_brelse(bp);
 
 	return 0;
@@ -4019,13 +4336,14 @@ void
 buf_drop(buf_t bp)
 {
 	int need_wakeup = 0;
+	struct bufstripe *bs;
 
-	lck_mtx_lock_spin(buf_mtxp);
+	bs = buf_stripe_lock(bp->b_stripe);
 
 	if (ISSET(bp->b_lflags, BL_WANTED)) {
 		/*
 		 * delay the actual wakeup until after we
-		 * clear BL_BUSY and we've dropped buf_mtxp
+		 * clear BL_BUSY and we've dropped the stripe lock
 		 */
 		need_wakeup = 1;
 	}
@@ -4037,9 +4355,9 @@ buf_drop(buf_t bp)
 	 * Unlock the buffer.
 	 */
 	CLR(bp->b_lflags, (BL_BUSY | BL_WANTED));
-	buf_busycount--;
+	OSAddAtomic(-1, &buf_busycount);
 
-	lck_mtx_unlock(buf_mtxp);
+	buf_stripe_unlock(bs);
 
 	if (need_wakeup) {
 		/*
@@ -4053,23 +4371,32 @@ buf_drop(buf_t bp)
 errno_t
 buf_acquire(buf_t bp, int flags, int slpflag, int slptimeo)
 {
-	errno_t error;
-
-	lck_mtx_lock_spin(buf_mtxp);
-
-	error = buf_acquire_locked(bp, flags, slpflag, slptimeo);
+	return buf_acquire_common(bp, flags, slpflag, slptimeo, FALSE);
+}
 
-	lck_mtx_unlock(buf_mtxp);
 
-	return error;
+/*
+ * buf_mtxp is held on entry and on return, but is dropped
+ * if we have to wait for the buffer
+ */
+static errno_t
+buf_acquire_locked(buf_t bp, int flags, int slpflag, int slptimeo)
+{
+	return buf_acquire_common(bp, flags, slpflag, slptimeo, TRUE);
 }
 
 
+/*
+ * only the stripe lock is needed to take the buffer... callers
+ * walking a vnode's buffer lists also hold buf_mtxp (list_locked),
+ * which has to be dropped while we wait
+ */
 static errno_t
-buf_acquire_locked(buf_t bp, int flags, int slpflag, int slptimeo)
+buf_acquire_common(buf_t bp, int flags, int slpflag, int slptimeo, boolean_t list_locked)
 {
 	errno_t error;
 	struct timespec ts;
+	struct bufstripe *bs;
 
 	if (ISSET(bp->b_flags, B_LOCKED)) {
 		if ((flags & BAC_SKIP_LOCKED)) {
@@ -4080,6 +4407,18 @@ buf_acquire_locked(buf_t bp, int flags, int slpflag, int slptimeo)
 			return EDEADLK;
 		}
 	}
+	/*
+	 * without buf_mtxp, a buffer we don't own may
+	 * be recycled onto another stripe under us
+	 */
+	for (;;) {
+		bs = buf_stripe_lock(bp->b_stripe);
+
+		if (bs == &buf_stripes[bp->b_stripe]) {
+			break;
+		}
+		buf_stripe_unlock(bs);
+	}
 	if (ISSET(bp->b_lflags, BL_BUSY)) {
 		/*
 		 * since the lck_mtx_lock may block, the buffer
@@ -4087,14 +4426,22 @@ buf_acquire_locked(buf_t bp, int flags, int slpflag, int slptimeo)
 		 * recheck for a NOWAIT request
 		 */
 		if (flags & BAC_NOWAIT) {
+			buf_stripe_unlock(bs);
 			return EBUSY;
 		}
 		SET(bp->b_lflags, BL_WANTED);
 
+		if (list_locked) {
+			lck_mtx_unlock(buf_mtxp);
+		}
 		/* the hz value is 100; which leads to 10ms */
 		ts.tv_sec = (slptimeo / 100);
 		ts.tv_nsec = (slptimeo % 100) * 10  * NSEC_PER_USEC * 1000;
-		error = msleep((caddr_t)bp, buf_mtxp, slpflag | (PRIBIO + 1), "buf_acquire", &ts);
+		error = msleep((caddr_t)bp, &bs->bs_mtx, slpflag | PDROP | (PRIBIO + 1), "buf_acquire", &ts);
+
+		if (list_locked) {
+			lck_mtx_lock(buf_mtxp);
+		}
 
 		if (error) {
 			return error;
@@ -4105,7 +4452,9 @@ buf_acquire_locked(buf_t bp, int flags, int slpflag, int slptimeo)
 		bremfree_locked(bp);
 	}
 	SET(bp->b_lflags, BL_BUSY);
-	buf_busycount++;
+	OSAddAtomic(1, &buf_busycount);
+
+	buf_stripe_unlock(bs);
 
 #ifdef JOE_DEBUG
 	bp->b_owner = current_thread();
@@ -4122,15 +4471,17 @@ buf_acquire_locked(buf_t bp, int flags, int slpflag, int slptimeo)
 errno_t
 buf_biowait(buf_t bp)
 {
+	struct bufstripe *bs;
+
 	while (!ISSET(bp->b_flags, B_DONE)) {
-		lck_mtx_lock_spin(buf_mtxp);
+		bs = buf_stripe_lock(bp->b_stripe);
 
 		if (!ISSET(bp->b_flags, B_DONE)) {
 			DTRACE_IO1(wait__start, buf_t, bp);
-			(void) msleep(bp, buf_mtxp, PDROP | (PRIBIO + 1), "buf_biowait", NULL);
+			(void) msleep(bp, &bs->bs_mtx, PDROP | (PRIBIO + 1), "buf_biowait", NULL);
 			DTRACE_IO1(wait__done, buf_t, bp);
 		} else {
-			lck_mtx_unlock(buf_mtxp);
+			buf_stripe_unlock(bs);
 		}
 	}
 	/* check for interruption of I/O (e.g. via NFS), then errors. */
@@ -4311,7 +4662,7 @@ buf_biodone(buf_t bp)
 		buf_brelse(bp);
 	} else {                                /* or just wakeup the buffer */
 		/*
-		 * by taking the mutex, we serialize
+		 * by taking the stripe mutex, we serialize
 		 * the buf owner calling buf_biowait so that we'll
 		 * only see him in one of 2 states...
 		 * state 1: B_DONE wasn't set and he's
@@ -4324,12 +4675,12 @@ buf_biodone(buf_t bp)
 		 * they do get to run, their going to re-set
 		 * BL_WANTED and go back to sleep
 		 */
-		lck_mtx_lock_spin(buf_mtxp);
+		struct bufstripe *bs = buf_stripe_lock(bp->b_stripe);
 
 		CLR(bp->b_lflags, BL_WANTED);
 		SET(bp->b_flags, B_DONE);               /* note that it's done */
 
-		lck_mtx_unlock(buf_mtxp);
+		buf_stripe_unlock(bs);
 
 		wakeup(bp);
 	}
@@ -4358,16 +4709,19 @@ int
 count_lock_queue(void)
 {
 	buf_t   bp;
+	struct bufstripe *bs;
+	int     i;
 	int     n = 0;
 
-	lck_mtx_lock_spin(buf_mtxp);
+	for (i = 0; i < buf_nstripes; i++) {
+		bs = buf_stripe_lock(i);
 
-	for (bp = bufqueues[BQ_LOCKED].tqh_first; bp;
-	    bp = bp->b_freelist.tqe_next) {
-		n++;
+		for (bp = bs->bs_queues[BQ_LOCKED].tqh_first; bp;
+		    bp = bp->b_freelist.tqe_next) {
+			n++;
+		}
+		buf_stripe_unlock(bs);
 	}
-	lck_mtx_unlock(buf_mtxp);
-
 	return n;
 }
 
@@ -4390,26 +4744,29 @@ count_busy_buffers(void)
 void
 vfs_bufstats()
 {
-	int i, j, count;
+	int i, j, s, count;
 	struct buf *bp;
 	struct bqueues *dp;
 	int counts[MAXBSIZE / CLBYTES + 1];
 	static char *bname[BQUEUES] =
 	{ "LOCKED", "LRU", "AGE", "EMPTY", "META", "LAUNDRY" };
 
-	for (dp = bufqueues, i = 0; dp < &bufqueues[BQUEUES]; dp++, i++) {
+	for (i = 0; i < BQUEUES; i++) {
 		count = 0;
 		for (j = 0; j <= MAXBSIZE / CLBYTES; j++) {
 			counts[j] = 0;
 		}
 
-		lck_mtx_lock(buf_mtxp);
+		for (s = 0; s < buf_nstripes; s++) {
+			lck_mtx_lock(&buf_stripes[s].bs_mtx);
 
-		for (bp = dp->tqh_first; bp; bp = bp->b_freelist.tqe_next) {
-			counts[bp->b_bufsize / CLBYTES]++;
-			count++;
+			dp = &buf_stripes[s].bs_queues[i];
+			for (bp = dp->tqh_first; bp; bp = bp->b_freelist.tqe_next) {
+				counts[bp->b_bufsize / CLBYTES]++;
+				count++;
+			}
+			lck_mtx_unlock(&buf_stripes[s].bs_mtx);
 		}
-		lck_mtx_unlock(buf_mtxp);
 
 		printf("%s: total-%d", bname[i], count);
 		for (j = 0; j <= MAXBSIZE / CLBYTES; j++) {
@@ -4615,32 +4972,70 @@ bcleanbuf_thread_init(void)
 
 typedef int (*bcleanbufcontinuation)(int);
 
+/*
+ * Take the first buffer off the first stripe laundry queue that has
+ * one, starting after the stripe we last took one from.
+ * buf_mtxp is held, which buffers are only moved to the laundry under,
+ * so if this comes back empty nothing can be queued before we sleep.
+ */
+static buf_t
+buf_laundry_get(void)
+{
+	static int laundry_stripe;
+	struct bufstripe *bs;
+	buf_t   bp;
+	int     i, stripe;
+
+	if (blaundrycnt == 0) {
+		return NULL;
+	}
+	for (i = 0; i < buf_nstripes; i++) {
+		stripe = (laundry_stripe + i) & (buf_nstripes - 1);
+		bs = &buf_stripes[stripe];
+
+		if (bs->bs_queues[BQ_LAUNDRY].tqh_first == NULL) {
+			continue;
+		}
+		buf_stripe_lock(stripe);
+
+		if ((bp = TAILQ_FIRST(&bs->bs_queues[BQ_LAUNDRY]))) {
+			/*
+			 * Remove from the queue
+			 */
+			bremfree_locked(bp);
+
+			/*
+			 * Buffer is no longer on any free list
+			 */
+			SET(bp->b_lflags, BL_BUSY);
+			OSAddAtomic(1, &buf_busycount);
+
+			buf_stripe_unlock(bs);
+
+			laundry_stripe = (stripe + 1) & (buf_nstripes - 1);
+			return bp;
+		}
+		buf_stripe_unlock(bs);
+	}
+	return NULL;
+}
+
 __attribute__((noreturn))
 static void
 bcleanbuf_thread(void)
 {
 	struct buf *bp;
+	struct bufstripe *bs;
 	int error = 0;
 	int loopcnt = 0;
 
 	for (;;) {
 		lck_mtx_lock_spin(buf_mtxp);
 
-		while ((bp = TAILQ_FIRST(&bufqueues[BQ_LAUNDRY])) == NULL) {
-			(void)msleep0(&bufqueues[BQ_LAUNDRY], buf_mtxp, PRIBIO | PDROP, "blaundry", 0, (bcleanbufcontinuation)bcleanbuf_thread);
+		while ((bp = buf_laundry_get()) == NULL) {
+			(void)msleep0(&blaundrycnt, buf_mtxp, PRIBIO | PDROP, "blaundry", 0, (bcleanbufcontinuation)bcleanbuf_thread);
 		}
 
-		/*
-		 * Remove from the queue
-		 */
-		bremfree_locked(bp);
-
-		/*
-		 * Buffer is no longer on any free list
-		 */
-		SET(bp->b_lflags, BL_BUSY);
-		buf_busycount++;
-
 #ifdef JOE_DEBUG
 		bp->b_owner = current_thread();
 		bp->b_tag   = 10;
@@ -4657,18 +5052,20 @@ bcleanbuf_thread(void)
 			bp->b_timestamp = buf_timestamp();
 
 			lck_mtx_lock_spin(buf_mtxp);
+			bs = buf_stripe_lock(bp->b_stripe);
 
-			binstailfree(bp, &bufqueues[BQ_LAUNDRY], BQ_LAUNDRY);
-			blaundrycnt++;
+			binstailfree(bp, &bs->bs_queues[BQ_LAUNDRY], BQ_LAUNDRY);
+			OSAddAtomic(1, &blaundrycnt);
 
 			/* we never leave a busy page on the laundry queue */
 			CLR(bp->b_lflags, BL_BUSY);
-			buf_busycount--;
+			OSAddAtomic(-1, &buf_busycount);
 #ifdef JOE_DEBUG
 			bp->b_owner = current_thread();
 			bp->b_tag   = 11;
 #endif
 
+			buf_stripe_unlock(bs);
 			lck_mtx_unlock(buf_mtxp);
 
 			if (loopcnt > MAXLAUNDRY) {
@@ -4677,7 +5074,7 @@ bcleanbuf_thread(void)
 				 * done several I/Os and failed, give the system some time to unthrottle
 				 * the vnode
 				 */
-				(void)tsleep((void *)&bufqueues[BQ_LAUNDRY], PRIBIO, "blaundry", 1);
+				(void)tsleep((void *)&blaundrycnt, PRIBIO, "blaundry", 1);
 				loopcnt = 0;
 			} else {
 				/* give other threads a chance to run */
@@ -4800,8 +5197,12 @@ buffer_cache_gc(int all)
 	boolean_t need_wakeup = FALSE;
 	int now = buf_timestamp();
 	uint32_t found = 0;
+	uint32_t total = 0;
+	uint32_t batch;
 	struct bqueues privq;
+	struct bufstripe *bs;
 	int thresh_hold = BUF_STALE_THRESHHOLD;
+	int i, stripe;
 
 	if (all) {
 		thresh_hold = 0;
@@ -4812,111 +5213,125 @@ buffer_cache_gc(int all)
 	 * for deep sleep), we only evict up to BUF_MAX_GC_BATCH_SIZE buffers
 	 * that have not been accessed in the last BUF_STALE_THRESHOLD seconds.
 	 * BUF_MAX_GC_BATCH_SIZE controls both the hold time of the global lock
-	 * "buf_mtxp" and the length of time we spend compute bound in the GC
-	 * thread which calls this function
+	 * "buf_mtxp" and the stripe locks and the length of time we spend
+	 * compute bound in the GC thread which calls this function.  That
+	 * budget is shared by all the stripes, so each call starts with the
+	 * stripe after the one the last call stopped at
 	 */
 	lck_mtx_lock(buf_mtxp);
 
-	do {
-		found = 0;
-		TAILQ_INIT(&privq);
-		need_wakeup = FALSE;
-
-		while (((bp = TAILQ_FIRST(&bufqueues[BQ_META]))) &&
-		    (now > bp->b_timestamp) &&
-		    (now - bp->b_timestamp > thresh_hold) &&
-		    (found < BUF_MAX_GC_BATCH_SIZE)) {
-			/* Remove from free list */
-			bremfree_locked(bp);
-			found++;
+	for (i = 0; i < buf_nstripes && (all || total < BUF_MAX_GC_BATCH_SIZE); i++) {
+		stripe = (buf_gc_stripe + i) & (buf_nstripes - 1);
+		batch = all ? BUF_MAX_GC_BATCH_SIZE : BUF_MAX_GC_BATCH_SIZE - total;
+
+		do {
+			found = 0;
+			TAILQ_INIT(&privq);
+			need_wakeup = FALSE;
+
+			bs = buf_stripe_lock(stripe);
+
+			while (((bp = TAILQ_FIRST(&bs->bs_queues[BQ_META]))) &&
+			    (now > bp->b_timestamp) &&
+			    (now - bp->b_timestamp > thresh_hold) &&
+			    (found < batch)) {
+				/* Remove from free list */
+				bremfree_locked(bp);
+				found++;
 
 #ifdef JOE_DEBUG
-			bp->b_owner = current_thread();
-			bp->b_tag   = 12;
+				bp->b_owner = current_thread();
+				bp->b_tag   = 12;
 #endif
 
-			/* If dirty, move to laundry queue and remember to do wakeup */
-			if (ISSET(bp->b_flags, B_DELWRI)) {
-				SET(bp->b_lflags, BL_WANTDEALLOC);
-
-				bmovelaundry(bp);
-				need_wakeup = TRUE;
+				/* If dirty, move to laundry queue and remember to do wakeup */
+				if (ISSET(bp->b_flags, B_DELWRI)) {
+					SET(bp->b_lflags, BL_WANTDEALLOC);
 
-				continue;
-			}
+					bmovelaundry(bp);
+					need_wakeup = TRUE;
 
-			/*
-			 * Mark busy and put on private list.  We could technically get
-			 * away without setting BL_BUSY here.
-			 */
-			SET(bp->b_lflags, BL_BUSY);
-			buf_busycount++;
+					continue;
+				}
 
-			/*
-			 * Remove from hash and dissociate from vp.
-			 */
-			bremhash(bp);
-			if (bp->b_vp) {
-				brelvp_locked(bp);
-			}
+				/*
+				 * Mark busy and put on private list.  We could technically get
+				 * away without setting BL_BUSY here.
+				 */
+				SET(bp->b_lflags, BL_BUSY);
+				OSAddAtomic(1, &buf_busycount);
 
-			TAILQ_INSERT_TAIL(&privq, bp, b_freelist);
-		}
+				/*
+				 * Remove from hash and dissociate from vp.
+				 */
+				bremhash(bp);
+				if (bp->b_vp) {
+					brelvp_locked(bp);
+				}
 
-		if (found == 0) {
-			break;
-		}
+				TAILQ_INSERT_TAIL(&privq, bp, b_freelist);
+			}
+			buf_stripe_unlock(bs);
 
-		/* Drop lock for batch processing */
-		lck_mtx_unlock(buf_mtxp);
+			if (found == 0) {
+				break;
+			}
+			total += found;
 
-		/* Wakeup and yield for laundry if need be */
-		if (need_wakeup) {
-			wakeup(&bufqueues[BQ_LAUNDRY]);
-			(void)thread_block(THREAD_CONTINUE_NULL);
-		}
+			/* Drop lock for batch processing */
+			lck_mtx_unlock(buf_mtxp);
 
-		/* Clean up every buffer on private list */
-		TAILQ_FOREACH(bp, &privq, b_freelist) {
-			/* Take note if we've definitely freed at least a page to a zone */
-			if ((ISSET(bp->b_flags, B_ZALLOC)) && (buf_size(bp) >= PAGE_SIZE)) {
-				did_large_zfree = TRUE;
+			/* Wakeup and yield for laundry if need be */
+			if (need_wakeup) {
+				wakeup(&blaundrycnt);
+				(void)thread_block(THREAD_CONTINUE_NULL);
 			}
 
-			trace(TR_BRELSE, pack(bp->b_vp, bp->b_bufsize), bp->b_lblkno);
+			/* Clean up every buffer on private list */
+			TAILQ_FOREACH(bp, &privq, b_freelist) {
+				/* Take note if we've definitely freed at least a page to a zone */
+				if ((ISSET(bp->b_flags, B_ZALLOC)) && (buf_size(bp) >= PAGE_SIZE)) {
+					did_large_zfree = TRUE;
+				}
 
-			/* Free Storage */
-			buf_free_meta_store(bp);
+				trace(TR_BRELSE, pack(bp->b_vp, bp->b_bufsize), bp->b_lblkno);
 
-			/* Release credentials */
-			buf_release_credentials(bp);
+				/* Free Storage */
+				buf_free_meta_store(bp);
 
-			/* Prepare for moving to empty queue */
-			CLR(bp->b_flags, (B_META | B_ZALLOC | B_DELWRI | B_LOCKED
-			    | B_AGE | B_ASYNC | B_NOCACHE | B_FUA));
-			bp->b_whichq = BQ_EMPTY;
-			BLISTNONE(bp);
-		}
-		lck_mtx_lock(buf_mtxp);
+				/* Release credentials */
+				buf_release_credentials(bp);
 
-		/* Back under lock, move them all to invalid hash and clear busy */
-		TAILQ_FOREACH(bp, &privq, b_freelist) {
-			binshash(bp, &invalhash);
-			CLR(bp->b_lflags, BL_BUSY);
-			buf_busycount--;
+				/* Prepare for moving to empty queue */
+				CLR(bp->b_flags, (B_META | B_ZALLOC | B_DELWRI | B_LOCKED
+				    | B_AGE | B_ASYNC | B_NOCACHE | B_FUA));
+				bp->b_whichq = BQ_EMPTY;
+				BLISTNONE(bp);
+			}
+			lck_mtx_lock(buf_mtxp);
+			bs = buf_stripe_lock(stripe);
+
+			/* Back under lock, clear busy */
+			TAILQ_FOREACH(bp, &privq, b_freelist) {
+				CLR(bp->b_lflags, BL_BUSY);
+				OSAddAtomic(-1, &buf_busycount);
 
 #ifdef JOE_DEBUG
-			if (bp->b_owner != current_thread()) {
-				panic("Buffer stolen from buffer_cache_gc()");
-			}
-			bp->b_owner = current_thread();
-			bp->b_tag   = 13;
+				if (bp->b_owner != current_thread()) {
+					panic("Buffer stolen from buffer_cache_gc()");
+				}
+				bp->b_owner = current_thread();
+				bp->b_tag   = 13;
 #endif
-		}
+			}
 
-		/* And do a big bulk move to the empty queue */
-		TAILQ_CONCAT(&bufqueues[BQ_EMPTY], &privq, b_freelist);
-	} while (all && (found == BUF_MAX_GC_BATCH_SIZE));
+			/* And do a big bulk move to the stripe's empty queue */
+			TAILQ_CONCAT(&bs->bs_queues[BQ_EMPTY], &privq, b_freelist);
+
+			buf_stripe_unlock(bs);
+		} while (all && (found == BUF_MAX_GC_BATCH_SIZE));
+	}
+	buf_gc_stripe = (buf_gc_stripe + i) & (buf_nstripes - 1);
 
 	lck_mtx_unlock(buf_mtxp);
 
@@ -4956,6 +5371,8 @@ bflushq(int whichq, mount_t mp)
 	buf_t   bp, next;
 	int     i, buf_count;
 	int     total_writes = 0;
+	int     stripe = 0;
+	struct bufstripe *bs;
 	static buf_t flush_table[NFLUSH];
 
 	if (whichq < 0 || whichq >= BQUEUES) {
@@ -4963,9 +5380,9 @@ bflushq(int whichq, mount_t mp)
 	}
 
 restart:
-	lck_mtx_lock(buf_mtxp);
+	bs = buf_stripe_lock(stripe);
 
-	bp = TAILQ_FIRST(&bufqueues[whichq]);
+	bp = TAILQ_FIRST(&bs->bs_queues[whichq]);
 
 	for (buf_count = 0; bp; bp = next) {
 		next = bp->b_freelist.tqe_next;
@@ -4981,14 +5398,14 @@ restart:
 			bp->b_tag   = 7;
 #endif
 			SET(bp->b_lflags, BL_BUSY);
-			buf_busycount++;
+			OSAddAtomic(1, &buf_busycount);
 
 			flush_table[buf_count] = bp;
 			buf_count++;
 			total_writes++;
 
 			if (buf_count >= NFLUSH) {
-				lck_mtx_unlock(buf_mtxp);
+				buf_stripe_unlock(bs);
 
 				qsort(flush_table, buf_count, sizeof(struct buf *), bp_cmp);
 
@@ -4999,7 +5416,7 @@ restart:
 			}
 		}
 	}
-	lck_mtx_unlock(buf_mtxp);
+	buf_stripe_unlock(bs);
 
 	if (buf_count > 0) {
 		qsort(flush_table, buf_count, sizeof(struct buf *), bp_cmp);
@@ -5008,6 +5425,9 @@ restart:
 			buf_bawrite(flush_table[i]);
 		}
 	}
+	if (++stripe < buf_nstripes) {
+		goto restart;
+	}
 
 	return total_writes;
 }
@@ -82,7 +82,13 @@
 #include <sys/kauth.h>
 #include <sys/user.h>
 #include <sys/paths.h>
+#include <sys/sysctl.h>
 #include <os/overflow.h>
+#include <os/hash.h>
+#include <kern/cpu_number.h>
+#include <kern/thread.h>
+#include <kern/thread_call.h>
+#include <machine/machine_routines.h>
 
 #if CONFIG_MACF
 #include <security/mac_framework.h>
@@ -120,6 +126,75 @@ int     nc_disabled = 0;
 TAILQ_HEAD(, namecache) nchead;         /* chain of all name cache entries */
 TAILQ_HEAD(, namecache) neghead;        /* chain of only negative cache entries */
 
+/*
+ * Replacement policy
+ *
+ * nchead and neghead are each run as a CLOCK: entries are recycled from
+ * the head, but one that has been looked up since the hand last passed
+ * it (nc_ref) gets a second chance at the tail instead.  Negative
+ * entries have their own budget, desiredNegNodes, so that a burst of
+ * failed lookups cannot push out the positive entries.
+ *
+ * Every NC_TUNE_INTERVAL seconds, nc_tune() looks at the hit, miss and
+ * eviction counters since the last run.  It grows the cache while the
+ * miss rate is high and live entries are being recycled quickly, up to
+ * nc_max_nodes.  It also moves the negative budget toward the share of
+ * hits that negative entries earn, between NC_NEG_MIN_PCT and
+ * NC_NEG_MAX_PCT of the cache, as ARC moves capacity to the list that
+ * earns the hits.
+ *
+ * When the buffer cache is asked to give memory back, nc_gc() gives back
+ * what nc_tune() grew the cache by, down to nc_base_nodes.
+ *
+ * The counters nc_tune() reads are kept per CPU, and only written by
+ * their CPU with preemption disabled.  The per-mount copies behind the
+ * vfs.namecache.mountstats sysctl cost an atomic per lookup, so they
+ * are only kept while vfs.namecache.mountstats_enable is set.
+ */
+#define NC_CLOCK_SCAN_MAX       64      /* max second chances per eviction */
+#define NC_TUNE_INTERVAL        10      /* seconds */
+#define NC_NEG_MIN_PCT          5
+#define NC_NEG_MAX_PCT          50
+#define NC_MAX_GROWTH           16      /* nc_max_nodes limit, in nc_base_nodes */
+
+int     nc_max_nodes;                   /* upper bound for nc_tune() growth */
+int     nc_base_nodes;                  /* desiredNodes at boot, nc_gc() floor */
+int     nc_mountstats_enable;           /* keep the per-mount counters */
+static thread_call_t nc_tune_call;
+static struct nc_mount_stats *nc_cpu_stats;
+static unsigned int nc_ncpus;
+static struct nc_mount_stats nc_tune_last;
+
+static void
+nc_stat_bump(mount_t mp, size_t offset)
+{
+	disable_preemption();
+	(*(uint64_t *)((uintptr_t)&nc_cpu_stats[cpu_number()] + offset))++;
+	enable_preemption();
+
+	if (nc_mountstats_enable && mp != NULL) {
+		os_atomic_inc((uint64_t *)((uintptr_t)&mp->mnt_ncstats[cpu_number() % NC_STAT_STRIPES] +
+		    offset), relaxed);
+	}
+}
+
+#define NCMSTAT(mp, field) \
+	nc_stat_bump((mp), offsetof(struct nc_mount_stats, field))
+
+static void
+nc_stats_sum(struct nc_mount_stats *stripes, unsigned int nstripes, struct nc_mount_stats *sum)
+{
+	unsigned int i;
+
+	bzero(sum, sizeof(*sum));
+	for (i = 0; i < nstripes; i++) {
+		sum->ncm_hits += os_atomic_load(&stripes[i].ncm_hits, relaxed);
+		sum->ncm_neghits += os_atomic_load(&stripes[i].ncm_neghits, relaxed);
+		sum->ncm_misses += os_atomic_load(&stripes[i].ncm_misses, relaxed);
+		sum->ncm_evictions += os_atomic_load(&stripes[i].ncm_evictions, relaxed);
+	}
+}
+
 
 #if COLLECT_STATS
 
@@ -151,7 +226,57 @@ lck_grp_t * strcache_lck_grp;
 lck_grp_attr_t * strcache_lck_grp_attr;
 lck_attr_t * strcache_lck_attr;
 
-lck_rw_t  * namecache_rw_lock;
+/*
+ * The name cache lock is striped: a shared holder only takes the stripe
+ * picked by its thread, so concurrent lookups in cache_lookup_path() do
+ * not all bounce the same lock word between cores.  An exclusive holder
+ * takes every stripe, in order, which keeps the semantics of a single
+ * rw lock for everything the name cache lock protects (the hash chains,
+ * the LRU lists, and the v_parent / v_name / v_nclinks / v_ncchildren /
+ * v_cred fields of the vnodes).  It is used for purges, identity updates
+ * and resizing.
+ *
+ * Entering and deleting single entries (cache_enter(), cache_lookup())
+ * doesn't take every stripe.  It holds the caller's stripe shared, which
+ * keeps exclusive holders out, and namecache_list_mtx, which serializes
+ * updates to the LRU lists, the counters and the v_nclinks / v_ncchildren
+ * lists.
+ *
+ * Lookups walk the hash chains without namecache_list_mtx.  Every change
+ * to a chain is bracketed by the sequence count of the chain's stripe
+ * (nc_hash_stripe of the entry), and a walk that saw the count move is
+ * retried, falling back to namecache_list_mtx, see cache_hash_find().
+ * An entry unhashed by a shared holder may still be under such a walk,
+ * so it is neither reused nor freed, and its name is kept: it goes on
+ * nc_deferred_head until nc_reclaim() has held every stripe exclusive,
+ * after which no walk can reach it.  Exclusive holders exclude every
+ * walk and free entries directly.
+ *
+ * Lock order: name cache stripes, namecache_list_mtx.
+ */
+#define NUM_NAMECACHE_LOCKS 16
+
+static struct namecache_rw_stripe {
+	lck_rw_t        ncs_lock;
+} __attribute__((aligned(128))) namecache_rw_locks[NUM_NAMECACHE_LOCKS];  /* one cache line each */
+
+static struct namecache_seq_stripe {
+	uint32_t        ncq_seq;
+} __attribute__((aligned(128))) namecache_hash_seq[NUM_NAMECACHE_LOCKS];  /* odd while a chain changes */
+
+#define NAMECACHE_RW_STRIPE() \
+	(&namecache_rw_locks[os_hash_kernel_pointer(current_thread()) % NUM_NAMECACHE_LOCKS].ncs_lock)
+
+#define NC_LOCKLESS_RETRIES     4       /* unlocked chain walks before taking namecache_list_mtx */
+#define NC_CHAIN_SCAN_MAX       1024    /* longer unlocked walks are following moving entries */
+#define NC_DEFERRED_MAX         64      /* unhashed entries queued before nc_reclaim() runs */
+
+lck_mtx_t namecache_list_mtx;
+
+static TAILQ_HEAD(, namecache) nc_deferred_head = TAILQ_HEAD_INITIALIZER(nc_deferred_head);
+static int nc_deferred_count;
+static thread_call_t nc_reclaim_call;
+
 lck_rw_t  * strtable_rw_lock;
 
 #define NUM_STRCACHE_LOCKS 1024
@@ -163,8 +288,14 @@ static vnode_t cache_lookup_locked(vnode_t dvp, struct componentname *cnp);
 static const char *add_name_internal(const char *, uint32_t, u_int, boolean_t, u_int);
 static void init_string_table(void);
 static void cache_delete(struct namecache *, int);
+static void cache_delete_deferred(struct namecache *);
+static void nc_reclaim(thread_call_param_t p0, thread_call_param_t p1);
 static void cache_enter_locked(vnode_t dvp, vnode_t vp, struct componentname *cnp, const char *strname);
 static void cache_purge_locked(vnode_t vp, kauth_cred_t *credp);
+static struct namecache *cache_clock_victim(boolean_t negative);
+static int resize_namecache_nodes(int dNodes, int dNegNodes);
+static void nc_tune(thread_call_param_t p0, thread_call_param_t p1);
+static void nc_gc(int all, void *context);
 
 #ifdef DUMP_STRING_TABLE
 /*
@@ -177,8 +308,12 @@ static void init_crc32(void);
 static unsigned int crc32tab[256];
 
 
+#define NCHHASH_INDEX(dvp, hash_val) \
+	((dvp->v_id ^ (hash_val)) & nchashmask)
 #define NCHHASH(dvp, hash_val) \
-	(&nchashtbl[(dvp->v_id ^ (hash_val)) & nchashmask])
+	(&nchashtbl[NCHHASH_INDEX(dvp, hash_val)])
+#define NCHHASH_STRIPE(index) \
+	((unsigned short)((index) % NUM_NAMECACHE_LOCKS))
 
 /*
  * This function tries to check if a directory vp is a subdirectory of dvp
@@ -1926,36 +2061,121 @@ errorout:
 }
 
 
-static vnode_t
-cache_lookup_locked(vnode_t dvp, struct componentname *cnp)
+static inline void
+nc_hash_write_begin(unsigned short stripe)
+{
+	os_atomic_inc(&namecache_hash_seq[stripe].ncq_seq, relaxed);
+	os_atomic_thread_fence(release);
+}
+
+static inline void
+nc_hash_write_end(unsigned short stripe)
+{
+	os_atomic_inc(&namecache_hash_seq[stripe].ncq_seq, release);
+}
+
+/*
+ * Scan one hash chain for (dvp, cnp).  Gives up and returns FALSE after
+ * max_steps entries, which an unlocked walk only reaches when it keeps
+ * following entries moved to other chains.
+ */
+static boolean_t
+cache_chain_scan(struct nchashhead *ncpp, vnode_t dvp, struct componentname *cnp,
+    u_int max_steps, struct namecache **ncpp_out, vnode_t *vpp)
 {
 	struct namecache *ncp;
-	struct nchashhead *ncpp;
+	const char *name;
 	long namelen = cnp->cn_namelen;
-	unsigned int hashval = cnp->cn_hash;
+	u_int steps = 0;
 
-	if (nc_disabled) {
-		return NULL;
+	for (ncp = ncpp->lh_first; ncp != NULL; ncp = ncp->nc_hash.le_next) {
+		if (++steps > max_steps) {
+			return FALSE;
+		}
+		name = ncp->nc_name;
+		if (ncp->nc_dvp == dvp && ncp->nc_hashval == cnp->cn_hash && name != NULL &&
+		    strncmp(name, cnp->cn_nameptr, namelen) == 0 && name[namelen] == 0) {
+			*vpp = ncp->nc_vp;
+			break;
+		}
 	}
+	*ncpp_out = ncp;
+	return TRUE;
+}
 
-	ncpp = NCHHASH(dvp, cnp->cn_hash);
-	LIST_FOREACH(ncp, ncpp, nc_hash) {
-		if ((ncp->nc_dvp == dvp) && (ncp->nc_hashval == hashval)) {
-			if (strncmp(ncp->nc_name, cnp->cn_nameptr, namelen) == 0 && ncp->nc_name[namelen] == 0) {
-				break;
+/*
+ * Find the entry for (dvp, cnp) and the vnode it names (NULL for a
+ * negative entry).  Called with a name cache stripe held, so the entry
+ * and the vnode stay allocated; with list_locked unset, the chain is
+ * walked without namecache_list_mtx and the walk retried if the chain
+ * changed under it.
+ */
+static struct namecache *
+cache_hash_find(vnode_t dvp, struct componentname *cnp, boolean_t list_locked, vnode_t *vpp)
+{
+	struct nchashhead *ncpp = NCHHASH(dvp, cnp->cn_hash);
+	struct namecache *ncp;
+	uint32_t *seqp, seq;
+	int tries;
+
+	if (!list_locked) {
+		seqp = &namecache_hash_seq[NCHHASH_STRIPE(ncpp - nchashtbl)].ncq_seq;
+
+		for (tries = 0; tries < NC_LOCKLESS_RETRIES; tries++) {
+			seq = os_atomic_load(seqp, acquire);
+			if (seq & 1) {
+				continue;
+			}
+			if (!cache_chain_scan(ncpp, dvp, cnp, NC_CHAIN_SCAN_MAX, &ncp, vpp)) {
+				continue;
+			}
+			os_atomic_thread_fence(acquire);
+			if (os_atomic_load(seqp, relaxed) == seq) {
+				return ncp;
 			}
 		}
+		lck_mtx_lock(&namecache_list_mtx);
+	}
+	(void)cache_chain_scan(ncpp, dvp, cnp, UINT_MAX, &ncp, vpp);
+	if (!list_locked) {
+		lck_mtx_unlock(&namecache_list_mtx);
+	}
+	return ncp;
+}
+
+
+static vnode_t
+cache_lookup_locked(vnode_t dvp, struct componentname *cnp)
+{
+	struct namecache *ncp;
+	vnode_t vp = NULLVP;
+
+	if (nc_disabled) {
+		return NULL;
 	}
+
+	ncp = cache_hash_find(dvp, cnp, FALSE, &vp);
 	if (ncp == 0) {
 		/*
 		 * We failed to find an entry
 		 */
 		NCHSTAT(ncs_miss);
+		NCMSTAT(dvp->v_mount, ncm_misses);
 		return NULL;
 	}
 	NCHSTAT(ncs_goodhits);
+	if (vp) {
+		NCMSTAT(dvp->v_mount, ncm_hits);
+	} else {
+		NCMSTAT(dvp->v_mount, ncm_neghits);
+	}
+
+	/* racing lookups all store the same value */
+	if (!ncp->nc_ref) {
+		ncp->nc_ref = 1;
+	}
 
-	return ncp->nc_vp;
+	return vp;
 }
 
 
@@ -2009,9 +2229,6 @@ int
 cache_lookup(struct vnode *dvp, struct vnode **vpp, struct componentname *cnp)
 {
 	struct namecache *ncp;
-	struct nchashhead *ncpp;
-	long namelen = cnp->cn_namelen;
-	unsigned int hashval;
 	boolean_t       have_exclusive = FALSE;
 	uint32_t vid;
 	vnode_t  vp;
@@ -2019,7 +2236,6 @@ cache_lookup(struct vnode *dvp, struct vnode **vpp, struct componentname *cnp)
 	if (cnp->cn_hash == 0) {
 		cnp->cn_hash = hash_string(cnp->cn_nameptr, cnp->cn_namelen);
 	}
-	hashval = cnp->cn_hash;
 
 	if (nc_disabled) {
 		return 0;
@@ -2028,41 +2244,52 @@ cache_lookup(struct vnode *dvp, struct vnode **vpp, struct componentname *cnp)
 	NAME_CACHE_LOCK_SHARED();
 
 relook:
-	ncpp = NCHHASH(dvp, cnp->cn_hash);
-	LIST_FOREACH(ncp, ncpp, nc_hash) {
-		if ((ncp->nc_dvp == dvp) && (ncp->nc_hashval == hashval)) {
-			if (strncmp(ncp->nc_name, cnp->cn_nameptr, namelen) == 0 && ncp->nc_name[namelen] == 0) {
-				break;
-			}
-		}
-	}
+	vp = NULLVP;
+	ncp = cache_hash_find(dvp, cnp, have_exclusive, &vp);
+
 	/* We failed to find an entry */
 	if (ncp == 0) {
 		NCHSTAT(ncs_miss);
+		NCMSTAT(dvp->v_mount, ncm_misses);
+		if (have_exclusive == TRUE) {
+			lck_mtx_unlock(&namecache_list_mtx);
+		}
 		NAME_CACHE_UNLOCK();
 		return 0;
 	}
+	if (!ncp->nc_ref) {
+		ncp->nc_ref = 1;
+	}
+	vid = vp ? vp->v_id : 0;
+
+	/*
+	 * Deleting the entry needs namecache_list_mtx, which keeps anyone
+	 * else from deleting or recycling it once we have looked it up
+	 * again with the mutex held.
+	 */
 
 	/* We don't want to have an entry, so dump it */
 	if ((cnp->cn_flags & MAKEENTRY) == 0) {
 		if (have_exclusive == TRUE) {
 			NCHSTAT(ncs_badhits);
-			cache_delete(ncp, 1);
+			cache_delete_deferred(ncp);
+			lck_mtx_unlock(&namecache_list_mtx);
 			NAME_CACHE_UNLOCK();
 			return 0;
 		}
-		NAME_CACHE_UNLOCK();
-		NAME_CACHE_LOCK();
+		lck_mtx_lock(&namecache_list_mtx);
 		have_exclusive = TRUE;
 		goto relook;
 	}
-	vp = ncp->nc_vp;
 
 	/* We found a "positive" match, return the vnode */
 	if (vp) {
 		NCHSTAT(ncs_goodhits);
+		NCMSTAT(dvp->v_mount, ncm_hits);
 
-		vid = vp->v_id;
+		if (have_exclusive == TRUE) {
+			lck_mtx_unlock(&namecache_list_mtx);
+		}
 		NAME_CACHE_UNLOCK();
 
 		if (vnode_getwithvid(vp, vid)) {
@@ -2081,12 +2308,12 @@ relook:
 	if (cnp->cn_nameiop == CREATE || cnp->cn_nameiop == RENAME) {
 		if (have_exclusive == TRUE) {
 			NCHSTAT(ncs_badhits);
-			cache_delete(ncp, 1);
+			cache_delete_deferred(ncp);
+			lck_mtx_unlock(&namecache_list_mtx);
 			NAME_CACHE_UNLOCK();
 			return 0;
 		}
-		NAME_CACHE_UNLOCK();
-		NAME_CACHE_LOCK();
+		lck_mtx_lock(&namecache_list_mtx);
 		have_exclusive = TRUE;
 		goto relook;
 	}
@@ -2095,7 +2322,11 @@ relook:
 	 * We found a "negative" match, ENOENT notifies client of this match.
 	 */
 	NCHSTAT(ncs_neghits);
+	NCMSTAT(dvp->v_mount, ncm_neghits);
 
+	if (have_exclusive == TRUE) {
+		lck_mtx_unlock(&namecache_list_mtx);
+	}
 	NAME_CACHE_UNLOCK();
 	return ENOENT;
 }
@@ -2116,10 +2347,12 @@ cache_enter_create(vnode_t dvp, vnode_t vp, struct componentname *cnp)
 	 */
 	strname = add_name_internal(cnp->cn_nameptr, cnp->cn_namelen, cnp->cn_hash, TRUE, 0);
 
-	NAME_CACHE_LOCK();
+	NAME_CACHE_LOCK_SHARED();
+	lck_mtx_lock(&namecache_list_mtx);
 
 	cache_enter_locked(dvp, vp, cnp, strname);
 
+	lck_mtx_unlock(&namecache_list_mtx);
 	NAME_CACHE_UNLOCK();
 
 	return strname;
@@ -2141,12 +2374,14 @@ cache_enter_with_gen(struct vnode *dvp, struct vnode *vp, struct componentname *
 		cnp->cn_hash = hash_string(cnp->cn_nameptr, cnp->cn_namelen);
 	}
 
-	NAME_CACHE_LOCK();
+	NAME_CACHE_LOCK_SHARED();
+	lck_mtx_lock(&namecache_list_mtx);
 
 	if (dvp->v_nc_generation == gen) {
 		(void)cache_enter_locked(dvp, vp, cnp, NULL);
 	}
 
+	lck_mtx_unlock(&namecache_list_mtx);
 	NAME_CACHE_UNLOCK();
 }
 
@@ -2169,19 +2404,26 @@ cache_enter(struct vnode *dvp, struct vnode *vp, struct componentname *cnp)
 	 */
 	strname = add_name_internal(cnp->cn_nameptr, cnp->cn_namelen, cnp->cn_hash, FALSE, 0);
 
-	NAME_CACHE_LOCK();
+	NAME_CACHE_LOCK_SHARED();
+	lck_mtx_lock(&namecache_list_mtx);
 
 	cache_enter_locked(dvp, vp, cnp, strname);
 
+	lck_mtx_unlock(&namecache_list_mtx);
 	NAME_CACHE_UNLOCK();
 }
 
 
+/*
+ * Called with either every name cache stripe held exclusive, or the
+ * caller's stripe held shared and namecache_list_mtx held.
+ */
 static void
 cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cnp, const char *strname)
 {
 	struct namecache *ncp, *negp;
 	struct nchashhead *ncpp;
+	u_long index;
 
 	if (nc_disabled) {
 		return;
@@ -2217,16 +2459,21 @@ cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cn
 		/*
 		 * reuse an old entry
 		 */
-		ncp = TAILQ_FIRST(&nchead);
-		TAILQ_REMOVE(&nchead, ncp, nc_entry);
+		ncp = cache_clock_victim(FALSE);
 
 		if (ncp->nc_hash.le_prev != 0) {
 			/*
-			 * still in use... we need to
-			 * delete it before re-using it
+			 * still in use... a lookup may be walking
+			 * past it, so retire it and take a new one
 			 */
 			NCHSTAT(ncs_stolen);
-			cache_delete(ncp, 0);
+			NCMSTAT(ncp->nc_dvp->v_mount, ncm_evictions);
+			cache_delete_deferred(ncp);
+
+			ncp = (struct namecache *)_MALLOC_ZONE(sizeof(*ncp), M_CACHE, M_WAITOK);
+			numcache++;
+		} else {
+			TAILQ_REMOVE(&nchead, ncp, nc_entry);
 		}
 	}
 	NCHSTAT(ncs_enters);
@@ -2237,6 +2484,7 @@ cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cn
 	ncp->nc_vp = vp;
 	ncp->nc_dvp = dvp;
 	ncp->nc_hashval = cnp->cn_hash;
+	ncp->nc_ref = 0;
 
 	if (strname == NULL) {
 		ncp->nc_name = add_name_internal(cnp->cn_nameptr, cnp->cn_namelen, cnp->cn_hash, FALSE, 0);
@@ -2268,7 +2516,10 @@ cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cn
 	 */
 	TAILQ_INSERT_TAIL(&nchead, ncp, nc_entry);
 
-	ncpp = NCHHASH(dvp, cnp->cn_hash);
+	index = NCHHASH_INDEX(dvp, cnp->cn_hash);
+	ncpp = &nchashtbl[index];
+	ncp->nc_hash_stripe = NCHHASH_STRIPE(index);
+
 #if DIAGNOSTIC
 	{
 		struct namecache *p;
@@ -2281,9 +2532,13 @@ cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cn
 	}
 #endif
 	/*
-	 * make us available to be found via lookup
+	 * make us available to be found via lookup, the
+	 * barrier in nc_hash_write_begin() publishes the
+	 * fields filled in above before the entry itself
 	 */
+	nc_hash_write_begin(ncp->nc_hash_stripe);
 	LIST_INSERT_HEAD(ncpp, ncp, nc_hash);
+	nc_hash_write_end(ncp->nc_hash_stripe);
 
 	if (vp) {
 		/*
@@ -2304,10 +2559,11 @@ cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cn
 			/*
 			 * if we've reached our desired limit
 			 * of negative cache entries, delete
-			 * the oldest
+			 * the oldest one not recently used
 			 */
-			negp = TAILQ_FIRST(&neghead);
-			cache_delete(negp, 1);
+			negp = cache_clock_victim(TRUE);
+			NCMSTAT(negp->nc_dvp->v_mount, ncm_evictions);
+			cache_delete_deferred(negp);
 		}
 	}
 	/*
@@ -2322,6 +2578,43 @@ cache_enter_locked(struct vnode *dvp, struct vnode *vp, struct componentname *cn
 }
 
 
+/*
+ * Pick the entry to recycle from the head of nchead, or of neghead
+ * when negative is set, giving entries looked up since the last pass a
+ * second chance at the tail.  The scan is bounded so that a cache full
+ * of hot entries still makes progress.
+ *
+ * Called with either every name cache stripe held exclusive, or the
+ * caller's stripe held shared and namecache_list_mtx held.
+ */
+static struct namecache *
+cache_clock_victim(boolean_t negative)
+{
+	struct namecache *ncp;
+	int     i;
+
+	for (i = 0; i < NC_CLOCK_SCAN_MAX; i++) {
+		if (negative) {
+			ncp = TAILQ_FIRST(&neghead);
+		} else {
+			ncp = TAILQ_FIRST(&nchead);
+		}
+		/* entries that are no longer hashed are free for the taking */
+		if (ncp->nc_hash.le_prev == 0 || !ncp->nc_ref) {
+			return ncp;
+		}
+		ncp->nc_ref = 0;
+		if (negative) {
+			TAILQ_REMOVE(&neghead, ncp, nc_un.nc_negentry);
+			TAILQ_INSERT_TAIL(&neghead, ncp, nc_un.nc_negentry);
+		} else {
+			TAILQ_REMOVE(&nchead, ncp, nc_entry);
+			TAILQ_INSERT_TAIL(&nchead, ncp, nc_entry);
+		}
+	}
+	return negative ? TAILQ_FIRST(&neghead) : TAILQ_FIRST(&nchead);
+}
+
 /*
  * Initialize CRC-32 remainder table.
  */
@@ -2364,6 +2657,12 @@ nchinit(void)
 
 	desiredNegNodes = (desiredvnodes / 10);
 	desiredNodes = desiredvnodes + desiredNegNodes;
+	nc_base_nodes = desiredNodes;
+	nc_max_nodes = desiredNodes * 4;
+
+	nc_ncpus = ml_get_max_cpus();
+	MALLOC(nc_cpu_stats, struct nc_mount_stats *, nc_ncpus * sizeof(*nc_cpu_stats),
+	    M_CACHE, M_WAITOK | M_ZERO);
 
 	TAILQ_INIT(&nchead);
 	TAILQ_INIT(&neghead);
@@ -2384,8 +2683,11 @@ nchinit(void)
 	/* Allocate name cache lock attribute */
 	namecache_lck_attr = lck_attr_alloc_init();
 
-	/* Allocate name cache lock */
-	namecache_rw_lock = lck_rw_alloc_init(namecache_lck_grp, namecache_lck_attr);
+	/* Initialize name cache lock stripes */
+	for (i = 0; i < NUM_NAMECACHE_LOCKS; i++) {
+		lck_rw_init(&namecache_rw_locks[i].ncs_lock, namecache_lck_grp, namecache_lck_attr);
+	}
+	lck_mtx_init(&namecache_list_mtx, namecache_lck_grp, namecache_lck_attr);
 
 
 	/* Allocate string cache lock group attribute and group */
@@ -2402,44 +2704,69 @@ nchinit(void)
 	for (i = 0; i < NUM_STRCACHE_LOCKS; i++) {
 		lck_mtx_init(&strcache_mtx_locks[i], strcache_lck_grp, strcache_lck_attr);
 	}
+
+	nc_tune_call = thread_call_allocate_with_options(nc_tune, NULL,
+	    THREAD_CALL_PRIORITY_LOW, THREAD_CALL_OPTIONS_ONCE);
+	nc_reclaim_call = thread_call_allocate_with_options(nc_reclaim, NULL,
+	    THREAD_CALL_PRIORITY_LOW, THREAD_CALL_OPTIONS_ONCE);
+	nc_tune(NULL, NULL);
+	fs_buffer_cache_gc_register(nc_gc, NULL);
 }
 
 void
 name_cache_lock_shared(void)
 {
-	lck_rw_lock_shared(namecache_rw_lock);
+	lck_rw_lock_shared(NAMECACHE_RW_STRIPE());
 }
 
 void
 name_cache_lock(void)
 {
-	lck_rw_lock_exclusive(namecache_rw_lock);
+	int     i;
+
+	for (i = 0; i < NUM_NAMECACHE_LOCKS; i++) {
+		lck_rw_lock_exclusive(&namecache_rw_locks[i].ncs_lock);
+	}
 }
 
 void
 name_cache_unlock(void)
 {
-	lck_rw_done(namecache_rw_lock);
+	lck_rw_t *mine = NAMECACHE_RW_STRIPE();
+	int     i;
+
+	if (lck_rw_done(mine) != LCK_RW_TYPE_EXCLUSIVE) {
+		return;
+	}
+	for (i = 0; i < NUM_NAMECACHE_LOCKS; i++) {
+		if (&namecache_rw_locks[i].ncs_lock != mine) {
+			lck_rw_done(&namecache_rw_locks[i].ncs_lock);
+		}
+	}
 }
 
 
 int
 resize_namecache(int newsize)
+{
+	if (newsize < 0) {
+		return EINVAL;
+	}
+
+	return resize_namecache_nodes(newsize + (newsize / 10), newsize / 10);
+}
+
+static int
+resize_namecache_nodes(int dNodes, int dNegNodes)
 {
 	struct nchashhead   *new_table;
 	struct nchashhead   *old_table;
 	struct nchashhead   *old_head, *head;
 	struct namecache    *entry, *next;
 	uint32_t            i, hashval;
-	int                 dNodes, dNegNodes, nelements;
-	u_long              new_size, old_size;
-
-	if (newsize < 0) {
-		return EINVAL;
-	}
+	int                 nelements;
+	u_long              new_size, new_mask, old_size;
 
-	dNegNodes = (newsize / 10);
-	dNodes = newsize + dNegNodes;
 	// we don't support shrinking yet
 	if (dNodes <= desiredNodes) {
 		return 0;
@@ -2449,19 +2776,27 @@ resize_namecache(int newsize)
 		return EINVAL;
 	}
 
-	new_table = hashinit(nelements, M_CACHE, &nchashmask);
-	new_size  = nchashmask + 1;
+	new_table = hashinit(nelements, M_CACHE, &new_mask);
+	new_size  = new_mask + 1;
 
 	if (new_table == NULL) {
 		return ENOMEM;
 	}
 
 	NAME_CACHE_LOCK();
+	// somebody else may have grown the cache while we allocated
+	if (dNodes <= desiredNodes) {
+		NAME_CACHE_UNLOCK();
+		FREE(new_table, M_CACHE);
+		return 0;
+	}
+
 	// do the switch!
 	old_table = nchashtbl;
 	nchashtbl = new_table;
 	old_size  = nchash;
 	nchash    = new_size;
+	nchashmask = new_mask;
 
 	// walk the old table and insert all the entries into
 	// the new table
@@ -2476,6 +2811,7 @@ resize_namecache(int newsize)
 			hashval = hash_string(entry->nc_name, 0);
 			entry->nc_hashval = hashval;
 			head = NCHHASH(entry->nc_dvp, hashval);
+			entry->nc_hash_stripe = NCHHASH_STRIPE(head - nchashtbl);
 
 			next = entry->nc_hash.le_next;
 			LIST_INSERT_HEAD(head, entry, nc_hash);
@@ -2483,6 +2819,9 @@ resize_namecache(int newsize)
 	}
 	desiredNodes = dNodes;
 	desiredNegNodes = dNegNodes;
+	if (nc_max_nodes < desiredNodes) {
+		nc_max_nodes = desiredNodes;
+	}
 
 	NAME_CACHE_UNLOCK();
 	FREE(old_table, M_CACHE);
@@ -2490,8 +2829,224 @@ resize_namecache(int newsize)
 	return 0;
 }
 
+/*
+ * Periodic tuning of the name cache size and negative budget from the
+ * counters gathered since the last run; see "Replacement policy" above.
+ */
 static void
-cache_delete(struct namecache *ncp, int free_entry)
+nc_tune(__unused thread_call_param_t p0, __unused thread_call_param_t p1)
+{
+	struct nc_mount_stats now;
+	uint64_t hits, neghits, misses, evictions, lookups, deadline;
+	int     neg_target, dNodes;
+
+	nc_stats_sum(nc_cpu_stats, nc_ncpus, &now);
+	hits = now.ncm_hits - nc_tune_last.ncm_hits;
+	neghits = now.ncm_neghits - nc_tune_last.ncm_neghits;
+	misses = now.ncm_misses - nc_tune_last.ncm_misses;
+	evictions = now.ncm_evictions - nc_tune_last.ncm_evictions;
+	nc_tune_last = now;
+	lookups = hits + neghits + misses;
+
+	if (nc_disabled || lookups == 0) {
+		goto out;
+	}
+
+	/*
+	 * More than 1 lookup in 8 missing while an eighth of the cache
+	 * was recycled: the working set does not fit, grow by a quarter.
+	 */
+	dNodes = desiredNodes;
+	if (misses * 8 > lookups && evictions * 8 > (uint64_t)dNodes &&
+	    dNodes < nc_max_nodes) {
+		dNodes = MIN(dNodes + dNodes / 4, nc_max_nodes);
+		(void)resize_namecache_nodes(dNodes,
+		    (int)((uint64_t)desiredNegNodes * dNodes / desiredNodes));
+	}
+
+	/*
+	 * Move the negative budget an eighth of the way toward twice the
+	 * share of hits negative entries earned, within the bounds.
+	 */
+	if (hits + neghits != 0) {
+		neg_target = (int)((uint64_t)dNodes * 2 * neghits / (hits + neghits));
+		neg_target = MAX(neg_target, dNodes * NC_NEG_MIN_PCT / 100);
+		neg_target = MIN(neg_target, dNodes * NC_NEG_MAX_PCT / 100);
+
+		NAME_CACHE_LOCK();
+		desiredNegNodes += (neg_target - desiredNegNodes) / 8;
+		NAME_CACHE_UNLOCK();
+	}
+
+out:
+	clock_interval_to_deadline(NC_TUNE_INTERVAL, NSEC_PER_SEC, &deadline);
+	thread_call_enter_delayed(nc_tune_call, deadline);
+}
+
+/*
+ * Lower desiredNodes to dNodes, but not below nc_base_nodes, scaling the
+ * negative budget with it, and free the entries over the new budgets.
+ * The hash table keeps its size.
+ */
+static void
+nc_shrink(int dNodes)
+{
+	struct namecache *ncp;
+
+	dNodes = MAX(dNodes, nc_base_nodes);
+
+	NAME_CACHE_LOCK();
+	if (dNodes < desiredNodes) {
+		desiredNegNodes = (int)((uint64_t)desiredNegNodes * dNodes / desiredNodes);
+		desiredNodes = dNodes;
+	}
+	while (ncs_negtotal > desiredNegNodes &&
+	    (ncp = TAILQ_FIRST(&neghead)) != NULL) {
+		NCMSTAT(ncp->nc_dvp->v_mount, ncm_evictions);
+		cache_delete(ncp, 1);
+	}
+	while (numcache > desiredNodes && (ncp = TAILQ_FIRST(&nchead)) != NULL) {
+		if (ncp->nc_hash.le_prev != 0) {
+			NCMSTAT(ncp->nc_dvp->v_mount, ncm_evictions);
+			cache_delete(ncp, 1);
+		} else {
+			/* already purged, only its memory is left */
+			TAILQ_REMOVE(&nchead, ncp, nc_entry);
+			FREE_ZONE(ncp, sizeof(*ncp), M_CACHE);
+			numcache--;
+		}
+	}
+	NAME_CACHE_UNLOCK();
+}
+
+/*
+ * Buffer cache GC callout: memory is short, give back half of what
+ * nc_tune() grew the cache by, or all of it.
+ */
+static void
+nc_gc(int all, __unused void *context)
+{
+	int dNodes = desiredNodes;
+
+	nc_shrink(all ? nc_base_nodes : dNodes - (dNodes - nc_base_nodes) / 2);
+}
+
+/*
+ * vfs.namecache.max_nodes: the cache can't be made to grow past
+ * NC_MAX_GROWTH times its boot size, and lowering the bound below the
+ * current size shrinks the cache.
+ */
+static int
+sysctl_nc_max_nodes(__unused struct sysctl_oid *oidp, __unused void *arg1,
+    __unused int arg2, struct sysctl_req *req)
+{
+	int     value = nc_max_nodes;
+	int     error, changed = 0;
+
+	error = sysctl_io_number(req, value, sizeof(value), &value, &changed);
+	if (error != 0 || !changed) {
+		return error;
+	}
+	if (value < nc_base_nodes || value / NC_MAX_GROWTH > nc_base_nodes) {
+		return EINVAL;
+	}
+
+	nc_max_nodes = value;
+	if (value < desiredNodes) {
+		nc_shrink(value);
+	}
+	return 0;
+}
+
+/*
+ * Name cache counters of every mounted file system, as an array of
+ * struct namecache_mount_stats.
+ */
+static int
+sysctl_nc_mountstats(__unused struct sysctl_oid *oidp, __unused void *arg1,
+    __unused int arg2, struct sysctl_req *req)
+{
+	struct namecache_mount_stats *stats;
+	struct nc_mount_stats sum;
+	struct mount *mp;
+	int     count, actual, error;
+
+again:
+	count = 0;
+	mount_list_lock();
+	TAILQ_FOREACH(mp, &mountlist, mnt_list) {
+		count++;
+	}
+	mount_list_unlock();
+
+	if (req->oldptr == USER_ADDR_NULL) {
+		/* leave room for a few more mounts */
+		req->oldidx = (count + 4) * sizeof(*stats);
+		return 0;
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	MALLOC(stats, struct namecache_mount_stats *, count * sizeof(*stats),
+	    M_TEMP, M_WAITOK | M_ZERO);
+	if (stats == NULL) {
+		return ENOMEM;
+	}
+
+	actual = 0;
+	mount_list_lock();
+	TAILQ_FOREACH(mp, &mountlist, mnt_list) {
+		if (actual < count) {
+			nc_stats_sum(mp->mnt_ncstats, NC_STAT_STRIPES, &sum);
+			stats[actual].nms_fsid = mp->mnt_vfsstat.f_fsid;
+			stats[actual].nms_hits = sum.ncm_hits;
+			stats[actual].nms_neghits = sum.ncm_neghits;
+			stats[actual].nms_misses = sum.ncm_misses;
+			stats[actual].nms_evictions = sum.ncm_evictions;
+		}
+		actual++;
+	}
+	mount_list_unlock();
+
+	if (actual > count) {
+		/* a file system was mounted while we allocated */
+		FREE(stats, M_TEMP);
+		goto again;
+	}
+
+	error = SYSCTL_OUT(req, stats, actual * sizeof(*stats));
+	FREE(stats, M_TEMP);
+	return error;
+}
+
+SYSCTL_NODE(_vfs, OID_AUTO, namecache, CTLFLAG_RW | CTLFLAG_LOCKED, NULL, "name cache");
+
+SYSCTL_INT(_vfs_namecache, OID_AUTO, desired_nodes, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &desiredNodes, 0, "current target number of name cache entries");
+
+SYSCTL_INT(_vfs_namecache, OID_AUTO, desired_neg_nodes, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &desiredNegNodes, 0, "current budget of negative name cache entries");
+
+SYSCTL_PROC(_vfs_namecache, OID_AUTO, max_nodes, CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED,
+    NULL, 0, sysctl_nc_max_nodes, "I", "size the name cache may grow to on its own");
+
+SYSCTL_INT(_vfs_namecache, OID_AUTO, mountstats_enable, CTLFLAG_RW | CTLFLAG_LOCKED,
+    &nc_mountstats_enable, 0, "keep the per-mount name cache counters");
+
+SYSCTL_PROC(_vfs_namecache, OID_AUTO, mountstats,
+    CTLTYPE_STRUCT | CTLFLAG_RD | CTLFLAG_LOCKED,
+    NULL, 0, sysctl_nc_mountstats, "S,namecache_mount_stats",
+    "per-mount name cache hits, misses and evictions");
+
+/*
+ * Take ncp off its hash chain and the vnode lists.
+ *
+ * Called with either every name cache stripe held exclusive, or the
+ * caller's stripe held shared and namecache_list_mtx held.
+ */
+static void
+cache_unlink(struct namecache *ncp)
 {
 	NCHSTAT(ncs_deletes);
 
@@ -2503,6 +3058,7 @@ cache_delete(struct namecache *ncp, int free_entry)
 	}
 	TAILQ_REMOVE(&(ncp->nc_dvp->v_ncchildren), ncp, nc_child);
 
+	nc_hash_write_begin(ncp->nc_hash_stripe);
 	LIST_REMOVE(ncp, nc_hash);
 	/*
 	 * this field is used to indicate
@@ -2511,6 +3067,16 @@ cache_delete(struct namecache *ncp, int free_entry)
 	 * be reused...
 	 */
 	ncp->nc_hash.le_prev = NULL;
+	nc_hash_write_end(ncp->nc_hash_stripe);
+}
+
+/*
+ * Called with every name cache stripe held exclusive.
+ */
+static void
+cache_delete(struct namecache *ncp, int free_entry)
+{
+	cache_unlink(ncp);
 
 	vfs_removename(ncp->nc_name);
 	ncp->nc_name = NULL;
@@ -2521,6 +3087,48 @@ cache_delete(struct namecache *ncp, int free_entry)
 	}
 }
 
+/*
+ * Delete ncp while lookups may be walking its hash chain: it keeps its
+ * name and memory until nc_reclaim() frees it.
+ *
+ * Called with the caller's stripe held shared and namecache_list_mtx held.
+ */
+static void
+cache_delete_deferred(struct namecache *ncp)
+{
+	cache_unlink(ncp);
+
+	TAILQ_REMOVE(&nchead, ncp, nc_entry);
+	numcache--;
+	TAILQ_INSERT_TAIL(&nc_deferred_head, ncp, nc_entry);
+	if (++nc_deferred_count == NC_DEFERRED_MAX) {
+		thread_call_enter(nc_reclaim_call);
+	}
+}
+
+/*
+ * Free the entries queued by cache_delete_deferred().  Once every stripe
+ * has been held exclusive, no lookup that could have seen them on a hash
+ * chain is still running.
+ */
+static void
+nc_reclaim(__unused thread_call_param_t p0, __unused thread_call_param_t p1)
+{
+	TAILQ_HEAD(, namecache) reclaim = TAILQ_HEAD_INITIALIZER(reclaim);
+	struct namecache *ncp;
+
+	NAME_CACHE_LOCK();
+	TAILQ_CONCAT(&reclaim, &nc_deferred_head, nc_entry);
+	nc_deferred_count = 0;
+	NAME_CACHE_UNLOCK();
+
+	while ((ncp = TAILQ_FIRST(&reclaim)) != NULL) {
+		TAILQ_REMOVE(&reclaim, ncp, nc_entry);
+		vfs_removename(ncp->nc_name);
+		FREE_ZONE(ncp, sizeof(*ncp), M_CACHE);
+	}
+}
+
 
 /*
  * purge the entry associated with the
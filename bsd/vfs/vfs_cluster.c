@@ -85,6 +85,7 @@
 #include <mach/upl.h>
 #include <kern/task.h>
 #include <kern/policy_internal.h>
+#include <kern/clock.h>
 
 #include <vm/vm_kern.h>
 #include <vm/vm_map.h>
@@ -215,6 +216,11 @@ static int cluster_align_phys_io(vnode_t vp, struct uio *uio, addr64_t usr_paddr
 static int      cluster_read_prefetch(vnode_t vp, off_t f_offset, u_int size, off_t filesize, int (*callback)(buf_t, void *), void *callback_arg, int bflag);
 static void     cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_readahead *ra,
     int (*callback)(buf_t, void *), void *callback_arg, int bflag);
+static void     cluster_read_ahead_strided(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_readahead *rap,
+    int (*callback)(buf_t, void *), void *callback_arg, int bflag);
+static void     cluster_ra_select(struct cl_readahead *rap, struct cl_extent *extent);
+static u_int    cluster_ra_max_prefetch(vnode_t vp, struct cl_readahead *rap);
+static void     cluster_ra_note_latency(mount_t mp, uint64_t start);
 
 static int      cluster_push_now(vnode_t vp, struct cl_extent *, off_t EOF, int flags, int (*)(buf_t, void *), void *callback_arg, boolean_t vm_ioitiated);
 
@@ -308,6 +314,16 @@ uint32_t throttle_max_iosize = (128 * 1024);
 
 SYSCTL_INT(_debug, OID_AUTO, lowpri_throttle_max_iosize, CTLFLAG_RW | CTLFLAG_LOCKED, &throttle_max_iosize, 0, "");
 
+/*
+ * when set, read-ahead tracks several streams per file, follows strided
+ * streams and sizes its window from the measured device latency (see
+ * vfs_cluster_ra.h)... when clear, a single sequential stream is tracked
+ * with the fixed MAX_PREFETCH ceiling
+ */
+int     cluster_ra_adaptive = 1;
+
+SYSCTL_INT(_debug, OID_AUTO, cluster_ra_adaptive, CTLFLAG_RW | CTLFLAG_LOCKED, &cluster_ra_adaptive, 0, "");
+
 
 void
 cluster_init(void)
@@ -418,6 +434,7 @@ cluster_get_rap(vnode_t vp)
 
 		bzero(rap, sizeof *rap);
 		rap->cl_lastr = -1;
+		cl_ra_init(&rap->cl_ras);
 		lck_mtx_init(&rap->cl_lockr, cl_mtx_grp, cl_mtx_attr);
 
 		vnode_lock(vp);
@@ -2056,6 +2073,22 @@ cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct
 		return;
 	}
 	if (rap->cl_lastr == -1 || (extent->b_addr != rap->cl_lastr && extent->b_addr != (rap->cl_lastr + 1))) {
+		if (cluster_ra_adaptive) {
+			if (cl_ra_is_strided(&rap->cl_ras.cl_streams[rap->cl_ras.cl_stream], extent->b_addr)) {
+				cluster_read_ahead_strided(vp, extent, filesize, rap, callback, callback_arg, bflag);
+
+				KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
+				    rap->cl_ralen, (int)rap->cl_maxra, (int)rap->cl_lastr, 7, 0);
+				return;
+			}
+			if (rap->cl_lastr != -1 && rap->cl_maxra > rap->cl_lastr) {
+				/*
+				 * the stream jumped away from pages we
+				 * prefetched for it and never read
+				 */
+				cl_ra_wasted(&rap->cl_ras);
+			}
+		}
 		rap->cl_ralen = 0;
 		rap->cl_maxra = 0;
 
@@ -2064,11 +2097,10 @@ cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct
 
 		return;
 	}
-	max_prefetch = MAX_PREFETCH(vp, cluster_max_io_size(vp->v_mount, CL_READ), disk_conditioner_mount_is_ssd(vp->v_mount));
-
-	if (max_prefetch > speculative_prefetch_max) {
-		max_prefetch = speculative_prefetch_max;
+	if (cluster_ra_adaptive && extent->e_addr <= rap->cl_maxra) {
+		cl_ra_hit(&rap->cl_ras);
 	}
+	max_prefetch = cluster_ra_max_prefetch(vp, rap);
 
 	if (max_prefetch <= PAGE_SIZE) {
 		KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
@@ -2119,6 +2151,145 @@ cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct
 }
 
 
+/*
+ * issue read-ahead for the records following 'extent' in a confirmed
+ * strided stream... as many records as fit in the stream's window,
+ * up to CL_RA_STRIDE_DEPTH, skipping those already prefetched
+ */
+static void
+cluster_read_ahead_strided(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_readahead *rap,
+    int (*callback)(buf_t, void *), void *callback_arg, int bflag)
+{
+	struct cl_rastream *s;
+	daddr64_t       r_addr;
+	daddr64_t       rec_pages;
+	int             depth;
+	int             k;
+	int             size_of_prefetch;
+
+	s = &rap->cl_ras.cl_streams[rap->cl_ras.cl_stream];
+	rec_pages = (extent->e_addr - extent->b_addr) + 1;
+
+	if (extent->e_addr <= rap->cl_maxra) {
+		cl_ra_hit(&rap->cl_ras);
+	}
+	depth = (int)((cluster_ra_max_prefetch(vp, rap) / PAGE_SIZE) / rec_pages);
+
+	if (depth < 1) {
+		depth = 1;
+	} else if (depth > CL_RA_STRIDE_DEPTH) {
+		depth = CL_RA_STRIDE_DEPTH;
+	}
+	for (k = 1; k <= depth; k++) {
+		r_addr = cl_ra_stride_record(s, extent->b_addr, extent->e_addr, k);
+
+		if ((off_t)(r_addr * PAGE_SIZE_64) >= filesize) {
+			break;
+		}
+		if (r_addr <= rap->cl_maxra) {
+			continue;
+		}
+		size_of_prefetch = cluster_read_prefetch(vp, (off_t)(r_addr * PAGE_SIZE_64), (u_int)(rec_pages * PAGE_SIZE),
+		    filesize, callback, callback_arg, bflag);
+
+		if (size_of_prefetch == 0) {
+			break;
+		}
+		rap->cl_maxra = (r_addr + size_of_prefetch) - 1;
+	}
+}
+
+
+/*
+ * the read-ahead ceiling for the active stream, in bytes... MAX_PREFETCH
+ * (clipped to speculative_prefetch_max), or with cluster_ra_adaptive,
+ * what the stream consumes over twice the mount's demand read latency,
+ * kept between one I/O and 4 times MAX_PREFETCH and scaled down while
+ * read-ahead is being wasted
+ */
+static u_int
+cluster_ra_max_prefetch(vnode_t vp, struct cl_readahead *rap)
+{
+	u_int   max_io_size;
+	u_int   max_prefetch;
+	u_int   max_adaptive;
+
+	max_io_size = cluster_max_io_size(vp->v_mount, CL_READ);
+	max_prefetch = MAX_PREFETCH(vp, max_io_size, disk_conditioner_mount_is_ssd(vp->v_mount));
+
+	if (max_prefetch > speculative_prefetch_max) {
+		max_prefetch = speculative_prefetch_max;
+	}
+	if (cluster_ra_adaptive) {
+		max_adaptive = min(max_prefetch * 4, speculative_prefetch_max);
+
+		max_prefetch = cl_ra_window(&rap->cl_ras, &rap->cl_ras.cl_streams[rap->cl_ras.cl_stream],
+		    vp->v_mount->mnt_read_latency, max_prefetch / PAGE_SIZE,
+		    min(max_io_size, max_prefetch) / PAGE_SIZE, max_adaptive / PAGE_SIZE) * PAGE_SIZE;
+	}
+	return max_prefetch;
+}
+
+
+/*
+ * make the stream that the read described by 'extent' continues the
+ * active one... park the active stream's state in rap->cl_ras, pick
+ * the stream (see cl_ra_select), account the read to it and load its
+ * state into rap for cluster_read_copy and cluster_read_ahead
+ */
+static void
+cluster_ra_select(struct cl_readahead *rap, struct cl_extent *extent)
+{
+	struct cl_rastreams *ras = &rap->cl_ras;
+	struct cl_rastream *s;
+	int64_t         wasted;
+	uint64_t        now;
+
+	s = &ras->cl_streams[ras->cl_stream];
+	s->cl_lastr = rap->cl_lastr;
+	s->cl_maxra = rap->cl_maxra;
+	s->cl_ralen = rap->cl_ralen;
+
+	ras->cl_stream = cl_ra_select(ras, extent->b_addr, &wasted);
+
+	if (wasted) {
+		cl_ra_wasted(ras);
+	}
+	s = &ras->cl_streams[ras->cl_stream];
+
+	absolutetime_to_nanoseconds(mach_absolute_time(), &now);
+	cl_ra_note_read(s, extent->b_addr, extent->e_addr, now);
+
+	rap->cl_lastr = s->cl_lastr;
+	rap->cl_maxra = s->cl_maxra;
+	rap->cl_ralen = s->cl_ralen;
+}
+
+
+/*
+ * fold the time a demand read issued at 'start' waited for its I/O
+ * into the mount's smoothed read latency... this includes any delay
+ * the disk conditioner adds, so read-ahead sizes itself to the
+ * conditioned device as well
+ */
+static void
+cluster_ra_note_latency(mount_t mp, uint64_t start)
+{
+	uint64_t        elapsed;
+	uint32_t        latency;
+	uint32_t        sample;
+
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &elapsed);
+	sample = (uint32_t)MIN(elapsed / NSEC_PER_USEC, USEC_PER_SEC);
+
+	/*
+	 * racing updates can lose a sample, which doesn't matter here
+	 */
+	latency = mp->mnt_read_latency;
+	mp->mnt_read_latency = latency ? ((latency * 7) + sample) / 8 : sample;
+}
+
+
 int
 cluster_pageout(vnode_t vp, upl_t upl, upl_offset_t upl_offset, off_t f_offset,
     int size, off_t filesize, int flags)
@@ -3937,6 +4108,7 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 	struct cl_readahead *   rap;
 	struct clios            iostate;
 	struct cl_extent        extent;
+	uint64_t         io_start = 0;
 	int              bflag;
 	int              take_reference = 1;
 	int              policy = IOPOL_DEFAULT;
@@ -3999,6 +4171,10 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 		} else {
 			extent.b_addr = uio->uio_offset / PAGE_SIZE_64;
 			extent.e_addr = (last_request_offset - 1) / PAGE_SIZE_64;
+
+			if (cluster_ra_adaptive) {
+				cluster_ra_select(rap, &extent);
+			}
 		}
 	}
 	if (rap != NULL && rap->cl_ralen && (rap->cl_lastr == extent.b_addr || (rap->cl_lastr + 1) == extent.b_addr)) {
@@ -4238,6 +4414,7 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 			/*
 			 * issue an asynchronous read to cluster_io
 			 */
+			io_start = mach_absolute_time();
 
 			error = cluster_io(vp, upl, upl_offset, upl_f_offset + upl_offset,
 			    io_size, CL_READ | CL_ASYNC | bflag, (buf_t)NULL, &iostate, callback, callback_arg);
@@ -4251,6 +4428,10 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 					 * logic which will cause us to restart from scratch
 					 */
 					rap->cl_maxra = 0;
+
+					if (cluster_ra_adaptive) {
+						cl_ra_wasted(&rap->cl_ras);
+					}
 				}
 			}
 		}
@@ -4340,6 +4521,9 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 			if (iolock_inited == TRUE) {
 				cluster_iostate_wait(&iostate, 0, "cluster_read_copy");
 			}
+			if (start_pg < last_pg && !iostate.io_error && cluster_ra_adaptive) {
+				cluster_ra_note_latency(vp->v_mount, io_start);
+			}
 
 			if (iostate.io_error) {
 				error = iostate.io_error;
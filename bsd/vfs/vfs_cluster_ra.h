@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Read-ahead stream tracking for cluster_read_copy().
+ *
+ * A file may be read by several sequential or strided streams at once
+ * (interleaved readers, or one reader walking records of fixed stride).
+ * Up to CL_RA_STREAMS of them are tracked per file.  Each read is matched
+ * to the stream it continues and that stream's read-ahead state is used.
+ * The window is sized to cover the device latency at the rate the
+ * stream consumes data, and backs off when prefetched pages go unused.
+ *
+ * Everything here is pure arithmetic on the state below, with no kernel
+ * dependencies, so that tests/vfs_cluster_ra.c can replay access traces
+ * through the same policy in user space.  vfs_cluster.c supplies the
+ * clock and the measured latency, and issues the I/O.  Addresses are in
+ * pages and times in nanoseconds.
+ */
+
+#ifndef _VFS_VFS_CLUSTER_RA_H_
+#define _VFS_VFS_CLUSTER_RA_H_
+
+#include <stdint.h>
+
+#define CL_RA_STREAMS           4       /* streams tracked per file */
+#define CL_RA_STRIDE_MAX        256     /* largest gap learned as a stride */
+#define CL_RA_STRIDE_CONFIRM    2       /* repeats before a stride is prefetched */
+#define CL_RA_STRIDE_DEPTH      8       /* most records prefetched ahead */
+#define CL_RA_WASTE_MAX         3       /* largest back-off shift */
+#define CL_RA_WASTE_DECAY       128     /* read-ahead hits that undo one back-off step */
+
+struct cl_rastream {
+	int64_t         cl_lastr;       /* last page read by the stream, -1 if unused */
+	int64_t         cl_maxra;       /* last page prefetched for the stream */
+	int             cl_ralen;       /* length of the last prefetch */
+	int             cl_stride;      /* gap from the end of one record to the next */
+	int             cl_stride_hits; /* times cl_stride has repeated */
+	uint32_t        cl_rate;        /* smoothed consumption, pages per second */
+	uint64_t        cl_lastuse;     /* time of the last read */
+};
+
+struct cl_rastreams {
+	int             cl_stream;      /* index of the active stream */
+	int             cl_waste;       /* back-off shift applied to every window */
+	int             cl_hits;        /* read-ahead hits since cl_waste last changed */
+	struct cl_rastream cl_streams[CL_RA_STREAMS];
+};
+
+static inline void
+cl_ra_stream_reset(struct cl_rastream *s)
+{
+	s->cl_lastr = -1;
+	s->cl_maxra = 0;
+	s->cl_ralen = 0;
+	s->cl_stride = 0;
+	s->cl_stride_hits = 0;
+	s->cl_rate = 0;
+	s->cl_lastuse = 0;
+}
+
+static inline void
+cl_ra_init(struct cl_rastreams *ras)
+{
+	int i;
+
+	ras->cl_stream = 0;
+	ras->cl_waste = 0;
+	ras->cl_hits = 0;
+	for (i = 0; i < CL_RA_STREAMS; i++) {
+		cl_ra_stream_reset(&ras->cl_streams[i]);
+	}
+}
+
+/*
+ * Picks the stream a read starting at b_addr continues: one it follows
+ * sequentially or lands on the stride of, else the nearest stream it is
+ * a small forward jump from that has not settled into sequential
+ * read-ahead (a stride to learn), else an unused or the least recently
+ * used stream, which is reset.  Returns the number of pages the reset
+ * stream had prefetched but never read in *wastedp.
+ */
+static inline int
+cl_ra_select(struct cl_rastreams *ras, int64_t b_addr, int64_t *wastedp)
+{
+	struct cl_rastream *s;
+	int64_t gap, best_gap = CL_RA_STRIDE_MAX + 1;
+	int i, best = -1, lru = -1;
+
+	*wastedp = 0;
+	for (i = 0; i < CL_RA_STREAMS; i++) {
+		s = &ras->cl_streams[i];
+
+		if (s->cl_lastr == -1) {
+			if (lru == -1 || ras->cl_streams[lru].cl_lastr != -1) {
+				lru = i;
+			}
+			continue;
+		}
+		gap = b_addr - s->cl_lastr;
+		if (gap == 0 || gap == 1 || (s->cl_stride && gap == s->cl_stride)) {
+			return i;
+		}
+		if (gap > 1 && gap < best_gap && s->cl_ralen == 0) {
+			best = i;
+			best_gap = gap;
+		}
+		if (lru == -1 || (ras->cl_streams[lru].cl_lastr != -1 &&
+		    s->cl_lastuse < ras->cl_streams[lru].cl_lastuse)) {
+			lru = i;
+		}
+	}
+	if (best != -1) {
+		return best;
+	}
+
+	s = &ras->cl_streams[lru];
+	if (s->cl_lastr != -1 && s->cl_maxra > s->cl_lastr) {
+		*wastedp = s->cl_maxra - s->cl_lastr;
+	}
+	cl_ra_stream_reset(s);
+	return lru;
+}
+
+/*
+ * Accounts a read of [b_addr, e_addr] at time now to stream s: learns or
+ * confirms its stride and updates its consumption rate.  Must be called
+ * before the stream's cl_lastr moves to e_addr.
+ */
+static inline void
+cl_ra_note_read(struct cl_rastream *s, int64_t b_addr, int64_t e_addr,
+    uint64_t now)
+{
+	int64_t gap = b_addr - s->cl_lastr;
+	uint64_t pages = (uint64_t)(e_addr - b_addr + 1);
+	uint64_t rate;
+
+	if (s->cl_lastr != -1 && gap > 1 && gap <= CL_RA_STRIDE_MAX) {
+		if (gap == s->cl_stride) {
+			if (s->cl_stride_hits < CL_RA_STRIDE_CONFIRM) {
+				s->cl_stride_hits++;
+			}
+		} else {
+			s->cl_stride = (int)gap;
+			s->cl_stride_hits = 0;
+		}
+	} else if (gap != 0) {
+		s->cl_stride = 0;
+		s->cl_stride_hits = 0;
+	}
+
+	if (s->cl_lastuse && now > s->cl_lastuse) {
+		rate = pages * 1000000000ULL / (now - s->cl_lastuse);
+		if (rate > UINT32_MAX) {
+			rate = UINT32_MAX;
+		}
+		if (s->cl_rate) {
+			rate = ((uint64_t)s->cl_rate * 7 + rate) / 8;
+		}
+		s->cl_rate = (uint32_t)rate;
+	}
+	s->cl_lastuse = now;
+}
+
+/*
+ * Whether the stream is a confirmed strided stream and a read starting
+ * at b_addr is its next record.
+ */
+static inline int
+cl_ra_is_strided(const struct cl_rastream *s, int64_t b_addr)
+{
+	return s->cl_stride_hits >= CL_RA_STRIDE_CONFIRM &&
+	       s->cl_lastr != -1 && b_addr == s->cl_lastr + s->cl_stride;
+}
+
+/*
+ * First page of the k'th record (k >= 1) after the record [b_addr, e_addr]
+ * of a strided stream.
+ */
+static inline int64_t
+cl_ra_stride_record(const struct cl_rastream *s, int64_t b_addr,
+    int64_t e_addr, int k)
+{
+	return b_addr + (int64_t)k * (e_addr - b_addr + s->cl_stride);
+}
+
+/*
+ * Read-ahead window of a stream, in pages: twice what the stream consumes
+ * over one device latency, between min_pages and max_pages, or def_pages
+ * until both the rate and the latency have been measured, then shifted
+ * down by the back-off.
+ */
+static inline int
+cl_ra_window(const struct cl_rastreams *ras, const struct cl_rastream *s,
+    uint32_t latency_us, int def_pages, int min_pages, int max_pages)
+{
+	uint64_t want;
+
+	if (s->cl_rate == 0 || latency_us == 0) {
+		want = (uint64_t)def_pages;
+	} else {
+		want = (uint64_t)s->cl_rate * latency_us * 2 / 1000000;
+		if (want < (uint64_t)min_pages) {
+			want = (uint64_t)min_pages;
+		}
+	}
+	if (want > (uint64_t)max_pages) {
+		want = (uint64_t)max_pages;
+	}
+	return (int)(want >> ras->cl_waste);
+}
+
+/*
+ * Prefetched pages went unused: back off every window of the file.
+ */
+static inline void
+cl_ra_wasted(struct cl_rastreams *ras)
+{
+	if (ras->cl_waste < CL_RA_WASTE_MAX) {
+		ras->cl_waste++;
+	}
+	ras->cl_hits = 0;
+}
+
+/*
+ * A read was satisfied by read-ahead: undo the back-off gradually.
+ */
+static inline void
+cl_ra_hit(struct cl_rastreams *ras)
+{
+	if (ras->cl_waste && ++ras->cl_hits >= CL_RA_WASTE_DECAY) {
+		ras->cl_waste--;
+		ras->cl_hits = 0;
+	}
+}
+
+#endif /* _VFS_VFS_CLUSTER_RA_H_ */
@@ -57,6 +57,11 @@
 #include <mach/mach_time.h>
 #include <kern/thread_call.h>
 #include <kern/clock.h>
+#include <kern/task.h>
+#include <mach/mach_vm.h>
+#include <mach/vm_map.h>
+#include <vm/vm_kern.h>
+#include <vm/vm_protos.h>
 
 #include <security/audit/audit.h>
 #include <bsm/audit_kevents.h>
@@ -97,6 +102,19 @@ int num_pending_rename = 0;
 
 struct fsevent_handle;
 
+// a path prefix events must fall under (FSEVENTS_PREFIX_FILTER)
+typedef struct fse_prefix {
+	uint32_t     len;
+	const char  *path;
+} fse_prefix;
+
+// a directory interned in a watcher's event ring, indexed by its id
+typedef struct fse_ring_dir {
+	const char  *path;               // from vfs_addname(), NULL if the id is unused
+	uint32_t     len;
+	uint32_t     hash;
+} fse_ring_dir;
+
 typedef struct fs_event_watcher {
 	int8_t      *event_list;         // the events we're interested in
 	int32_t      num_events;
@@ -115,6 +133,15 @@ typedef struct fs_event_watcher {
 	struct fsevent_handle *fseh;
 	pid_t        pid;
 	char         proc_name[(2 * MAXCOMLEN) + 1];
+	fse_prefix  *prefixes;           // report only events under these paths
+	uint32_t     num_prefixes;
+	struct fsevent_ring_hdr *ring;   // shared event ring, if mapped (FSEVENTS_MAP_RING)
+	char        *ring_data;          // the ring's record area
+	vm_size_t    ring_map_size;      // bytes of kernel_map holding the ring
+	uint64_t     ring_size;          // bytes in the record area
+	uint64_t     ring_head;          // our copy of ring->fr_head
+	int32_t      ring_unsignaled;    // events written since the last wakeup
+	fse_ring_dir *ring_dirs;         // FSE_RING_DIRS interned directories
 } fs_event_watcher;
 
 // fs_event_watcher flags
@@ -147,6 +174,7 @@ static dev_t fsevent_unmount_dev = 0;
 static int fsevent_unmount_ack_count = 0;
 
 static int  watcher_add_event(fs_event_watcher *watcher, kfs_event *kfse);
+static int32_t watcher_pending(fs_event_watcher *watcher);
 static void fsevents_wakeup(fs_event_watcher *watcher);
 
 //
@@ -287,6 +315,46 @@ watcher_cares_about_dev(fs_event_watcher *watcher, dev_t dev)
 	return 1;
 }
 
+static int
+path_is_under(const char *path, const fse_prefix *pfx)
+{
+	if (strncmp(path, pfx->path, pfx->len) != 0) {
+		return 0;
+	}
+	// "/a/b" is under "/a" and "/a/", but "/ab" is under neither
+	return pfx->path[pfx->len - 1] == '/' || path[pfx->len] == '/' || path[pfx->len] == '\0';
+}
+
+static int
+watcher_cares_about_path(fs_event_watcher *watcher, kfs_event *kfse)
+{
+	kfs_event *cur;
+	const char *path;
+	unsigned int i;
+
+	if (watcher->prefixes == NULL) {
+		return 1;
+	}
+
+	// these carry no path (str holds an inode number for the docid events)
+	if (kfse->type == FSE_DOCID_CREATED || kfse->type == FSE_DOCID_CHANGED ||
+	    kfse->type == FSE_UNMOUNT_PENDING) {
+		return 1;
+	}
+
+	// a rename or clone matters if either of its paths does
+	for (cur = kfse; cur != NULL; cur = cur->dest) {
+		path = (cur->str == NULL || cur->str[0] == '\0') ? "/" : cur->str;
+		for (i = 0; i < watcher->num_prefixes; i++) {
+			if (path_is_under(path, &watcher->prefixes[i])) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
 
 int
 need_fsevent(int type, vnode_t vp)
@@ -803,7 +871,8 @@ done_with_args:
 
 		if (type < watcher->num_events
 		    && watcher->event_list[type] == FSE_REPORT
-		    && watcher_cares_about_dev(watcher, dev)) {
+		    && watcher_cares_about_dev(watcher, dev)
+		    && watcher_cares_about_path(watcher, kfse)) {
 			if (watcher_add_event(watcher, kfse) != 0) {
 				watcher->num_dropped++;
 				continue;
@@ -976,6 +1045,15 @@ add_watcher(int8_t *event_list, int32_t num_events, int32_t eventq_size, fs_even
 	watcher->num_readers  = 0;
 	watcher->max_event_id = 0;
 	watcher->fseh         = fseh;
+	watcher->prefixes     = NULL;
+	watcher->num_prefixes = 0;
+	watcher->ring         = NULL;
+	watcher->ring_data    = NULL;
+	watcher->ring_map_size = 0;
+	watcher->ring_size    = 0;
+	watcher->ring_head    = 0;
+	watcher->ring_unsignaled = 0;
+	watcher->ring_dirs    = NULL;
 	watcher->pid          = proc_selfpid();
 	proc_selfname(watcher->proc_name, sizeof(watcher->proc_name));
 
@@ -1094,6 +1172,21 @@ remove_watcher(fs_event_watcher *target)
 			FREE(watcher->devices_not_to_watch, M_TEMP);
 			watcher->devices_not_to_watch = NULL;
 		}
+		if (watcher->prefixes) {
+			FREE(watcher->prefixes, M_TEMP);
+			watcher->prefixes = NULL;
+		}
+		if (watcher->ring) {
+			// the consumer's mapping keeps the pages for as long as it wants them
+			for (i = 0; i < FSE_RING_DIRS; i++) {
+				if (watcher->ring_dirs[i].path) {
+					vfs_removename(watcher->ring_dirs[i].path);
+				}
+			}
+			FREE(watcher->ring_dirs, M_TEMP);
+			kmem_free(kernel_map, (vm_offset_t)watcher->ring, watcher->ring_map_size);
+			watcher->ring = NULL;
+		}
 		FREE(watcher, M_TEMP);
 
 		return;
@@ -1116,7 +1209,7 @@ delayed_event_delivery(__unused void *param0, __unused void *param1)
 	lock_watch_table();
 
 	for (i = 0; i < MAX_WATCHERS; i++) {
-		if (watcher_table[i] != NULL && watcher_table[i]->rd != watcher_table[i]->wr) {
+		if (watcher_table[i] != NULL && watcher_pending(watcher_table[i]) != 0) {
 			fsevents_wakeup(watcher_table[i]);
 		}
 	}
@@ -1149,6 +1242,314 @@ schedule_event_wakeup(void)
 
 #define MAX_NUM_PENDING  16
 
+//
+// Shared event rings (FSEVENTS_MAP_RING).  Events are encoded into the
+// ring as they are added, instead of being queued for read().
+//
+#define FSE_RING_ALIGN(x)       (((x) + 7) & ~7)
+#define FSE_RING_HDR_SIZE       PAGE_SIZE
+
+// one path of an event, ready to be written to a ring
+typedef struct fse_ring_part {
+	kfs_event   *cur;
+	uint16_t     kind;               // FSE_RING_EVENT or FSE_RING_DEST
+	uint16_t     id;                 // directory id, or FSE_RING_NO_DIR
+	int          define;             // id must be (re)assigned to dir first
+	const char  *dir;
+	uint32_t     dirlen;
+	uint32_t     hash;
+	const char  *name;
+	uint32_t     namelen;
+} fse_ring_part;
+
+static uint32_t
+fse_ring_hash(const char *str, uint32_t len)
+{
+	uint32_t hash = 2166136261U;    // FNV-1a
+
+	while (len-- > 0) {
+		hash = (hash ^ (uint8_t)*str++) * 16777619U;
+	}
+	return hash;
+}
+
+//
+// Splits the path of cur into its directory and leaf name, and looks
+// the directory up in the watcher's interned directories.
+//
+static void
+fse_ring_split(fs_event_watcher *watcher, kfs_event *kfse, kfs_event *cur,
+    uint16_t kind, fse_ring_part *part)
+{
+	const char *path, *slash;
+	fse_ring_dir *rd;
+	uint32_t len;
+
+	part->cur = cur;
+	part->kind = kind;
+	part->id = FSE_RING_NO_DIR;
+	part->define = 0;
+	part->dir = NULL;
+	part->dirlen = 0;
+	part->name = "";
+	part->namelen = 0;
+
+	if (kfse->type == FSE_DOCID_CREATED || kfse->type == FSE_DOCID_CHANGED ||
+	    kfse->type == FSE_UNMOUNT_PENDING) {
+		return;
+	}
+
+	path = (cur->str == NULL || cur->str[0] == '\0') ? "/" : cur->str;
+	len = (uint32_t)strlen(path);
+	slash = NULL;
+	for (const char *c = path; *c != '\0'; c++) {
+		if (*c == '/') {
+			slash = c;
+		}
+	}
+	if (slash == NULL) {
+		part->name = path;
+		part->namelen = len;
+		return;
+	}
+
+	part->dir = path;
+	part->dirlen = (slash == path) ? 1 : (uint32_t)(slash - path);
+	part->name = slash + 1;
+	part->namelen = len - (uint32_t)(slash + 1 - path);
+	part->hash = fse_ring_hash(part->dir, part->dirlen);
+	part->id = (uint16_t)(part->hash & (FSE_RING_DIRS - 1));
+
+	rd = &watcher->ring_dirs[part->id];
+	part->define = !(rd->path != NULL && rd->hash == part->hash && rd->len == part->dirlen &&
+	    memcmp(rd->path, part->dir, part->dirlen) == 0);
+}
+
+static uint32_t
+fse_ring_part_size(const fse_ring_part *part)
+{
+	uint32_t size = FSE_RING_ALIGN(sizeof(struct fsevent_ring_event) + part->namelen + 1);
+
+	if (part->define) {
+		size += FSE_RING_ALIGN(sizeof(struct fsevent_ring_dir) + part->dirlen + 1);
+	}
+	return size;
+}
+
+//
+// Finds room for len contiguous bytes at the head of the ring, padding
+// out the end of the record area if they do not fit before it.  Returns
+// NULL if the consumer has not left enough room.
+//
+static char *
+fse_ring_reserve(fs_event_watcher *watcher, uint32_t len)
+{
+	struct fsevent_ring_rec *pad;
+	uint64_t head = watcher->ring_head;
+	uint64_t tail = *(volatile uint64_t *)&watcher->ring->fr_tail;
+	uint64_t off = head & (watcher->ring_size - 1);
+	uint64_t padlen = 0;
+
+	// the consumer owns fr_tail: don't trust it further than it can be
+	if (tail > head || head - tail > watcher->ring_size) {
+		return NULL;
+	}
+	if (off + len > watcher->ring_size) {
+		padlen = watcher->ring_size - off;
+	}
+	if (padlen + len > watcher->ring_size - (head - tail)) {
+		return NULL;
+	}
+
+	if (padlen) {
+		pad = (struct fsevent_ring_rec *)(watcher->ring_data + off);
+		pad->frr_kind = FSE_RING_PAD;
+		pad->frr_len = (uint16_t)padlen;
+		watcher->ring_head += padlen;
+		off = 0;
+	}
+	return watcher->ring_data + off;
+}
+
+static char *
+fse_ring_write_event(char *p, uint16_t kind, int32_t type, uint16_t id, kfs_event *cur,
+    const char *name, uint32_t namelen)
+{
+	struct fsevent_ring_event *fre = (struct fsevent_ring_event *)p;
+	uint32_t len = FSE_RING_ALIGN(sizeof(*fre) + namelen + 1);
+
+	memset(fre, 0, len);
+	fre->fre_kind = kind;
+	fre->fre_len = (uint16_t)len;
+	fre->fre_type = (uint16_t)type;
+	fre->fre_dir = id;
+	if (cur != NULL) {
+		fre->fre_pid = cur->pid;
+		fre->fre_mode = cur->mode;
+		fre->fre_dev = cur->dev;
+		fre->fre_uid = cur->uid;
+		fre->fre_gid = cur->gid;
+		fre->fre_ino = cur->ino;
+		fre->fre_time = cur->abstime;
+	}
+	fre->fre_namelen = (uint16_t)namelen;
+	memcpy(fre->fre_name, name, namelen);
+	return p + len;
+}
+
+static char *
+fse_ring_write_part(fs_event_watcher *watcher, char *p, int32_t type, fse_ring_part *part)
+{
+	struct fsevent_ring_dir *frd;
+	fse_ring_dir *rd;
+	uint32_t len;
+
+	if (part->define) {
+		rd = &watcher->ring_dirs[part->id];
+		if (rd->path) {
+			vfs_removename(rd->path);
+		}
+		rd->path = vfs_addname(part->dir, part->dirlen, 0, 0);
+		rd->len = part->dirlen;
+		rd->hash = part->hash;
+
+		frd = (struct fsevent_ring_dir *)p;
+		len = FSE_RING_ALIGN(sizeof(*frd) + part->dirlen + 1);
+		memset(frd, 0, len);
+		frd->frd_kind = FSE_RING_DIR;
+		frd->frd_len = (uint16_t)len;
+		frd->frd_id = part->id;
+		frd->frd_pathlen = (uint16_t)part->dirlen;
+		memcpy(frd->frd_path, part->dir, part->dirlen);
+		p += len;
+	}
+	return fse_ring_write_event(p, part->kind, type, part->id, part->cur, part->name, part->namelen);
+}
+
+//
+// Encodes kfse into the watcher's ring: an event record per path, each
+// preceded by an FSE_RING_DIR record if its directory was not interned
+// yet, and an FSE_EVENTS_DROPPED record first if events were dropped
+// since the last write.  Either all of it goes in or none of it does.
+// The watch table must be locked.
+//
+static int
+watcher_ring_add_event(fs_event_watcher *watcher, kfs_event *kfse)
+{
+	fse_ring_part parts[2];
+	int nparts = 1, i;
+	int32_t type;
+	uint32_t len, dropped_len;
+	char *p, *start;
+
+	if (kfse->flags & KFSE_BEING_CREATED) {
+		return 0;
+	}
+	if ((kfse->type == FSE_RENAME || kfse->type == FSE_CLONE) && kfse->dest == NULL) {
+		// the destination of a recycled rename, as in copy_out_kfse()
+		return 0;
+	}
+	if (!(watcher->flags & WATCHER_APPLE_SYSTEM_SERVICE) && kfse->type != FSE_DOCID_CREATED &&
+	    kfse->type != FSE_DOCID_CHANGED && is_ignored_directory(kfse->str)) {
+		return 0;
+	}
+
+	type = kfse->type & FSE_TYPE_MASK;
+	if (kfse->flags & KFSE_CONTAINS_DROPPED_EVENTS) {
+		type |= (FSE_CONTAINS_DROPPED_EVENTS << FSE_FLAG_SHIFT);
+	} else if (kfse->flags & KFSE_COMBINED_EVENTS) {
+		type |= (FSE_COMBINED_EVENTS << FSE_FLAG_SHIFT);
+	}
+
+	fse_ring_split(watcher, kfse, kfse, FSE_RING_EVENT, &parts[0]);
+	if (kfse->dest) {
+		fse_ring_split(watcher, kfse, kfse->dest, FSE_RING_DEST, &parts[1]);
+		nparts = 2;
+	} else if (kfse->type == FSE_DOCID_CREATED || kfse->type == FSE_DOCID_CHANGED) {
+		// the destination inode travels in a second record
+		fse_ring_split(watcher, kfse, kfse, FSE_RING_DEST, &parts[1]);
+		nparts = 2;
+	}
+	if (nparts == 2 && parts[1].id == parts[0].id && parts[0].define) {
+		// the first part reassigns the id the second one looked up
+		parts[1].define = !(parts[1].dirlen == parts[0].dirlen &&
+		    memcmp(parts[1].dir, parts[0].dir, parts[0].dirlen) == 0);
+	}
+
+	dropped_len = (watcher->flags & WATCHER_DROPPED_EVENTS) ?
+	    FSE_RING_ALIGN(sizeof(struct fsevent_ring_event) + 1) : 0;
+	len = dropped_len;
+	for (i = 0; i < nparts; i++) {
+		len += fse_ring_part_size(&parts[i]);
+	}
+
+	start = p = fse_ring_reserve(watcher, len);
+	if (p == NULL) {
+		watcher->ring->fr_dropped++;
+		watcher->flags |= WATCHER_DROPPED_EVENTS;
+		fsevents_wakeup(watcher);
+		return ENOSPC;
+	}
+
+	if (dropped_len) {
+		p = fse_ring_write_event(p, FSE_RING_EVENT, FSE_EVENTS_DROPPED, FSE_RING_NO_DIR, NULL, "", 0);
+		watcher->flags &= ~WATCHER_DROPPED_EVENTS;
+	}
+	p = fse_ring_write_part(watcher, p, type, &parts[0]);
+	if (nparts == 2) {
+		p = fse_ring_write_part(watcher, p, type, &parts[1]);
+	}
+	if (kfse->type == FSE_DOCID_CREATED || kfse->type == FSE_DOCID_CHANGED) {
+		// see copy_out_kfse(): the destination inode is in str, the docid in uid
+		struct fsevent_ring_event *fre = (struct fsevent_ring_event *)(p - FSE_RING_ALIGN(sizeof(*fre) + 1));
+		struct fsevent_ring_event *first = (struct fsevent_ring_event *)(start + dropped_len);
+		uint64_t docid;
+
+		memcpy(&fre->fre_ino, &kfse->str, sizeof(ino64_t));
+		memcpy(&docid, &kfse->uid, sizeof(uint64_t));
+		first->fre_docid = docid;
+		fre->fre_docid = docid;
+	}
+
+	watcher->ring_head += len;
+	OSMemoryBarrier();
+	watcher->ring->fr_head = watcher->ring_head;
+
+	if (++watcher->ring_unsignaled > MAX_NUM_PENDING) {
+		fsevents_wakeup(watcher);
+	} else if (timer_set == 0) {
+		schedule_event_wakeup();
+	}
+	return 0;
+}
+
+//
+// How much there is for the watcher to read: queued events, or bytes in
+// its ring.
+//
+static int32_t
+watcher_pending(fs_event_watcher *watcher)
+{
+	int32_t rd, wr;
+	uint64_t tail, pending;
+
+	if (watcher->ring) {
+		tail = *(volatile uint64_t *)&watcher->ring->fr_tail;
+		pending = watcher->ring_head - tail;
+		if (tail > watcher->ring_head || pending > watcher->ring_size) {
+			pending = watcher->ring_size;
+		}
+		return (int32_t)MIN(pending, INT32_MAX);
+	}
+
+	rd = watcher->rd;
+	wr = watcher->wr;
+	if (rd <= wr) {
+		return wr - rd;
+	}
+	return watcher->eventq_size - (rd - wr);
+}
+
 //
 // NOTE: the watch table must be locked before calling
 //       this routine.
@@ -1160,6 +1561,10 @@ watcher_add_event(fs_event_watcher *watcher, kfs_event *kfse)
 		watcher->max_event_id = kfse->abstime;
 	}
 
+	if (watcher->ring) {
+		return watcher_ring_add_event(watcher, kfse);
+	}
+
 	if (((watcher->wr + 1) % watcher->eventq_size) == watcher->rd) {
 		watcher->flags |= WATCHER_DROPPED_EVENTS;
 		fsevents_wakeup(watcher);
@@ -1498,6 +1903,11 @@ fmod_watch(fs_event_watcher *watcher, struct uio *uio)
 		return 0;
 	}
 
+	if (watcher->ring) {
+		// events go to the shared ring instead
+		return EINVAL;
+	}
+
 	if (OSAddAtomic(1, &watcher->num_readers) != 0) {
 		// don't allow multiple threads to read from the fd at the same time
 		OSAddAtomic(-1, &watcher->num_readers);
@@ -1725,6 +2135,167 @@ typedef struct fsevent_dev_filter_args64 {
 #define FSEVENTS_DEVICE_FILTER_32       _IOW('s', 100, fsevent_dev_filter_args32)
 #define FSEVENTS_DEVICE_FILTER_64       _IOW('s', 100, fsevent_dev_filter_args64)
 
+static int
+watcher_set_prefixes(fs_event_watcher *watcher, fsevent_prefix_filter_args *args)
+{
+	fse_prefix *prefixes = NULL, *tmp;
+	char *strs;
+	uint32_t i, off, len;
+	int error;
+
+	if (args->num_prefixes > FSEVENTS_MAX_PREFIXES ||
+	    args->size > FSEVENTS_MAX_PREFIXES * MAXPATHLEN) {
+		return EINVAL;
+	}
+
+	if (args->num_prefixes != 0) {
+		if (args->size == 0) {
+			return EINVAL;
+		}
+		MALLOC(prefixes, fse_prefix *,
+		    args->num_prefixes * sizeof(fse_prefix) + args->size,
+		    M_TEMP, M_WAITOK);
+		if (prefixes == NULL) {
+			return ENOMEM;
+		}
+		strs = (char *)&prefixes[args->num_prefixes];
+		error = copyin((user_addr_t)args->prefixes, strs, args->size);
+		if (error) {
+			FREE(prefixes, M_TEMP);
+			return error;
+		}
+
+		for (i = 0, off = 0; i < args->num_prefixes; i++) {
+			len = (uint32_t)strnlen(strs + off, args->size - off);
+			if (off + len >= args->size || len == 0 || strs[off] != '/') {
+				// not NUL terminated, empty or not absolute
+				FREE(prefixes, M_TEMP);
+				return EINVAL;
+			}
+			prefixes[i].path = strs + off;
+			prefixes[i].len = len;
+			// "/a/" means "/a", but "/" stays "/"
+			if (len > 1 && strs[off + len - 1] == '/') {
+				strs[off + len - 1] = '\0';
+				prefixes[i].len--;
+			}
+			off += len + 1;
+		}
+	}
+
+	lock_watch_table();
+	tmp = watcher->prefixes;
+	watcher->prefixes = prefixes;
+	watcher->num_prefixes = args->num_prefixes;
+	unlock_watch_table();
+
+	if (tmp) {
+		FREE(tmp, M_TEMP);
+	}
+	return 0;
+}
+
+//
+// Maps a new event ring into the calling task and switches the watcher
+// over to it.  Events queued for read() until now are moved into it.
+//
+static int
+watcher_map_ring(fs_event_watcher *watcher, fsevent_ring_args *args)
+{
+	struct fsevent_ring_hdr *hdr;
+	fse_ring_dir *dirs = NULL;
+	vm_offset_t kaddr = 0;
+	vm_size_t map_size;
+	memory_object_size_t entry_size;
+	mach_vm_address_t uaddr = 0;
+	void *mem_entry = NULL;
+	uint64_t size;
+	kfs_event *kfse;
+	kern_return_t kr;
+	int error = 0;
+
+	if (args->size < FSE_RING_MIN_SIZE || args->size > FSE_RING_MAX_SIZE) {
+		return EINVAL;
+	}
+	for (size = FSE_RING_MIN_SIZE; size < args->size; size <<= 1) {
+		;
+	}
+	map_size = FSE_RING_HDR_SIZE + (vm_size_t)size;
+
+	// keep read() out while the queue moves into the ring
+	if (OSAddAtomic(1, &watcher->num_readers) != 0) {
+		OSAddAtomic(-1, &watcher->num_readers);
+		return EBUSY;
+	}
+	if (watcher->ring != NULL) {
+		error = EBUSY;
+		goto out;
+	}
+
+	kr = kmem_alloc(kernel_map, &kaddr, map_size, VM_KERN_MEMORY_FILE);
+	if (kr != KERN_SUCCESS) {
+		error = ENOMEM;
+		goto out;
+	}
+	bzero((void *)kaddr, map_size);
+	hdr = (struct fsevent_ring_hdr *)kaddr;
+	hdr->fr_magic = FSE_RING_MAGIC;
+	hdr->fr_hdr_size = FSE_RING_HDR_SIZE;
+	hdr->fr_size = size;
+
+	MALLOC(dirs, fse_ring_dir *, FSE_RING_DIRS * sizeof(fse_ring_dir), M_TEMP, M_WAITOK | M_ZERO);
+
+	entry_size = map_size;
+	kr = mach_make_memory_entry_64(kernel_map, &entry_size, (memory_object_offset_t)kaddr,
+	    MAP_MEM_VM_SHARE | VM_PROT_READ | VM_PROT_WRITE, (ipc_port_t *)&mem_entry, MACH_PORT_NULL);
+	if (kr == KERN_SUCCESS) {
+		kr = mach_vm_map_kernel(current_map(), &uaddr, map_size, 0, VM_FLAGS_ANYWHERE,
+		    VM_MAP_KERNEL_FLAGS_NONE, VM_KERN_MEMORY_NONE, (ipc_port_t)mem_entry, 0, FALSE,
+		    VM_PROT_READ | VM_PROT_WRITE, VM_PROT_READ | VM_PROT_WRITE, VM_INHERIT_NONE);
+		mach_memory_entry_port_release((ipc_port_t)mem_entry);
+	}
+	if (kr != KERN_SUCCESS) {
+		FREE(dirs, M_TEMP);
+		kmem_free(kernel_map, kaddr, map_size);
+		error = ENOMEM;
+		goto out;
+	}
+
+	lock_watch_table();
+	lck_rw_lock_exclusive(&event_handling_lock);
+
+	watcher->ring_dirs = dirs;
+	watcher->ring_data = (char *)kaddr + FSE_RING_HDR_SIZE;
+	watcher->ring_size = size;
+	watcher->ring_map_size = map_size;
+	watcher->ring_head = 0;
+	watcher->ring_unsignaled = 0;
+	watcher->ring = hdr;
+
+	while (watcher->rd != watcher->wr) {
+		kfse = watcher->event_queue[watcher->rd];
+		watcher->event_queue[watcher->rd] = NULL;
+		watcher->rd = (watcher->rd + 1) % watcher->eventq_size;
+		OSSynchronizeIO();
+		if (kfse != NULL && kfse->type != FSE_INVALID && kfse->refcount >= 1) {
+			if (kfse->type < watcher->num_events && watcher->event_list[kfse->type] == FSE_REPORT &&
+			    watcher_cares_about_dev(watcher, kfse->dev) && watcher_cares_about_path(watcher, kfse)) {
+				(void)watcher_ring_add_event(watcher, kfse);
+			}
+			release_event_ref(kfse);
+		}
+	}
+
+	lck_rw_unlock_exclusive(&event_handling_lock);
+	unlock_watch_table();
+
+	args->addr = uaddr;
+	args->size = (uint32_t)map_size;
+out:
+	OSAddAtomic(-1, &watcher->num_readers);
+	return error;
+}
+
 static int
 fseventsf_ioctl(struct fileproc *fp, u_long cmd, caddr_t data, vfs_context_t ctx)
 {
@@ -1834,6 +2405,14 @@ handle_dev_filter:
 			break;
 		}
 
+	case FSEVENTS_PREFIX_FILTER:
+		ret = watcher_set_prefixes(fseh->watcher, (fsevent_prefix_filter_args *)data);
+		break;
+
+	case FSEVENTS_MAP_RING:
+		ret = watcher_map_ring(fseh->watcher, (fsevent_ring_args *)data);
+		break;
+
 	case FSEVENTS_UNMOUNT_PENDING_ACK: {
 		lock_watch_table();
 		dev_t dev = *(dev_t *)data;
@@ -1872,7 +2451,7 @@ fseventsf_select(struct fileproc *fp, int which, __unused void *wql, vfs_context
 
 
 	// if there's nothing in the queue, we're not ready
-	if (fseh->watcher->rd != fseh->watcher->wr) {
+	if (watcher_pending(fseh->watcher) != 0) {
 		ready = 1;
 	}
 
@@ -1939,7 +2518,7 @@ filt_fsevent_common(struct knote *kn, struct kevent_qos_s *kev, long hint)
 {
 	fsevent_handle *fseh = (struct fsevent_handle *)kn->kn_hook;
 	int activate = 0;
-	int32_t rd, wr, amt;
+	int32_t amt;
 	int64_t data = 0;
 
 	if (NOTE_REVOKE == hint) {
@@ -1947,13 +2526,7 @@ filt_fsevent_common(struct knote *kn, struct kevent_qos_s *kev, long hint)
 		activate = 1;
 	}
 
-	rd = fseh->watcher->rd;
-	wr = fseh->watcher->wr;
-	if (rd <= wr) {
-		amt = wr - rd;
-	} else {
-		amt = fseh->watcher->eventq_size - (rd - wr);
-	}
+	amt = watcher_pending(fseh->watcher);
 
 	switch (kn->kn_filter) {
 	case EVFILT_READ:
@@ -2441,6 +3014,7 @@ handle_clone:
 static void
 fsevents_wakeup(fs_event_watcher *watcher)
 {
+	watcher->ring_unsignaled = 0;
 	selwakeup(&watcher->fseh->si);
 	KNOTE(&watcher->fseh->knotes, NOTE_WRITE | NOTE_NONE);
 	wakeup((caddr_t)watcher);
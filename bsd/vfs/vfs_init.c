@@ -470,6 +470,11 @@ vfsinit(void)
 	 */
 	vnode_authorize_init();
 
+	/*
+	 * Start the getattrlistbulk prefetch workers.
+	 */
+	attrlist_init();
+
 	/*
 	 * Initialiize the quota system.
 	 */
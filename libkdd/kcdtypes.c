@@ -850,6 +850,20 @@ kcdata_get_typedescription(unsigned type_id, uint8_t * buffer, uint32_t buffer_s
 		break;
 	}
 
+	case STACKSHOT_KCTYPE_IPC_PORT_STATS: {
+		i = 0;
+		_SUBTYPE(KC_ST_UINT64, struct ipc_port_stats_snapshot, ipss_port);
+		_SUBTYPE(KC_ST_UINT64, struct ipc_port_stats_snapshot, ipss_owner);
+		_SUBTYPE(KC_ST_UINT64, struct ipc_port_stats_snapshot, ipss_messages);
+		_SUBTYPE(KC_ST_UINT32, struct ipc_port_stats_snapshot, ipss_receiver_name);
+		_SUBTYPE(KC_ST_UINT32, struct ipc_port_stats_snapshot, ipss_sampled);
+		_SUBTYPE(KC_ST_UINT32, struct ipc_port_stats_snapshot, ipss_depth_max);
+		_SUBTYPE_ARRAY(KC_ST_UINT32, struct ipc_port_stats_snapshot, ipss_latency, 16);
+		_SUBTYPE_ARRAY(KC_ST_UINT32, struct ipc_port_stats_snapshot, ipss_size, 16);
+		setup_type_definition(retval, type_id, i, "ipc_port_stats");
+		break;
+	}
+
 	default:
 		retval = NULL;
 		break;
@@ -91,7 +91,11 @@ typedef struct _lck_mtx_ {
 				};
 				uint32_t        lck_mtx_state;
 			};
-			/* Pad field used as a canary, initialized to ~0 */
+			/*
+			 * Pad field used as a canary, initialized to ~0 but for
+			 * the low byte, the profile slot of the mutex group
+			 * (see lck_mtx_prof_for_slot()).
+			 */
 			uint32_t                        lck_mtx_pad32;
 		};
 		struct {
@@ -109,6 +113,9 @@ typedef struct _lck_mtx_ {
 #define LCK_MTX_MLOCKED_MSK             0x02000000
 #define LCK_MTX_SPIN_MSK                0x08000000
 
+#define LCK_MTX_PAD32_SLOT_MASK         0x000000ff
+#define LCK_MTX_PAD32(grp)              (~LCK_MTX_PAD32_SLOT_MASK | (grp)->lck_grp_mtx_prof_slot)
+
 /* This pattern must subsume the interlocked, mlocked and spin bits */
 #define LCK_MTX_TAG_INDIRECT                    0x07ff1007      /* lock marked as Indirect  */
 #define LCK_MTX_TAG_DESTROYED                   0x07fe2007      /* lock marked as Destroyed */
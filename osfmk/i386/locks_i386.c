@@ -239,7 +239,7 @@ static lck_rw_type_t lck_rw_done_gen(lck_rw_t *lck, uint32_t prior_lock_state);
 void lck_rw_clear_promotions_x86(thread_t thread);
 static boolean_t lck_rw_held_read_or_upgrade(lck_rw_t *lock);
 static boolean_t lck_rw_grab_want(lck_rw_t *lock);
-static boolean_t lck_rw_grab_shared(lck_rw_t *lock);
+static boolean_t lck_rw_grab_shared(lck_rw_t *lock, boolean_t starved);
 static void lck_mtx_unlock_wakeup_tail(lck_mtx_t *mutex, uint32_t state, boolean_t indirect);
 static void lck_mtx_interlock_lock(lck_mtx_t *mutex, uint32_t *new_state);
 static void lck_mtx_interlock_lock_clear_flags(lck_mtx_t *mutex, uint32_t and_flags, uint32_t *new_state);
@@ -887,6 +887,7 @@ lck_rw_init(
 	lck->lck_rw_can_sleep = TRUE;
 	lck->lck_r_waiting = lck->lck_w_waiting = 0;
 	lck->lck_rw_tag = 0;
+	lck->lck_rw_owner = THREAD_NULL;
 	lck->lck_rw_priv_excl = ((lck_attr->lck_attr_val &
 				LCK_ATTR_RW_SHARED_PRIORITY) == 0);
 
@@ -1004,6 +1005,84 @@ lck_rw_interlock_spin(lck_rw_t *lock)
 	}
 }
 
+/*
+ * The thread owning lck_rw_want_write is recorded in lck_rw_owner so that
+ * writers blocking behind it can push on it through a turnstile.
+ * The owner is set right after want_write is acquired and cleared right
+ * before it is released, outside of the interlock: waiters may observe
+ * THREAD_NULL for a short window, in which case they block without
+ * pushing, but never a stale owner.
+ */
+static inline void
+lck_rw_set_owner(lck_rw_t *lock, thread_t owner)
+{
+	os_atomic_store(&lock->lck_rw_owner, owner, relaxed);
+}
+
+/*
+ * Wait for the lck_rw_want_write owner to release the lock,
+ * pushing on it with a turnstile.
+ *
+ * Called with the interlock held, returns with it dropped.
+ */
+static wait_result_t
+lck_rw_lock_exclusive_wait_owner(lck_rw_t *lck, boolean_t istate)
+{
+	thread_t owner = os_atomic_load(&lck->lck_rw_owner, relaxed);
+	struct turnstile *ts;
+	wait_result_t res;
+
+	ts = turnstile_prepare((uintptr_t)lck, NULL, TURNSTILE_NULL, TURNSTILE_KERNEL_MUTEX);
+
+	thread_set_pending_block_hint(current_thread(), kThreadWaitKernelRWLockWrite);
+	if (owner != THREAD_NULL && owner != current_thread()) {
+		turnstile_update_inheritor(ts, owner,
+		    (TURNSTILE_DELAYED_UPDATE | TURNSTILE_INHERITOR_THREAD));
+	}
+
+	res = waitq_assert_wait64(&ts->ts_waitq, CAST_EVENT64_T(RW_LOCK_WRITER_EVENT(lck)),
+	    THREAD_UNINT | THREAD_WAIT_NOREPORT_USER, TIMEOUT_WAIT_FOREVER);
+	lck_interlock_unlock(lck, istate);
+
+	turnstile_update_inheritor_complete(ts, TURNSTILE_INTERLOCK_NOT_HELD);
+
+	if (res == THREAD_WAITING) {
+		res = thread_block(THREAD_CONTINUE_NULL);
+	}
+
+	istate = lck_interlock_lock(lck);
+	turnstile_complete((uintptr_t)lck, NULL, NULL, TURNSTILE_KERNEL_MUTEX);
+	lck_interlock_unlock(lck, istate);
+
+	turnstile_cleanup();
+
+	return res;
+}
+
+/*
+ * Wake up the writers blocked on the turnstile of the lock,
+ * their push on the previous owner goes away with it.
+ */
+static void
+lck_rw_wakeup_turnstile_writers(lck_rw_t *lck)
+{
+	struct turnstile *ts;
+	boolean_t istate;
+
+	istate = lck_interlock_lock(lck);
+
+	ts = turnstile_prepare((uintptr_t)lck, NULL, TURNSTILE_NULL, TURNSTILE_KERNEL_MUTEX);
+	waitq_wakeup64_all(&ts->ts_waitq, CAST_EVENT64_T(RW_LOCK_WRITER_EVENT(lck)),
+	    THREAD_AWAKENED, WAITQ_ALL_PRIORITIES);
+	turnstile_update_inheritor(ts, NULL, TURNSTILE_IMMEDIATE_UPDATE);
+	turnstile_update_inheritor_complete(ts, TURNSTILE_INTERLOCK_HELD);
+	turnstile_complete((uintptr_t)lck, NULL, NULL, TURNSTILE_KERNEL_MUTEX);
+
+	lck_interlock_unlock(lck, istate);
+
+	turnstile_cleanup();
+}
+
 static boolean_t
 lck_rw_grab_want(lck_rw_t *lock)
 {
@@ -1021,11 +1100,24 @@ lck_rw_grab_want(lck_rw_t *lock)
 		return FALSE;
 	}
 	data |= LCK_RW_WANT_WRITE;
-	return atomic_exchange_complete32(&lock->data, prev, data, memory_order_relaxed);
+	if (atomic_exchange_complete32(&lock->data, prev, data, memory_order_relaxed)) {
+		lck_rw_set_owner(lock, current_thread());
+		return TRUE;
+	}
+	return FALSE;
 }
 
+/*
+ * A reader which has been put to sleep LCK_RW_READER_MAX_SLEEPS times
+ * because writers have priority (lck_rw_priv_excl) is considered starved:
+ * from then on it only defers to an actual writer and joins any shared
+ * hold of the lock, which bounds how long a stream of writers can hold
+ * readers off.
+ */
+#define LCK_RW_READER_MAX_SLEEPS        4
+
 static boolean_t
-lck_rw_grab_shared(lck_rw_t *lock)
+lck_rw_grab_shared(lck_rw_t *lock, boolean_t starved)
 {
 	uint32_t	data, prev;
 
@@ -1037,7 +1129,8 @@ lck_rw_grab_shared(lck_rw_t *lock)
 		lck_rw_interlock_spin(lock);
 	}
 	if (data & (LCK_RW_WANT_WRITE | LCK_RW_WANT_UPGRADE)) {
-		if (((data & LCK_RW_SHARED_MASK) == 0) || (data & LCK_RW_PRIV_EXCL)) {
+		if (((data & LCK_RW_SHARED_MASK) == 0) ||
+		    ((data & LCK_RW_PRIV_EXCL) && !starved)) {
 			atomic_exchange_abort();
 			return FALSE;
 		}
@@ -1118,18 +1211,13 @@ lck_rw_lock_exclusive_gen(
 
 				lck->lck_w_waiting = TRUE;
 
-				thread_set_pending_block_hint(current_thread(), kThreadWaitKernelRWLockWrite);
-				res = assert_wait(RW_LOCK_WRITER_EVENT(lck),
-						THREAD_UNINT | THREAD_WAIT_NOREPORT_USER);
-				lck_interlock_unlock(lck, istate);
+				res = lck_rw_lock_exclusive_wait_owner(lck, istate);
+				slept++;
 
-				if (res == THREAD_WAITING) {
-					res = thread_block(THREAD_CONTINUE_NULL);
-					slept++;
-				}
 				KERNEL_DEBUG(MACHDBG_CODE(DBG_MACH_LOCKS, LCK_RW_LCK_EX_WRITER_WAIT_CODE) | DBG_FUNC_END, trace_lck, res, slept, 0, 0);
 			} else {
 				lck->lck_rw_want_write = TRUE;
+				lck_rw_set_owner(lck, current_thread());
 				lck_interlock_unlock(lck, istate);
 				break;
 			}
@@ -1258,6 +1346,10 @@ lck_rw_type_t lck_rw_done(lck_rw_t *lock)
 {
 	uint32_t	data, prev;
 
+	if (lock->lck_rw_owner == current_thread()) {
+		lck_rw_set_owner(lock, THREAD_NULL);
+	}
+
 	for ( ; ; ) {
 		data = atomic_exchange_begin32(&lock->data, &prev, memory_order_release_smp);
 		if (data & LCK_RW_INTERLOCK) {		/* wait for interlock to clear */
@@ -1335,6 +1427,7 @@ lck_rw_done_gen(
 		if (fake_lck->lck_rw_shared_count <= 1) {
 			if (fake_lck->lck_w_waiting) {
 				thread_wakeup(RW_LOCK_WRITER_EVENT(lck));
+				lck_rw_wakeup_turnstile_writers(lck);
 			}
 
 			if (!(fake_lck->lck_rw_priv_excl && fake_lck->lck_w_waiting) && fake_lck->lck_r_waiting) {
@@ -1490,7 +1583,7 @@ lck_rw_lock_shared_gen(
 	boolean_t dtrace_rwl_shared_spin, dtrace_rwl_shared_block, dtrace_ls_enabled = FALSE;
 #endif
 
-	while ( !lck_rw_grab_shared(lck)) {
+	while ( !lck_rw_grab_shared(lck, slept >= LCK_RW_READER_MAX_SLEEPS)) {
 
 #if	CONFIG_DTRACE
 		if (dtrace_ls_initialized == FALSE) {
@@ -1516,7 +1609,8 @@ lck_rw_lock_shared_gen(
 		KERNEL_DEBUG(MACHDBG_CODE(DBG_MACH_LOCKS, LCK_RW_LCK_SHARED_SPIN_CODE) | DBG_FUNC_START,
 			     trace_lck, lck->lck_rw_want_write, lck->lck_rw_want_upgrade, 0, 0);
 
-		while (((gotlock = lck_rw_grab_shared(lck)) == 0) && mach_absolute_time() < deadline)
+		while (((gotlock = lck_rw_grab_shared(lck, slept >= LCK_RW_READER_MAX_SLEEPS)) == 0) &&
+		    mach_absolute_time() < deadline)
 			lck_rw_lock_pause(istate);
 
 		KERNEL_DEBUG(MACHDBG_CODE(DBG_MACH_LOCKS, LCK_RW_LCK_SHARED_SPIN_CODE) | DBG_FUNC_END,
@@ -1534,7 +1628,8 @@ lck_rw_lock_shared_gen(
 			istate = lck_interlock_lock(lck);
 
 			if ((lck->lck_rw_want_write || lck->lck_rw_want_upgrade) &&
-			    ((lck->lck_rw_shared_count == 0) || lck->lck_rw_priv_excl)) {
+			    ((lck->lck_rw_shared_count == 0) ||
+			    (lck->lck_rw_priv_excl && slept < LCK_RW_READER_MAX_SLEEPS))) {
 
 				KERNEL_DEBUG(MACHDBG_CODE(DBG_MACH_LOCKS, LCK_RW_LCK_SHARED_WAIT_CODE) | DBG_FUNC_START,
 					     trace_lck, lck->lck_rw_want_write, lck->lck_rw_want_upgrade, 0, 0);
@@ -1572,6 +1667,11 @@ lck_rw_lock_shared_gen(
 	}
 	LOCKSTAT_RECORD(LS_LCK_RW_LOCK_SHARED_ACQUIRE, lck, 0);
 #endif
+#if DEVELOPMENT || DEBUG
+	if (slept >= LCK_RW_READER_MAX_SLEEPS) {
+		os_atomic_inc(&lck_rw_readers_starved, relaxed);
+	}
+#endif
 }
 
 
@@ -1586,6 +1686,7 @@ lck_rw_lock_exclusive(lck_rw_t *lock)
 	if (atomic_test_and_set32(&lock->data,
 		(LCK_RW_SHARED_MASK | LCK_RW_WANT_EXCL | LCK_RW_WANT_UPGRADE | LCK_RW_INTERLOCK),
 		LCK_RW_WANT_EXCL, memory_order_acquire_smp, FALSE)) {
+		lck_rw_set_owner(lock, current_thread());
 #if	CONFIG_DTRACE
 		LOCKSTAT_RECORD(LS_LCK_RW_LOCK_EXCL_ACQUIRE, lock, DTRACE_RW_EXCL);
 #endif	/* CONFIG_DTRACE */
@@ -1666,9 +1767,13 @@ lck_rw_lock_shared_to_exclusive_failure(
 		/*
 		 *	Someone else has requested upgrade.
 		 *	Since we've released the read lock, wake
-		 *	him up if he's blocked waiting
+		 *	him up if he's blocked waiting.  The fast path
+		 *	cleared lck_w_waiting, so writers blocked on the
+		 *	turnstile of the lock must be woken up as well or
+		 *	nothing will wake them when the lock is released.
 		 */
 		thread_wakeup(RW_LOCK_WRITER_EVENT(lck));
+		lck_rw_wakeup_turnstile_writers(lck);
 	}
 
 	if ((rwlock_count == 1 /* field now 0 */) && (thread->sched_flags & TH_SFLAG_RW_PROMOTED)) {
@@ -1801,6 +1906,10 @@ void lck_rw_lock_exclusive_to_shared(lck_rw_t *lock)
 {
 	uint32_t	data, prev;
 
+	if (lock->lck_rw_owner == current_thread()) {
+		lck_rw_set_owner(lock, THREAD_NULL);
+	}
+
 	for ( ; ; ) {
 		data = atomic_exchange_begin32(&lock->data, &prev, memory_order_release_smp);
 		if (data & LCK_RW_INTERLOCK) {
@@ -1939,6 +2048,7 @@ boolean_t lck_rw_try_lock_exclusive(lck_rw_t *lock)
 		cpu_pause();
 	}
 
+	lck_rw_set_owner(lock, current_thread());
 	current_thread()->rwlock_count++;
 #if	CONFIG_DTRACE
 	LOCKSTAT_RECORD(LS_LCK_RW_TRY_LOCK_EXCL_ACQUIRE, lock, DTRACE_RW_EXCL);
@@ -2163,7 +2273,7 @@ lck_mtx_init(
 		lck->lck_mtx_owner = 0;
 		lck->lck_mtx_state = 0;
 	}
-	lck->lck_mtx_pad32 = 0xFFFFFFFF;
+	lck->lck_mtx_pad32 = LCK_MTX_PAD32(grp);
 	lck_grp_reference(grp);
 	lck_grp_lckcnt_incr(grp, LCK_TYPE_MTX);
 }
@@ -2193,7 +2303,7 @@ lck_mtx_init_ext(
 		lck->lck_mtx_owner = 0;
 		lck->lck_mtx_state = 0;
 	}
-	lck->lck_mtx_pad32 = 0xFFFFFFFF;
+	lck->lck_mtx_pad32 = LCK_MTX_PAD32(grp);
 
 	lck_grp_reference(grp);
 	lck_grp_lckcnt_incr(grp, LCK_TYPE_MTX);
@@ -2611,6 +2721,31 @@ lck_mtx_interlock_unlock_enable_interrupts(
 	ml_set_interrupts_enabled(istate);
 }
 
+static inline lck_grp_mtx_prof_t *
+lck_mtx_prof_for_lock(
+	lck_mtx_t       *lock,
+	boolean_t       indirect)
+{
+	if (indirect) {
+		return &((struct _lck_mtx_ext_*)lock)->lck_mtx_grp->lck_grp_mtx_prof;
+	}
+	return lck_mtx_prof_for_slot(lock->lck_mtx_pad32 & LCK_MTX_PAD32_SLOT_MASK);
+}
+
+static inline int
+lck_mtx_prof_outcome(
+	lck_mtx_spinwait_ret_type_t ret)
+{
+	switch (ret) {
+	case LCK_MTX_SPINWAIT_ACQUIRED:
+		return LCK_MTX_PROF_SPIN_ACQUIRED;
+	case LCK_MTX_SPINWAIT_SPUN:
+		return LCK_MTX_PROF_SPIN_SPUN;
+	default:
+		return LCK_MTX_PROF_SPIN_NO_SPIN;
+	}
+}
+
 __attribute__((noinline))
 static void
 lck_mtx_lock_contended(
@@ -2622,6 +2757,9 @@ lck_mtx_lock_contended(
 	uint32_t state;
 	thread_t thread;
 	struct turnstile *ts = NULL;
+	lck_grp_mtx_prof_t *prof = lck_mtx_prof_for_lock(lock, indirect);
+	uint64_t prof_start = lck_mtx_prof_sample_begin();
+	int prof_outcome = -1;
 
 try_again:
 
@@ -2630,6 +2768,9 @@ try_again:
 	}
 
 	ret = lck_mtx_lock_spinwait_x86(lock);
+	if (prof_outcome < 0) {
+		prof_outcome = lck_mtx_prof_outcome(ret);
+	}
 	state = ordered_load_mtx_state(lock);
 	switch (ret) {
 	case LCK_MTX_SPINWAIT_NO_SPIN:
@@ -2690,6 +2831,10 @@ try_again:
 	 * interlock is already acquired here
 	 */
 
+	if (prof_start) {
+		lck_mtx_prof_record(prof, prof_outcome, prof_start);
+	}
+
 	/* mutex has been acquired */
 	thread = (thread_t)lock->lck_mtx_owner;
 	if (state & LCK_MTX_WAITERS_MSK) {
@@ -3209,14 +3354,22 @@ lck_mtx_lock_spinwait_x86(
 	uint64_t	overall_deadline;
 	uint64_t	check_owner_deadline;
 	uint64_t	cur_time;
+	uint64_t	spin_budget;
 	lck_mtx_spinwait_ret_type_t		retval = LCK_MTX_SPINWAIT_SPUN;
 	int		loopcount = 0;
 
 	KERNEL_DEBUG(MACHDBG_CODE(DBG_MACH_LOCKS, LCK_MTX_LCK_SPIN_CODE) | DBG_FUNC_START,
 		     trace_lck, VM_KERNEL_UNSLIDE_OR_PERM(mutex->lck_mtx_owner), mutex->lck_mtx_waiters, 0, 0);
 
+	/*
+	 * The spin budget is tuned per lock group from the sampled
+	 * contention profile, see lck_mtx_prof_record().
+	 */
+	spin_budget = lck_mtx_prof_spin_budget(
+		lck_mtx_prof_for_lock(mutex, mutex->lck_mtx_is_ext));
+
 	cur_time = mach_absolute_time();
-	overall_deadline = cur_time + MutexSpin;
+	overall_deadline = cur_time + spin_budget;
 	check_owner_deadline = cur_time;
 
 	/*
@@ -3268,7 +3421,7 @@ lck_mtx_lock_spinwait_x86(
 				}
 				lck_mtx_interlock_unlock_enable_interrupts(mutex, istate);
 
-				check_owner_deadline = cur_time + (MutexSpin / 4);
+				check_owner_deadline = cur_time + (spin_budget / 4);
 			}
 		}
 		cpu_pause();
@@ -3290,10 +3443,10 @@ lck_mtx_lock_spinwait_x86(
 	 */
 	if (__probable(mutex->lck_mtx_is_ext == 0)) {
 		LOCKSTAT_RECORD(LS_LCK_MTX_LOCK_SPIN, mutex,
-			mach_absolute_time() - (overall_deadline - MutexSpin));
+			mach_absolute_time() - (overall_deadline - spin_budget));
 	} else {
 		LOCKSTAT_RECORD(LS_LCK_MTX_EXT_LOCK_SPIN, mutex,
-			mach_absolute_time() - (overall_deadline - MutexSpin));
+			mach_absolute_time() - (overall_deadline - spin_budget));
 	}
 	/* The lockstat acquire event is recorded by the assembly code beneath us. */
 #endif
@@ -3450,4 +3603,8 @@ kdp_rwlck_find_owner(__unused struct waitq * waitq, event64_t event, thread_wait
 	}
 	waitinfo->context = VM_KERNEL_UNSLIDE_OR_PERM(rwlck);
 	waitinfo->owner = 0;
+	if (waitinfo->wait_type == kThreadWaitKernelRWLockWrite &&
+	    rwlck->lck_rw_owner != THREAD_NULL) {
+		waitinfo->owner = thread_tid(rwlck->lck_rw_owner);
+	}
 }
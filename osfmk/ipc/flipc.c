@@ -485,6 +485,7 @@ flipc_msg_to_remote_node(mach_node_t  to_node,
 			 * This SHOULD be OK, since we are the only thread looking.
 			 */
 			if (kmsg != IKM_NULL) {
+				(void) ipc_kmsg_inline_copy_materialize(kmsg);
 				mnl_msg_from_kmsg(kmsg, (mnl_msg_t*)&fmsg);
 			}
 		} else {
@@ -500,6 +501,8 @@ flipc_msg_to_remote_node(mach_node_t  to_node,
 			current_task()->messages_received++;
 			ip_release(to_node->control_port); // Should derive ref from port_mq
 
+			(void) ipc_kmsg_inline_copy_materialize(kmsg);
+
 			/* We just pass the kmsg payload as the fmsg.
 			 * flipc_msg_free() will notice and free the kmsg properly.
 			 */
@@ -115,6 +115,86 @@ ipc_entry_lookup(
 	return entry;
 }
 
+/*
+ *	Routine:	ipc_entry_lookup_snapshot
+ *	Purpose:
+ *		Copies out the entry for a name without taking the
+ *		space lock.  The copy is trusted if the entry's bits
+ *		didn't change while it was made, otherwise this falls
+ *		back to locking the space.
+ *
+ *		No reference is taken on the object, and it may be
+ *		destroyed as soon as this returns: the snapshot is only
+ *		good for answering questions about the name itself.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		Found an entry.
+ *		KERN_INVALID_TASK	The space is dead.
+ *		KERN_INVALID_NAME	Name doesn't exist in space.
+ */
+
+kern_return_t
+ipc_entry_lookup_snapshot(
+	ipc_space_t             space,
+	mach_port_name_t        name,
+	ipc_entry_t             snap)
+{
+	mach_port_index_t index = MACH_PORT_INDEX(name);
+	ipc_entry_t table, entry;
+	ipc_entry_num_t size;
+	ipc_entry_bits_t bits;
+	boolean_t active, valid;
+
+	/*
+	 *	Keep replaced tables from being freed while we look
+	 *	(see ipc_space_reclaim_retired_tables).
+	 */
+	ipc_space_reader_enter();
+
+	valid = TRUE;
+	bzero(snap, sizeof(*snap));
+	active = is_active(space);
+	/* the table is published before its size, see ipc_entry_grow_table */
+	size = os_atomic_load(&space->is_table_size, acquire);
+	table = os_atomic_load(&space->is_table, relaxed);
+	if (active && index != 0 && index < size) {
+		entry = &table[index];
+		bits = os_atomic_load(&entry->ie_bits, acquire);
+		/* may be torn, only trusted if the bits didn't move */
+		*snap = *entry;
+		os_atomic_thread_fence(acquire);
+		valid = (os_atomic_load(&entry->ie_bits, relaxed) == bits);
+		snap->ie_bits = bits;
+	}
+
+	ipc_space_reader_exit();
+	if (valid) {
+		goto done;
+	}
+
+	/* a writer got in the way */
+	bzero(snap, sizeof(*snap));
+	is_read_lock(space);
+	active = is_active(space);
+	if (active) {
+		entry = ipc_entry_lookup(space, name);
+		if (entry != IE_NULL) {
+			*snap = *entry;
+		}
+	}
+	is_read_unlock(space);
+
+done:
+	if (!active) {
+		return KERN_INVALID_TASK;
+	}
+	if (IE_BITS_GEN(snap->ie_bits) != MACH_PORT_GEN(name) ||
+	    IE_BITS_TYPE(snap->ie_bits) == MACH_PORT_TYPE_NONE) {
+		return KERN_INVALID_NAME;
+	}
+	return KERN_SUCCESS;
+}
 
 /*
  *	Routine:	ipc_entries_hold
@@ -550,7 +630,7 @@ ipc_entry_grow_table(
 {
 	ipc_entry_num_t osize, size, nsize, psize;
 
-	ipc_entry_t otable, table;
+	ipc_entry_t otable, table, retired;
 	ipc_table_size_t oits, its, nits;
 	mach_port_index_t i, free_index;
 	mach_port_index_t low_mod, hi_mod;
@@ -610,6 +690,20 @@ ipc_entry_grow_table(
 		return KERN_NO_SPACE;
 	}
 
+	/*
+	 * Past a page, the natural sizes only grow by a few pages at a
+	 * time, so filling a large space one step at a time copies the
+	 * table over and over.  Skip ahead until the table at least
+	 * doubles, which keeps the total copying (and the retired tables
+	 * kept for lockless lookups) linear in the final size.
+	 */
+	if (target_size == ITS_SIZE_NONE) {
+		while (size < 2 * osize && its[1].its_size != size) {
+			its++;
+			size = its->its_size;
+		}
+	}
+
 	nits = its + 1;
 	nsize = nits->its_size;
 	assert((osize < size) && (size <= nsize));
@@ -757,24 +851,30 @@ rescan:
 	table[free_index].ie_next = osize;
 
 	assert(space->is_table == otable);
-	assert((space->is_table_next == its) ||
-	    (target_size != ITS_SIZE_NONE));
+	assert(space->is_table_next == oits + 1);
 	assert(space->is_table_size == osize);
 
-	space->is_table = table;
-	space->is_table_size = size;
+	/* lockless lookups load the size first, so publish it last */
+	os_atomic_store(&space->is_table, table, relaxed);
+	os_atomic_store(&space->is_table_size, size, release);
 	space->is_table_next = nits;
 	space->is_table_free += size - osize;
 
+	/*
+	 *	Lockless lookups may still be reading the old table, and
+	 *	earlier ones, so they are only freed once every lookup
+	 *	that started before they were retired is done.
+	 */
+	ipc_space_retire_table(space, otable, osize);
+	retired = ipc_space_reclaim_retired_tables(space);
+
 	is_done_growing(space);
 	is_write_unlock(space);
 
 	thread_wakeup((event_t) space);
 
-	/*
-	 *	Now we need to free the old table.
-	 */
-	it_entries_free(oits, otable);
+	ipc_space_free_table_list(retired);
+
 	is_write_lock(space);
 
 	return KERN_SUCCESS;
@@ -219,6 +219,12 @@ extern ipc_entry_t ipc_entry_lookup(
 	ipc_space_t             space,
 	mach_port_name_t        name);
 
+/* Copy out an entry without locking the space */
+extern kern_return_t ipc_entry_lookup_snapshot(
+	ipc_space_t             space,
+	mach_port_name_t        name,
+	ipc_entry_t             snap);
+
 /* Hold a number of entries in a locked space */
 extern kern_return_t ipc_entries_hold(
 	ipc_space_t             space,
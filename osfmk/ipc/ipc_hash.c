@@ -74,26 +74,6 @@
 #include <ipc/ipc_init.h>
 #include <os/hash.h>
 
-#include <mach_ipc_debug.h>
-
-#if     MACH_IPC_DEBUG
-#include <mach/kern_return.h>
-#include <mach_debug/hash_info.h>
-#include <vm/vm_map.h>
-#include <vm/vm_kern.h>
-#endif  /* MACH_IPC_DEBUG */
-
-/*
- * Forward declarations
- */
-
-/* Delete an entry from the local reverse hash table */
-void ipc_hash_local_delete(
-	ipc_space_t             space,
-	ipc_object_t            obj,
-	mach_port_index_t       index,
-	ipc_entry_t             entry);
-
 /*
  *	Routine:	ipc_hash_lookup
  *	Purpose:
@@ -188,8 +168,14 @@ ipc_hash_delete(
  *	So possibly a small win; probably nothing significant.
  */
 
+/*
+ *	Table sizes are not powers of two, so the hash is scaled into
+ *	[0, size) with a multiply and shift rather than a modulo:
+ *	a division is the single most expensive step of a probe.
+ */
 #define IH_TABLE_HASH(obj, size)                                \
-	        ((mach_port_index_t)(os_hash_kernel_pointer(obj) % (size)))
+	        ((mach_port_index_t)(((uint64_t)os_hash_kernel_pointer(obj) * \
+	        (uint64_t)(size)) >> 32))
 
 /*
  *	Routine:	ipc_hash_table_lookup
@@ -401,7 +387,7 @@ ipc_hash_table_delete(
 		 * If its displacement was pegged, recompute it.
 		 */
 		if (dist-- == IPC_ENTRY_DIST_MAX) {
-			uint32_t desired = IH_TABLE_HASH(table[index].ie_object, size);
+			mach_port_index_t desired = IH_TABLE_HASH(table[index].ie_object, size);
 			if (hindex >= desired) {
 				dist = hindex - desired;
 			} else {
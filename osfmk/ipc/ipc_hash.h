@@ -75,6 +75,12 @@
  * Exported interfaces
  */
 
+/*
+ *	There is no global reverse hash: each space hashes the send
+ *	rights in its own table, under the space lock, so copyouts to
+ *	different tasks never contend with one another.
+ */
+
 /* Lookup (space, obj) in the appropriate reverse hash table */
 extern boolean_t ipc_hash_lookup(
 	ipc_space_t             space,
@@ -125,16 +131,4 @@ extern void ipc_hash_table_delete(
 	mach_port_name_t        name,
 	ipc_entry_t             entry);
 
-#include <mach_ipc_debug.h>
-
-#if     MACH_IPC_DEBUG
-
-#include <mach_debug/hash_info.h>
-
-extern natural_t ipc_hash_info(
-	hash_info_bucket_t      *info,
-	natural_t count);
-
-#endif  /* MACH_IPC_DEBUG */
-
 #endif  /* _IPC_IPC_HASH_H_ */
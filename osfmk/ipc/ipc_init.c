@@ -103,6 +103,7 @@
 #include <ipc/ipc_init.h>
 #include <ipc/ipc_table.h>
 #include <ipc/ipc_voucher.h>
+#include <ipc/ipc_port_stats.h>
 #include <ipc/ipc_importance.h>
 
 #include <mach/machine/ndr_def.h>   /* NDR_record */
@@ -123,6 +124,13 @@ vm_size_t ipc_kmsg_max_vm_space = ((IPC_KERNEL_COPY_MAP_SIZE * 7) / 8);
 #define IPC_KMSG_MAX_SPACE (64 * 1024 * 1024) /* keep in sync with COPYSIZELIMIT_PANIC */
 vm_size_t ipc_kmsg_max_body_space = ((IPC_KMSG_MAX_SPACE * 3) / 4 - MAX_TRAILER_SIZE);
 
+/*
+ * page-aligned spans of simple inline message bodies larger than this
+ * are remapped copy-on-write instead of being copied (0 disables)
+ */
+#define IPC_KMSG_REMAP_THRESHOLD (64 * 1024)
+vm_size_t ipc_kmsg_remap_threshold = IPC_KMSG_REMAP_THRESHOLD;
+
 int ipc_space_max;
 int ipc_port_max;
 int ipc_pset_max;
@@ -198,6 +206,27 @@ ipc_bootstrap(void)
 	zone_change(ipc_kmsg_zone, Z_CALLERACCT, FALSE);
 	zone_change(ipc_kmsg_zone, Z_CACHING_ENABLED, TRUE);
 
+	/*
+	 * Create the zones for the larger kmsg size classes, also cached
+	 * at the processor level, so that medium sized messages don't
+	 * have to go through kalloc.
+	 */
+	for (int class = 0; class < IKM_ZONE_CLASSES; class++) {
+		static const char *ipc_kmsg_class_zone_names[IKM_ZONE_CLASSES] = {
+			"ipc kmsgs.1K", "ipc kmsgs.2K", "ipc kmsgs.4K",
+			"ipc kmsgs.8K", "ipc kmsgs.16K", "ipc kmsgs.32K",
+		};
+		vm_size_t size = ikm_class_kmsg_size(class);
+
+		ipc_kmsg_class_zones[class] = zinit(size,
+		    ipc_port_max * MACH_PORT_QLIMIT_DEFAULT *
+		    IKM_SAVED_KMSG_SIZE,
+		    round_page(size),
+		    ipc_kmsg_class_zone_names[class]);
+		zone_change(ipc_kmsg_class_zones[class], Z_CALLERACCT, FALSE);
+		zone_change(ipc_kmsg_class_zones[class], Z_CACHING_ENABLED, TRUE);
+	}
+
 	/* create special spaces */
 
 	kr = ipc_space_create_special(&ipc_space_kernel);
@@ -215,6 +244,7 @@ ipc_bootstrap(void)
 	mig_init();
 	ipc_table_init();
 	ipc_voucher_init();
+	ipc_port_stats_init();
 
 #if IMPORTANCE_INHERITANCE
 	ipc_importance_init();
@@ -234,6 +264,8 @@ ipc_bootstrap(void)
 	if (PE_parse_boot_argn("ipc_strict_reply", &strict_reply_bootarg, sizeof(strict_reply_bootarg))) {
 		enforce_strict_reply = !!strict_reply_bootarg;
 	}
+	(void) PE_parse_boot_argn("ipc_remap_threshold", &ipc_kmsg_remap_threshold,
+	    sizeof(ipc_kmsg_remap_threshold));
 }
 
 /*
@@ -511,6 +511,7 @@ extern vm_map_t         ipc_kernel_copy_map;
 extern vm_size_t        ipc_kmsg_max_space;
 extern vm_size_t        ipc_kmsg_max_vm_space;
 extern vm_size_t        ipc_kmsg_max_body_space;
+extern vm_size_t        ipc_kmsg_remap_threshold;
 extern vm_size_t        msg_ool_size_small;
 
 #define MSG_OOL_SIZE_SMALL      msg_ool_size_small
@@ -864,6 +865,9 @@ ipc_kmsg_trace_send(ipc_kmsg_t kmsg,
 /* zone for cached ipc_kmsg_t structures */
 zone_t                  ipc_kmsg_zone;
 
+/* zones for the larger size classes of cached ipc_kmsg_t structures */
+zone_t                  ipc_kmsg_class_zones[IKM_ZONE_CLASSES];
+
 /*
  * Forward declarations
  */
@@ -977,6 +981,14 @@ ipc_kmsg_alloc(
 	}
 	if (max_expanded_size == IKM_SAVED_MSG_SIZE) {
 		kmsg = (ipc_kmsg_t)zalloc(ipc_kmsg_zone);
+	} else if (max_expanded_size <= ikm_class_msg_size(IKM_ZONE_CLASSES - 1)) {
+		int class = 0;
+
+		while (max_expanded_size > ikm_class_msg_size(class)) {
+			class++;
+		}
+		max_expanded_size = ikm_class_msg_size(class);  /* round up for the class cache */
+		kmsg = (ipc_kmsg_t)zalloc(ipc_kmsg_class_zones[class]);
 	} else {
 		kmsg = (ipc_kmsg_t)kalloc(ikm_plus_overhead(max_expanded_size));
 	}
@@ -1033,10 +1045,25 @@ ipc_kmsg_free(
 		ip_release(port); /* May be last reference */
 	}
 
+	if (kmsg->ikm_inline_copy != VM_MAP_COPY_NULL) {
+		vm_map_copy_discard(kmsg->ikm_inline_copy);
+		kmsg->ikm_inline_copy = VM_MAP_COPY_NULL;
+	}
+	if (kmsg->ikm_inline_buf != NULL) {
+		kfree(kmsg->ikm_inline_buf, kmsg->ikm_inline_bufsize);
+		kmsg->ikm_inline_buf = NULL;
+	}
+
 	if (kmsg->ikm_size == IKM_SAVED_MSG_SIZE) {
 		zfree(ipc_kmsg_zone, kmsg);
 		return;
 	}
+	for (int class = 0; class < IKM_ZONE_CLASSES; class++) {
+		if (size == ikm_class_msg_size(class)) {
+			zfree(ipc_kmsg_class_zones[class], kmsg);
+			return;
+		}
+	}
 	kfree(kmsg, ikm_plus_overhead(size));
 }
 
@@ -1572,6 +1599,158 @@ ipc_kmsg_prealloc(mach_msg_size_t size)
 }
 
 
+/*
+ *	Routine:	ipc_kmsg_inline_copy_materialize
+ *	Purpose:
+ *		Large page-aligned parts of simple inline messages
+ *		are carried by a COW copy (ikm_inline_copy) instead of
+ *		being copied into the kmsg by ipc_kmsg_get(), and
+ *		the kmsg buffer has no room for them.
+ *
+ *		Build the whole message in a separate buffer and
+ *		point ikm_header at it, for receivers that need to
+ *		look at the whole body in kernel memory (kernel
+ *		servers, kernel receives, FLIPC).
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		MACH_MSG_SUCCESS	The body is fully in the kmsg.
+ *		MACH_MSG_VM_KERNEL	Couldn't map the copy, the part it
+ *					covered has been zero-filled.
+ *		MACH_MSG_VM_KERNEL	Couldn't allocate the buffer, the
+ *					message is cut down to the part
+ *					that was in the kmsg.
+ */
+
+mach_msg_return_t
+ipc_kmsg_inline_copy_materialize(
+	ipc_kmsg_t              kmsg)
+{
+	vm_map_copy_t copy = kmsg->ikm_inline_copy;
+	mach_msg_size_t head, len, size;
+	vm_map_address_t addr;
+	kern_return_t kr;
+	char *src, *dst;
+
+	if (copy == VM_MAP_COPY_NULL) {
+		return MACH_MSG_SUCCESS;
+	}
+
+	kmsg->ikm_inline_copy = VM_MAP_COPY_NULL;
+	src = (char *)kmsg->ikm_header;
+	head = (mach_msg_size_t)sizeof(mach_msg_header_t) + kmsg->ikm_inline_offset;
+	len = kmsg->ikm_inline_size;
+	size = kmsg->ikm_header->msgh_size + MAX_TRAILER_SIZE;
+
+	dst = kalloc(size + len);
+	if (dst == NULL) {
+		vm_map_copy_discard(copy);
+		return MACH_MSG_VM_KERNEL;
+	}
+
+	memcpy(dst, src, head);
+	kr = vm_map_copyout(kernel_map, &addr, copy);
+	if (kr != KERN_SUCCESS) {
+		vm_map_copy_discard(copy);
+		bzero(dst + head, len);
+	} else {
+		memcpy(dst + head, (const void *)addr, len);
+		(void) vm_deallocate(kernel_map, addr, len);
+	}
+	memcpy(dst + head + len, src + head, size - head);
+
+	kmsg->ikm_inline_buf = dst;
+	kmsg->ikm_inline_bufsize = size + len;
+	kmsg->ikm_header = (mach_msg_header_t *)dst;
+	kmsg->ikm_header->msgh_size += len;
+
+	return kr == KERN_SUCCESS ? MACH_MSG_SUCCESS : MACH_MSG_VM_KERNEL;
+}
+
+/*
+ *	Routine:	ipc_kmsg_inline_span
+ *	Purpose:
+ *		Simple messages whose body spans more than
+ *		ipc_kmsg_remap_threshold bytes of whole pages are
+ *		not copied in whole: the pages are carried by a COW
+ *		copy that ipc_kmsg_put() remaps into the receiver.
+ *
+ *		Returns how many bytes of the body that is, starting
+ *		*headp bytes into it, or 0 if it is copied in whole.
+ */
+
+static mach_msg_size_t
+ipc_kmsg_inline_span(
+	mach_msg_bits_t         bits,
+	mach_vm_address_t       body_addr,
+	mach_msg_size_t         body_size,
+	mach_msg_size_t         *headp)
+{
+	vm_map_t map = current_map();
+	mach_vm_address_t start, end;
+
+	start = vm_map_round_page(body_addr, VM_MAP_PAGE_MASK(map));
+	end = vm_map_trunc_page(body_addr + body_size, VM_MAP_PAGE_MASK(map));
+
+	if (ipc_kmsg_remap_threshold == 0 ||
+	    (bits & MACH_MSGH_BITS_COMPLEX) ||
+	    end <= start || end - start < ipc_kmsg_remap_threshold) {
+		*headp = 0;
+		return 0;
+	}
+
+	*headp = (mach_msg_size_t)(start - body_addr);
+	return (mach_msg_size_t)(end - start);
+}
+
+/*
+ *	Routine:	ipc_kmsg_get_body
+ *	Purpose:
+ *		Copies the body of a user message to the message buffer,
+ *		except for the len bytes at head, which are taken as
+ *		a COW copy (see ipc_kmsg_inline_span).
+ *	Conditions:
+ *		Nothing locked.
+ */
+
+static mach_msg_return_t
+ipc_kmsg_get_body(
+	ipc_kmsg_t              kmsg,
+	mach_vm_address_t       body_addr,
+	mach_msg_size_t         body_size,
+	mach_msg_size_t         head,
+	mach_msg_size_t         len)
+{
+	char *body = (char *)(kmsg->ikm_header + 1);
+	thread_t thread = current_thread();
+
+	if (len == 0) {
+		if (copyinmsg(body_addr, body, body_size)) {
+			return MACH_SEND_INVALID_DATA;
+		}
+		thread->ipc_inline_bytes_copied += body_size;
+		return MACH_MSG_SUCCESS;
+	}
+
+	if (head && copyinmsg(body_addr, body, head)) {
+		return MACH_SEND_INVALID_DATA;
+	}
+	if (body_size > head + len &&
+	    copyinmsg(body_addr + head + len, body + head, body_size - head - len)) {
+		return MACH_SEND_INVALID_DATA;
+	}
+	if (vm_map_copyin(current_map(), body_addr + head, len, FALSE,
+	    &kmsg->ikm_inline_copy) != KERN_SUCCESS) {
+		return MACH_SEND_INVALID_DATA;
+	}
+	kmsg->ikm_inline_offset = head;
+	kmsg->ikm_inline_size = len;
+
+	thread->ipc_inline_bytes_copied += body_size - len;
+	thread->ipc_inline_bytes_remapped += len;
+	return MACH_MSG_SUCCESS;
+}
+
 /*
  *	Routine:	ipc_kmsg_get
  *	Purpose:
@@ -1599,6 +1778,7 @@ ipc_kmsg_get(
 	mach_msg_max_trailer_t          *trailer;
 	mach_msg_legacy_base_t      legacy_base;
 	mach_msg_size_t             len_copied;
+	mach_msg_size_t             inline_head, inline_len;
 	legacy_base.body.msgh_descriptor_count = 0;
 
 	if ((size < sizeof(mach_msg_legacy_header_t)) || (size & 3)) {
@@ -1642,13 +1822,17 @@ ipc_kmsg_get(
 	}
 	__unreachable_ok_pop
 
-	    msg_and_trailer_size = size + MAX_TRAILER_SIZE;
+	    inline_len = ipc_kmsg_inline_span(legacy_base.header.msgh_bits, msg_addr,
+	    size - (mach_msg_size_t)sizeof(mach_msg_header_t), &inline_head);
+
+	/* the remapped part of the body doesn't take room in the kmsg */
+	msg_and_trailer_size = size - inline_len + MAX_TRAILER_SIZE;
 	kmsg = ipc_kmsg_alloc(msg_and_trailer_size);
 	if (kmsg == IKM_NULL) {
 		return MACH_SEND_NO_BUFFER;
 	}
 
-	kmsg->ikm_header->msgh_size                     = size;
+	kmsg->ikm_header->msgh_size                     = size - inline_len;
 	kmsg->ikm_header->msgh_bits                     = legacy_base.header.msgh_bits;
 	kmsg->ikm_header->msgh_remote_port      = CAST_MACH_NAME_TO_PORT(legacy_base.header.msgh_remote_port);
 	kmsg->ikm_header->msgh_local_port       = CAST_MACH_NAME_TO_PORT(legacy_base.header.msgh_local_port);
@@ -1669,7 +1853,9 @@ ipc_kmsg_get(
 	    kmsg->ikm_header->msgh_voucher_port,
 	    kmsg->ikm_header->msgh_id);
 
-	if (copyinmsg(msg_addr, (char *)(kmsg->ikm_header + 1), size - (mach_msg_size_t)sizeof(mach_msg_header_t))) {
+	if (ipc_kmsg_get_body(kmsg, msg_addr,
+	    size - (mach_msg_size_t)sizeof(mach_msg_header_t),
+	    inline_head, inline_len) != MACH_MSG_SUCCESS) {
 		ipc_kmsg_free(kmsg);
 		return MACH_SEND_INVALID_DATA;
 	}
@@ -1677,9 +1863,9 @@ ipc_kmsg_get(
 	/* unreachable if !DEBUG */
 	__unreachable_ok_push
 	if (DEBUG_KPRINT_SYSCALL_PREDICATE(DEBUG_KPRINT_SYSCALL_IPC_MASK)) {
-		kprintf("body: size: %lu\n", (size - sizeof(mach_msg_header_t)));
+		kprintf("body: size: %lu\n", (kmsg->ikm_header->msgh_size - sizeof(mach_msg_header_t)));
 		uint32_t i;
-		for (i = 0; i * 4 < (size - sizeof(mach_msg_header_t)); i++) {
+		for (i = 0; i * 4 < (kmsg->ikm_header->msgh_size - sizeof(mach_msg_header_t)); i++) {
 			kprintf("%.4x\n", ((uint32_t *)(kmsg->ikm_header + 1))[i]);
 		}
 	}
@@ -1692,7 +1878,8 @@ ipc_kmsg_get(
 	 * is initialized to the minimum (sizeof(mach_msg_trailer_t)), to optimize
 	 * the cases where no implicit data is requested.
 	 */
-	trailer = (mach_msg_max_trailer_t *) ((vm_offset_t)kmsg->ikm_header + size);
+	trailer = (mach_msg_max_trailer_t *) ((vm_offset_t)kmsg->ikm_header +
+	    kmsg->ikm_header->msgh_size);
 	trailer->msgh_sender = current_thread()->task->sec_token;
 	trailer->msgh_audit = current_thread()->task->audit_token;
 	trailer->msgh_trailer_type = MACH_MSG_TRAILER_FORMAT_0;
@@ -1931,6 +2118,9 @@ retry:
 
 		current_task()->messages_sent++;
 
+		/* kernel servers expect the whole body in the kmsg */
+		(void) ipc_kmsg_inline_copy_materialize(kmsg);
+
 		/*
 		 * Call the server routine, and get the reply message to send.
 		 */
@@ -2081,11 +2271,24 @@ ipc_kmsg_put(
 	mach_msg_size_t         trailer_size,
 	mach_msg_size_t         *sizep)
 {
-	mach_msg_size_t size = kmsg->ikm_header->msgh_size + trailer_size;
+	mach_msg_size_t size, head = 0, len = 0;
+	vm_offset_t body;
 	mach_msg_return_t mr;
 
 	DEBUG_IPC_KMSG_PRINT(kmsg, "ipc_kmsg_put()");
 
+	if (current_task() == kernel_task) {
+		(void) ipc_kmsg_inline_copy_materialize(kmsg);
+	}
+
+	size = kmsg->ikm_header->msgh_size + trailer_size;
+	body = (vm_offset_t)(kmsg->ikm_header + 1);
+	if (kmsg->ikm_inline_copy != VM_MAP_COPY_NULL) {
+		/* the receiver sees the size of the whole message */
+		len = kmsg->ikm_inline_size;
+		kmsg->ikm_header->msgh_size += len;
+	}
+
 
 	DEBUG_KPRINT_SYSCALL_IPC("ipc_kmsg_put header:\n"
 	    "  size:		0x%.8x\n"
@@ -2139,10 +2342,30 @@ ipc_kmsg_put(
 
 	/* Re-Compute target address if using stack-style delivery */
 	if (option & MACH_RCV_STACK) {
-		rcv_addr += rcv_size - size;
+		rcv_addr += rcv_size - size - len;
 	}
 
-	if (copyoutmsg((const char *) kmsg->ikm_header, rcv_addr, size)) {
+	if (len != 0) {
+		/*
+		 * Copy out the parts of the message around the remapped
+		 * pages, and remap those into the receive buffer.
+		 */
+		head = (mach_msg_size_t)(body - (vm_offset_t)kmsg->ikm_header) +
+		    kmsg->ikm_inline_offset;
+		if (copyoutmsg((const char *) kmsg->ikm_header, rcv_addr, head) ||
+		    copyoutmsg((const char *) kmsg->ikm_header + head,
+		    rcv_addr + head + len, size - head) ||
+		    vm_map_copy_overwrite(current_map(), rcv_addr + head,
+		    kmsg->ikm_inline_copy, FALSE) != KERN_SUCCESS) {
+			mr = MACH_RCV_INVALID_DATA;
+			size = 0;
+		} else {
+			/* consumed by vm_map_copy_overwrite() */
+			kmsg->ikm_inline_copy = VM_MAP_COPY_NULL;
+			size += len;
+			mr = MACH_MSG_SUCCESS;
+		}
+	} else if (copyoutmsg((const char *) kmsg->ikm_header, rcv_addr, size)) {
 		mr = MACH_RCV_INVALID_DATA;
 		size = 0;
 	} else {
@@ -2180,6 +2403,7 @@ ipc_kmsg_put_to_kernel(
 	ipc_kmsg_t              kmsg,
 	mach_msg_size_t         size)
 {
+	(void) ipc_kmsg_inline_copy_materialize(kmsg);
 	(void) memcpy((void *) msg, (const void *) kmsg->ikm_header, size);
 
 	ipc_kmsg_free(kmsg);
@@ -5051,6 +5275,9 @@ ipc_kmsg_copyout_size(
 	mach_msg_size_t             send_size;
 
 	send_size = kmsg->ikm_header->msgh_size;
+	if (kmsg->ikm_inline_copy != VM_MAP_COPY_NULL) {
+		send_size += kmsg->ikm_inline_size;
+	}
 
 	boolean_t is_task_64bit = (map->max_offset > VM_MAX_ADDRESS);
 
@@ -5280,6 +5507,11 @@ ipc_kmsg_copyout_dest(
 		ipc_kmsg_clean_body(kmsg, body->msgh_descriptor_count,
 		    (mach_msg_descriptor_t *)(body + 1));
 	}
+
+	if (kmsg->ikm_inline_copy != VM_MAP_COPY_NULL) {
+		vm_map_copy_discard(kmsg->ikm_inline_copy);
+		kmsg->ikm_inline_copy = VM_MAP_COPY_NULL;
+	}
 }
 
 /*
@@ -5306,6 +5538,9 @@ ipc_kmsg_copyout_to_kernel(
 	mach_msg_type_name_t reply_type;
 	mach_port_name_t dest_name;
 
+	/* kernel receivers expect the whole body in the kmsg */
+	(void) ipc_kmsg_inline_copy_materialize(kmsg);
+
 	dest = ip_to_object(kmsg->ikm_header->msgh_remote_port);
 	reply = kmsg->ikm_header->msgh_local_port;
 	dest_type = MACH_MSGH_BITS_REMOTE(kmsg->ikm_header->msgh_bits);
@@ -5365,6 +5600,9 @@ ipc_kmsg_copyout_to_kernel_legacy(
 	mach_msg_type_name_t reply_type;
 	mach_port_name_t dest_name;
 
+	/* kernel receivers expect the whole body in the kmsg */
+	(void) ipc_kmsg_inline_copy_materialize(kmsg);
+
 	dest = ip_to_object(kmsg->ikm_header->msgh_remote_port);
 	reply = kmsg->ikm_header->msgh_local_port;
 	dest_type = MACH_MSGH_BITS_REMOTE(kmsg->ikm_header->msgh_bits);
@@ -97,6 +97,12 @@ typedef uint32_t ipc_kmsg_flags_t;
  *	The ikm_header.msgh_remote_port field is the destination
  *	of the message.
  *
+ *	When ikm_inline_copy is set, the ikm_inline_size bytes at
+ *	ikm_inline_offset in the body are not in the buffer: the part
+ *	of the body after them follows directly, and msgh_size does
+ *	not count them until ipc_kmsg_put() or
+ *	ipc_kmsg_inline_copy_materialize() puts them back.
+ *
  *	sync_qos and special_port_qos stores the qos for prealloced
  *	port, this fields could be deleted once we remove ip_prealloc.
  */
@@ -114,6 +120,12 @@ struct ipc_kmsg {
 	struct ipc_importance_elem *ikm_importance;  /* inherited from */
 	queue_chain_t              ikm_inheritance;  /* inherited from link */
 	struct turnstile           *ikm_turnstile;   /* send turnstile for ikm_prealloc port */
+	struct vm_map_copy         *ikm_inline_copy; /* remapped part of the inline body */
+	mach_msg_size_t            ikm_inline_offset; /* offset of ikm_inline_copy in the body */
+	mach_msg_size_t            ikm_inline_size;  /* size of ikm_inline_copy */
+	void                       *ikm_inline_buf;  /* materialized message, ikm_header points in */
+	vm_size_t                  ikm_inline_bufsize; /* size of ikm_inline_buf */
+	uint64_t                   ikm_sample_time;  /* queued at, if sampled for port stats */
 #if MACH_FLIPC
 	struct mach_node           *ikm_node;        /* Originating node - needed for ack */
 #endif
@@ -143,6 +155,16 @@ extern zone_t ipc_kmsg_zone;
 #define IKM_SAVED_KMSG_SIZE     256
 #define IKM_SAVED_MSG_SIZE      ikm_less_overhead(IKM_SAVED_KMSG_SIZE)
 
+/*
+ *	Larger kernel message buffers are cached in size classes of
+ *	1K to 32K (including overhead), each backed by a zone with
+ *	per-cpu caching enabled.
+ */
+#define IKM_ZONE_CLASSES        6
+extern zone_t ipc_kmsg_class_zones[IKM_ZONE_CLASSES];
+#define ikm_class_kmsg_size(class)      (IKM_SAVED_KMSG_SIZE << ((class) + 2))
+#define ikm_class_msg_size(class)       ikm_less_overhead(ikm_class_kmsg_size(class))
+
 #define ikm_prealloc_inuse_port(kmsg)                                   \
 	((kmsg)->ikm_prealloc)
 
@@ -174,6 +196,10 @@ MACRO_BEGIN                                                     \
 	(kmsg)->ikm_prealloc = IP_NULL;                             \
 	(kmsg)->ikm_voucher = IP_NULL;                              \
 	(kmsg)->ikm_importance = IIE_NULL;                          \
+	(kmsg)->ikm_inline_copy = NULL;                             \
+	(kmsg)->ikm_inline_size = 0;                                \
+	(kmsg)->ikm_inline_buf = NULL;                              \
+	(kmsg)->ikm_sample_time = 0;                                \
 	ikm_qos_init(kmsg);                                         \
 	ikm_flipc_init(kmsg);                                       \
 	assert((kmsg)->ikm_prev = (kmsg)->ikm_next = IKM_BOGUS);    \
@@ -319,6 +345,10 @@ extern void ipc_kmsg_put_to_kernel(
 	ipc_kmsg_t              kmsg,
 	mach_msg_size_t         size);
 
+/* Copy the remapped part of an inline body into the kmsg */
+extern mach_msg_return_t ipc_kmsg_inline_copy_materialize(
+	ipc_kmsg_t              kmsg);
+
 /* Copyin port rights in the header of a message */
 extern mach_msg_return_t ipc_kmsg_copyin_header(
 	ipc_kmsg_t              kmsg,
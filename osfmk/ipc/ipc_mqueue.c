@@ -90,6 +90,7 @@
 #include <ipc/ipc_port.h>
 #include <ipc/ipc_pset.h>
 #include <ipc/ipc_space.h>
+#include <ipc/ipc_port_stats.h>
 
 #if MACH_FLIPC
 #include <ipc/flipc.h>
@@ -777,6 +778,8 @@ ipc_mqueue_post(
 		goto out_unlock;
 	}
 
+	ipc_port_stats_post(mqueue, kmsg);
+
 	for (;;) {
 		struct waitq *waitq = &mqueue->imq_wait_queue;
 		spl_t th_spl;
@@ -886,6 +889,7 @@ ipc_mqueue_post(
 		    !(receiver->ith_option & MACH_RCV_LARGE)) {
 			receiver->ith_kmsg = kmsg;
 			receiver->ith_seqno = mqueue->imq_seqno++;
+			ipc_port_stats_dequeue(mqueue, kmsg);
 #if MACH_FLIPC
 			mach_node_t node = kmsg->ikm_node;
 #endif
@@ -1344,6 +1348,7 @@ ipc_mqueue_select_on_thread(
 	}
 
 	ipc_kmsg_rmqueue(&port_mq->imq_messages, kmsg);
+	ipc_port_stats_dequeue(port_mq, kmsg);
 #if MACH_FLIPC
 	if (MACH_NODE_VALID(kmsg->ikm_node) && FPORT_VALID(port_mq->imq_fport)) {
 		flipc_msg_ack(kmsg->ikm_node, port_mq, TRUE);
@@ -1417,6 +1422,9 @@ ipc_mqueue_peek_locked(ipc_mqueue_t mq,
 	}
 	if (msg_sizep != NULL) {
 		*msg_sizep = kmsg->ikm_header->msgh_size;
+		if (kmsg->ikm_inline_copy != VM_MAP_COPY_NULL) {
+			*msg_sizep += kmsg->ikm_inline_size;
+		}
 	}
 	if (msg_idp != NULL) {
 		*msg_idp = kmsg->ikm_header->msgh_id;
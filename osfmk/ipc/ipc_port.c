@@ -90,6 +90,8 @@
 #include <ipc/ipc_mqueue.h>
 #include <ipc/ipc_notify.h>
 #include <ipc/ipc_table.h>
+#include <ipc/ipc_shm_ring.h>
+#include <ipc/ipc_port_stats.h>
 #include <ipc/ipc_importance.h>
 #include <machine/limits.h>
 #include <kern/turnstile.h>
@@ -661,6 +663,8 @@ ipc_port_init(
 	port->ip_premsg = IKM_NULL;
 	port->ip_context = 0;
 	port->ip_reply_context = 0;
+	port->ip_shm_ring = ISR_NULL;
+	port->ip_stats = IPS_NULL;
 
 	port->ip_sprequests  = 0;
 	port->ip_spimportant = 0;
@@ -950,6 +954,11 @@ ipc_port_destroy(ipc_port_t port)
 	/* clear any reply-port context */
 	port->ip_reply_context = 0;
 
+	/* receivers blocked on a shared memory ring notice the port is gone */
+	if (port->ip_shm_ring != ISR_NULL) {
+		ipc_shm_ring_wakeup_all(port->ip_shm_ring);
+	}
+
 	/* check for a backup port */
 	pdrequest = port->ip_pdrequest;
 
@@ -2794,6 +2803,16 @@ ipc_port_finalize(
 		port->ip_requests = IPR_NULL;
 	}
 
+	if (port->ip_shm_ring != ISR_NULL) {
+		ipc_shm_ring_destroy(port->ip_shm_ring);
+		port->ip_shm_ring = ISR_NULL;
+	}
+
+	if (port->ip_stats != IPS_NULL) {
+		ipc_port_stats_destroy(port->ip_stats);
+		port->ip_stats = IPS_NULL;
+	}
+
 	ipc_mqueue_deinit(&port->ip_messages);
 
 #if     MACH_ASSERT
@@ -145,6 +145,9 @@ struct ipc_port {
 
 	mach_vm_address_t ip_context;
 
+	struct ipc_shm_ring *ip_shm_ring;       /* MACH_PORT_SHM_RING, see ipc_shm_ring.c */
+	struct ipc_port_stats *ip_stats;        /* MACH_PORT_IPC_STATS, see ipc_port_stats.c */
+
 	natural_t ip_sprequests:1,      /* send-possible requests outstanding */
 	    ip_spimportant:1,           /* ... at least one is importance donating */
 	    ip_impdonation:1,           /* port supports importance donation */
@@ -0,0 +1,371 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+/*
+ *	File:	ipc/ipc_port_stats.c
+ *
+ *	Sampled message flow statistics for receive rights.
+ *
+ *	A port gets a statistics block the first time one of its messages
+ *	is sampled.  From then on every message queued on it bumps a
+ *	counter and the queue depth high-watermark, and sampled messages
+ *	(1 in ipc_port_stats_sample_rate, counted with the port's own
+ *	sequence numbers) also go into the size histogram and are time
+ *	stamped, so that their queueing latency can be recorded when a
+ *	receiver picks them up.  Everything is updated under the mqueue
+ *	lock the send and receive paths already hold.
+ */
+
+#include <mach/mach_types.h>
+#include <mach/kern_return.h>
+#include <mach/port.h>
+
+#include <kern/clock.h>
+#include <kern/kcdata.h>
+#include <kern/locks.h>
+#include <kern/misc_protos.h>
+#include <kern/task.h>
+#include <kern/zalloc.h>
+
+#include <ipc/ipc_init.h>
+#include <ipc/ipc_kmsg.h>
+#include <ipc/ipc_mqueue.h>
+#include <ipc/ipc_port.h>
+#include <ipc/ipc_space.h>
+#include <ipc/ipc_port_stats.h>
+
+#include <pexpert/pexpert.h>
+
+#define IPC_PORT_STATS_SAMPLE_RATE      64
+
+uint32_t ipc_port_stats_sample_rate = IPC_PORT_STATS_SAMPLE_RATE;
+
+static zone_t ipc_port_stats_zone;
+static queue_head_t ipc_port_stats_queue;
+static lck_spin_t ipc_port_stats_lock;
+
+/*
+ *	Routine:	ipc_port_stats_init
+ *	Purpose:
+ *		Set up the statistics zone.  The sample rate can be
+ *		changed with the ipc_port_stats_sample boot-arg, and
+ *		is rounded down to a power of 2.
+ */
+void
+ipc_port_stats_init(void)
+{
+	uint32_t rate;
+
+	if (PE_parse_boot_argn("ipc_port_stats_sample", &rate, sizeof(rate))) {
+		ipc_port_stats_sample_rate = rate ? 1u << (flsll(rate) - 1) : 0;
+	}
+
+	ipc_port_stats_zone = zinit(sizeof(struct ipc_port_stats),
+	    ipc_port_max * sizeof(struct ipc_port_stats),
+	    sizeof(struct ipc_port_stats),
+	    "ipc port stats");
+	zone_change(ipc_port_stats_zone, Z_CALLERACCT, FALSE);
+	zone_change(ipc_port_stats_zone, Z_NOENCRYPT, TRUE);
+
+	queue_init(&ipc_port_stats_queue);
+	lck_spin_init(&ipc_port_stats_lock, &ipc_lck_grp, &ipc_lck_attr);
+}
+
+static inline uint32_t
+ipc_port_stats_bucket(uint64_t value)
+{
+	int bucket = flsll(value);
+
+	if (bucket >= MACH_PORT_IPC_HISTOGRAM_BUCKETS) {
+		bucket = MACH_PORT_IPC_HISTOGRAM_BUCKETS - 1;
+	}
+	return (uint32_t)bucket;
+}
+
+static ipc_port_stats_t
+ipc_port_stats_alloc(
+	ipc_port_t              port)
+{
+	ipc_port_stats_t stats;
+
+	/* called from the send path with the mqueue locked */
+	stats = (ipc_port_stats_t)zalloc_noblock(ipc_port_stats_zone);
+	if (stats == IPS_NULL) {
+		return IPS_NULL;
+	}
+	bzero(stats, sizeof(*stats));
+	stats->ips_port = port;
+
+	lck_spin_lock_grp(&ipc_port_stats_lock, &ipc_lck_grp);
+	enqueue_tail(&ipc_port_stats_queue, &stats->ips_link);
+	lck_spin_unlock(&ipc_port_stats_lock);
+
+	port->ip_stats = stats;
+	return stats;
+}
+
+/*
+ *	Routine:	ipc_port_stats_post
+ *	Purpose:
+ *		Account for a message being queued on (or handed
+ *		directly to a receiver of) a port, and sample it.
+ *	Conditions:
+ *		The mqueue is locked, and its reservation for the
+ *		message is still counted in imq_msgcount.
+ */
+void
+ipc_port_stats_post(
+	ipc_mqueue_t            mqueue,
+	ipc_kmsg_t              kmsg)
+{
+	ipc_port_t port = ip_from_mq(mqueue);
+	ipc_port_stats_t stats = port->ip_stats;
+	uint32_t rate = ipc_port_stats_sample_rate;
+	boolean_t sample;
+
+	kmsg->ikm_sample_time = 0;
+	if (rate == 0) {
+		return;
+	}
+
+	sample = ((mqueue->imq_seqno + mqueue->imq_msgcount) & (rate - 1)) == 0;
+	if (stats == IPS_NULL) {
+		if (!sample) {
+			return;
+		}
+		stats = ipc_port_stats_alloc(port);
+		if (stats == IPS_NULL) {
+			return;
+		}
+	}
+
+	stats->ips_messages++;
+	if (mqueue->imq_msgcount > stats->ips_depth_max) {
+		stats->ips_depth_max = mqueue->imq_msgcount;
+	}
+
+	if (sample) {
+		/* bucket 0 is < 64 bytes */
+		stats->ips_size[ipc_port_stats_bucket(kmsg->ikm_header->msgh_size >> 5)]++;
+		stats->ips_sampled++;
+		kmsg->ikm_sample_time = mach_absolute_time();
+	}
+}
+
+/*
+ *	Routine:	ipc_port_stats_dequeue
+ *	Purpose:
+ *		Record the queueing latency of a sampled message
+ *		that is being handed to a receiver.
+ *	Conditions:
+ *		The mqueue is locked.
+ */
+void
+ipc_port_stats_dequeue(
+	ipc_mqueue_t            mqueue,
+	ipc_kmsg_t              kmsg)
+{
+	ipc_port_stats_t stats;
+	uint64_t ns;
+
+	if (kmsg->ikm_sample_time == 0) {
+		return;
+	}
+
+	stats = ip_from_mq(mqueue)->ip_stats;
+	if (stats != IPS_NULL) {
+		absolutetime_to_nanoseconds(mach_absolute_time() -
+		    kmsg->ikm_sample_time, &ns);
+		stats->ips_latency[ipc_port_stats_bucket(ns / NSEC_PER_USEC)]++;
+	}
+	kmsg->ikm_sample_time = 0;
+}
+
+/*
+ *	Routine:	ipc_port_stats_destroy
+ *	Purpose:
+ *		Free the statistics of a port that is being freed.
+ *	Conditions:
+ *		Nothing locked.
+ */
+void
+ipc_port_stats_destroy(
+	ipc_port_stats_t        stats)
+{
+	lck_spin_lock_grp(&ipc_port_stats_lock, &ipc_lck_grp);
+	remqueue(&stats->ips_link);
+	lck_spin_unlock(&ipc_port_stats_lock);
+
+	zfree(ipc_port_stats_zone, stats);
+}
+
+/*
+ *	Routine:	ipc_port_stats_get
+ *	Purpose:
+ *		Copy out one of the MACH_PORT_IPC_STATS,
+ *		MACH_PORT_IPC_LATENCY_HISTOGRAM and
+ *		MACH_PORT_IPC_SIZE_HISTOGRAM flavors.
+ *	Conditions:
+ *		The port is locked and active.
+ *	Returns:
+ *		KERN_SUCCESS		Copied out the flavor.
+ *		KERN_FAILURE		The buffer is too small.
+ */
+kern_return_t
+ipc_port_stats_get(
+	ipc_port_t              port,
+	int                     flavor,
+	mach_port_info_t        info,
+	mach_msg_type_number_t  *count)
+{
+	ipc_mqueue_t mqueue = &port->ip_messages;
+	ipc_port_stats_t stats;
+
+	if (flavor == MACH_PORT_IPC_STATS) {
+		mach_port_ipc_stats_t *mpis = (mach_port_ipc_stats_t *)info;
+
+		if (*count < MACH_PORT_IPC_STATS_COUNT) {
+			return KERN_FAILURE;
+		}
+
+		bzero(mpis, sizeof(*mpis));
+		mpis->mpis_sample_rate = ipc_port_stats_sample_rate;
+
+		imq_lock(mqueue);
+		stats = port->ip_stats;
+		if (stats != IPS_NULL) {
+			mpis->mpis_messages = stats->ips_messages;
+			mpis->mpis_sampled = stats->ips_sampled;
+			mpis->mpis_depth_max = stats->ips_depth_max;
+		}
+		imq_unlock(mqueue);
+
+		*count = MACH_PORT_IPC_STATS_COUNT;
+	} else {
+		mach_port_ipc_histogram_t *mpih = (mach_port_ipc_histogram_t *)info;
+
+		if (*count < MACH_PORT_IPC_HISTOGRAM_COUNT) {
+			return KERN_FAILURE;
+		}
+
+		bzero(mpih, sizeof(*mpih));
+
+		imq_lock(mqueue);
+		stats = port->ip_stats;
+		if (stats != IPS_NULL) {
+			bcopy(flavor == MACH_PORT_IPC_LATENCY_HISTOGRAM ?
+			    stats->ips_latency : stats->ips_size,
+			    mpih->mpih_buckets, sizeof(mpih->mpih_buckets));
+		}
+		imq_unlock(mqueue);
+
+		*count = MACH_PORT_IPC_HISTOGRAM_COUNT;
+	}
+
+	return KERN_SUCCESS;
+}
+
+/*
+ *	Routine:	ipc_port_stats_kdp_count
+ *	Purpose:
+ *		Return the number of ports with statistics,
+ *		or 0 if the list is being changed.
+ *	Conditions:
+ *		Called from stackshot, in debugger context.
+ */
+uint32_t
+ipc_port_stats_kdp_count(void)
+{
+	ipc_port_stats_t stats;
+	uint32_t count = 0;
+
+	if (kdp_lck_spin_is_acquired(&ipc_port_stats_lock)) {
+		return 0;
+	}
+
+	qe_foreach_element(stats, &ipc_port_stats_queue, ips_link) {
+		count++;
+	}
+	return count;
+}
+
+/*
+ *	Routine:	ipc_port_stats_kdp_snapshot
+ *	Purpose:
+ *		Fill in stackshot records for up to count ports
+ *		with statistics.  Returns the number filled in.
+ *	Conditions:
+ *		Called from stackshot, in debugger context.
+ */
+uint32_t
+ipc_port_stats_kdp_snapshot(
+	struct ipc_port_stats_snapshot *snaps,
+	uint32_t                count)
+{
+	ipc_port_stats_t stats;
+	uint32_t i = 0;
+
+	if (kdp_lck_spin_is_acquired(&ipc_port_stats_lock)) {
+		return 0;
+	}
+
+	qe_foreach_element(stats, &ipc_port_stats_queue, ips_link) {
+		struct ipc_port_stats_snapshot *snap = &snaps[i];
+		ipc_port_t port = stats->ips_port;
+
+		if (i == count) {
+			break;
+		}
+
+		snap->ipss_port = VM_KERNEL_UNSLIDE_OR_PERM(port);
+		snap->ipss_messages = stats->ips_messages;
+		snap->ipss_sampled = stats->ips_sampled;
+		snap->ipss_depth_max = stats->ips_depth_max;
+		memcpy(snap->ipss_latency, stats->ips_latency, sizeof(snap->ipss_latency));
+		memcpy(snap->ipss_size, stats->ips_size, sizeof(snap->ipss_size));
+
+		/* same conventions as kdp_mqueue_send_find_owner() */
+		snap->ipss_owner = 0;
+		snap->ipss_receiver_name = MACH_PORT_NULL;
+		if (ip_lock_held_kdp(port)) {
+			snap->ipss_owner = STACKSHOT_WAITOWNER_PORT_LOCKED;
+		} else if (!ip_active(port)) {
+			/* dying, leave no owner */
+		} else if (port->ip_receiver_name != MACH_PORT_NULL) {
+			snap->ipss_receiver_name = port->ip_receiver_name;
+			if (port->ip_receiver == ipc_space_kernel) {
+				snap->ipss_owner = STACKSHOT_WAITOWNER_KERNEL;
+			} else if (port->ip_receiver->is_task != TASK_NULL) {
+				snap->ipss_owner = pid_from_task(port->ip_receiver->is_task);
+			}
+		} else {
+			snap->ipss_owner = STACKSHOT_WAITOWNER_INTRANSIT;
+		}
+		i++;
+	}
+	return i;
+}
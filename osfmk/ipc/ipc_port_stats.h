@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+/*
+ *	File:	ipc/ipc_port_stats.h
+ *
+ *	Always-on, sampled message flow statistics for receive rights
+ *	(MACH_PORT_IPC_STATS and the histogram flavors).
+ */
+
+#ifndef _IPC_IPC_PORT_STATS_H_
+#define _IPC_IPC_PORT_STATS_H_
+
+#include <mach/port.h>
+#include <kern/queue.h>
+#include <ipc/ipc_types.h>
+
+struct ipc_port_stats {
+	queue_chain_t   ips_link;               /* on ipc_port_stats_queue */
+	ipc_port_t      ips_port;               /* back pointer, for stackshot */
+	uint64_t        ips_messages;           /* messages queued since allocation */
+	uint32_t        ips_sampled;            /* messages in the histograms */
+	uint32_t        ips_depth_max;          /* queue depth high-watermark */
+	uint32_t        ips_latency[MACH_PORT_IPC_HISTOGRAM_BUCKETS];
+	uint32_t        ips_size[MACH_PORT_IPC_HISTOGRAM_BUCKETS];
+};
+
+typedef struct ipc_port_stats *ipc_port_stats_t;
+
+#define IPS_NULL                ((ipc_port_stats_t) NULL)
+
+/* 1 in this many messages is sampled, 0 turns the statistics off */
+extern uint32_t ipc_port_stats_sample_rate;
+
+/* Set up the zone and the sample rate */
+extern void ipc_port_stats_init(void);
+
+/* Account for a message being queued on a port (mqueue locked) */
+extern void ipc_port_stats_post(
+	ipc_mqueue_t            mqueue,
+	ipc_kmsg_t              kmsg);
+
+/* Account for a message being handed to a receiver (mqueue locked) */
+extern void ipc_port_stats_dequeue(
+	ipc_mqueue_t            mqueue,
+	ipc_kmsg_t              kmsg);
+
+/* Free the statistics of a port being freed */
+extern void ipc_port_stats_destroy(
+	ipc_port_stats_t        stats);
+
+/* Copy out one of the MACH_PORT_IPC_* flavors (port locked) */
+extern kern_return_t ipc_port_stats_get(
+	ipc_port_t              port,
+	int                     flavor,
+	mach_port_info_t        info,
+	mach_msg_type_number_t  *count);
+
+struct ipc_port_stats_snapshot;
+
+/* Number of ports with statistics, for stackshot */
+extern uint32_t ipc_port_stats_kdp_count(void);
+
+/* Fill in up to count snapshots, returns how many were filled */
+extern uint32_t ipc_port_stats_kdp_snapshot(
+	struct ipc_port_stats_snapshot *snaps,
+	uint32_t                count);
+
+#endif  /* _IPC_IPC_PORT_STATS_H_ */
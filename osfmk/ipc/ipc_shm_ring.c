@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+/*
+ *	File:	ipc/ipc_shm_ring.c
+ *
+ *	Shared memory rings attached to receive rights.
+ *
+ *	Messages that carry no rights or out-of-line memory can be passed
+ *	between a sender and a receiver through a ring mapped in both
+ *	tasks, without allocating or queueing a kmsg.  The data path lives
+ *	entirely in user space (see <mach/shm_ring.h>); the kernel sets up
+ *	the memory, and provides a binary semaphore on the port to block
+ *	an idle receiver and wake it up when a sender finds it waiting.
+ */
+
+#include <mach/mach_types.h>
+#include <mach/kern_return.h>
+#include <mach/mach_traps.h>
+#include <mach/shm_ring.h>
+#include <mach/vm_map.h>
+
+#include <kern/kalloc.h>
+#include <kern/task.h>
+#include <kern/sched_prim.h>
+#include <kern/misc_protos.h>
+
+#include <vm/vm_map.h>
+#include <vm/vm_object.h>
+
+#include <ipc/ipc_port.h>
+#include <ipc/ipc_space.h>
+#include <ipc/ipc_shm_ring.h>
+
+/*
+ *	Routine:	ipc_shm_ring_create
+ *	Purpose:
+ *		Allocate a ring and its backing memory.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		The ring was allocated.
+ *		KERN_INVALID_VALUE	Bad geometry.
+ *		KERN_RESOURCE_SHORTAGE	Couldn't allocate memory.
+ */
+kern_return_t
+ipc_shm_ring_create(
+	mach_port_shm_ring_t    *info,
+	ipc_shm_ring_t          *ringp)
+{
+	uint32_t count = info->msr_entry_count;
+	ipc_shm_ring_t ring;
+	vm_object_t object;
+
+	if (info->msr_entry_size == 0 ||
+	    info->msr_entry_size > MACH_SHM_RING_ENTRY_SIZE_MAX ||
+	    count < 2 || count > MACH_SHM_RING_ENTRY_COUNT_MAX ||
+	    (count & (count - 1)) != 0 ||
+	    (info->msr_flags & ~MACH_PORT_SHM_RING_MPSC) != 0) {
+		return KERN_INVALID_VALUE;
+	}
+
+	ring = (ipc_shm_ring_t)kalloc(sizeof(*ring));
+	if (ring == ISR_NULL) {
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	ring->isr_size = round_page_64(MACH_SHM_RING_SIZE(info->msr_entry_size, count));
+	object = vm_object_allocate(ring->isr_size);
+	if (object == VM_OBJECT_NULL) {
+		kfree(ring, sizeof(*ring));
+		return KERN_RESOURCE_SHORTAGE;
+	}
+	/* the ring is shared, never copied */
+	object->copy_strategy = MEMORY_OBJECT_COPY_NONE;
+
+	ring->isr_object = object;
+	ring->isr_info = *info;
+	ring->isr_info.reserved = 0;
+	ring->isr_sender = TASK_NULL;
+	ring->isr_sender_addr = 0;
+	ring->isr_pending = FALSE;
+
+	*ringp = ring;
+	return KERN_SUCCESS;
+}
+
+/*
+ *	Routine:	ipc_shm_ring_destroy
+ *	Purpose:
+ *		Free a ring when its port goes away.  Tasks that
+ *		mapped the ring hold their own reference on the
+ *		backing memory.
+ *	Conditions:
+ *		Nothing locked.
+ */
+void
+ipc_shm_ring_destroy(
+	ipc_shm_ring_t          ring)
+{
+	if (ring->isr_sender != TASK_NULL) {
+		task_deallocate(ring->isr_sender);
+	}
+	vm_object_deallocate(ring->isr_object);
+	kfree(ring, sizeof(*ring));
+}
+
+/*
+ *	Routine:	ipc_shm_ring_wakeup_all
+ *	Purpose:
+ *		Wake up every receiver blocked on the ring, so they
+ *		notice that the port was destroyed or moved.
+ *	Conditions:
+ *		The port is locked.
+ */
+void
+ipc_shm_ring_wakeup_all(
+	ipc_shm_ring_t          ring)
+{
+	thread_wakeup((event_t)&ring->isr_pending);
+}
+
+/*
+ *	Routine:	ipc_shm_ring_sender_gone
+ *	Purpose:
+ *		Whether the sender task that mapped an SPSC ring at
+ *		addr has since exited or unmapped it, so that another
+ *		sender may map the ring.
+ *	Conditions:
+ *		Nothing locked.
+ */
+static boolean_t
+ipc_shm_ring_sender_gone(
+	ipc_shm_ring_t          ring,
+	task_t                  task,
+	mach_vm_offset_t        addr)
+{
+	vm_map_entry_t entry;
+	boolean_t gone = TRUE;
+	vm_map_t map;
+
+	map = get_task_map_reference(task);
+	if (map == VM_MAP_NULL) {
+		return TRUE;
+	}
+	vm_map_lock_read(map);
+	if (vm_map_lookup_entry(map, addr, &entry) && !entry->is_sub_map &&
+	    VME_OBJECT(entry) == ring->isr_object) {
+		gone = FALSE;
+	}
+	vm_map_unlock_read(map);
+	vm_map_deallocate(map);
+	return gone;
+}
+
+/*
+ *	Routine:	mach_port_shm_ring_map_trap [mach trap]
+ *	Purpose:
+ *		Map the ring attached to a port into the current task,
+ *		and copy out its address and geometry.  The receiver
+ *		maps it through its receive right, senders through a
+ *		send right.  Only one sender task at a time may map a
+ *		MACH_PORT_SHM_RING_SPSC ring: another may once that one
+ *		has exited or unmapped it.  Which threads of that task
+ *		send is up to the task, the kernel can't see them.
+ *
+ *		The geometry is returned out of band rather than in the
+ *		ring, which every sender can write, so that the inline
+ *		helpers never compute an address from shared memory.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		The address and geometry are copied out.
+ *		KERN_INVALID_NAME	The name doesn't denote a right.
+ *		KERN_INVALID_RIGHT	Name doesn't denote a port right.
+ *		KERN_INVALID_ARGUMENT	The port has no ring.
+ *		KERN_NO_ACCESS		SPSC ring already has a sender.
+ *		KERN_NO_SPACE		No room in the address space.
+ *		KERN_INVALID_ADDRESS	Couldn't copy out the address.
+ */
+kern_return_t
+mach_port_shm_ring_map_trap(
+	struct mach_port_shm_ring_map_trap_args *args)
+{
+	ipc_space_t space = current_space();
+	vm_map_t map = current_map();
+	task_t task = current_task();
+	mach_vm_offset_t addr = 0;
+	mach_port_shm_ring_t info;
+	boolean_t spsc_sender = FALSE;
+	task_t checked = TASK_NULL, stale = TASK_NULL;
+	ipc_shm_ring_t ring;
+	vm_object_t object;
+	uint64_t size;
+	ipc_port_t port;
+	kern_return_t kr;
+
+	kr = ipc_port_translate_receive(space, args->name, &port);
+	if (kr != KERN_SUCCESS) {
+		kr = ipc_port_translate_send(space, args->name, &port);
+		if (kr != KERN_SUCCESS) {
+			return kr;
+		}
+		spsc_sender = TRUE;
+	}
+	/* port is locked and active */
+	ip_reference(port);
+
+	ring = port->ip_shm_ring;
+	if (ring == ISR_NULL) {
+		ip_unlock(port);
+		ip_release(port);
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	if (ring->isr_info.msr_flags & MACH_PORT_SHM_RING_MPSC) {
+		spsc_sender = FALSE;
+	} else if (spsc_sender && ring->isr_sender != TASK_NULL) {
+		task_t sender = ring->isr_sender;
+		mach_vm_offset_t sender_addr = ring->isr_sender_addr;
+		boolean_t gone;
+
+		/* a zero address means that sender is still mapping the ring */
+		if (sender_addr == 0) {
+			ip_unlock(port);
+			ip_release(port);
+			return KERN_NO_ACCESS;
+		}
+		task_reference(sender);
+		ip_unlock(port);
+		gone = ipc_shm_ring_sender_gone(ring, sender, sender_addr);
+		ip_lock(port);
+		if (gone && ring->isr_sender == sender &&
+		    ring->isr_sender_addr == sender_addr) {
+			ring->isr_sender = TASK_NULL;
+			ring->isr_sender_addr = 0;
+			stale = sender;
+		}
+		/* drop our reference once the port is unlocked */
+		checked = sender;
+		if (ring->isr_sender != TASK_NULL || !ip_active(port)) {
+			ip_unlock(port);
+			kr = KERN_NO_ACCESS;
+			goto done;
+		}
+	}
+	if (spsc_sender) {
+		task_reference(task);
+		ring->isr_sender = task;
+		ring->isr_sender_addr = 0;
+	}
+
+	object = ring->isr_object;
+	vm_object_reference(object);
+	size = ring->isr_size;
+	info = ring->isr_info;
+	ip_unlock(port);
+
+	kr = vm_map_enter(map, &addr, size, 0, VM_FLAGS_ANYWHERE,
+	    VM_MAP_KERNEL_FLAGS_NONE, VM_MEMORY_MACH_MSG, object, 0, FALSE,
+	    VM_PROT_READ | VM_PROT_WRITE, VM_PROT_READ | VM_PROT_WRITE,
+	    VM_INHERIT_NONE);
+	if (kr != KERN_SUCCESS) {
+		vm_object_deallocate(object);
+		goto out;
+	}
+	/* the mapping owns the object reference now */
+
+	if (copyout(&info, args->info, sizeof(info)) ||
+	    copyout(&addr, args->address, sizeof(addr))) {
+		(void)vm_map_remove(map, addr, addr + size, VM_MAP_REMOVE_NO_FLAGS);
+		kr = KERN_INVALID_ADDRESS;
+	}
+
+out:
+	if (spsc_sender) {
+		ip_lock(port);
+		if (kr == KERN_SUCCESS) {
+			ring->isr_sender_addr = addr;
+		} else {
+			ring->isr_sender = TASK_NULL;
+		}
+		ip_unlock(port);
+		if (kr != KERN_SUCCESS) {
+			task_deallocate(task);
+		}
+	}
+done:
+	ip_release(port);
+	if (checked != TASK_NULL) {
+		task_deallocate(checked);
+	}
+	if (stale != TASK_NULL) {
+		/* the ring's reference on the sender that went away */
+		task_deallocate(stale);
+	}
+	return kr;
+}
+
+/*
+ *	Routine:	mach_port_shm_ring_wait_trap [mach trap]
+ *	Purpose:
+ *		Block the receiver of a ring until a sender signals it,
+ *		or until the timeout (in milliseconds) expires.  A signal
+ *		sent while nobody waits is remembered, so a receiver can
+ *		set msr_waiting, check the ring one last time and then
+ *		call this without losing a wakeup.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		Signalled (possibly spuriously).
+ *		KERN_OPERATION_TIMED_OUT
+ *		KERN_ABORTED		The wait was interrupted.
+ *		KERN_TERMINATED		The port was destroyed or moved.
+ *		KERN_INVALID_ARGUMENT	The port has no ring.
+ */
+kern_return_t
+mach_port_shm_ring_wait_trap(
+	struct mach_port_shm_ring_wait_trap_args *args)
+{
+	ipc_space_t space = current_space();
+	mach_msg_timeout_t timeout = args->timeout;
+	wait_result_t wresult;
+	ipc_shm_ring_t ring;
+	ipc_port_t port;
+	kern_return_t kr;
+
+	kr = ipc_port_translate_receive(space, args->name, &port);
+	if (kr != KERN_SUCCESS) {
+		return kr;
+	}
+	/* port is locked and active */
+
+	ring = port->ip_shm_ring;
+	if (ring == ISR_NULL) {
+		ip_unlock(port);
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	if (ring->isr_pending) {
+		ring->isr_pending = FALSE;
+		ip_unlock(port);
+		return KERN_SUCCESS;
+	}
+
+	if (timeout != MACH_MSG_TIMEOUT_NONE) {
+		wresult = assert_wait_timeout((event_t)&ring->isr_pending,
+		    THREAD_ABORTSAFE, timeout, 1000 * NSEC_PER_USEC);
+	} else {
+		wresult = assert_wait((event_t)&ring->isr_pending, THREAD_ABORTSAFE);
+	}
+	ip_reference(port);
+	ip_unlock(port);
+
+	if (wresult == THREAD_WAITING) {
+		wresult = thread_block(THREAD_CONTINUE_NULL);
+	}
+
+	ip_lock(port);
+	if (!ip_active(port) || port->ip_receiver != space) {
+		kr = KERN_TERMINATED;
+	} else if (ring->isr_pending) {
+		/* consume the signal even if we also timed out */
+		ring->isr_pending = FALSE;
+		kr = KERN_SUCCESS;
+	} else if (wresult == THREAD_TIMED_OUT) {
+		kr = KERN_OPERATION_TIMED_OUT;
+	} else if (wresult == THREAD_INTERRUPTED) {
+		kr = KERN_ABORTED;
+	} else {
+		kr = KERN_SUCCESS;
+	}
+	ip_unlock(port);
+	ip_release(port);
+
+	return kr;
+}
+
+/*
+ *	Routine:	mach_port_shm_ring_signal_trap [mach trap]
+ *	Purpose:
+ *		Wake up the receiver of a ring, or leave a pending
+ *		signal for its next wait if it is not blocked yet.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		The receiver was signalled.
+ *		KERN_INVALID_ARGUMENT	The port has no ring.
+ */
+kern_return_t
+mach_port_shm_ring_signal_trap(
+	struct mach_port_shm_ring_signal_trap_args *args)
+{
+	ipc_space_t space = current_space();
+	ipc_shm_ring_t ring;
+	ipc_port_t port;
+	kern_return_t kr;
+
+	kr = ipc_port_translate_send(space, args->name, &port);
+	if (kr != KERN_SUCCESS) {
+		return kr;
+	}
+	/* port is locked and active */
+
+	ring = port->ip_shm_ring;
+	if (ring == ISR_NULL) {
+		ip_unlock(port);
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	ring->isr_pending = TRUE;
+	thread_wakeup_one((event_t)&ring->isr_pending);
+	ip_unlock(port);
+
+	return KERN_SUCCESS;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+/*
+ *	File:	ipc/ipc_shm_ring.h
+ *
+ *	Shared memory rings attached to receive rights
+ *	(MACH_PORT_SHM_RING), see <mach/shm_ring.h>.
+ */
+
+#ifndef _IPC_IPC_SHM_RING_H_
+#define _IPC_IPC_SHM_RING_H_
+
+#include <mach/port.h>
+#include <mach/kern_return.h>
+#include <ipc/ipc_types.h>
+
+struct vm_object;
+
+struct ipc_shm_ring {
+	struct vm_object        *isr_object;    /* backing memory, mapped by the traps */
+	uint64_t                isr_size;
+	mach_port_shm_ring_t    isr_info;
+	struct task             *isr_sender;    /* SPSC sender task that mapped the ring, referenced */
+	mach_vm_offset_t        isr_sender_addr; /* where it mapped it, 0 while mapping */
+	boolean_t               isr_pending;    /* signalled with no waiter, port locked */
+};
+
+typedef struct ipc_shm_ring *ipc_shm_ring_t;
+
+#define ISR_NULL                ((ipc_shm_ring_t) NULL)
+
+/* Allocate a ring with the given geometry */
+extern kern_return_t ipc_shm_ring_create(
+	mach_port_shm_ring_t    *info,
+	ipc_shm_ring_t          *ringp);
+
+/* Free a ring (the port is gone, mappings keep their own memory ref) */
+extern void ipc_shm_ring_destroy(
+	ipc_shm_ring_t          ring);
+
+/* Wake up all the receivers blocked on a ring (port locked) */
+extern void ipc_shm_ring_wakeup_all(
+	ipc_shm_ring_t          ring);
+
+#endif  /* _IPC_IPC_SHM_RING_H_ */
@@ -86,6 +86,14 @@
 #include <prng/random.h>
 #include <string.h>
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <i386/mp.h>
+#endif
+
+#if defined (__arm__) || defined (__arm64__)
+#include <arm/cpu_data_internal.h>
+#endif
+
 /* Remove this in the future so port names are less predictable. */
 #define CONFIG_SEMI_RANDOM_ENTRIES
 #ifdef CONFIG_SEMI_RANDOM_ENTRIES
@@ -96,6 +104,18 @@ zone_t ipc_space_zone;
 ipc_space_t ipc_space_kernel;
 ipc_space_t ipc_space_reply;
 
+/*
+ *	Lockless table readers publish the epoch they started in on
+ *	their own cpu's line, so they never write memory shared with
+ *	other cpus.  Retiring a table advances the epoch; the table can
+ *	be freed once no cpu is still in an older one.
+ */
+static uint64_t ipc_space_epoch = 1;
+
+static struct ipc_space_reader {
+	uint64_t        isr_epoch;      /* 0 when no lockless reader runs */
+} __attribute__((aligned(128))) ipc_space_readers[MAX_CPUS];
+
 /*
  *	Routine:	ipc_space_reference
  *	Routine:	ipc_space_release
@@ -274,6 +294,8 @@ ipc_space_create(
 	space->is_low_mod = new_size;
 	space->is_high_mod = 0;
 	space->is_node_id = HOST_LOCAL_NODE; /* HOST_LOCAL_NODE, except proxy spaces */
+	space->is_table_retired = IE_NULL;
+	space->is_table_retired_epoch = 0;
 
 	*spacep = space;
 	return KERN_SUCCESS;
@@ -314,11 +336,144 @@ ipc_space_create_special(
 	space->is_low_mod    = 0;
 	space->is_high_mod   = 0;
 	space->is_node_id = HOST_LOCAL_NODE; /* HOST_LOCAL_NODE, except proxy spaces */
+	space->is_table_retired = IE_NULL;
+	space->is_table_retired_epoch = 0;
 
 	*spacep = space;
 	return KERN_SUCCESS;
 }
 
+/*
+ *	Routine:	ipc_space_retire_table
+ *	Purpose:
+ *		Queue a table that is no longer the space's is_table
+ *		to be freed once lockless lookups can no longer be
+ *		reading from it.
+ *
+ *		Index 0 of a table never names a right, so the first
+ *		entry is reused to link the table and remember its size.
+ *	Conditions:
+ *		The space is write-locked, or inactive and only
+ *		touched by its last user.
+ */
+void
+ipc_space_retire_table(
+	ipc_space_t     space,
+	ipc_entry_t     table,
+	ipc_entry_num_t size)
+{
+	table[0].ie_object = (ipc_object_t)space->is_table_retired;
+	table[0].ie_next = size;
+	space->is_table_retired = table;
+	/* readers that start in a later epoch find the new table */
+	space->is_table_retired_epoch = os_atomic_inc_orig(&ipc_space_epoch, release);
+}
+
+/*
+ *	Routine:	ipc_space_reader_enter
+ *	Purpose:
+ *		Start reading a space's table without its lock.
+ *		Tables retired from now on are not freed until the
+ *		matching ipc_space_reader_exit.
+ *	Conditions:
+ *		Nothing locked.  Returns with preemption disabled.
+ */
+void
+ipc_space_reader_enter(void)
+{
+	struct ipc_space_reader *isr;
+
+	disable_preemption();
+	isr = &ipc_space_readers[cpu_number()];
+	os_atomic_store(&isr->isr_epoch,
+	    os_atomic_load(&ipc_space_epoch, acquire), relaxed);
+	/* pairs with the fence in ipc_space_reclaim_retired_tables() */
+	os_atomic_thread_fence(seq_cst);
+}
+
+/*
+ *	Routine:	ipc_space_reader_exit
+ *	Purpose:
+ *		Done reading a table entered with ipc_space_reader_enter.
+ *	Conditions:
+ *		Preemption disabled by ipc_space_reader_enter.
+ */
+void
+ipc_space_reader_exit(void)
+{
+	os_atomic_store(&ipc_space_readers[cpu_number()].isr_epoch, 0, release);
+	enable_preemption();
+}
+
+/*
+ *	Routine:	ipc_space_free_retired_tables
+ *	Purpose:
+ *		Free the tables queued by ipc_space_retire_table.
+ *	Conditions:
+ *		The last reference on the space is being dropped.
+ */
+void
+ipc_space_free_retired_tables(
+	ipc_space_t     space)
+{
+	ipc_space_free_table_list(space->is_table_retired);
+	space->is_table_retired = IE_NULL;
+}
+
+/*
+ *	Routine:	ipc_space_reclaim_retired_tables
+ *	Purpose:
+ *		Take the tables queued by ipc_space_retire_table,
+ *		unless a cpu is still running a lockless lookup that
+ *		started before the newest of them was retired.  A lookup
+ *		that starts after this check finds the current table,
+ *		which was published first.
+ *	Conditions:
+ *		The space is write-locked.
+ *	Returns:
+ *		The tables, for ipc_space_free_table_list once the
+ *		space is unlocked, or IE_NULL.
+ */
+ipc_entry_t
+ipc_space_reclaim_retired_tables(
+	ipc_space_t     space)
+{
+	ipc_entry_t list;
+	uint64_t epoch;
+	unsigned int cpu;
+
+	/* pairs with the fence in ipc_space_reader_enter() */
+	os_atomic_thread_fence(seq_cst);
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		epoch = os_atomic_load(&ipc_space_readers[cpu].isr_epoch, relaxed);
+		if (epoch != 0 && epoch <= space->is_table_retired_epoch) {
+			return IE_NULL;
+		}
+	}
+	list = space->is_table_retired;
+	space->is_table_retired = IE_NULL;
+	return list;
+}
+
+/*
+ *	Routine:	ipc_space_free_table_list
+ *	Purpose:
+ *		Free a chain of retired tables.
+ *	Conditions:
+ *		Nothing locked, or the space is being freed.
+ */
+void
+ipc_space_free_table_list(
+	ipc_entry_t     list)
+{
+	ipc_entry_t table, next;
+
+	for (table = list; table != IE_NULL; table = next) {
+		next = (ipc_entry_t)table[0].ie_object;
+		ipc_table_free(table[0].ie_next * sizeof(struct ipc_entry), table);
+	}
+}
+
 /*
  * ipc_space_clean - remove all port references from an ipc space.
  *
@@ -439,7 +594,11 @@ ipc_space_terminate(
 		}
 	}
 
-	it_entries_free(space->is_table_next - 1, table);
+	/*
+	 *	Lockless lookups may still be looking at the table,
+	 *	so it is only freed along with the space.
+	 */
+	ipc_space_retire_table(space, table, size);
 	space->is_table_size = 0;
 	space->is_table_free = 0;
 
@@ -86,6 +86,7 @@
 #include <kern/macro_help.h>
 #include <kern/kern_types.h>
 #include <kern/locks.h>
+#include <machine/atomic.h>
 #include <kern/task.h>
 #include <kern/zalloc.h>
 #include <ipc/ipc_entry.h>
@@ -104,6 +105,16 @@
  *	that need it grown wait for the first.  We do almost all the
  *	work with the space unlocked, so lookups proceed pretty much
  *	unaffected while the grow operation is underway.
+ *
+ *	Read-only queries can look at an entry without taking the lock
+ *	(see ipc_entry_lookup_snapshot).  Such readers load is_table_size
+ *	before is_table, and a grow publishes the new table before the
+ *	new size, so a reader never pairs a size with a smaller table.
+ *	Because they may still be looking at a table after it has been
+ *	replaced, old tables are kept on is_table_retired, stamped with
+ *	the reader epoch they were retired in (is_table_retired_epoch),
+ *	and freed by a later grow once every cpu is past that epoch
+ *	(see ipc_space_reader_enter), or with the space itself.
  */
 
 typedef natural_t ipc_space_refs_t;
@@ -126,6 +137,8 @@ struct ipc_space {
 	struct bool_gen bool_gen;       /* state for boolean RNG */
 	unsigned int is_entropy[IS_ENTROPY_CNT]; /* pool of entropy taken from RNG */
 	int is_node_id;                 /* HOST_LOCAL_NODE, or remote node if proxy space */
+	ipc_entry_t is_table_retired;   /* replaced tables, see above */
+	uint64_t is_table_retired_epoch;/* reader epoch of the newest one */
 };
 
 #define IS_NULL                 ((ipc_space_t) 0)
@@ -202,6 +215,30 @@ is_reference(ipc_space_t is)
 }
 
 
+/* Free the tables replaced while the space was alive */
+extern void ipc_space_free_retired_tables(
+	ipc_space_t     space);
+
+/* Start a lockless look at a space's table, with preemption disabled */
+extern void ipc_space_reader_enter(void);
+
+/* End a lockless look started with ipc_space_reader_enter */
+extern void ipc_space_reader_exit(void);
+
+/* Take the replaced tables if no lockless reader can be using them */
+extern ipc_entry_t ipc_space_reclaim_retired_tables(
+	ipc_space_t     space);
+
+/* Free tables taken with ipc_space_reclaim_retired_tables */
+extern void ipc_space_free_table_list(
+	ipc_entry_t     list);
+
+/* Keep a replaced table around until the space is freed */
+extern void ipc_space_retire_table(
+	ipc_space_t     space,
+	ipc_entry_t     table,
+	ipc_entry_num_t size);
+
 static inline void
 is_release(ipc_space_t is)
 {
@@ -210,6 +247,7 @@ is_release(ipc_space_t is)
 	/* If we just removed the last reference count */
 	if (1 == (OSDecrementAtomic(&(is->is_bits)) & IS_REFS_MAX)) {
 		assert(!is_active(is));
+		ipc_space_free_retired_tables(is);
 		is_lock_destroy(is);
 		is_free(is);
 	}
@@ -82,6 +82,21 @@ typedef struct ipc_importance_task *ipc_importance_task_t;
 typedef struct ipc_importance_inherit *ipc_importance_inherit_t;
 #define III_NULL        ((ipc_importance_inherit_t)0)
 
+/*
+ * One entry of the per-thread cache of voucher transformations done by
+ * ipc_voucher_send_preprocessing() and ipc_voucher_receive_postprocessing().
+ */
+struct ipc_voucher_cache {
+	struct ipc_voucher      *ivc_in;        /* voucher found in the message */
+	struct ipc_voucher      *ivc_out;       /* voucher it was replaced with */
+	uint32_t                ivc_gen;        /* ipc_voucher_generation at the time */
+	boolean_t               ivc_app;        /* task_is_app() of the thread's task */
+};
+
+#define IVC_SEND        0
+#define IVC_RECEIVE     1
+#define IVC_COUNT       2
+
 
 #else   /* MACH_KERNEL_PRIVATE */
 
@@ -35,8 +35,11 @@
 #include <kern/ipc_kobject.h>
 #include <kern/ipc_tt.h>
 #include <kern/mach_param.h>
+#include <kern/thread.h>
 #include <kern/kalloc.h>
+#include <kern/policy_internal.h>
 #include <kern/zalloc.h>
+#include <machine/atomic.h>
 
 #include <libkern/OSAtomic.h>
 
@@ -96,6 +99,13 @@ static lck_spin_t ivgt_lock_data;
 #define ivgt_unlock() \
 	lck_spin_unlock(&ivgt_lock_data)
 
+/*
+ * Changes whenever an attribute manager is registered or goes away,
+ * which invalidates the processing flags cached in the vouchers and
+ * the per-thread voucher caches.
+ */
+static uint32_t ipc_voucher_generation = 1;
+
 ipc_voucher_t iv_alloc(iv_index_t entries);
 void iv_dealloc(ipc_voucher_t iv, boolean_t unhash);
 
@@ -247,6 +257,8 @@ iv_alloc(iv_index_t entries)
 	iv->iv_sum = 0;
 	iv->iv_hash = 0;
 	iv->iv_port = IP_NULL;
+	iv->iv_proc_cache = 0;
+	iv->iv_values_cached = 0;
 
 	if (entries > IV_ENTRIES_INLINE) {
 		iv_entry_t table;
@@ -606,6 +618,7 @@ ivac_dealloc(ipc_voucher_attr_control_t ivac)
 		iv_global_table[key_index].ivgte_manager = IVAM_NULL;
 		iv_global_table[key_index].ivgte_control = IVAC_NULL;
 		iv_global_table[key_index].ivgte_key = MACH_VOUCHER_ATTR_KEY_NONE;
+		os_atomic_inc(&ipc_voucher_generation, relaxed);
 	}
 	ivgt_unlock();
 
@@ -771,6 +784,44 @@ ivace_lookup_values(
 	*count = 1;
 }
 
+/*
+ *  iv_lookup_values - Look up the value(s) a voucher holds for a key
+ *
+ *	Same as ivace_lookup_values() on iv_lookup(iv, key_index), but
+ *	remembers the value in the voucher so that later lookups do not
+ *	take the attribute control lock.
+ *
+ *  Conditions:	Caller holds a reference on the voucher.
+ */
+static void
+iv_lookup_values(
+	ipc_voucher_t                           iv,
+	iv_index_t                              key_index,
+	mach_voucher_attr_value_handle_array_t          values,
+	mach_voucher_attr_value_handle_array_size_t     *count)
+{
+	iv_index_t value_index = iv_lookup(iv, key_index);
+	uint32_t bit;
+
+	if (IV_UNUSED_VALINDEX == value_index || IV_ENTRIES_INLINE <= key_index) {
+		ivace_lookup_values(key_index, value_index, values, count);
+		return;
+	}
+
+	bit = 1u << key_index;
+	if (os_atomic_load(&iv->iv_values_cached, acquire) & bit) {
+		values[0] = iv->iv_values[key_index];
+		*count = 1;
+		return;
+	}
+
+	ivace_lookup_values(key_index, value_index, values, count);
+
+	/* racing lookups store the same value */
+	iv->iv_values[key_index] = values[0];
+	os_atomic_or(&iv->iv_values_cached, bit, release);
+}
+
 /*
  *  ivac_grow_table - Allocate a bigger table of attribute values
  *
@@ -1180,7 +1231,6 @@ ipc_replace_voucher_value(
 	ipc_voucher_t new_value_voucher;
 	ipc_voucher_attr_manager_t ivam;
 	ipc_voucher_attr_control_t ivac;
-	iv_index_t prev_val_index;
 	iv_index_t save_val_index;
 	iv_index_t val_index;
 	iv_index_t key_index;
@@ -1205,11 +1255,13 @@ ipc_replace_voucher_value(
 	 * Otherwise, they come from the intermediate values already
 	 * in the forming voucher.
 	 */
-	prev_val_index = (IV_NULL != prev_voucher) ?
-	    iv_lookup(prev_voucher, key_index) :
-	    save_val_index;
-	ivace_lookup_values(key_index, prev_val_index,
-	    previous_vals, &previous_vals_count);
+	if (IV_NULL != prev_voucher) {
+		iv_lookup_values(prev_voucher, key_index,
+		    previous_vals, &previous_vals_count);
+	} else {
+		ivace_lookup_values(key_index, save_val_index,
+		    previous_vals, &previous_vals_count);
+	}
 
 	/* Call out to resource manager to get new value */
 	new_value_voucher = IV_NULL;
@@ -1933,6 +1985,7 @@ ipc_register_well_known_mach_voucher_attr_manager(
 	iv_global_table[key_index].ivgte_manager = manager;
 	iv_global_table[key_index].ivgte_control = new_control;
 	iv_global_table[key_index].ivgte_key = key;
+	os_atomic_inc(&ipc_voucher_generation, relaxed);
 
 	/* insert the default value into the hash (in case it is returned later) */
 	hash_index = iv_hash_value(key_index, default_value);
@@ -2335,7 +2388,7 @@ mach_voucher_attr_control_get_values(
 	mach_voucher_attr_value_handle_array_t out_values,
 	mach_voucher_attr_value_handle_array_size_t *in_out_size)
 {
-	iv_index_t key_index, value_index;
+	iv_index_t key_index;
 
 	if (IPC_VOUCHER_ATTR_CONTROL_NULL == control) {
 		return KERN_INVALID_CAPABILITY;
@@ -2352,9 +2405,7 @@ mach_voucher_attr_control_get_values(
 	key_index = control->ivac_key_index;
 
 	assert(os_ref_get_count(&voucher->iv_refs) > 0);
-	value_index = iv_lookup(voucher, key_index);
-	ivace_lookup_values(key_index, value_index,
-	    out_values, in_out_size);
+	iv_lookup_values(voucher, key_index, out_values, in_out_size);
 	return KERN_SUCCESS;
 }
 
@@ -2660,6 +2711,141 @@ ipc_get_pthpriority_from_kmsg_voucher(
 }
 
 
+/*
+ *	Routine:	iv_processing_flags
+ *	Purpose:
+ *		Tell whether any attribute of the voucher belongs to a
+ *		manager that wants send preprocessing or receive
+ *		postprocessing, without walking the voucher and the
+ *		global table on every message.
+ *	Returns:
+ *		IV_PROC_* flags.
+ */
+static uint32_t
+iv_processing_flags(ipc_voucher_t voucher, uint32_t gen)
+{
+	uint64_t cache = os_atomic_load(&voucher->iv_proc_cache, relaxed);
+	uint32_t flags = IV_PROC_VALID;
+	iv_index_t key_index;
+
+	if ((cache & IV_PROC_VALID) && (uint32_t)(cache >> 32) == gen) {
+		return (uint32_t)cache;
+	}
+
+	for (key_index = 0; key_index < voucher->iv_table_size; key_index++) {
+		ipc_voucher_attr_manager_t manager;
+
+		if (IV_UNUSED_VALINDEX == iv_lookup(voucher, key_index)) {
+			continue;
+		}
+
+		ivgt_lookup(key_index, FALSE, &manager, NULL);
+		if (IVAM_NULL == manager) {
+			continue;
+		}
+
+		if (manager->ivam_flags & IVAM_FLAGS_SUPPORT_SEND_PREPROCESS) {
+			flags |= IV_PROC_SEND_PREPROCESS;
+		}
+		if (manager->ivam_flags & IVAM_FLAGS_SUPPORT_RECEIVE_POSTPROCESS) {
+			flags |= IV_PROC_RECEIVE_POSTPROCESS;
+		}
+	}
+
+	/* racing threads compute the same flags */
+	os_atomic_store(&voucher->iv_proc_cache, ((uint64_t)gen << 32) | flags, relaxed);
+	return flags;
+}
+
+/*
+ *	Routine:	ipc_voucher_cache_lookup
+ *	Purpose:
+ *		Find the voucher the current thread last replaced `in`
+ *		with, in the given direction (IVC_SEND or IVC_RECEIVE).
+ *
+ *		What the attribute managers return when processing a
+ *		voucher only depends on the voucher, on the current
+ *		task, which a thread never changes, and on whether that
+ *		task is an app (the bank manager then uses the current
+ *		thread group).  The cache holds references on both
+ *		vouchers, so a hit cannot be an address reused by
+ *		another voucher.
+ *
+ *		An entry from an older ipc_voucher_generation can never
+ *		hit again: drop it instead of keeping its vouchers (and
+ *		the bank references they hold) alive.
+ *	Returns:
+ *		A reference on the cached voucher, or IV_NULL.
+ */
+static ipc_voucher_t
+ipc_voucher_cache_lookup(int which, ipc_voucher_t in, uint32_t gen, boolean_t app)
+{
+	struct ipc_voucher_cache *ivc = &current_thread()->ith_voucher_cache[which];
+
+	if (ivc->ivc_in != in || ivc->ivc_gen != gen || ivc->ivc_app != app) {
+		if (IV_NULL != ivc->ivc_in && ivc->ivc_gen != gen) {
+			ipc_voucher_release(ivc->ivc_in);
+			ipc_voucher_release(ivc->ivc_out);
+			ivc->ivc_in = IV_NULL;
+			ivc->ivc_out = IV_NULL;
+		}
+		return IV_NULL;
+	}
+	ipc_voucher_reference(ivc->ivc_out);
+	return ivc->ivc_out;
+}
+
+/*
+ *	Routine:	ipc_voucher_cache_enter
+ *	Purpose:
+ *		Remember that the current thread replaced `in` with `out`.
+ *	Conditions:
+ *		Nothing locked, may release the previous entry's vouchers.
+ */
+static void
+ipc_voucher_cache_enter(int which, ipc_voucher_t in, ipc_voucher_t out,
+    uint32_t gen, boolean_t app)
+{
+	struct ipc_voucher_cache *ivc = &current_thread()->ith_voucher_cache[which];
+	ipc_voucher_t old_in = ivc->ivc_in;
+	ipc_voucher_t old_out = ivc->ivc_out;
+
+	ipc_voucher_reference(in);
+	ipc_voucher_reference(out);
+	ivc->ivc_in = in;
+	ivc->ivc_out = out;
+	ivc->ivc_gen = gen;
+	ivc->ivc_app = app;
+
+	if (IV_NULL != old_in) {
+		ipc_voucher_release(old_in);
+		ipc_voucher_release(old_out);
+	}
+}
+
+/*
+ *	Routine:	ipc_voucher_cache_flush
+ *	Purpose:
+ *		Drop the voucher references held by a thread's cache.
+ *	Conditions:
+ *		The thread is terminating or being deallocated, or is
+ *		the current thread.
+ */
+void
+ipc_voucher_cache_flush(thread_t thread)
+{
+	for (int i = 0; i < IVC_COUNT; i++) {
+		struct ipc_voucher_cache *ivc = &thread->ith_voucher_cache[i];
+
+		if (IV_NULL != ivc->ivc_in) {
+			ipc_voucher_release(ivc->ivc_in);
+			ipc_voucher_release(ivc->ivc_out);
+			ivc->ivc_in = IV_NULL;
+			ivc->ivc_out = IV_NULL;
+		}
+	}
+}
+
 /*
  *	Routine:	ipc_voucher_send_preprocessing
  *	Purpose:
@@ -2677,14 +2863,31 @@ ipc_voucher_send_preprocessing(ipc_kmsg_t kmsg)
 	ipc_voucher_t voucher_to_send;
 	kern_return_t kr;
 	int need_preprocessing = FALSE;
+	uint32_t gen;
+	boolean_t app;
 
 	if (!IP_VALID(kmsg->ikm_voucher) || current_task() == kernel_task) {
 		return;
 	}
 
-	/* setup recipe for preprocessing of all the attributes. */
 	pre_processed_voucher = (ipc_voucher_t)kmsg->ikm_voucher->ip_kobject;
 
+	gen = os_atomic_load(&ipc_voucher_generation, relaxed);
+	if ((iv_processing_flags(pre_processed_voucher, gen) &
+	    IV_PROC_SEND_PREPROCESS) == 0) {
+		return;
+	}
+
+	app = task_is_app(current_task());
+	voucher_to_send = ipc_voucher_cache_lookup(IVC_SEND,
+	    pre_processed_voucher, gen, app);
+	if (IV_NULL != voucher_to_send) {
+		ipc_port_release_send(kmsg->ikm_voucher);
+		kmsg->ikm_voucher = convert_voucher_to_port(voucher_to_send);
+		return;
+	}
+
+	/* setup recipe for preprocessing of all the attributes. */
 	kr = ipc_voucher_prepare_processing_recipe(pre_processed_voucher,
 	    (mach_voucher_attr_raw_recipe_array_t)recipes,
 	    &recipe_size, MACH_VOUCHER_ATTR_SEND_PREPROCESS,
@@ -2699,6 +2902,8 @@ ipc_voucher_send_preprocessing(ipc_kmsg_t kmsg)
 		    recipe_size,
 		    &voucher_to_send);
 		assert(KERN_SUCCESS == kr);
+		ipc_voucher_cache_enter(IVC_SEND, pre_processed_voucher,
+		    voucher_to_send, gen, app);
 		ipc_port_release_send(kmsg->ikm_voucher);
 		kmsg->ikm_voucher = convert_voucher_to_port(voucher_to_send);
 	}
@@ -2725,30 +2930,50 @@ ipc_voucher_receive_postprocessing(
 	ipc_voucher_t sent_voucher;
 	kern_return_t kr;
 	int need_postprocessing = FALSE;
+	uint32_t gen;
+	boolean_t app;
 
 	if ((option & MACH_RCV_VOUCHER) == 0 || (!IP_VALID(kmsg->ikm_voucher)) ||
 	    current_task() == kernel_task) {
 		return;
 	}
 
-	/* setup recipe for auto redeem of all the attributes. */
 	sent_voucher = (ipc_voucher_t)kmsg->ikm_voucher->ip_kobject;
 
-	kr = ipc_voucher_prepare_processing_recipe(sent_voucher,
-	    (mach_voucher_attr_raw_recipe_array_t)recipes,
-	    &recipe_size, MACH_VOUCHER_ATTR_AUTO_REDEEM,
-	    IVAM_FLAGS_SUPPORT_RECEIVE_POSTPROCESS, &need_postprocessing);
+	gen = os_atomic_load(&ipc_voucher_generation, relaxed);
+	if ((iv_processing_flags(sent_voucher, gen) &
+	    IV_PROC_RECEIVE_POSTPROCESS) == 0) {
+		return;
+	}
 
-	assert(KERN_SUCCESS == kr);
+	app = task_is_app(current_task());
+	recv_voucher = ipc_voucher_cache_lookup(IVC_RECEIVE, sent_voucher,
+	    gen, app);
+	if (IV_NULL != recv_voucher) {
+		need_postprocessing = TRUE;
+	} else {
+		/* setup recipe for auto redeem of all the attributes. */
+		kr = ipc_voucher_prepare_processing_recipe(sent_voucher,
+		    (mach_voucher_attr_raw_recipe_array_t)recipes,
+		    &recipe_size, MACH_VOUCHER_ATTR_AUTO_REDEEM,
+		    IVAM_FLAGS_SUPPORT_RECEIVE_POSTPROCESS, &need_postprocessing);
 
-	/*
-	 * Only do receive postprocessing if the voucher needs any post processing.
-	 */
-	if (need_postprocessing) {
-		kr = ipc_create_mach_voucher(recipes,
-		    recipe_size,
-		    &recv_voucher);
 		assert(KERN_SUCCESS == kr);
+
+		/*
+		 * Only do receive postprocessing if the voucher needs any post processing.
+		 */
+		if (need_postprocessing) {
+			kr = ipc_create_mach_voucher(recipes,
+			    recipe_size,
+			    &recv_voucher);
+			assert(KERN_SUCCESS == kr);
+			ipc_voucher_cache_enter(IVC_RECEIVE, sent_voucher,
+			    recv_voucher, gen, app);
+		}
+	}
+
+	if (need_postprocessing) {
 		/* swap the voucher port (and set voucher bits in case it didn't already exist) */
 		kmsg->ikm_header->msgh_bits |= (MACH_MSG_TYPE_MOVE_SEND << 16);
 		ipc_port_release_send(kmsg->ikm_voucher);
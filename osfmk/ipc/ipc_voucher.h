@@ -76,8 +76,29 @@ struct ipc_voucher {
 	iv_entry_t              iv_table;       /* table of voucher attr entries */
 	ipc_port_t              iv_port;        /* port representing the voucher */
 	queue_chain_t           iv_hash_link;   /* link on hash chain */
+	uint64_t                iv_proc_cache;  /* IV_PROC_* flags | generation << 32 */
+	uint32_t                iv_values_cached; /* bitmap of valid iv_values[] */
+	iv_value_handle_t       iv_values[IV_ENTRIES_INLINE]; /* resolved values */
 };
 
+/*
+ * Because vouchers are immutable, what the message paths need to know
+ * about them is computed once and kept in the voucher itself:
+ *
+ * iv_proc_cache records whether any attribute of the voucher belongs to
+ * a manager that wants send preprocessing or receive postprocessing.
+ * It is tagged with ipc_voucher_generation, which changes whenever an
+ * attribute manager comes or goes.
+ *
+ * iv_values[] holds the value handle of each well-known key once it
+ * has been looked up, so that mach_voucher_attr_control_get_values()
+ * does not need the attribute control lock.  The voucher's reference
+ * on the value keeps the handle stable for the voucher's lifetime.
+ */
+#define IV_PROC_VALID                   0x1
+#define IV_PROC_SEND_PREPROCESS         0x2
+#define IV_PROC_RECEIVE_POSTPROCESS     0x4
+
 #define IV_NULL         IPC_VOUCHER_NULL
 
 
@@ -158,6 +179,7 @@ typedef ipc_voucher_attr_control_t iv_attr_control_t;
 extern ipc_voucher_attr_control_t  ivac_alloc(iv_index_t);
 extern void ipc_voucher_receive_postprocessing(ipc_kmsg_t kmsg, mach_msg_option_t option);
 extern void ipc_voucher_send_preprocessing(ipc_kmsg_t kmsg);
+extern void ipc_voucher_cache_flush(thread_t thread);
 extern void mach_init_activity_id(void);
 extern kern_return_t ipc_get_pthpriority_from_kmsg_voucher(ipc_kmsg_t kmsg, ipc_pthread_priority_value_t *qos);
 #define ivac_lock_init(ivac) \
@@ -719,6 +719,168 @@ mach_msg_trap(
 	return kr;
 }
 
+/* number of vector elements copied in at a time */
+#define MACH_MSG_VECTOR_CHUNK   16
+
+/*
+ *	Routine:	mach_msg_vector_trap [mach trap]
+ *	Purpose:
+ *		Send a batch of messages, or receive a batch of messages
+ *		from one port or port set, in a single trap.
+ *
+ *		Exactly one of MACH_SEND_MSG and MACH_RCV_MSG must be
+ *		given.  Sends stop at the first message that fails.
+ *		Only the first receive waits (for the caller's timeout);
+ *		the remaining buffers are filled with messages that are
+ *		already queued, and the receive name is looked up once
+ *		for the whole batch.
+ *
+ *		The number of messages sent or received is copied out
+ *		to the processed address, if one is given.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_INVALID_ARGUMENT	Bad count or option combination.
+ *		MACH_SEND_INVALID_DATA	Couldn't copy in the vector (send).
+ *		MACH_RCV_INVALID_DATA	Couldn't copy in the vector (receive).
+ *		All of mach_msg_send and mach_msg_receive error codes.
+ */
+
+mach_msg_return_t
+mach_msg_vector_trap(
+	struct mach_msg_vector_trap_args *args)
+{
+	mach_msg_vector_t       vec[MACH_MSG_VECTOR_CHUNK];
+	user_addr_t             vec_addr = args->vector;
+	mach_msg_size_t         count = args->count;
+	mach_msg_option_t       option = args->option;
+	mach_port_name_t        rcv_name = args->rcv_name;
+	mach_msg_timeout_t      msg_timeout = args->timeout;
+	mach_msg_size_t         done = 0;
+
+	mach_msg_return_t mr = MACH_MSG_SUCCESS;
+	ipc_space_t space = current_space();
+	vm_map_t map = current_map();
+	boolean_t send;
+
+	/* Only accept options allowed by the user */
+	option &= MACH_MSG_OPTION_USER;
+	send = (option & MACH_SEND_MSG) != 0;
+
+	if (count == 0 || count > MACH_MSG_VECTOR_MAX ||
+	    send == ((option & MACH_RCV_MSG) != 0) ||
+	    (option & MACH_RCV_SYNC_WAIT)) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	if (send) {
+		while (done < count) {
+			mach_msg_size_t n = MIN(count - done, MACH_MSG_VECTOR_CHUNK);
+
+			if (copyin(vec_addr + done * sizeof(vec[0]), vec, n * sizeof(vec[0]))) {
+				mr = MACH_SEND_INVALID_DATA;
+				goto out;
+			}
+
+			for (mach_msg_size_t i = 0; i < n; i++) {
+				mach_vm_address_t msg_addr = vec[i].msgv_data;
+				mach_msg_size_t send_size = vec[i].msgv_send_size;
+				mach_msg_option_t msg_option = option;
+				ipc_kmsg_t kmsg;
+
+				KDBG(MACHDBG_CODE(DBG_MACH_IPC, MACH_IPC_KMSG_INFO) | DBG_FUNC_START);
+
+				mr = ipc_kmsg_get(msg_addr, send_size, &kmsg);
+				if (mr != MACH_MSG_SUCCESS) {
+					KDBG(MACHDBG_CODE(DBG_MACH_IPC, MACH_IPC_KMSG_INFO) | DBG_FUNC_END, mr);
+					goto out;
+				}
+
+				mr = ipc_kmsg_copyin(kmsg, space, map, MACH_MSG_PRIORITY_UNSPECIFIED, &msg_option);
+				if (mr != MACH_MSG_SUCCESS) {
+					ipc_kmsg_free(kmsg);
+					KDBG(MACHDBG_CODE(DBG_MACH_IPC, MACH_IPC_KMSG_INFO) | DBG_FUNC_END, mr);
+					goto out;
+				}
+
+				mr = ipc_kmsg_send(kmsg, msg_option, msg_timeout);
+				if (mr != MACH_MSG_SUCCESS) {
+					mr |= ipc_kmsg_copyout_pseudo(kmsg, space, map, MACH_MSG_BODY_NULL);
+					(void) ipc_kmsg_put(kmsg, msg_option, msg_addr, send_size, 0, NULL);
+					KDBG(MACHDBG_CODE(DBG_MACH_IPC, MACH_IPC_KMSG_INFO) | DBG_FUNC_END, mr);
+					goto out;
+				}
+				done++;
+			}
+		}
+	} else {
+		thread_t self = current_thread();
+		ipc_object_t object;
+		ipc_mqueue_t mqueue;
+		boolean_t drained = FALSE;
+
+		mr = ipc_mqueue_copyin(space, rcv_name, &mqueue, &object);
+		if (mr != MACH_MSG_SUCCESS) {
+			return mr;
+		}
+		/* hold ref for object */
+
+		while (done < count && mr == MACH_MSG_SUCCESS && !drained) {
+			mach_msg_size_t n = MIN(count - done, MACH_MSG_VECTOR_CHUNK);
+
+			if (copyin(vec_addr + done * sizeof(vec[0]), vec, n * sizeof(vec[0]))) {
+				mr = MACH_RCV_INVALID_DATA;
+				break;
+			}
+
+			for (mach_msg_size_t i = 0; i < n; i++) {
+				mach_msg_option_t msg_option = option;
+				mach_msg_timeout_t rcv_timeout = msg_timeout;
+
+				if (done > 0) {
+					/* only wait for the first message */
+					msg_option |= MACH_RCV_TIMEOUT;
+					rcv_timeout = 0;
+				}
+
+				/* mach_msg_receive_results() consumes one reference */
+				io_reference(object);
+
+				self->ith_msg_addr = vec[i].msgv_data;
+				self->ith_object = object;
+				self->ith_rsize = vec[i].msgv_rcv_size;
+				self->ith_msize = 0;
+				self->ith_option = msg_option;
+				self->ith_receiver_name = MACH_PORT_NULL;
+				self->ith_continuation = NULL;
+				self->ith_knote = ITH_KNOTE_NULL;
+
+				ipc_mqueue_receive(mqueue, msg_option, vec[i].msgv_rcv_size,
+				    rcv_timeout, THREAD_ABORTSAFE);
+				mr = mach_msg_receive_results(NULL);
+
+				if (mr != MACH_MSG_SUCCESS) {
+					if (mr == MACH_RCV_TIMED_OUT && done > 0) {
+						/* queue drained */
+						mr = MACH_MSG_SUCCESS;
+						drained = TRUE;
+					}
+					break;
+				}
+				done++;
+			}
+		}
+		io_release(object);
+	}
+
+out:
+	if (args->processed != (user_addr_t)0 &&
+	    copyout(&done, args->processed, sizeof(done)) && mr == MACH_MSG_SUCCESS) {
+		mr = send ? MACH_SEND_INVALID_DATA : MACH_RCV_INVALID_DATA;
+	}
+	return mr;
+}
+
 
 /*
  *	Routine:	msg_receive_error	[internal]
@@ -96,6 +96,8 @@
 #include <ipc/ipc_pset.h>
 #include <ipc/ipc_right.h>
 #include <ipc/ipc_kmsg.h>
+#include <ipc/ipc_shm_ring.h>
+#include <ipc/ipc_port_stats.h>
 #include <kern/misc_protos.h>
 #include <security/mac_mach_internal.h>
 
@@ -421,6 +423,7 @@ mach_port_type(
 	mach_port_type_t        *typep)
 {
 	mach_port_urefs_t urefs;
+	struct ipc_entry snap;
 	ipc_entry_t entry;
 	kern_return_t kr;
 
@@ -437,6 +440,22 @@ mach_port_type(
 		return KERN_SUCCESS;
 	}
 
+	/*
+	 * Unless the name holds send rights, whose port may have died
+	 * behind our back, or has requests registered on its port,
+	 * the type is just the entry bits: skip the space lock.
+	 */
+	kr = ipc_entry_lookup_snapshot(space, name, &snap);
+	if (kr != KERN_SUCCESS) {
+		return kr;
+	}
+	if ((snap.ie_bits & MACH_PORT_TYPE_SEND_RIGHTS) == 0 &&
+	    ((snap.ie_bits & MACH_PORT_TYPE_RECEIVE) == 0 ||
+	    snap.ie_request == IE_REQ_NONE)) {
+		*typep = IE_BITS_TYPE(snap.ie_bits);
+		return KERN_SUCCESS;
+	}
+
 	kr = ipc_right_lookup_write(space, name, &entry);
 	if (kr != KERN_SUCCESS) {
 		return kr;
@@ -1969,6 +1988,54 @@ mach_port_get_attributes(
 		break;
 	}
 
+	case MACH_PORT_SHM_RING: {
+		mach_port_shm_ring_t *msrp = (mach_port_shm_ring_t *)info;
+
+		if (*count < MACH_PORT_SHM_RING_COUNT) {
+			return KERN_FAILURE;
+		}
+
+		if (!MACH_PORT_VALID(name)) {
+			return KERN_INVALID_RIGHT;
+		}
+
+		kr = ipc_port_translate_receive(space, name, &port);
+		if (kr != KERN_SUCCESS) {
+			return kr;
+		}
+		/* port is locked and active */
+
+		if (port->ip_shm_ring == ISR_NULL) {
+			bzero(msrp, sizeof(*msrp));
+		} else {
+			*msrp = port->ip_shm_ring->isr_info;
+		}
+		*count = MACH_PORT_SHM_RING_COUNT;
+		ip_unlock(port);
+		break;
+	}
+
+	case MACH_PORT_IPC_STATS:
+	case MACH_PORT_IPC_LATENCY_HISTOGRAM:
+	case MACH_PORT_IPC_SIZE_HISTOGRAM: {
+		if (!MACH_PORT_VALID(name)) {
+			return KERN_INVALID_RIGHT;
+		}
+
+		kr = ipc_port_translate_receive(space, name, &port);
+		if (kr != KERN_SUCCESS) {
+			return kr;
+		}
+		/* port is locked and active */
+
+		kr = ipc_port_stats_get(port, flavor, info, count);
+		ip_unlock(port);
+		if (kr != KERN_SUCCESS) {
+			return kr;
+		}
+		break;
+	}
+
 	default:
 		return KERN_INVALID_ARGUMENT;
 		/*NOTREACHED*/
@@ -2129,6 +2196,42 @@ mach_port_set_attributes(
 		break;
 #endif /* IMPORTANCE_INHERITANCE */
 
+	case MACH_PORT_SHM_RING: {
+		ipc_shm_ring_t ring;
+
+		if (count < MACH_PORT_SHM_RING_COUNT) {
+			return KERN_FAILURE;
+		}
+
+		if (!MACH_PORT_VALID(name)) {
+			return KERN_INVALID_RIGHT;
+		}
+
+		kr = ipc_shm_ring_create((mach_port_shm_ring_t *)info, &ring);
+		if (kr != KERN_SUCCESS) {
+			return kr;
+		}
+
+		kr = ipc_port_translate_receive(space, name, &port);
+		if (kr != KERN_SUCCESS) {
+			ipc_shm_ring_destroy(ring);
+			return kr;
+		}
+		/* port is locked and active */
+
+		/* a ring can't be replaced while tasks have it mapped */
+		if (ip_is_kobject(port) || port->ip_specialreply ||
+		    port->ip_shm_ring != ISR_NULL) {
+			ip_unlock(port);
+			ipc_shm_ring_destroy(ring);
+			return KERN_INVALID_ARGUMENT;
+		}
+
+		port->ip_shm_ring = ring;
+		ip_unlock(port);
+		break;
+	}
+
 	default:
 		return KERN_INVALID_ARGUMENT;
 		/*NOTREACHED*/
@@ -257,6 +257,8 @@ enum {
 	STACKSHOT_INSTRS_CYCLES                    = 0x8000000,
 	STACKSHOT_ASID                             = 0x10000000,
 	STACKSHOT_PAGE_TABLES                      = 0x20000000,
+	/* Include the message flow statistics of receive rights */
+	STACKSHOT_IPC_PORT_STATS                   = 0x40000000,
 };
 
 #define STACKSHOT_THREAD_SNAPSHOT_MAGIC     0xfeedface
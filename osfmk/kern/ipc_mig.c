@@ -461,6 +461,9 @@ mach_msg_rpc_from_kernel_body(
 		}
 	}
 
+	/* the checks below and our caller want the whole body in the kmsg */
+	(void) ipc_kmsg_inline_copy_materialize(kmsg);
+
 	/*
 	 * Check to see how much of the message/trailer can be received.
 	 * We chose the maximum trailer that will fit, since we don't
@@ -725,6 +728,9 @@ mach_msg_overwrite(
 			return mr;
 		}
 
+		/* the message is copied out below with memcpy() */
+		(void) ipc_kmsg_inline_copy_materialize(kmsg);
+
 		trailer_size = ipc_kmsg_add_trailer(kmsg, space, option, current_thread(), seqno, TRUE,
 		    kmsg->ikm_header->msgh_remote_port->ip_context);
 
@@ -477,6 +477,7 @@ struct kcdata_type_definition {
 #define STACKSHOT_KCTYPE_SYS_SHAREDCACHE_LAYOUT      0x927u /* same as KCDATA_TYPE_LIBRARY_LOADINFO64 */
 #define STACKSHOT_KCTYPE_THREAD_DISPATCH_QUEUE_LABEL 0x928u /* dispatch queue label */
 #define STACKSHOT_KCTYPE_THREAD_TURNSTILEINFO        0x929u /* struct stackshot_thread_turnstileinfo */
+#define STACKSHOT_KCTYPE_IPC_PORT_STATS              0x92au /* struct ipc_port_stats_snapshot */
 
 #define STACKSHOT_KCTYPE_TASK_DELTA_SNAPSHOT 0x940u   /* task_delta_snapshot_v2 */
 #define STACKSHOT_KCTYPE_THREAD_DELTA_SNAPSHOT 0x941u /* thread_delta_snapshot_v* */
@@ -838,6 +839,21 @@ typedef struct stackshot_thread_turnstileinfo {
 #define STACKSHOT_WAITOWNER_THREQUESTED    (UINT64_MAX - 6) /* workloop waiting for a new worker thread */
 #define STACKSHOT_WAITOWNER_SUSPENDED      (UINT64_MAX - 7) /* workloop is suspended */
 
+/*
+ * Message flow statistics of a receive right, see MACH_PORT_IPC_STATS
+ * in <mach/port.h> for the meaning of the histogram buckets.
+ */
+struct ipc_port_stats_snapshot {
+	uint64_t ipss_port;             /* permuted address of the port */
+	uint64_t ipss_owner;            /* receiver pid or STACKSHOT_WAITOWNER_* */
+	uint64_t ipss_messages;
+	uint32_t ipss_receiver_name;
+	uint32_t ipss_sampled;
+	uint32_t ipss_depth_max;
+	uint32_t ipss_latency[16];
+	uint32_t ipss_size[16];
+} __attribute__((packed));
+
 
 struct stack_snapshot_stacktop {
 	uint64_t sp;
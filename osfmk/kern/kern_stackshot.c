@@ -35,6 +35,7 @@
 #ifdef IMPORTANCE_INHERITANCE
 #include <ipc/ipc_importance.h>
 #endif
+#include <ipc/ipc_port_stats.h>
 #include <sys/appleapiopts.h>
 #include <kern/debug.h>
 #include <kern/block_hint.h>
@@ -2164,6 +2165,16 @@ kdp_stackshot_kcdata_format(int pid, uint32_t trace_flags, uint32_t * pBytesTrac
 
 	trace_flags &= ~(STACKSHOT_THREAD_GROUP);
 
+	if (trace_flags & STACKSHOT_IPC_PORT_STATS) {
+		uint32_t num_ports = ipc_port_stats_kdp_count();
+
+		if (num_ports > 0) {
+			kcd_exit_on_error(kcdata_get_memory_addr_for_array(stackshot_kcdata_p, STACKSHOT_KCTYPE_IPC_PORT_STATS,
+			    sizeof(struct ipc_port_stats_snapshot), num_ports, &out_addr));
+			ipc_port_stats_kdp_snapshot((struct ipc_port_stats_snapshot *)out_addr, num_ports);
+		}
+	}
+
 
 	/* Iterate over tasks */
 	queue_iterate(&tasks, task, task_t, tasks)
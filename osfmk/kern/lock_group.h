@@ -82,6 +82,45 @@ typedef struct _lck_grp_stats_ {
 	lck_grp_stat_t                  lgss_mtx_wait;
 } lck_grp_stats_t;
 
+/*
+ * Sampled mutex contention profile.
+ *
+ * Only contended acquisitions (the ones that reach the adaptive spin path)
+ * are sampled, so the fast path is left untouched.
+ * lgmp_spin_budget is the adaptive spin duration (in absolute time units)
+ * used for mutexes of the group, 0 meaning MutexSpin.
+ *
+ * Samples are counted per CPU in lgmp_cpu_counts (MAX_CPUS entries),
+ * allocated with the group. Groups set up before kalloc is available
+ * count in the shared lgmp_samples/lgmp_spin/lgmp_wait instead.
+ *
+ * Direct mutexes don't point to their group: they find its profile
+ * through the lck_grp_mtx_prof_slot of the group, an index into
+ * lck_mtx_prof_grps (0 if the table was full).
+ */
+#define LCK_MTX_PROF_SPIN_ACQUIRED      0       /* acquired while spinning */
+#define LCK_MTX_PROF_SPIN_SPUN          1       /* spun, then blocked */
+#define LCK_MTX_PROF_SPIN_NO_SPIN       2       /* owner off core, blocked */
+#define LCK_MTX_PROF_SPIN_OUTCOMES      3
+
+#define LCK_MTX_PROF_WAIT_BUCKETS       8       /* <1us, then x4 up to >=4ms */
+
+#define LCK_MTX_PROF_SLOTS              255     /* slot 0 is not assigned */
+
+typedef struct _lck_mtx_prof_counts_ {
+	uint32_t                lmpc_samples;
+	uint32_t                lmpc_spin[LCK_MTX_PROF_SPIN_OUTCOMES];
+	uint32_t                lmpc_wait[LCK_MTX_PROF_WAIT_BUCKETS];
+} __attribute__((aligned(64))) lck_mtx_prof_counts_t;
+
+typedef struct _lck_grp_mtx_prof_ {
+	uint64_t                lgmp_samples;
+	uint64_t                lgmp_spin[LCK_MTX_PROF_SPIN_OUTCOMES];
+	uint64_t                lgmp_wait[LCK_MTX_PROF_WAIT_BUCKETS];
+	uint64_t                lgmp_spin_budget;
+	lck_mtx_prof_counts_t   *lgmp_cpu_counts;
+} lck_grp_mtx_prof_t;
+
 #define LCK_GRP_MAX_NAME        64
 
 typedef struct _lck_grp_ {
@@ -93,6 +132,8 @@ typedef struct _lck_grp_ {
 	uint32_t                lck_grp_attr;
 	char                    lck_grp_name[LCK_GRP_MAX_NAME];
 	lck_grp_stats_t         lck_grp_stats;
+	lck_grp_mtx_prof_t      lck_grp_mtx_prof;
+	uint32_t                lck_grp_mtx_prof_slot;
 } lck_grp_t;
 
 #else
@@ -259,6 +259,45 @@ lck_grp_spin_spin_enabled(void *lock LCK_GRP_ARG(lck_grp_t *grp))
 	return enabled;
 }
 
+/*
+ * Sampled contention profile of mutexes, see lck_mtx_prof_record().
+ * Direct mutexes use the profile of the group in their profile slot.
+ * Those without a slot share lck_mtx_direct_prof, which is global and
+ * therefore not used for spin tuning.
+ */
+extern lck_grp_mtx_prof_t lck_mtx_direct_prof;
+extern lck_grp_t *lck_mtx_prof_grps[LCK_MTX_PROF_SLOTS];
+extern uint32_t lck_mtx_adaptive_spin_tuning;
+
+/*
+ * The group in a slot can't change while one of its mutexes
+ * exists, since the mutex holds a reference on it.
+ */
+static inline lck_grp_mtx_prof_t *
+lck_mtx_prof_for_slot(uint32_t slot)
+{
+	lck_grp_t *grp = NULL;
+
+	if (slot < LCK_MTX_PROF_SLOTS) {
+		grp = os_atomic_load(&lck_mtx_prof_grps[slot], relaxed);
+	}
+	return grp != NULL ? &grp->lck_grp_mtx_prof : &lck_mtx_direct_prof;
+}
+
+extern uint64_t lck_mtx_prof_sample_begin(void);
+extern void lck_mtx_prof_record(lck_grp_mtx_prof_t *prof, int outcome, uint64_t start);
+
+static inline uint64_t
+lck_mtx_prof_spin_budget(lck_grp_mtx_prof_t *prof)
+{
+	uint64_t budget = os_atomic_load(&prof->lgmp_spin_budget, relaxed);
+
+	if (budget == 0 || budget > MutexSpin || !lck_mtx_adaptive_spin_tuning) {
+		return MutexSpin;
+	}
+	return budget;
+}
+
 static void inline
 lck_grp_mtx_inc_stats(
 	uint64_t* stat)
@@ -76,6 +76,14 @@
 #include <machine/machine_cpu.h>
 #include <string.h>
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <i386/mp.h>
+#endif
+
+#if defined(__arm__) || defined(__arm64__)
+#include <arm/cpu_data_internal.h>
+#endif
+
 #include <sys/kdebug.h>
 
 #define LCK_MTX_SLEEP_CODE              0
@@ -107,6 +115,32 @@ lck_grp_attr_t  LockDefaultGroupAttr;
 lck_grp_t               LockCompatGroup;
 lck_attr_t              LockDefaultLckAttr;
 
+/*
+ * Mutex contention profiling.
+ *
+ * One in lck_mtx_prof_sample_rate contended mutex acquisitions records
+ * its spin outcome and total wait time in the profile of the mutex group
+ * (0 disables profiling). When lck_mtx_adaptive_spin_tuning is set, the
+ * samples also drive the spin budget of the group.
+ *
+ * Each CPU counts down to its next sample in lck_mtx_prof_countdown.
+ */
+lck_grp_mtx_prof_t      lck_mtx_direct_prof;
+lck_grp_t               *lck_mtx_prof_grps[LCK_MTX_PROF_SLOTS];
+uint32_t                lck_mtx_prof_sample_rate = 16;
+uint32_t                lck_mtx_adaptive_spin_tuning = 1;
+
+static struct {
+	uint32_t        lmpc_countdown;
+} __attribute__((aligned(64))) lck_mtx_prof_countdown[MAX_CPUS];
+
+extern vm_map_t         kalloc_map;
+
+#if DEVELOPMENT || DEBUG
+/* readers that stopped deferring to writers, see LCK_RW_READER_MAX_SLEEPS */
+uint64_t                lck_rw_readers_starved;
+#endif
+
 #if CONFIG_DTRACE && __SMP__
 #if defined (__x86_64__)
 uint64_t dtrace_spin_threshold = 500; // 500ns
@@ -252,6 +286,35 @@ lck_grp_alloc_init(
 	return grp;
 }
 
+/*
+ * Routine: lck_mtx_prof_grp_init
+ *
+ * Gives the group a profile slot for its direct mutexes, and
+ * per-CPU sample counters once kalloc is available.
+ */
+
+static void
+lck_mtx_prof_grp_init(lck_grp_t *grp)
+{
+	uint32_t slot;
+
+	for (slot = 1; slot < LCK_MTX_PROF_SLOTS; slot++) {
+		if (os_atomic_cmpxchg(&lck_mtx_prof_grps[slot], NULL, grp, release)) {
+			grp->lck_grp_mtx_prof_slot = slot;
+			break;
+		}
+	}
+
+	if (kalloc_map != VM_MAP_NULL) {
+		grp->lck_grp_mtx_prof.lgmp_cpu_counts =
+		    kalloc(MAX_CPUS * sizeof(lck_mtx_prof_counts_t));
+		if (grp->lck_grp_mtx_prof.lgmp_cpu_counts != NULL) {
+			bzero(grp->lck_grp_mtx_prof.lgmp_cpu_counts,
+			    MAX_CPUS * sizeof(lck_mtx_prof_counts_t));
+		}
+	}
+}
+
 /*
  * Routine: lck_grp_init
  */
@@ -299,6 +362,8 @@ lck_grp_init(lck_grp_t * grp, const char * grp_name, lck_grp_attr_t * attr)
 
 	os_ref_init(&grp->lck_grp_refcnt, NULL);
 
+	lck_mtx_prof_grp_init(grp);
+
 	lck_mtx_lock(&lck_grp_lock);
 	enqueue_tail(&lck_grp_queue, (queue_entry_t)grp);
 	lck_grp_cnt++;
@@ -345,6 +410,13 @@ lck_grp_deallocate(
 		return;
 	}
 
+	if (grp->lck_grp_mtx_prof_slot != 0) {
+		os_atomic_store(&lck_mtx_prof_grps[grp->lck_grp_mtx_prof_slot], NULL, relaxed);
+	}
+	if (grp->lck_grp_mtx_prof.lgmp_cpu_counts != NULL) {
+		kfree(grp->lck_grp_mtx_prof.lgmp_cpu_counts,
+		    MAX_CPUS * sizeof(lck_mtx_prof_counts_t));
+	}
 	kfree(grp, sizeof(lck_grp_t));
 }
 
@@ -1685,6 +1757,223 @@ lck_rw_set_promotion_locked(thread_t thread)
 	}
 }
 
+/*
+ * Routine:	lck_mtx_prof_sample_begin
+ *
+ * Returns the start timestamp if the contended acquisition
+ * in progress should be profiled, 0 otherwise.
+ */
+uint64_t
+lck_mtx_prof_sample_begin(void)
+{
+	uint32_t rate = os_atomic_load(&lck_mtx_prof_sample_rate, relaxed);
+	uint32_t *countdown;
+	boolean_t sample;
+
+	if (rate == 0) {
+		return 0;
+	}
+
+	disable_preemption();
+	countdown = &lck_mtx_prof_countdown[cpu_number()].lmpc_countdown;
+	if (*countdown == 0 || *countdown > rate) {
+		*countdown = rate;
+	}
+	sample = (--*countdown == 0);
+	enable_preemption();
+
+	return sample ? mach_absolute_time() : 0;
+}
+
+/*
+ * Routine:	lck_mtx_prof_record
+ *
+ * Records a contended acquisition that started at 'start' and
+ * whose first spin attempt ended with 'outcome'.
+ */
+void
+lck_mtx_prof_record(lck_grp_mtx_prof_t *prof, int outcome, uint64_t start)
+{
+	lck_mtx_prof_counts_t *counts;
+	uint64_t wait, budget, floor;
+	int bucket = 0;
+
+	assert(outcome >= 0 && outcome < LCK_MTX_PROF_SPIN_OUTCOMES);
+
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &wait);
+	for (wait /= NSEC_PER_USEC; wait != 0 && bucket < LCK_MTX_PROF_WAIT_BUCKETS - 1; wait >>= 2) {
+		bucket++;
+	}
+
+	counts = prof->lgmp_cpu_counts;
+	if (counts != NULL) {
+		disable_preemption();
+		counts = &counts[cpu_number()];
+		counts->lmpc_samples++;
+		counts->lmpc_spin[outcome]++;
+		counts->lmpc_wait[bucket]++;
+		enable_preemption();
+	} else {
+		os_atomic_inc(&prof->lgmp_samples, relaxed);
+		os_atomic_inc(&prof->lgmp_spin[outcome], relaxed);
+		os_atomic_inc(&prof->lgmp_wait[bucket], relaxed);
+	}
+
+	/*
+	 * Direct mutexes without a profile slot share one profile across
+	 * all groups, so they keep spinning for MutexSpin rather than for
+	 * a budget tuned by whichever of them happen to be contended.
+	 */
+	if (!lck_mtx_adaptive_spin_tuning || prof == &lck_mtx_direct_prof) {
+		return;
+	}
+
+	/*
+	 * Spinning that ended with the mutex acquired paid off: grow the
+	 * budget back towards MutexSpin. Spinning for the whole budget and
+	 * then blocking was wasted time: shrink it, but not below
+	 * MutexSpin / 8 so that the group can still see successful spins.
+	 */
+	budget = lck_mtx_prof_spin_budget(prof);
+	if (outcome == LCK_MTX_PROF_SPIN_ACQUIRED) {
+		budget += budget / 8;
+		if (budget > MutexSpin) {
+			budget = MutexSpin;
+		}
+	} else if (outcome == LCK_MTX_PROF_SPIN_SPUN) {
+		floor = MutexSpin / 8;
+		budget -= budget / 8;
+		if (budget < floor) {
+			budget = floor;
+		}
+	} else {
+		return;
+	}
+	if (budget != lck_mtx_prof_spin_budget(prof)) {
+		os_atomic_store(&prof->lgmp_spin_budget, budget, relaxed);
+	}
+}
+
+/*
+ * Adds up the shared and per-CPU counters of a profile into sum
+ * (whose lgmp_cpu_counts and lgmp_spin_budget are left alone).
+ */
+static void
+lck_mtx_prof_sum(lck_grp_mtx_prof_t *prof, lck_grp_mtx_prof_t *sum)
+{
+	lck_mtx_prof_counts_t *counts = prof->lgmp_cpu_counts;
+	int cpu, i;
+
+	sum->lgmp_samples = os_atomic_load(&prof->lgmp_samples, relaxed);
+	for (i = 0; i < LCK_MTX_PROF_SPIN_OUTCOMES; i++) {
+		sum->lgmp_spin[i] = os_atomic_load(&prof->lgmp_spin[i], relaxed);
+	}
+	for (i = 0; i < LCK_MTX_PROF_WAIT_BUCKETS; i++) {
+		sum->lgmp_wait[i] = os_atomic_load(&prof->lgmp_wait[i], relaxed);
+	}
+	if (counts == NULL) {
+		return;
+	}
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		sum->lgmp_samples += counts[cpu].lmpc_samples;
+		for (i = 0; i < LCK_MTX_PROF_SPIN_OUTCOMES; i++) {
+			sum->lgmp_spin[i] += counts[cpu].lmpc_spin[i];
+		}
+		for (i = 0; i < LCK_MTX_PROF_WAIT_BUCKETS; i++) {
+			sum->lgmp_wait[i] += counts[cpu].lmpc_wait[i];
+		}
+	}
+}
+
+static int
+lck_mtx_prof_string_one(const char *name, lck_grp_mtx_prof_t *prof,
+    char *buffer, int buffer_size)
+{
+	lck_grp_mtx_prof_t sum;
+	uint64_t budget;
+	int off, i;
+
+	lck_mtx_prof_sum(prof, &sum);
+	if (sum.lgmp_samples == 0) {
+		return 0;
+	}
+
+	/* the longest line is well below LCK_MTX_PROF_LINE_MAX */
+	if (buffer_size < LCK_MTX_PROF_LINE_MAX) {
+		return -1;
+	}
+
+	absolutetime_to_nanoseconds(lck_mtx_prof_spin_budget(prof), &budget);
+
+	off = scnprintf(buffer, buffer_size,
+	    "%s: samples %llu spin acquired %llu spun %llu no_spin %llu budget %llu ns wait",
+	    name, sum.lgmp_samples,
+	    sum.lgmp_spin[LCK_MTX_PROF_SPIN_ACQUIRED],
+	    sum.lgmp_spin[LCK_MTX_PROF_SPIN_SPUN],
+	    sum.lgmp_spin[LCK_MTX_PROF_SPIN_NO_SPIN], budget);
+	for (i = 0; i < LCK_MTX_PROF_WAIT_BUCKETS; i++) {
+		off += scnprintf(&buffer[off], buffer_size - off, " %llu",
+		    sum.lgmp_wait[i]);
+	}
+	off += scnprintf(&buffer[off], buffer_size - off, "\n");
+
+	return off;
+}
+
+/*
+ * Routine:	lck_mtx_prof_string_size
+ *
+ * Returns a buffer size large enough for lck_mtx_prof_string()
+ * given the current number of lock groups.
+ */
+int
+lck_mtx_prof_string_size(void)
+{
+	return (int)(os_atomic_load(&lck_grp_cnt, relaxed) + 1) *
+	       LCK_MTX_PROF_LINE_MAX;
+}
+
+/*
+ * Routine:	lck_mtx_prof_string
+ *
+ * Formats the contention profile of every lock group that has
+ * samples, one line per group. Wait time buckets are in microseconds:
+ * <1, <4, <16, <64, <256, <1024, <4096, >=4096.
+ *
+ * Direct mutexes are reported with their group, except for those
+ * without a profile slot, which share a single "direct mutexes" line.
+ *
+ * Returns the length of the string, or -1 if the buffer is too
+ * small (lock groups were created since lck_mtx_prof_string_size()).
+ */
+int
+lck_mtx_prof_string(char *buffer, int buffer_size)
+{
+	lck_grp_t *grp;
+	int off, len;
+
+	off = lck_mtx_prof_string_one("direct mutexes", &lck_mtx_direct_prof,
+	    buffer, buffer_size);
+	if (off < 0) {
+		return -1;
+	}
+
+	lck_mtx_lock(&lck_grp_lock);
+	qe_foreach_element(grp, &lck_grp_queue, lck_grp_link) {
+		len = lck_mtx_prof_string_one(grp->lck_grp_name,
+		    &grp->lck_grp_mtx_prof, &buffer[off], buffer_size - off);
+		if (len < 0) {
+			off = -1;
+			break;
+		}
+		off += len;
+	}
+	lck_mtx_unlock(&lck_grp_lock);
+
+	return off;
+}
+
 kern_return_t
 host_lockgroup_info(
 	host_t                                  host,
@@ -805,6 +805,14 @@ extern void lck_mtx_gate_assert(lck_mtx_t *lock, gate_t *gate, int flags);
 
 #endif //KERNEL_PRIVATE
 
+#ifdef XNU_KERNEL_PRIVATE
+extern uint32_t         lck_mtx_prof_sample_rate;
+extern uint32_t         lck_mtx_adaptive_spin_tuning;
+#define LCK_MTX_PROF_LINE_MAX   512
+extern int              lck_mtx_prof_string_size(void);
+extern int              lck_mtx_prof_string(char* buffer, int buffer_size);
+#endif /* XNU_KERNEL_PRIVATE */
+
 #if DEVELOPMENT || DEBUG
 #define FULL_CONTENDED 0
 #define HALF_CONTENDED 1
@@ -819,6 +827,9 @@ extern int              lck_mtx_test_mtx_uncontended(int iter, char* buffer, int
 extern int              lck_mtx_test_mtx_contended(int iter, char* buffer, int buffer_size, int type);
 extern int              lck_mtx_test_mtx_uncontended_loop_time(int iter, char* buffer, int buffer_size);
 extern int              lck_mtx_test_mtx_contended_loop_time(int iter, char* buffer, int buffer_size, int type);
+extern int              lck_rw_test_hold_exclusive(int hold_ms);
+extern uint64_t         lck_rw_test_shared_max_wait(int iter);
+extern uint64_t         lck_rw_readers_starved;
 #endif
 #ifdef  KERNEL_PRIVATE
 
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <kern/assert.h>
+#include <kern/kalloc.h>
+#include <kern/mpmc_queue.h>
+
+#pragma mark MPMC bounded ring
+
+kern_return_t
+mpmc_ring_init(mpmc_ring_t ring, uint32_t capacity)
+{
+	struct mpmc_ring_slot *slots;
+
+	if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	slots = kalloc(capacity * sizeof(struct mpmc_ring_slot));
+	if (slots == NULL) {
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	for (uint32_t i = 0; i < capacity; i++) {
+		os_atomic_init(&slots[i].mprs_seq, i);
+		slots[i].mprs_elm = NULL;
+	}
+
+	os_atomic_init(&ring->mpr_enqueue_pos, 0);
+	os_atomic_init(&ring->mpr_dequeue_pos, 0);
+	ring->mpr_mask = capacity - 1;
+	ring->mpr_slots = slots;
+	return KERN_SUCCESS;
+}
+
+void
+mpmc_ring_destroy(mpmc_ring_t ring)
+{
+	assert(mpmc_ring_empty(ring));
+	kfree(ring->mpr_slots, (ring->mpr_mask + 1) * sizeof(struct mpmc_ring_slot));
+	ring->mpr_slots = NULL;
+}
+
+bool
+mpmc_ring_enqueue(mpmc_ring_t ring, void *elm)
+{
+	struct mpmc_ring_slot *slot;
+	uint32_t pos, seq;
+
+	assert(elm != NULL);
+
+	pos = os_atomic_load(&ring->mpr_enqueue_pos, relaxed);
+	for (;;) {
+		slot = &ring->mpr_slots[pos & ring->mpr_mask];
+		seq  = os_atomic_load(&slot->mprs_seq, acquire);
+
+		int32_t diff = (int32_t)(seq - pos);
+		if (diff == 0) {
+			if (os_atomic_cmpxchgv(&ring->mpr_enqueue_pos, pos, pos + 1,
+			    &pos, relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* the consumer of the previous lap hasn't drained it */
+			return false;
+		} else {
+			pos = os_atomic_load(&ring->mpr_enqueue_pos, relaxed);
+		}
+	}
+
+	slot->mprs_elm = elm;
+	os_atomic_store(&slot->mprs_seq, pos + 1, release);
+	return true;
+}
+
+void *
+mpmc_ring_dequeue(mpmc_ring_t ring)
+{
+	struct mpmc_ring_slot *slot;
+	uint32_t pos, seq;
+	void *elm;
+
+	pos = os_atomic_load(&ring->mpr_dequeue_pos, relaxed);
+	for (;;) {
+		slot = &ring->mpr_slots[pos & ring->mpr_mask];
+		seq  = os_atomic_load(&slot->mprs_seq, acquire);
+
+		int32_t diff = (int32_t)(seq - (pos + 1));
+		if (diff == 0) {
+			if (os_atomic_cmpxchgv(&ring->mpr_dequeue_pos, pos, pos + 1,
+			    &pos, relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* the producer for this position hasn't published it */
+			return NULL;
+		} else {
+			pos = os_atomic_load(&ring->mpr_dequeue_pos, relaxed);
+		}
+	}
+
+	elm = slot->mprs_elm;
+	slot->mprs_elm = NULL;
+	os_atomic_store(&slot->mprs_seq, pos + ring->mpr_mask + 1, release);
+	return elm;
+}
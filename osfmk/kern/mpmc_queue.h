@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _KERN_MPMC_QUEUE_H_
+#define _KERN_MPMC_QUEUE_H_
+
+#ifdef XNU_KERNEL_PRIVATE
+
+#include <machine/atomic.h>
+#include <mach/kern_return.h>
+#include <stdbool.h>
+
+#endif // XNU_KERNEL_PRIVATE
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#ifdef XNU_KERNEL_PRIVATE
+
+/*!
+ * @const MPMC_QUEUE_CACHELINE_SIZE
+ *
+ * @brief
+ * Alignment used to keep the producer and consumer sides of the queues below
+ * on different cache lines.
+ */
+#define MPMC_QUEUE_CACHELINE_SIZE       128
+
+#pragma mark MPMC bounded ring
+
+/*!
+ * @typedef struct mpmc_ring_slot
+ *
+ * @brief
+ * Type for a cell of an MPMC ring.
+ */
+struct mpmc_ring_slot {
+	uint32_t _Atomic        mprs_seq;
+	void                   *mprs_elm;
+};
+
+/*!
+ * @typedef struct mpmc_ring
+ *
+ * @brief
+ * The type for a bounded multi-producer multi-consumer ring.
+ *
+ * @discussion
+ * MPMC rings allow several producers and several consumers to exchange
+ * pointers without a lock. Unlike MPSC queues they are not intrusive, and have
+ * a fixed capacity chosen at initialization time: enqueuing onto a full ring
+ * fails and lets the caller decide how to handle overflow.
+ *
+ * These rings shine when work is produced from several contexts and must be
+ * distributed to a pool of worker threads.
+ *
+ * <h2>Algorithm</h2>
+ *
+ * Each cell of the ring carries a sequence number. A cell at index `i` is
+ * ready to be filled by the producer that claims position `pos` when its
+ * sequence is `pos`, and ready to be drained by the consumer that claims
+ * position `pos` when its sequence is `pos + 1`.
+ *
+ * Producers (resp. consumers) claim a position with a single compare-exchange
+ * of the enqueue (resp. dequeue) cursor, then publish the cell by storing its
+ * new sequence with release semantics. A producer and a consumer only ever
+ * contend on the same cell, never on the same cursor.
+ *
+ * Neither side requires preemption to be disabled, however a thread preempted
+ * between claiming and publishing a cell will make the consumers (resp.
+ * producers) of that cell see the ring as empty (resp. full) until it runs
+ * again.
+ */
+typedef struct mpmc_ring {
+	uint32_t _Atomic        mpr_enqueue_pos
+	__attribute__((aligned(MPMC_QUEUE_CACHELINE_SIZE)));
+	uint32_t _Atomic        mpr_dequeue_pos
+	__attribute__((aligned(MPMC_QUEUE_CACHELINE_SIZE)));
+	uint32_t                mpr_mask
+	__attribute__((aligned(MPMC_QUEUE_CACHELINE_SIZE)));
+	struct mpmc_ring_slot  *mpr_slots;
+} *mpmc_ring_t;
+
+/*!
+ * @function mpmc_ring_init
+ *
+ * @brief
+ * Initialize an MPMC ring and allocate its storage.
+ *
+ * @param ring
+ * The ring to initialize.
+ *
+ * @param capacity
+ * The number of elements the ring can hold, which must be a power of 2.
+ *
+ * @returns
+ * - KERN_SUCCESS on success
+ * - KERN_INVALID_ARGUMENT if @a capacity isn't a power of 2
+ * - KERN_RESOURCE_SHORTAGE if the storage couldn't be allocated
+ */
+kern_return_t
+mpmc_ring_init(mpmc_ring_t ring, uint32_t capacity);
+
+/*!
+ * @function mpmc_ring_destroy
+ *
+ * @brief
+ * Free the storage of an MPMC ring.
+ *
+ * @discussion
+ * The ring must be empty, and no producer or consumer may use it anymore.
+ */
+void
+mpmc_ring_destroy(mpmc_ring_t ring);
+
+/*!
+ * @function mpmc_ring_enqueue
+ *
+ * @brief
+ * Enqueue an element onto an MPMC ring.
+ *
+ * @param ring
+ * The ring to enqueue onto.
+ *
+ * @param elm
+ * The element to enqueue, which must not be NULL.
+ *
+ * @returns
+ * false if the ring was full, true otherwise.
+ */
+bool
+mpmc_ring_enqueue(mpmc_ring_t ring, void *elm);
+
+/*!
+ * @function mpmc_ring_dequeue
+ *
+ * @brief
+ * Dequeue an element from an MPMC ring.
+ *
+ * @returns
+ * The oldest element in the ring, or NULL if the ring was empty.
+ */
+void *
+mpmc_ring_dequeue(mpmc_ring_t ring);
+
+/*!
+ * @function mpmc_ring_empty
+ *
+ * @brief
+ * Returns whether the ring was empty at the time of the call.
+ *
+ * @discussion
+ * This is only a hint: producers can enqueue concurrently.
+ */
+static inline bool
+mpmc_ring_empty(mpmc_ring_t ring)
+{
+	return os_atomic_load(&ring->mpr_enqueue_pos, relaxed) ==
+	       os_atomic_load(&ring->mpr_dequeue_pos, relaxed);
+}
+
+
+#pragma mark tests
+#if DEBUG || DEVELOPMENT
+
+int
+mpmc_test_ring(uint64_t count, uint64_t *out);
+
+#endif /* DEBUG || DEVELOPMENT */
+
+#endif /* XNU_KERNEL_PRIVATE */
+
+__END_DECLS
+
+#endif /* _KERN_MPMC_QUEUE_H_ */
@@ -132,7 +132,7 @@ const mach_trap_t       mach_trap_table[MACH_TRAP_TABLE_COUNT] = {
 /* 27 */ MACH_TRAP(thread_self_trap, 0, 0, NULL),
 /* 28 */ MACH_TRAP(task_self_trap, 0, 0, NULL),
 /* 29 */ MACH_TRAP(host_self_trap, 0, 0, NULL),
-/* 30 */ MACH_TRAP(kern_invalid, 0, 0, NULL),
+/* 30 */ MACH_TRAP(mach_msg_vector_trap, 6, 6, munge_wwwwww),
 /* 31 */ MACH_TRAP(mach_msg_trap, 7, 7, munge_wwwwwww),
 /* 32 */ MACH_TRAP(mach_msg_overwrite_trap, 8, 8, munge_wwwwwwww),
 /* 33 */ MACH_TRAP(semaphore_signal_trap, 1, 1, munge_w),
@@ -156,9 +156,9 @@ const mach_trap_t       mach_trap_table[MACH_TRAP_TABLE_COUNT] = {
 /* 51 */ MACH_TRAP(macx_triggers, 4, 4, munge_wwww),
 /* 52 */ MACH_TRAP(macx_backing_store_suspend, 1, 1, munge_w),
 /* 53 */ MACH_TRAP(macx_backing_store_recovery, 1, 1, munge_w),
-/* 54 */ MACH_TRAP(kern_invalid, 0, 0, NULL),
-/* 55 */ MACH_TRAP(kern_invalid, 0, 0, NULL),
-/* 56 */ MACH_TRAP(kern_invalid, 0, 0, NULL),
+/* 54 */ MACH_TRAP(mach_port_shm_ring_map_trap, 3, 3, munge_www),
+/* 55 */ MACH_TRAP(mach_port_shm_ring_wait_trap, 2, 2, munge_ww),
+/* 56 */ MACH_TRAP(mach_port_shm_ring_signal_trap, 1, 1, munge_w),
 /* 57 */ MACH_TRAP(kern_invalid, 0, 0, NULL),
 /* 58 */ MACH_TRAP(pfz_exit, 0, 0, NULL),
 /* 59 */ MACH_TRAP(swtch_pri, 0, 0, NULL),
@@ -267,7 +267,7 @@ const char * mach_syscall_name_table[MACH_TRAP_TABLE_COUNT] = {
 /* 27 */ "thread_self_trap",
 /* 28 */ "task_self_trap",
 /* 29 */ "host_self_trap",
-/* 30 */ "kern_invalid",
+/* 30 */ "mach_msg_vector_trap",
 /* 31 */ "mach_msg_trap",
 /* 32 */ "mach_msg_overwrite_trap",
 /* 33 */ "semaphore_signal_trap",
@@ -291,9 +291,9 @@ const char * mach_syscall_name_table[MACH_TRAP_TABLE_COUNT] = {
 /* 51 */ "macx_triggers",
 /* 52 */ "macx_backing_store_suspend",
 /* 53 */ "macx_backing_store_recovery",
-/* 54 */ "kern_invalid",
-/* 55 */ "kern_invalid",
-/* 56 */ "kern_invalid",
+/* 54 */ "mach_port_shm_ring_map_trap",
+/* 55 */ "mach_port_shm_ring_wait_trap",
+/* 56 */ "mach_port_shm_ring_signal_trap",
 /* 57 */ "kern_invalid",
 /* 58 */ "pfz_exit",
 /* 59 */ "swtch_pri",
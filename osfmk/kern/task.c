@@ -1559,6 +1559,8 @@ task_create_internal(
 		new_task->cow_faults = 0;
 		new_task->messages_sent = 0;
 		new_task->messages_received = 0;
+		new_task->ipc_inline_bytes_copied = 0;
+		new_task->ipc_inline_bytes_remapped = 0;
 		new_task->syscalls_mach = 0;
 		new_task->syscalls_unix = 0;
 		new_task->c_switch = 0;
@@ -1701,6 +1703,8 @@ task_rollup_accounting_info(task_t to_task, task_t from_task)
 	to_task->decompressions = from_task->decompressions;
 	to_task->messages_sent = from_task->messages_sent;
 	to_task->messages_received = from_task->messages_received;
+	to_task->ipc_inline_bytes_copied = from_task->ipc_inline_bytes_copied;
+	to_task->ipc_inline_bytes_remapped = from_task->ipc_inline_bytes_remapped;
 	to_task->syscalls_mach = from_task->syscalls_mach;
 	to_task->syscalls_unix = from_task->syscalls_unix;
 	to_task->c_switch = from_task->c_switch;
@@ -5336,6 +5340,28 @@ task_info(
 		break;
 #endif /* DEVELOPMENT || DEBUG */
 	}
+	case TASK_IPC_COPY_INFO:
+	{
+		task_ipc_copy_info_t copy_info;
+		thread_t thread;
+
+		if (*task_info_count < TASK_IPC_COPY_INFO_COUNT) {
+			error = KERN_INVALID_ARGUMENT;
+			break;
+		}
+
+		copy_info = (task_ipc_copy_info_t)task_info_out;
+		copy_info->inline_bytes_copied = task->ipc_inline_bytes_copied;
+		copy_info->inline_bytes_remapped = task->ipc_inline_bytes_remapped;
+
+		queue_iterate(&task->threads, thread, thread_t, task_threads) {
+			copy_info->inline_bytes_copied += thread->ipc_inline_bytes_copied;
+			copy_info->inline_bytes_remapped += thread->ipc_inline_bytes_remapped;
+		}
+
+		*task_info_count = TASK_IPC_COPY_INFO_COUNT;
+		break;
+	}
 	default:
 		error = KERN_INVALID_ARGUMENT;
 	}
@@ -240,6 +240,8 @@ struct task {
 	integer_t cow_faults;          /* copy on write fault counter */
 	integer_t messages_sent;       /* messages sent counter */
 	integer_t messages_received;   /* messages received counter */
+	uint64_t ipc_inline_bytes_copied;   /* inline message bytes copied in, by dead threads */
+	uint64_t ipc_inline_bytes_remapped; /* inline message bytes remapped COW, by dead threads */
 	integer_t syscalls_mach;       /* mach system call counter */
 	integer_t syscalls_unix;       /* unix system call counter */
 	uint32_t  c_switch;                                /* total context switches */
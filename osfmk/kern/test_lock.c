@@ -26,6 +26,8 @@ static lck_grp_t        test_mtx_grp;
 static lck_grp_attr_t   test_mtx_grp_attr;
 static lck_attr_t       test_mtx_attr;
 
+static lck_rw_t         test_rw;
+
 static lck_grp_t        test_mtx_stats_grp;
 static lck_grp_attr_t   test_mtx_stats_grp_attr;
 static lck_attr_t       test_mtx_stats_attr;
@@ -258,6 +260,7 @@ lck_mtx_test_init(void)
 		lck_grp_init(&test_mtx_grp, "testlck_mtx", &test_mtx_grp_attr);
 		lck_attr_setdefault(&test_mtx_attr);
 		lck_mtx_init(&test_mtx, &test_mtx_grp, &test_mtx_attr);
+		lck_rw_init(&test_rw, &test_mtx_grp, &test_mtx_attr);
 
 		init_test_mtx_stats();
 
@@ -1022,3 +1025,56 @@ lck_mtx_test_mtx_contended_loop_time(
 
 	return ret;
 }
+
+/*
+ * Takes test_rw exclusively and holds it for hold_ms milliseconds,
+ * sleeping in 1ms steps. Returns the highest scheduling priority
+ * observed while holding the lock, which shows whether writers
+ * blocked behind us pushed on us through the turnstile.
+ */
+int
+lck_rw_test_hold_exclusive(int hold_ms)
+{
+	thread_t thread = current_thread();
+	int max_pri;
+
+	lck_rw_lock_exclusive(&test_rw);
+
+	max_pri = thread->sched_pri;
+	for (int i = 0; i < hold_ms; i++) {
+		assert_wait_timeout((event_t)&test_rw, THREAD_UNINT, 1, NSEC_PER_MSEC);
+		(void) thread_block(THREAD_CONTINUE_NULL);
+		if (thread->sched_pri > max_pri) {
+			max_pri = thread->sched_pri;
+		}
+	}
+
+	lck_rw_unlock_exclusive(&test_rw);
+
+	return max_pri;
+}
+
+/*
+ * Takes test_rw shared iter times, holding it for 50us each time so
+ * that concurrent callers overlap their shared holds.
+ * Returns the longest time (in ns) it took to get the lock.
+ */
+uint64_t
+lck_rw_test_shared_max_wait(int iter)
+{
+	uint64_t start, wait, max_wait = 0;
+
+	for (int i = 0; i < iter; i++) {
+		start = mach_absolute_time();
+		lck_rw_lock_shared(&test_rw);
+		wait = mach_absolute_time() - start;
+		delay(50);
+		lck_rw_unlock_shared(&test_rw);
+		if (wait > max_wait) {
+			max_wait = wait;
+		}
+	}
+
+	absolutetime_to_nanoseconds(max_wait, &max_wait);
+	return max_wait;
+}
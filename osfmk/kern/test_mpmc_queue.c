@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <machine/machine_cpu.h>
+#include <kern/locks.h>
+#include <kern/mpmc_queue.h>
+#include <kern/thread.h>
+
+#if !DEBUG && !DEVELOPMENT
+#error "Test only file"
+#endif
+
+#include <sys/errno.h>
+
+#define MPMC_TEST_PRODUCERS     4
+#define MPMC_TEST_CONSUMERS     4
+#define MPMC_TEST_CAPACITY      256
+
+struct mpmc_test_ctx {
+	struct mpmc_ring        ring;
+	uint64_t                count;
+	uint64_t _Atomic        consumed;
+	uint64_t _Atomic        sum;
+	uint32_t _Atomic        next_id;
+	uint32_t _Atomic        running;
+	uint64_t                end;
+};
+
+static void
+mpmc_test_account(struct mpmc_test_ctx *ctx, void *elm)
+{
+	os_atomic_add(&ctx->sum, (uint64_t)(uintptr_t)elm, relaxed);
+	os_atomic_inc(&ctx->consumed, relaxed);
+}
+
+static void
+mpmc_test_thread_done(struct mpmc_test_ctx *ctx)
+{
+	if (os_atomic_dec(&ctx->running, relaxed) == 0) {
+		ctx->end = mach_absolute_time();
+		thread_wakeup(ctx);
+	}
+}
+
+static void
+mpmc_test_ring_producer(void *arg, wait_result_t wr __unused)
+{
+	struct mpmc_test_ctx *ctx = arg;
+	uint64_t per = ctx->count / MPMC_TEST_PRODUCERS;
+	uint64_t base = os_atomic_inc_orig(&ctx->next_id, relaxed) * per;
+
+	for (uint64_t i = 1; i <= per; i++) {
+		while (!mpmc_ring_enqueue(&ctx->ring, (void *)(uintptr_t)(base + i))) {
+			thread_yield_to_preemption();
+		}
+	}
+
+	mpmc_test_thread_done(ctx);
+}
+
+static void
+mpmc_test_ring_consumer(void *arg, wait_result_t wr __unused)
+{
+	struct mpmc_test_ctx *ctx = arg;
+	void *elm;
+
+	while (os_atomic_load(&ctx->consumed, relaxed) < ctx->count) {
+		elm = mpmc_ring_dequeue(&ctx->ring);
+		if (elm) {
+			mpmc_test_account(ctx, elm);
+		} else {
+			thread_yield_to_preemption();
+		}
+	}
+
+	mpmc_test_thread_done(ctx);
+}
+
+static void
+mpmc_test_start(struct mpmc_test_ctx *ctx, thread_continue_t fn, int n)
+{
+	kern_return_t kr;
+	thread_t th;
+
+	for (int i = 0; i < n; i++) {
+		kr = kernel_thread_start_priority(fn, ctx, MINPRI_KERNEL, &th);
+		if (kr != KERN_SUCCESS) {
+			panic("mpmc_test: unable to create thread: %x", kr);
+		}
+		thread_deallocate(th);
+	}
+}
+
+/*
+ * Runs `n1` threads of `fn1` and `n2` threads of `fn2` to completion, and
+ * checks that every element in [1, count] was consumed exactly once.
+ */
+static int
+mpmc_test_run(const char *name, struct mpmc_test_ctx *ctx,
+    thread_continue_t fn1, int n1, thread_continue_t fn2, int n2,
+    uint64_t *out)
+{
+	uint64_t start, expected;
+	wait_result_t wr;
+
+	assert_wait_timeout(ctx, THREAD_UNINT, 30000, 1000 * NSEC_PER_USEC);
+	start = mach_absolute_time();
+	mpmc_test_start(ctx, fn1, n1);
+	mpmc_test_start(ctx, fn2, n2);
+
+	wr = thread_block(THREAD_CONTINUE_NULL);
+	if (wr == THREAD_TIMED_OUT) {
+		panic("%s: timed out: ctx:%p", name, ctx);
+	}
+
+	expected = ctx->count * (ctx->count + 1) / 2;
+	if (ctx->consumed != ctx->count || ctx->sum != expected) {
+		panic("%s: consumed %lld elements summing to %lld, expected %lld/%lld",
+		    name, ctx->consumed, ctx->sum, ctx->count, expected);
+	}
+
+	absolutetime_to_nanoseconds(ctx->end - start, out);
+	printf("%s: %lld elements in %lld ns (%lld ns/element)\n",
+	    name, ctx->count, *out, *out / ctx->count);
+	return 0;
+}
+
+/*
+ * MPMC_TEST_PRODUCERS threads push `count` elements through a small ring
+ * drained by MPMC_TEST_CONSUMERS threads.
+ *
+ * The ring is kept small so that both the ring full and ring empty paths are
+ * exercised, and the test will panic if any element is lost or duplicated.
+ */
+int
+mpmc_test_ring(uint64_t count, uint64_t *out)
+{
+	struct mpmc_test_ctx ctx = { };
+	int rc;
+
+	if (count < 1000 || count > 10 * 1000 * 1000) {
+		return EINVAL;
+	}
+
+	ctx.count = count - count % MPMC_TEST_PRODUCERS;
+	os_atomic_init(&ctx.running, MPMC_TEST_PRODUCERS + MPMC_TEST_CONSUMERS);
+	if (mpmc_ring_init(&ctx.ring, MPMC_TEST_CAPACITY) != KERN_SUCCESS) {
+		return ENOMEM;
+	}
+
+	rc = mpmc_test_run("mpmc_test_ring", &ctx,
+	    mpmc_test_ring_consumer, MPMC_TEST_CONSUMERS,
+	    mpmc_test_ring_producer, MPMC_TEST_PRODUCERS, out);
+
+	mpmc_ring_destroy(&ctx.ring);
+	return rc;
+}
@@ -136,6 +136,7 @@
 
 #include <ipc/ipc_kmsg.h>
 #include <ipc/ipc_port.h>
+#include <ipc/ipc_voucher.h>
 #include <bank/bank_types.h>
 
 #include <vm/vm_kern.h>
@@ -382,6 +383,8 @@ thread_bootstrap(void)
 
 	thread_template.syscalls_unix = 0;
 	thread_template.syscalls_mach = 0;
+	thread_template.ipc_inline_bytes_copied = 0;
+	thread_template.ipc_inline_bytes_remapped = 0;
 
 	thread_template.t_ledger = LEDGER_NULL;
 	thread_template.t_threadledger = LEDGER_NULL;
@@ -409,6 +412,12 @@ thread_bootstrap(void)
 
 	thread_template.ith_voucher_name = MACH_PORT_NULL;
 	thread_template.ith_voucher = IPC_VOUCHER_NULL;
+	for (int i = 0; i < IVC_COUNT; i++) {
+		thread_template.ith_voucher_cache[i].ivc_in = IPC_VOUCHER_NULL;
+		thread_template.ith_voucher_cache[i].ivc_out = IPC_VOUCHER_NULL;
+		thread_template.ith_voucher_cache[i].ivc_gen = 0;
+		thread_template.ith_voucher_cache[i].ivc_app = FALSE;
+	}
 
 	thread_template.th_work_interval = NULL;
 
@@ -543,6 +552,9 @@ thread_terminate_self(void)
 
 	bank_swap_thread_bank_ledger(thread, NULL);
 
+	/* don't keep cached vouchers (and their bank references) until deallocation */
+	ipc_voucher_cache_flush(thread);
+
 	if (kdebug_enable && bsd_hasthreadname(thread->uthread)) {
 		char threadname[MAXTHREADNAMESIZE];
 		bsd_getthreadname(thread->uthread, threadname);
@@ -775,6 +787,7 @@ thread_deallocate_complete(
 	if (IPC_VOUCHER_NULL != thread->ith_voucher) {
 		ipc_voucher_release(thread->ith_voucher);
 	}
+	ipc_voucher_cache_flush(thread);
 
 	if (thread->thread_io_stats) {
 		kfree(thread->thread_io_stats, sizeof(struct io_stat_info));
@@ -894,6 +907,8 @@ thread_copy_resource_info(
 	dst_thread->vtimer_qos_save = src_thread->vtimer_qos_save;
 	dst_thread->syscalls_unix = src_thread->syscalls_unix;
 	dst_thread->syscalls_mach = src_thread->syscalls_mach;
+	dst_thread->ipc_inline_bytes_copied = src_thread->ipc_inline_bytes_copied;
+	dst_thread->ipc_inline_bytes_remapped = src_thread->ipc_inline_bytes_remapped;
 	ledger_rollup(dst_thread->t_threadledger, src_thread->t_threadledger);
 	*dst_thread->thread_io_stats = *src_thread->thread_io_stats;
 }
@@ -944,6 +959,9 @@ thread_terminate_queue_invoke(mpsc_queue_chain_t e,
 	task->syscalls_unix += thread->syscalls_unix;
 	task->syscalls_mach += thread->syscalls_mach;
 
+	task->ipc_inline_bytes_copied += thread->ipc_inline_bytes_copied;
+	task->ipc_inline_bytes_remapped += thread->ipc_inline_bytes_remapped;
+
 	task->task_timer_wakeups_bin_1 += thread->thread_timer_wakeups_bin_1;
 	task->task_timer_wakeups_bin_2 += thread->thread_timer_wakeups_bin_2;
 	task->task_gpu_ns += ml_gpu_stat(thread);
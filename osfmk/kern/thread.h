@@ -565,6 +565,8 @@ struct thread {
 	/* Statistics accumulated per-thread and aggregated per-task */
 	uint32_t                syscalls_unix;
 	uint32_t                syscalls_mach;
+	uint64_t                ipc_inline_bytes_copied;   /* inline message bytes copied in */
+	uint64_t                ipc_inline_bytes_remapped; /* inline message bytes remapped COW */
 	ledger_t                t_ledger;
 	ledger_t                t_threadledger; /* per thread ledger */
 	ledger_t                t_bankledger;                /* ledger to charge someone */
@@ -618,6 +620,7 @@ struct thread {
 
 	mach_port_name_t                ith_voucher_name;
 	ipc_voucher_t                   ith_voucher;
+	struct ipc_voucher_cache        ith_voucher_cache[IVC_COUNT];
 #if CONFIG_IOSCHED
 	void                            *decmp_upl;
 #endif /* CONFIG_IOSCHED */
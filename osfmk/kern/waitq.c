@@ -489,11 +489,16 @@ typedef int (*wql_callback_func)(struct waitq *waitq, void *ctx,
  *	   is 'FULL_DAG' (full directed-acyclic-graph), then try to lock
  *	   the associated waitq set object and recursively walk all sets to
  *	   which that set belongs. This is a DFS of the tree structure.
- *	*) recurse down the left side of the tree (following the
- *	   'left_setid' pointer in the link object
- *	*) recurse down the right side of the tree (following the
- *	   'right_setid' pointer in the link object
+ *	*) continue down the right side of the tree (following the
+ *	   'right_setid' pointer in the link object), and remember the
+ *	   left side (the 'left_setid' pointer) to walk once the right
+ *	   spine ends
+ *
+ *	Both sides of the tree are walked iteratively, so the stack depth
+ *	only grows with the nesting of sets within sets.
  */
+#define WQL_WALK_PENDING        16
+
 static __attribute__((noinline))
 int
 walk_waitq_links(int walk_type, struct waitq *waitq,
@@ -501,101 +506,126 @@ walk_waitq_links(int walk_type, struct waitq *waitq,
     void *ctx, wql_callback_func cb)
 {
 	struct waitq_link *link;
-	uint64_t nextid;
+	uint64_t leftid, nextid;
+	uint64_t pending[WQL_WALK_PENDING];
+	int npending = 0;
 	int wqltype;
 
-	link = wql_get_link(setid);
-
-	/* invalid link */
-	if (!link) {
-		return WQ_ITERATE_CONTINUE;
-	}
-
-	setid = nextid = 0;
-	wqltype = wql_type(link);
-	if (wqltype == WQL_LINK) {
-		setid  = link->wql_link.left_setid;
-		nextid = link->wql_link.right_setid;
-	}
-
 	/*
-	 * Make the callback only on specified link_type (or all links)
-	 * Note that after the callback, the link object may be
-	 * invalid. The only valid thing we can do is put our
-	 * reference to it (which may put it back on the free list)
+	 * waitq_link_internal() always hangs the previous root off the
+	 * right side of a new LINK object, so a waitq that is a member of
+	 * N sets produces a right spine of N LINK objects whose left
+	 * children are (almost always) leaves. Follow that spine in a loop,
+	 * and keep the left children on a small stack of pending subtrees,
+	 * only recursing when it is full: this keeps the stack depth
+	 * constant no matter how many sets a waitq belongs to.
+	 *
+	 * The walk itself is still linear in the number of sets: each step
+	 * takes a reference on a table object, and wakeups still lock every
+	 * member set.
 	 */
-	if (link_type == WQL_ALL || link_type == wqltype) {
-		/* allow the callback to early-out */
-		int ret = cb(waitq, ctx, link);
-		if (ret != WQ_ITERATE_CONTINUE) {
-			wql_put_link(link);
-			return ret;
-		}
-	}
+	for (;;) {
+		leftid = nextid = 0;
+		link = wql_get_link(setid);
 
-	if (wqltype == WQL_WQS &&
-	    (walk_type == LINK_WALK_FULL_DAG ||
-	    walk_type == LINK_WALK_FULL_DAG_UNLOCKED)) {
-		/*
-		 * Recurse down any sets to which this wait queue set was
-		 * added.  We do this just before we put our reference to
-		 * the link object (which may free it).
-		 */
-		struct waitq_set *wqset = link->wql_wqs.wql_set;
-		int ret = WQ_ITERATE_CONTINUE;
-		int should_unlock = 0;
-		uint64_t wqset_setid = 0;
+		/* invalid link */
+		if (!link) {
+			goto next;
+		}
 
-		if (waitq_set_is_valid(wqset) && walk_type == LINK_WALK_FULL_DAG) {
-			assert(!waitq_irq_safe(&wqset->wqset_q));
-			waitq_set_lock(wqset);
-			should_unlock = 1;
+		wqltype = wql_type(link);
+		if (wqltype == WQL_LINK) {
+			leftid = link->wql_link.left_setid;
+			nextid = link->wql_link.right_setid;
 		}
 
 		/*
-		 * verify the linked waitq set as it could have been
-		 * invalidated before we grabbed the lock!
+		 * Make the callback only on specified link_type (or all links)
+		 * Note that after the callback, the link object may be
+		 * invalid. The only valid thing we can do is put our
+		 * reference to it (which may put it back on the free list)
 		 */
-		if (wqset->wqset_id != link->wql_setid.id) {
-			/* This is the bottom of the tree: just get out */
-			if (should_unlock) {
-				waitq_set_unlock(wqset);
+		if (link_type == WQL_ALL || link_type == wqltype) {
+			/* allow the callback to early-out */
+			int ret = cb(waitq, ctx, link);
+			if (ret != WQ_ITERATE_CONTINUE) {
+				wql_put_link(link);
+				return ret;
 			}
-			wql_put_link(link);
-			return WQ_ITERATE_CONTINUE;
 		}
 
-		wqset_setid = wqset->wqset_q.waitq_set_id;
+		if (wqltype == WQL_WQS &&
+		    (walk_type == LINK_WALK_FULL_DAG ||
+		    walk_type == LINK_WALK_FULL_DAG_UNLOCKED)) {
+			/*
+			 * Recurse down any sets to which this wait queue set was
+			 * added.  We do this just before we put our reference to
+			 * the link object (which may free it).
+			 */
+			struct waitq_set *wqset = link->wql_wqs.wql_set;
+			int ret = WQ_ITERATE_CONTINUE;
+			int should_unlock = 0;
+			uint64_t wqset_setid = 0;
+
+			if (waitq_set_is_valid(wqset) && walk_type == LINK_WALK_FULL_DAG) {
+				assert(!waitq_irq_safe(&wqset->wqset_q));
+				waitq_set_lock(wqset);
+				should_unlock = 1;
+			}
 
-		if (wqset_setid > 0) {
-			ret = walk_waitq_links(walk_type, &wqset->wqset_q,
-			    wqset_setid, link_type, ctx, cb);
-		}
-		if (should_unlock) {
-			waitq_set_unlock(wqset);
-		}
-		if (ret != WQ_ITERATE_CONTINUE) {
-			wql_put_link(link);
-			return ret;
+			/*
+			 * verify the linked waitq set as it could have been
+			 * invalidated before we grabbed the lock!
+			 */
+			if (wqset->wqset_id != link->wql_setid.id) {
+				/* This is the bottom of the tree: just get out */
+				if (should_unlock) {
+					waitq_set_unlock(wqset);
+				}
+				wql_put_link(link);
+				goto next;
+			}
+
+			wqset_setid = wqset->wqset_q.waitq_set_id;
+
+			if (wqset_setid > 0) {
+				ret = walk_waitq_links(walk_type, &wqset->wqset_q,
+				    wqset_setid, link_type, ctx, cb);
+			}
+			if (should_unlock) {
+				waitq_set_unlock(wqset);
+			}
+			if (ret != WQ_ITERATE_CONTINUE) {
+				wql_put_link(link);
+				return ret;
+			}
 		}
-	}
 
-	wql_put_link(link);
+		wql_put_link(link);
 
-	/* recurse down left side of the tree */
-	if (setid) {
-		int ret = walk_waitq_links(walk_type, waitq, setid, link_type, ctx, cb);
-		if (ret != WQ_ITERATE_CONTINUE) {
-			return ret;
+		/* walk the left side of the tree once the right side is done */
+		if (leftid) {
+			if (npending < WQL_WALK_PENDING) {
+				pending[npending++] = leftid;
+			} else {
+				int ret = walk_waitq_links(walk_type, waitq, leftid,
+				    link_type, ctx, cb);
+				if (ret != WQ_ITERATE_CONTINUE) {
+					return ret;
+				}
+			}
 		}
-	}
 
-	/* recurse down right side of the tree */
-	if (nextid) {
-		return walk_waitq_links(walk_type, waitq, nextid, link_type, ctx, cb);
+next:
+		/* iterate down right side of the tree, then the pending left sides */
+		if (nextid) {
+			setid = nextid;
+		} else if (npending > 0) {
+			setid = pending[--npending];
+		} else {
+			return WQ_ITERATE_CONTINUE;
+		}
 	}
-
-	return WQ_ITERATE_CONTINUE;
 }
 
 /* ----------------------------------------------------------------------
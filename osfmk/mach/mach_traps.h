@@ -113,6 +113,14 @@ extern mach_msg_return_t mach_msg_overwrite_trap(
 	mach_msg_header_t *rcv_msg,
 	mach_msg_size_t rcv_limit);
 
+extern mach_msg_return_t mach_msg_vector_trap(
+	mach_msg_vector_t *vector,
+	mach_msg_size_t count,
+	mach_msg_option_t option,
+	mach_port_name_t rcv_name,
+	mach_msg_timeout_t timeout,
+	mach_msg_size_t *processed);
+
 extern kern_return_t semaphore_signal_trap(
 	mach_port_name_t signal_name);
 
@@ -141,6 +149,18 @@ extern kern_return_t semaphore_timedwait_signal_trap(
 	unsigned int sec,
 	clock_res_t nsec);
 
+extern kern_return_t mach_port_shm_ring_map_trap(
+	mach_port_name_t name,
+	mach_vm_address_t *address,
+	mach_port_shm_ring_t *info);
+
+extern kern_return_t mach_port_shm_ring_wait_trap(
+	mach_port_name_t name,
+	mach_msg_timeout_t timeout);
+
+extern kern_return_t mach_port_shm_ring_signal_trap(
+	mach_port_name_t name);
+
 #endif  /* PRIVATE */
 
 extern kern_return_t clock_sleep_trap(
@@ -450,6 +470,17 @@ extern mach_msg_return_t mach_msg_trap(
 extern mach_msg_return_t mach_msg_overwrite_trap(
 	struct mach_msg_overwrite_trap_args *args);
 
+struct mach_msg_vector_trap_args {
+	PAD_ARG_(user_addr_t, vector);
+	PAD_ARG_(mach_msg_size_t, count);
+	PAD_ARG_(mach_msg_option_t, option);
+	PAD_ARG_(mach_port_name_t, rcv_name);
+	PAD_ARG_(mach_msg_timeout_t, timeout);
+	PAD_ARG_(user_addr_t, processed);
+};
+extern mach_msg_return_t mach_msg_vector_trap(
+	struct mach_msg_vector_trap_args *args);
+
 struct semaphore_signal_trap_args {
 	PAD_ARG_(mach_port_name_t, signal_name);
 };
@@ -499,6 +530,27 @@ struct semaphore_timedwait_signal_trap_args {
 extern kern_return_t semaphore_timedwait_signal_trap(
 	struct semaphore_timedwait_signal_trap_args *args);
 
+struct mach_port_shm_ring_map_trap_args {
+	PAD_ARG_(mach_port_name_t, name);
+	PAD_ARG_(user_addr_t, address);
+	PAD_ARG_(user_addr_t, info);
+};
+extern kern_return_t mach_port_shm_ring_map_trap(
+	struct mach_port_shm_ring_map_trap_args *args);
+
+struct mach_port_shm_ring_wait_trap_args {
+	PAD_ARG_(mach_port_name_t, name);
+	PAD_ARG_(mach_msg_timeout_t, timeout);
+};
+extern kern_return_t mach_port_shm_ring_wait_trap(
+	struct mach_port_shm_ring_wait_trap_args *args);
+
+struct mach_port_shm_ring_signal_trap_args {
+	PAD_ARG_(mach_port_name_t, name);
+};
+extern kern_return_t mach_port_shm_ring_signal_trap(
+	struct mach_port_shm_ring_signal_trap_args *args);
+
 struct task_for_pid_args {
 	PAD_ARG_(mach_port_name_t, target_tport);
 	PAD_ARG_(int, pid);
@@ -670,6 +670,23 @@ typedef union{
  */
 #define MACH_MSG_SIZE_RELIABLE  ((mach_msg_size_t) 256 * 1024)
 #endif
+
+#ifdef PRIVATE
+/*
+ *  Element of the message vector passed to mach_msg_vector_trap().
+ *
+ *  msgv_data points at the message buffer.  For a send, msgv_send_size
+ *  is the size of the message to send; for a receive, msgv_rcv_size is
+ *  the size of the buffer the message is received into.
+ */
+typedef struct {
+	mach_vm_address_t       msgv_data;
+	mach_msg_size_t         msgv_send_size;
+	mach_msg_size_t         msgv_rcv_size;
+} mach_msg_vector_t;
+
+#define MACH_MSG_VECTOR_MAX     64
+#endif /* PRIVATE */
 /*
  *  Compatibility definitions, for code written
  *  when there was a msgh_kind instead of msgh_seqno.
@@ -367,6 +367,12 @@ typedef int     mach_port_flavor_t;
 #define MACH_PORT_IMPORTANCE_RECEIVER   5       /* indicates recieve right accepts priority donation */
 #define MACH_PORT_DENAP_RECEIVER        6       /* indicates receive right accepts de-nap donation */
 #define MACH_PORT_INFO_EXT              7       /* uses mach_port_info_ext_t */
+#ifdef PRIVATE
+#define MACH_PORT_SHM_RING              8       /* uses mach_port_shm_ring_t */
+#define MACH_PORT_IPC_STATS             9       /* uses mach_port_ipc_stats_t */
+#define MACH_PORT_IPC_LATENCY_HISTOGRAM 10      /* uses mach_port_ipc_histogram_t */
+#define MACH_PORT_IPC_SIZE_HISTOGRAM    11      /* uses mach_port_ipc_histogram_t */
+#endif /* PRIVATE */
 
 #define MACH_PORT_LIMITS_INFO_COUNT     ((natural_t) \
 	(sizeof(mach_port_limits_t)/sizeof(natural_t)))
@@ -375,6 +381,59 @@ typedef int     mach_port_flavor_t;
 #define MACH_PORT_DNREQUESTS_SIZE_COUNT 1
 #define MACH_PORT_INFO_EXT_COUNT        ((natural_t) \
 	(sizeof(mach_port_info_ext_t)/sizeof(natural_t)))
+
+#ifdef PRIVATE
+/*
+ * Geometry of the shared memory ring attached to a receive right with
+ * MACH_PORT_SHM_RING (see <mach/shm_ring.h>).
+ */
+typedef struct mach_port_shm_ring {
+	uint32_t                msr_entry_size;  /* max payload bytes per entry */
+	uint32_t                msr_entry_count; /* number of entries, power of 2 */
+	uint32_t                msr_flags;       /* MACH_PORT_SHM_RING_* */
+	uint32_t                reserved;
+} mach_port_shm_ring_t;
+
+#define MACH_PORT_SHM_RING_SPSC         0x0     /* a single sender thread, of a single task, may use the ring */
+#define MACH_PORT_SHM_RING_MPSC         0x1     /* any send right holder may map the ring, and read it */
+
+#define MACH_PORT_SHM_RING_COUNT        ((natural_t) \
+	(sizeof(mach_port_shm_ring_t)/sizeof(natural_t)))
+
+/*
+ * Message flow statistics kept for every receive right once it has
+ * received a sampled message (1 in mpis_sample_rate messages).
+ * mpis_messages and mpis_depth_max count every message from then on,
+ * the histograms only count sampled messages.
+ */
+typedef struct mach_port_ipc_stats {
+	uint64_t                mpis_messages;    /* messages queued */
+	uint32_t                mpis_sampled;     /* messages in the histograms */
+	uint32_t                mpis_depth_max;   /* queue depth high-watermark */
+	uint32_t                mpis_sample_rate; /* 0 if statistics are off */
+	uint32_t                reserved[3];
+} mach_port_ipc_stats_t;
+
+/*
+ * Latency histogram: bucket 0 counts messages dequeued less than 1us
+ * after they were queued, bucket n (n > 0) those dequeued after
+ * [2^(n-1), 2^n) us, the last bucket everything slower.
+ *
+ * Size histogram: bucket 0 counts messages of less than 64 bytes,
+ * bucket n those of [2^(n+5), 2^(n+6)) bytes, the last bucket
+ * everything larger.  Sizes are those of the inline message.
+ */
+#define MACH_PORT_IPC_HISTOGRAM_BUCKETS 16
+
+typedef struct mach_port_ipc_histogram {
+	uint32_t                mpih_buckets[MACH_PORT_IPC_HISTOGRAM_BUCKETS];
+} mach_port_ipc_histogram_t;
+
+#define MACH_PORT_IPC_STATS_COUNT       ((natural_t) \
+	(sizeof(mach_port_ipc_stats_t)/sizeof(natural_t)))
+#define MACH_PORT_IPC_HISTOGRAM_COUNT   ((natural_t) \
+	(sizeof(mach_port_ipc_histogram_t)/sizeof(natural_t)))
+#endif /* PRIVATE */
 /*
  * Structure used to pass information about port allocation requests.
  * Must be padded to 64-bits total length.
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ *	File:	mach/shm_ring.h
+ *
+ *	Layout of the shared memory ring that can be attached to a receive
+ *	right with the MACH_PORT_SHM_RING port attribute.
+ *
+ *	The ring is set up by the kernel and mapped into the receiver and
+ *	sender tasks with mach_port_shm_ring_map() (which wraps
+ *	mach_port_shm_ring_map_trap()).  Simple messages
+ *	(no port rights or out-of-line memory) are then exchanged entirely
+ *	in user space.  The kernel is only entered to block the receiver
+ *	when the ring is empty (mach_port_shm_ring_wait_trap()) and to wake
+ *	it up again (mach_port_shm_ring_signal_trap()), which a sender only
+ *	does when it finds msr_waiting set.
+ *
+ *	Entries are handed over with per-entry sequence numbers, which
+ *	makes the ring safe for several sender threads or tasks
+ *	(MACH_PORT_SHM_RING_MPSC) and one receiver.  The memory starts out
+ *	zero filled, so mss_seq is kept relative to the entry index.
+ *
+ *	A MACH_PORT_SHM_RING_SPSC ring claims msr_tail with a plain store,
+ *	so it must have a single sending thread.  The kernel only limits
+ *	it to one sender task: if more than one thread of that task sends,
+ *	the task has to serialize them itself, or use an MPSC ring.  The
+ *	same goes for receiving: only one thread may receive at a time.
+ *
+ *	All senders of an MPSC ring map the same memory, with read and
+ *	write access, so any of them can read (or overwrite) what the
+ *	others queued until the receiver drains it.  Only use an MPSC ring
+ *	between senders that may see each other's messages, and use a port
+ *	per sender otherwise.
+ *
+ *	Every task that maps the ring can write all of it, so nothing in
+ *	it is trusted to locate memory: the geometry comes back from the
+ *	map trap and is kept in the caller's private mach_shm_ring_t, and
+ *	indices and sizes read from the ring are masked or clamped to it.
+ */
+
+#ifndef _MACH_SHM_RING_H_
+#define _MACH_SHM_RING_H_
+
+#include <stdint.h>
+#include <mach/port.h>
+#include <mach/message.h>
+#include <sys/cdefs.h>
+
+#ifdef PRIVATE
+
+#define MACH_SHM_RING_CACHELINE         128
+#define MACH_SHM_RING_ENTRY_SIZE_MAX    (16 * 1024)
+#define MACH_SHM_RING_ENTRY_COUNT_MAX   4096
+
+typedef struct mach_shm_ring_header {
+	/* next entry to fill, advanced by senders */
+	uint64_t        msr_tail __attribute__((aligned(MACH_SHM_RING_CACHELINE)));
+
+	/* next entry to drain, advanced by the receiver */
+	uint64_t        msr_head __attribute__((aligned(MACH_SHM_RING_CACHELINE)));
+
+	/* set by a receiver about to block in the kernel */
+	uint32_t        msr_waiting __attribute__((aligned(MACH_SHM_RING_CACHELINE)));
+} __attribute__((aligned(MACH_SHM_RING_CACHELINE))) mach_shm_ring_header_t;
+
+typedef struct mach_shm_ring_slot {
+	uint64_t        mss_seq;                /* sequence number - entry index */
+	uint32_t        mss_size;               /* payload bytes */
+	mach_msg_id_t   mss_id;                 /* message id */
+	uint8_t         mss_data[];
+} mach_shm_ring_slot_t;
+
+#define MACH_SHM_RING_SLOT_SIZE(entry_size) \
+	(((uint32_t)sizeof(mach_shm_ring_slot_t) + (entry_size) + 63) & ~63u)
+
+#define MACH_SHM_RING_SIZE(entry_size, entry_count) \
+	((uint64_t)sizeof(mach_shm_ring_header_t) + \
+	(uint64_t)MACH_SHM_RING_SLOT_SIZE(entry_size) * (entry_count))
+
+#ifndef KERNEL
+
+#include <string.h>
+#include <mach/mach_traps.h>
+
+/* number of times a receiver polls an empty ring before blocking */
+#define MACH_SHM_RING_SPIN              256
+
+/*
+ * A task's handle on a mapped ring, in its private memory.
+ */
+typedef struct mach_shm_ring {
+	mach_shm_ring_header_t  *msh_header;
+	mach_port_name_t        msh_port;       /* port the ring is attached to */
+	uint32_t                msh_entry_size; /* max payload bytes per entry */
+	uint32_t                msh_slot_size;  /* stride between entries */
+	uint32_t                msh_flags;      /* MACH_PORT_SHM_RING_* */
+	uint64_t                msh_mask;       /* number of entries - 1 */
+} mach_shm_ring_t;
+
+/*
+ *	Routine:	mach_port_shm_ring_map
+ *	Purpose:
+ *		Map the ring attached to `port` into this task and
+ *		fill in a handle for it.
+ *	Returns:
+ *		As mach_port_shm_ring_map_trap().
+ */
+static inline kern_return_t
+mach_port_shm_ring_map(
+	mach_port_name_t        port,
+	mach_shm_ring_t         *ring)
+{
+	mach_port_shm_ring_t info;
+	mach_vm_address_t addr = 0;
+	kern_return_t kr;
+
+	kr = mach_port_shm_ring_map_trap(port, &addr, &info);
+	if (kr != KERN_SUCCESS) {
+		return kr;
+	}
+	ring->msh_header = (mach_shm_ring_header_t *)addr;
+	ring->msh_port = port;
+	ring->msh_entry_size = info.msr_entry_size;
+	ring->msh_slot_size = MACH_SHM_RING_SLOT_SIZE(info.msr_entry_size);
+	ring->msh_flags = info.msr_flags;
+	ring->msh_mask = info.msr_entry_count - 1;
+	return KERN_SUCCESS;
+}
+
+static inline mach_shm_ring_slot_t *
+mach_shm_ring_slot(const mach_shm_ring_t *ring, uint64_t pos)
+{
+	return (mach_shm_ring_slot_t *)((uintptr_t)(ring->msh_header + 1) +
+	       (uintptr_t)(pos & ring->msh_mask) * ring->msh_slot_size);
+}
+
+/*
+ *	Routine:	mach_shm_ring_send
+ *	Purpose:
+ *		Copy a message into the ring, and wake the receiver
+ *		through the port if it is blocked.
+ *	Returns:
+ *		KERN_SUCCESS            The message was queued.
+ *		KERN_INVALID_ARGUMENT   The message is too large.
+ *		KERN_RESOURCE_SHORTAGE  The ring is full.
+ */
+static inline kern_return_t
+mach_shm_ring_send(
+	mach_shm_ring_t         *ring,
+	mach_msg_id_t           id,
+	const void              *data,
+	uint32_t                size)
+{
+	mach_shm_ring_header_t *hdr = ring->msh_header;
+	uint64_t mask = ring->msh_mask;
+	mach_shm_ring_slot_t *slot;
+	uint64_t pos, seq;
+
+	if (size > ring->msh_entry_size) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	pos = __atomic_load_n(&hdr->msr_tail, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = mach_shm_ring_slot(ring, pos);
+		seq = __atomic_load_n(&slot->mss_seq, __ATOMIC_ACQUIRE) + (pos & mask);
+		if ((int64_t)(seq - pos) == 0) {
+			if (!(ring->msh_flags & MACH_PORT_SHM_RING_MPSC)) {
+				__atomic_store_n(&hdr->msr_tail, pos + 1, __ATOMIC_RELAXED);
+				break;
+			}
+			if (__atomic_compare_exchange_n(&hdr->msr_tail, &pos, pos + 1,
+			    true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if ((int64_t)(seq - pos) < 0) {
+			return KERN_RESOURCE_SHORTAGE;
+		} else {
+			pos = __atomic_load_n(&hdr->msr_tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->mss_size = size;
+	slot->mss_id = id;
+	memcpy(slot->mss_data, data, size);
+	__atomic_store_n(&slot->mss_seq, pos + 1 - (pos & mask), __ATOMIC_RELEASE);
+
+	/* pairs with the fence in mach_shm_ring_receive() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&hdr->msr_waiting, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&hdr->msr_waiting, 0, __ATOMIC_RELAXED)) {
+		(void)mach_port_shm_ring_signal_trap(ring->msh_port);
+	}
+	return KERN_SUCCESS;
+}
+
+static inline boolean_t
+mach_shm_ring_try_receive(
+	mach_shm_ring_t         *ring,
+	mach_msg_id_t           *id,
+	void                    *buf,
+	uint32_t                *size)
+{
+	mach_shm_ring_header_t *hdr = ring->msh_header;
+	uint64_t mask = ring->msh_mask;
+	uint64_t pos = __atomic_load_n(&hdr->msr_head, __ATOMIC_RELAXED);
+	mach_shm_ring_slot_t *slot = mach_shm_ring_slot(ring, pos);
+	uint32_t len;
+
+	if (__atomic_load_n(&slot->mss_seq, __ATOMIC_ACQUIRE) + (pos & mask) != pos + 1) {
+		return FALSE;
+	}
+
+	/* a sender can write anything in mss_size, stay within the slot */
+	len = slot->mss_size;
+	if (len > ring->msh_entry_size) {
+		len = ring->msh_entry_size;
+	}
+	if (len > *size) {
+		len = *size;
+	}
+	*id = slot->mss_id;
+	*size = len;
+	memcpy(buf, slot->mss_data, len);
+
+	__atomic_store_n(&slot->mss_seq, pos + mask + 1 - (pos & mask), __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->msr_head, pos + 1, __ATOMIC_RELAXED);
+	return TRUE;
+}
+
+/*
+ *	Routine:	mach_shm_ring_receive
+ *	Purpose:
+ *		Dequeue the next message from the ring, blocking on its
+ *		receive right for up to `timeout` milliseconds
+ *		(MACH_MSG_TIMEOUT_NONE waits forever) when it is empty.
+ *		Only one thread may receive from a ring at a time.
+ *		On input *size is the size of buf; on output it is the
+ *		number of payload bytes copied.
+ *	Returns:
+ *		KERN_SUCCESS            A message was received.
+ *		KERN_OPERATION_TIMED_OUT
+ *		KERN_ABORTED            The wait was interrupted.
+ *		KERN_TERMINATED         The port was destroyed.
+ */
+static inline kern_return_t
+mach_shm_ring_receive(
+	mach_shm_ring_t         *ring,
+	mach_msg_id_t           *id,
+	void                    *buf,
+	uint32_t                *size,
+	mach_msg_timeout_t      timeout)
+{
+	kern_return_t kr;
+
+	for (;;) {
+		for (int i = 0; i < MACH_SHM_RING_SPIN; i++) {
+			if (mach_shm_ring_try_receive(ring, id, buf, size)) {
+				return KERN_SUCCESS;
+			}
+		}
+
+		__atomic_store_n(&ring->msh_header->msr_waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (mach_shm_ring_try_receive(ring, id, buf, size)) {
+			/* a racing sender may have signalled, which is harmless */
+			__atomic_store_n(&ring->msh_header->msr_waiting, 0, __ATOMIC_RELAXED);
+			return KERN_SUCCESS;
+		}
+
+		kr = mach_port_shm_ring_wait_trap(ring->msh_port, timeout);
+		if (kr != KERN_SUCCESS) {
+			__atomic_store_n(&ring->msh_header->msr_waiting, 0, __ATOMIC_RELAXED);
+			return kr;
+		}
+	}
+}
+
+#endif /* !KERNEL */
+
+#endif /* PRIVATE */
+
+#endif  /* _MACH_SHM_RING_H_ */
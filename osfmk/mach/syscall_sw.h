@@ -103,6 +103,7 @@ kernel_trap(mach_reply_port,-26,0)
 kernel_trap(thread_self_trap,-27,0)
 kernel_trap(task_self_trap,-28,0)
 kernel_trap(host_self_trap,-29,0)
+kernel_trap(mach_msg_vector_trap,-30,6)
 
 kernel_trap(mach_msg_trap,-31,7)
 kernel_trap(mach_msg_overwrite_trap,-32,9)
@@ -134,6 +135,9 @@ kernel_trap(thread_get_special_reply_port,-50,0)
 kernel_trap(macx_triggers,-51, 4)
 kernel_trap(macx_backing_store_suspend,-52, 1)
 kernel_trap(macx_backing_store_recovery,-53, 1)
+kernel_trap(mach_port_shm_ring_map_trap,-54,3)
+kernel_trap(mach_port_shm_ring_wait_trap,-55,2)
+kernel_trap(mach_port_shm_ring_signal_trap,-56,1)
 
 /* These are currently used by pthreads even on LP64 */
 /* But as soon as that is fixed - they will go away there */
@@ -531,6 +531,20 @@ typedef struct task_debug_info_internal task_debug_info_internal_data_t;
 
 #endif /* PRIVATE */
 
+#define TASK_IPC_COPY_INFO      30 /* inline message bytes copied vs. remapped */
+
+#ifdef PRIVATE
+struct task_ipc_copy_info {
+	uint64_t inline_bytes_copied;   /* inline bytes sent by physical copy */
+	uint64_t inline_bytes_remapped; /* inline bytes sent by COW remapping */
+};
+typedef struct task_ipc_copy_info *task_ipc_copy_info_t;
+typedef struct task_ipc_copy_info task_ipc_copy_info_data_t;
+#define TASK_IPC_COPY_INFO_COUNT  ((mach_msg_type_number_t) \
+	        (sizeof (task_ipc_copy_info_data_t) / sizeof(natural_t)))
+
+#endif /* PRIVATE */
+
 /*
  * Type to control EXC_GUARD delivery options for a task
  * via task_get/set_exc_guard_behavior interface(s).
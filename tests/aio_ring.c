@@ -0,0 +1,367 @@
+/*
+ * aio_ring: Exercises the aio submission / completion rings
+ * (sys/aio_ring.h), and measures small random reads through a ring
+ * against one pread() per read.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <mach/mach_time.h>
+#include <sys/aio_ring.h>
+#include <sys/event.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.aio"),
+    T_META_CHECK_LEAKS(false));
+
+#define RING_ENTRIES            64
+#define RING_FILE_SIZE          (16 * 1024 * 1024)
+#define RING_IO_SIZE            4096
+#define RING_READS              (64 * 1024)
+#define RING_BATCH              32
+
+typedef struct {
+	struct aio_ring_header  *hdr;
+	struct aio_ring_sqe     *sqes;
+	struct aio_ring_cqe     *cqes;
+	uint32_t                entries;
+} ring_t;
+
+static void
+ring_create(ring_t *ring, uint32_t entries, int signo)
+{
+	size_t size = AIO_RING_SIZE(entries);
+	void *mem;
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	T_QUIET; T_ASSERT_NE(mem, MAP_FAILED, "mmap ring");
+	T_ASSERT_POSIX_SUCCESS(aio_ring_setup(mem, size, entries, signo), "aio_ring_setup");
+
+	ring->hdr = mem;
+	ring->sqes = (struct aio_ring_sqe *)((char *)mem + AIO_RING_SQES_OFFSET);
+	ring->cqes = (struct aio_ring_cqe *)((char *)mem + AIO_RING_CQES_OFFSET(entries));
+	ring->entries = entries;
+	T_QUIET; T_ASSERT_EQ(ring->hdr->ar_entries, entries, "kernel filled in the header");
+}
+
+static void
+ring_destroy(ring_t *ring)
+{
+	T_ASSERT_POSIX_SUCCESS(aio_ring_enter(ring->hdr, 0, 0, AIO_RING_ENTER_DESTROY),
+	    "aio_ring_enter(AIO_RING_ENTER_DESTROY)");
+	munmap(ring->hdr, AIO_RING_SIZE(ring->entries));
+}
+
+static struct aio_ring_sqe *
+ring_get_sqe(ring_t *ring)
+{
+	uint32_t tail = ring->hdr->ar_sq_tail;
+	struct aio_ring_sqe *sqe;
+
+	if (tail - __atomic_load_n(&ring->hdr->ar_sq_head, __ATOMIC_ACQUIRE) == ring->entries) {
+		return NULL;
+	}
+	sqe = &ring->sqes[tail & (ring->entries - 1)];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static void
+ring_push_sqe(ring_t *ring)
+{
+	__atomic_store_n(&ring->hdr->ar_sq_tail, ring->hdr->ar_sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static bool
+ring_reap(ring_t *ring, struct aio_ring_cqe *cqe)
+{
+	uint32_t head = ring->hdr->ar_cq_head;
+
+	if (head == __atomic_load_n(&ring->hdr->ar_cq_tail, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+	*cqe = ring->cqes[head & (2 * ring->entries - 1)];
+	__atomic_store_n(&ring->hdr->ar_cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void
+ring_prep(struct aio_ring_sqe *sqe, uint8_t opcode, int fd, void *addr,
+    uint32_t len, off_t offset, uint64_t user_data)
+{
+	sqe->sqe_opcode = opcode;
+	sqe->sqe_fd = fd;
+	sqe->sqe_addr = (uint64_t)(uintptr_t)addr;
+	sqe->sqe_len = len;
+	sqe->sqe_offset = (uint64_t)offset;
+	sqe->sqe_user_data = user_data;
+}
+
+static int
+ring_create_file(const char *name, bool cached)
+{
+	char path[PATH_MAX];
+	char *buf = malloc(RING_IO_SIZE);
+	int fd;
+
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+	snprintf(path, sizeof(path), "%s/%s", dt_tmpdir(), name);
+	fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", path);
+	if (!cached) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(fcntl(fd, F_NOCACHE, 1), "F_NOCACHE");
+	}
+
+	/* every 4-byte word holds its own offset */
+	for (off_t off = 0; off < RING_FILE_SIZE; off += RING_IO_SIZE) {
+		for (int i = 0; i < RING_IO_SIZE; i += 4) {
+			*(uint32_t *)(buf + i) = (uint32_t)(off + i);
+		}
+		T_QUIET; T_ASSERT_EQ_LONG(pwrite(fd, buf, RING_IO_SIZE, off),
+		    (long)RING_IO_SIZE, "pwrite");
+	}
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fsync(fd), "fsync");
+	if (!cached) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(fcntl(fd, F_NOCACHE, 0), "F_NOCACHE off");
+	} else {
+		/* make sure the whole file is resident */
+		for (off_t off = 0; off < RING_FILE_SIZE; off += RING_IO_SIZE) {
+			T_QUIET; T_ASSERT_EQ_LONG(pread(fd, buf, RING_IO_SIZE, off),
+			    (long)RING_IO_SIZE, "pread");
+		}
+	}
+	free(buf);
+	return fd;
+}
+
+static bool
+ring_check_block(const char *buf, off_t off)
+{
+	for (int i = 0; i < RING_IO_SIZE; i += 4) {
+		if (*(const uint32_t *)(buf + i) != (uint32_t)(off + i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+T_DECL(aio_ring_ops, "every ring operation completes once with the right result")
+{
+	struct aio_ring_cqe cqe;
+	struct aio_ring_sqe *sqe;
+	char path[PATH_MAX];
+	char wbuf[RING_IO_SIZE], rbuf[RING_IO_SIZE];
+	int64_t res[6];
+	uint32_t seen = 0;
+	ring_t ring;
+	int fd;
+
+	ring_create(&ring, RING_ENTRIES, 0);
+	fd = ring_create_file("aio_ring_ops", true);
+
+	snprintf(path, sizeof(path), "%s/aio_ring_ops", dt_tmpdir());
+	memset(wbuf, 'x', sizeof(wbuf));
+
+	ring_prep(ring_get_sqe(&ring), AIO_RING_OP_NOP, -1, NULL, 0, 0, 0);
+	ring_push_sqe(&ring);
+	ring_prep(ring_get_sqe(&ring), AIO_RING_OP_READ, fd, rbuf, RING_IO_SIZE, 3 * RING_IO_SIZE, 1);
+	ring_push_sqe(&ring);
+	ring_prep(ring_get_sqe(&ring), AIO_RING_OP_WRITE, fd, wbuf, RING_IO_SIZE, RING_FILE_SIZE, 2);
+	ring_push_sqe(&ring);
+	ring_prep(ring_get_sqe(&ring), AIO_RING_OP_FSYNC, fd, NULL, 0, 0, 3);
+	ring_push_sqe(&ring);
+	sqe = ring_get_sqe(&ring);
+	ring_prep(sqe, AIO_RING_OP_OPEN, AT_FDCWD, path, 0, 0, 4);
+	sqe->sqe_op_flags = O_RDONLY;
+	ring_push_sqe(&ring);
+	ring_prep(ring_get_sqe(&ring), 0xff, fd, NULL, 0, 0, 5);
+	ring_push_sqe(&ring);
+
+	T_ASSERT_EQ(aio_ring_enter(ring.hdr, 6, 6, 0), 6, "all six submitted");
+	T_EXPECT_EQ(ring.hdr->ar_sq_head, 6U, "the kernel consumed them");
+
+	/* fsync waits for the write, but completions may still be in flight */
+	while (seen != 0x3f) {
+		if (!ring_reap(&ring, &cqe)) {
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(aio_ring_enter(ring.hdr, 0, 1, 0), "wait");
+			continue;
+		}
+		T_QUIET; T_ASSERT_LT(cqe.cqe_user_data, 6ULL, "known request");
+		T_QUIET; T_ASSERT_FALSE((seen >> cqe.cqe_user_data) & 1, "completed once");
+		seen |= 1U << cqe.cqe_user_data;
+		res[cqe.cqe_user_data] = cqe.cqe_res;
+	}
+
+	T_EXPECT_EQ(res[0], 0LL, "nop");
+	T_EXPECT_EQ(res[1], (int64_t)RING_IO_SIZE, "read");
+	T_EXPECT_TRUE(ring_check_block(rbuf, 3 * RING_IO_SIZE), "read data");
+	T_EXPECT_EQ(res[2], (int64_t)RING_IO_SIZE, "write");
+	T_EXPECT_EQ(res[3], 0LL, "fsync");
+	T_EXPECT_GE(res[4], 0LL, "open returns a descriptor");
+	T_EXPECT_EQ(res[5], (int64_t)-EINVAL, "unknown opcode fails in its completion");
+
+	if (res[4] >= 0) {
+		T_EXPECT_EQ_LONG(pread((int)res[4], rbuf, RING_IO_SIZE, RING_FILE_SIZE),
+		    (long)RING_IO_SIZE, "the opened descriptor sees the write");
+		T_EXPECT_EQ(memcmp(rbuf, wbuf, RING_IO_SIZE), 0, "written data");
+		close((int)res[4]);
+	}
+
+	close(fd);
+	ring_destroy(&ring);
+	T_ASSERT_POSIX_FAILURE(aio_ring_enter(ring.hdr, 0, 0, 0), EINVAL,
+	    "the ring is gone after AIO_RING_ENTER_DESTROY");
+}
+
+T_DECL(aio_ring_uncached, "reads that miss the cache complete from the workers")
+{
+	struct aio_ring_cqe cqe;
+	char *bufs;
+	uint32_t done = 0, submitted = 0;
+	ring_t ring;
+	int fd, n;
+
+	ring_create(&ring, RING_ENTRIES, 0);
+	fd = ring_create_file("aio_ring_uncached", false);
+	bufs = malloc(RING_ENTRIES * RING_IO_SIZE);
+	T_QUIET; T_ASSERT_NOTNULL(bufs, "malloc");
+
+	for (uint32_t i = 0; i < RING_ENTRIES; i++) {
+		off_t off = (off_t)(arc4random_uniform(RING_FILE_SIZE / RING_IO_SIZE)) * RING_IO_SIZE;
+
+		ring_prep(ring_get_sqe(&ring), AIO_RING_OP_READ, fd,
+		    bufs + i * RING_IO_SIZE, RING_IO_SIZE, off, (uint64_t)off);
+		ring_push_sqe(&ring);
+	}
+	while (submitted < RING_ENTRIES) {
+		n = aio_ring_enter(ring.hdr, RING_ENTRIES - submitted, 0, 0);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "aio_ring_enter");
+		submitted += (uint32_t)n;
+	}
+
+	while (done < RING_ENTRIES) {
+		if (!ring_reap(&ring, &cqe)) {
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(aio_ring_enter(ring.hdr, 0, 1, 0), "wait");
+			continue;
+		}
+		T_QUIET; T_ASSERT_EQ(cqe.cqe_res, (int64_t)RING_IO_SIZE, "read");
+		done++;
+	}
+	T_PASS("%u uncached reads completed", done);
+
+	/* the buffers were filled in submission order; check each one */
+	for (uint32_t i = 0; i < RING_ENTRIES; i++) {
+		struct aio_ring_sqe *sqe = &ring.sqes[i & (RING_ENTRIES - 1)];
+
+		T_QUIET; T_EXPECT_TRUE(ring_check_block(bufs + i * RING_IO_SIZE,
+		    (off_t)sqe->sqe_offset), "data at %llu", sqe->sqe_offset);
+	}
+
+	free(bufs);
+	close(fd);
+	ring_destroy(&ring);
+}
+
+static double
+ring_rate(uint64_t abs)
+{
+	mach_timebase_info_data_t tb;
+
+	mach_timebase_info(&tb);
+	return (double)RING_READS * 1e9 / ((double)abs * tb.numer / tb.denom);
+}
+
+T_DECL(aio_ring_perf, "4k random reads of a warm file, ring against pread",
+    T_META_TAG_PERF)
+{
+	struct aio_ring_cqe cqe;
+	uint64_t start, pread_abs, ring_abs;
+	uint32_t done;
+	off_t *offs;
+	char *bufs;
+	ring_t ring;
+	int fd, n;
+
+	ring_create(&ring, RING_ENTRIES, 0);
+	fd = ring_create_file("aio_ring_perf", true);
+	bufs = malloc(RING_BATCH * RING_IO_SIZE);
+	offs = malloc(RING_READS * sizeof(*offs));
+	T_QUIET; T_ASSERT_NOTNULL(bufs, "malloc");
+	T_QUIET; T_ASSERT_NOTNULL(offs, "malloc");
+	for (int i = 0; i < RING_READS; i++) {
+		offs[i] = (off_t)(arc4random_uniform(RING_FILE_SIZE / RING_IO_SIZE)) * RING_IO_SIZE;
+	}
+
+	start = mach_absolute_time();
+	for (int i = 0; i < RING_READS; i++) {
+		T_QUIET; T_ASSERT_EQ_LONG(pread(fd, bufs, RING_IO_SIZE, offs[i]),
+		    (long)RING_IO_SIZE, "pread");
+	}
+	pread_abs = mach_absolute_time() - start;
+
+	start = mach_absolute_time();
+	for (int i = 0; i < RING_READS; i += RING_BATCH) {
+		for (int j = 0; j < RING_BATCH; j++) {
+			ring_prep(ring_get_sqe(&ring), AIO_RING_OP_READ, fd,
+			    bufs + j * RING_IO_SIZE, RING_IO_SIZE, offs[i + j], (uint64_t)j);
+			ring_push_sqe(&ring);
+		}
+		n = aio_ring_enter(ring.hdr, RING_BATCH, RING_BATCH, 0);
+		T_QUIET; T_ASSERT_EQ(n, RING_BATCH, "aio_ring_enter");
+		for (done = 0; done < RING_BATCH;) {
+			if (!ring_reap(&ring, &cqe)) {
+				T_QUIET; T_ASSERT_POSIX_SUCCESS(aio_ring_enter(ring.hdr, 0, 1, 0), "wait");
+				continue;
+			}
+			T_QUIET; T_ASSERT_EQ(cqe.cqe_res, (int64_t)RING_IO_SIZE, "read");
+			done++;
+		}
+	}
+	ring_abs = mach_absolute_time() - start;
+
+	T_PERF("aio_ring_pread", ring_rate(pread_abs), "reads/s", "one pread() per read");
+	T_PERF("aio_ring_batched", ring_rate(ring_abs), "reads/s",
+	    "one aio_ring_enter() per 32 reads");
+	T_LOG("pread %.0f reads/s, ring %.0f reads/s (x%.2f)", ring_rate(pread_abs),
+	    ring_rate(ring_abs), ring_rate(ring_abs) / ring_rate(pread_abs));
+
+	free(offs);
+	free(bufs);
+	close(fd);
+	ring_destroy(&ring);
+}
+
+T_DECL(aio_ring_signal, "the ring's signal can be watched with EVFILT_SIGNAL")
+{
+	struct aio_ring_cqe cqe;
+	struct kevent64_s kev;
+	struct timespec timeout = { .tv_sec = 10 };
+	ring_t ring;
+	int kq;
+
+	signal(SIGUSR1, SIG_IGN);
+	kq = kqueue();
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(kq, "kqueue");
+	EV_SET64(&kev, SIGUSR1, EVFILT_SIGNAL, EV_ADD, 0, 0, 0, 0, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(kevent64(kq, &kev, 1, NULL, 0, 0, NULL), "EVFILT_SIGNAL");
+
+	ring_create(&ring, RING_ENTRIES, SIGUSR1);
+	ring_prep(ring_get_sqe(&ring), AIO_RING_OP_NOP, -1, NULL, 0, 0, 42);
+	ring_push_sqe(&ring);
+	T_ASSERT_EQ(aio_ring_enter(ring.hdr, 1, 0, 0), 1, "submitted");
+
+	T_ASSERT_EQ(kevent64(kq, NULL, 0, &kev, 1, 0, &timeout), 1, "kevent for the completion");
+	T_EXPECT_TRUE(ring_reap(&ring, &cqe), "completion posted");
+	T_EXPECT_EQ(cqe.cqe_user_data, 42ULL, "for our request");
+
+	close(kq);
+	ring_destroy(&ring);
+}
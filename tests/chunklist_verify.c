@@ -0,0 +1,251 @@
+/*
+ * chunklist_verify: Builds synthetic root images and chunklists and
+ * verifies them the way validate_root_image() does, through the same
+ * chunk distribution (bsd/kern/chunklist_pipeline.h), with pread() and
+ * CommonCrypto standing in for vn_rdwr() and libkern's SHA256.
+ *
+ * Checks that corrupt chunks and chunklists that do not cover the image
+ * are caught whatever the thread count, and measures verification
+ * throughput from one thread up.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <CommonCrypto/CommonDigest.h>
+#include <mach/mach_time.h>
+#include <sys/param.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../bsd/kern/chunklist_pipeline.h"
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_CHECK_LEAKS(false));
+
+#define CLV_CHUNK_SIZE          (1024 * 1024)
+#define CLV_IMAGE_SIZE          (128 * CLV_CHUNK_SIZE + 12345)
+#define CLV_MAX_THREADS         16
+
+typedef struct {
+	pthread_mutex_t         lock;
+	struct clp_pipeline     pipeline;
+	int                     fd;
+	int                     error;
+	uint64_t                bad_chunk;
+} clv_verify_t;
+
+static char clv_image[PATH_MAX];
+static struct clp_chunk *clv_chunks;
+static uint64_t clv_nchunks;
+
+static void
+clv_fail(clv_verify_t *cv, int err, uint64_t chunk)
+{
+	pthread_mutex_lock(&cv->lock);
+	if (cv->error == 0) {
+		cv->error = err;
+		cv->bad_chunk = chunk;
+	}
+	clp_fail(&cv->pipeline);
+	pthread_mutex_unlock(&cv->lock);
+}
+
+/* chunklist_verify_batches() */
+static void *
+clv_worker(void *arg)
+{
+	clv_verify_t *cv = arg;
+	struct clp_batch batch;
+	uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+	uint8_t *buf;
+	uint64_t off;
+	ssize_t n;
+	int r;
+
+	buf = malloc(cv->pipeline.clp_batch_max);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+
+	for (;;) {
+		pthread_mutex_lock(&cv->lock);
+		r = clp_claim(&cv->pipeline, &batch);
+		pthread_mutex_unlock(&cv->lock);
+		if (r == CLP_DONE) {
+			break;
+		}
+		if (r == CLP_INVALID) {
+			clv_fail(cv, EINVAL, cv->pipeline.clp_next);
+			break;
+		}
+
+		n = pread(cv->fd, buf, batch.clb_length, (off_t)batch.clb_offset);
+		if (n != (ssize_t)batch.clb_length) {
+			clv_fail(cv, n < 0 ? errno : EINVAL, batch.clb_first);
+			break;
+		}
+		off = 0;
+		for (uint64_t ch = batch.clb_first; ch < batch.clb_first + batch.clb_count; ch++) {
+			const struct clp_chunk *chk = &cv->pipeline.clp_chunks[ch];
+
+			CC_SHA256(buf + off, chk->clc_size, digest);
+			if (memcmp(digest, chk->clc_sha256, sizeof(digest)) != 0) {
+				clv_fail(cv, EINVAL, ch);
+				goto out;
+			}
+			off += chk->clc_size;
+		}
+	}
+out:
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Verifies the image against chunks on nthreads threads, like
+ * validate_root_image(); returns 0 or the error and the chunk it hit.
+ */
+static int
+clv_verify(const struct clp_chunk *chunks, uint64_t nchunks, int nthreads,
+    uint64_t *bad_chunk)
+{
+	pthread_t threads[CLV_MAX_THREADS];
+	clv_verify_t cv = { .lock = PTHREAD_MUTEX_INITIALIZER };
+	off_t size;
+
+	cv.fd = open(clv_image, O_RDONLY);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(cv.fd, "open(%s)", clv_image);
+	size = lseek(cv.fd, 0, SEEK_END);
+	clp_init(&cv.pipeline, chunks, nchunks, chunks[0].clc_size);
+
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, clv_worker, &cv),
+		    "pthread_create");
+	}
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+	close(cv.fd);
+
+	if (cv.error == 0 && !clp_covers(&cv.pipeline, (uint64_t)size)) {
+		cv.error = EINVAL;
+		cv.bad_chunk = nchunks;
+	}
+	*bad_chunk = cv.bad_chunk;
+	return cv.error;
+}
+
+/*
+ * Writes an image of pseudo-random chunks and the chunklist for it.
+ */
+static void
+clv_setup(void)
+{
+	uint8_t *chunk;
+	uint64_t off = 0;
+	int err, fd;
+
+	if (clv_chunks != NULL) {
+		return;
+	}
+
+	snprintf(clv_image, sizeof(clv_image), "%s/chunklist_verify", dt_tmpdir());
+	err = mkpath_np(clv_image, 0755);
+	T_QUIET; T_ASSERT_TRUE(err == 0 || err == EEXIST, "mkpath_np(%s)", clv_image);
+	strlcat(clv_image, "/image.dmg", sizeof(clv_image));
+
+	fd = open(clv_image, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", clv_image);
+
+	clv_nchunks = (CLV_IMAGE_SIZE + CLV_CHUNK_SIZE - 1) / CLV_CHUNK_SIZE;
+	clv_chunks = calloc(clv_nchunks, sizeof(*clv_chunks));
+	chunk = malloc(CLV_CHUNK_SIZE);
+	T_QUIET; T_ASSERT_NOTNULL(clv_chunks, "calloc");
+	T_QUIET; T_ASSERT_NOTNULL(chunk, "malloc");
+
+	srandom(46);
+	for (uint64_t ch = 0; ch < clv_nchunks; ch++) {
+		uint32_t size = (uint32_t)MIN(CLV_CHUNK_SIZE, CLV_IMAGE_SIZE - off);
+
+		for (uint32_t i = 0; i < size; i += sizeof(long)) {
+			long r = random();
+			memcpy(chunk + i, &r, MIN(sizeof(r), size - i));
+		}
+		T_QUIET; T_ASSERT_EQ(pwrite(fd, chunk, size, (off_t)off), (ssize_t)size, "pwrite");
+		clv_chunks[ch].clc_size = size;
+		CC_SHA256(chunk, size, clv_chunks[ch].clc_sha256);
+		off += size;
+	}
+	close(fd);
+	free(chunk);
+}
+
+T_DECL(chunklist_verify_pipeline,
+    "the pipelined verifier accepts a good image and catches bad chunks and coverage")
+{
+	struct clp_chunk *chunks;
+	size_t len;
+	uint64_t bad;
+
+	clv_setup();
+	len = clv_nchunks * sizeof(*chunks);
+	chunks = malloc(len);
+	T_QUIET; T_ASSERT_NOTNULL(chunks, "malloc");
+
+	for (int n = 1; n <= 8; n *= 2) {
+		T_EXPECT_EQ(clv_verify(clv_chunks, clv_nchunks, n, &bad), 0,
+		    "good image verifies on %d threads", n);
+
+		/* a digest that does not match */
+		memcpy(chunks, clv_chunks, len);
+		chunks[clv_nchunks / 2].clc_sha256[7] ^= 0x40;
+		T_EXPECT_EQ(clv_verify(chunks, clv_nchunks, n, &bad), EINVAL,
+		    "corrupt chunk caught on %d threads", n);
+		T_EXPECT_EQ(bad, clv_nchunks / 2, "at the corrupt chunk");
+
+		/* a chunklist that stops short of the end of the image */
+		T_EXPECT_EQ(clv_verify(clv_chunks, clv_nchunks - 1, n, &bad), EINVAL,
+		    "short chunklist caught on %d threads", n);
+
+		/* a chunk larger than the first, so larger than the buffers */
+		memcpy(chunks, clv_chunks, len);
+		chunks[0].clc_size /= 2;
+		T_EXPECT_EQ(clv_verify(chunks, clv_nchunks, n, &bad), EINVAL,
+		    "oversized chunk caught on %d threads", n);
+	}
+	free(chunks);
+}
+
+T_DECL(chunklist_verify_perf,
+    "root image verification throughput by thread count",
+    T_META_TAG_PERF)
+{
+	mach_timebase_info_data_t tb;
+	uint64_t start, ns, bad, one = 0;
+	char name[64];
+	double rate;
+
+	clv_setup();
+	mach_timebase_info(&tb);
+
+	/* read the image once so every run hashes from the same cache state */
+	T_QUIET; T_ASSERT_EQ(clv_verify(clv_chunks, clv_nchunks, 1, &bad), 0, "verify");
+
+	for (int n = 1; n <= CLV_MAX_THREADS && n <= dt_ncpu(); n *= 2) {
+		start = mach_absolute_time();
+		T_QUIET; T_ASSERT_EQ(clv_verify(clv_chunks, clv_nchunks, n, &bad), 0, "verify");
+		ns = (mach_absolute_time() - start) * tb.numer / tb.denom;
+		if (n == 1) {
+			one = ns;
+		}
+
+		rate = (double)CLV_IMAGE_SIZE * 1e3 / ns;
+		snprintf(name, sizeof(name), "chunklist_verify_%dthr", n);
+		T_PERF(name, rate, "MB/s", "1MB chunks read and SHA-256 hashed");
+		T_LOG("%d threads: %.1f MB/s (x%.2f)", n, rate, (double)one / ns);
+	}
+}
@@ -0,0 +1,251 @@
+/*
+ * decmpfs_readahead: Reads files compressed with ditto --hfsCompression
+ * and checks their contents come back intact whether or not the chunks
+ * were decompressed ahead of the reader, then measures sequential read
+ * throughput with read-ahead off (vfs.decmpfs.ra_chunks=0) and on.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <mach/mach_time.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_ASROOT(true),
+    T_META_CHECK_LEAKS(false));
+
+#define DRA_FILE_SIZE           (32 * 1024 * 1024)
+#define DRA_READ_SIZE           (32 * 1024)
+#define DRA_RANDOM_READS        256
+
+static char dra_root[PATH_MAX];
+static char dra_source[PATH_MAX];
+static char *dra_expected;
+static int dra_copies;
+
+static void
+dra_setup(void)
+{
+	size_t off = 0;
+	int err, fd;
+
+	if (dra_expected != NULL) {
+		return;
+	}
+
+	snprintf(dra_root, sizeof(dra_root), "%s/decmpfs_readahead", dt_tmpdir());
+	err = mkpath_np(dra_root, 0755);
+	T_QUIET; T_ASSERT_TRUE(err == 0 || err == EEXIST, "mkpath_np(%s)", dra_root);
+
+	/* compressible, but every line different so misplaced chunks show */
+	dra_expected = malloc(DRA_FILE_SIZE);
+	T_QUIET; T_ASSERT_NOTNULL(dra_expected, "malloc");
+	for (int line = 0; off < DRA_FILE_SIZE; line++) {
+		char text[64];
+		int len = snprintf(text, sizeof(text), "line %08d of the decmpfs read-ahead test\n", line);
+
+		len = (int)MIN((size_t)len, DRA_FILE_SIZE - off);
+		memcpy(dra_expected + off, text, (size_t)len);
+		off += (size_t)len;
+	}
+
+	snprintf(dra_source, sizeof(dra_source), "%s/source", dra_root);
+	fd = open(dra_source, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", dra_source);
+	T_QUIET; T_ASSERT_EQ(write(fd, dra_expected, DRA_FILE_SIZE), (ssize_t)DRA_FILE_SIZE, "write");
+	close(fd);
+}
+
+/*
+ * Makes a new compressed copy of the source, so that none of it is in the
+ * UBC or the chunk cache yet, and opens it.
+ */
+static int
+dra_compressed_copy(void)
+{
+	char path[PATH_MAX];
+	char *argv[] = { "/usr/bin/ditto", "--hfsCompression", dra_source, path, NULL };
+	struct stat st;
+	pid_t pid;
+	int status, fd;
+
+	snprintf(path, sizeof(path), "%s/copy.%d", dra_root, dra_copies++);
+	unlink(path);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(dt_launch_tool(&pid, argv, false, NULL, NULL), "ditto");
+	T_QUIET; T_ASSERT_TRUE(dt_waitpid(pid, &status, NULL, 60), "ditto exited");
+	T_QUIET; T_ASSERT_EQ(status, 0, "ditto succeeded");
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(stat(path, &st), "stat(%s)", path);
+	if (!(st.st_flags & UF_COMPRESSED)) {
+		T_SKIP("%s does not support file compression", dra_root);
+	}
+	T_QUIET; T_ASSERT_EQ(st.st_size, (off_t)DRA_FILE_SIZE, "uncompressed size");
+
+	fd = open(path, O_RDONLY);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", path);
+	unlink(path);
+	return fd;
+}
+
+static int
+dra_get_int(const char *name)
+{
+	int value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "sysctlbyname(%s)", name);
+	return value;
+}
+
+static void
+dra_set_int(const char *name, int value)
+{
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, NULL, NULL, &value, sizeof(value)),
+	    "sysctlbyname(%s, %d)", name, value);
+}
+
+static uint64_t
+dra_get_quad(const char *name)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "sysctlbyname(%s)", name);
+	return value;
+}
+
+static int dra_saved_chunks = -1;
+
+static void
+dra_restore_chunks(void)
+{
+	if (dra_saved_chunks != -1) {
+		dra_set_int("vfs.decmpfs.ra_chunks", dra_saved_chunks);
+	}
+}
+
+static void
+dra_save_chunks(void)
+{
+	if (dra_saved_chunks == -1) {
+		dra_saved_chunks = dra_get_int("vfs.decmpfs.ra_chunks");
+		T_ATEND(dra_restore_chunks);
+	}
+}
+
+/*
+ * Reads the whole file front to back, checking it against the source,
+ * and returns the nanoseconds it took.
+ */
+static uint64_t
+dra_read_sequential(int fd, char *buf)
+{
+	mach_timebase_info_data_t tb;
+	uint64_t start, abs;
+	ssize_t n;
+
+	start = mach_absolute_time();
+	for (off_t off = 0; off < DRA_FILE_SIZE; off += n) {
+		n = pread(fd, buf, DRA_READ_SIZE, off);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "pread at %lld", off);
+		T_QUIET; T_ASSERT_GT(n, 0L, "short file at %lld", off);
+		T_QUIET; T_ASSERT_EQ(memcmp(buf, dra_expected + off, (size_t)n), 0,
+		    "contents at %lld", off);
+	}
+	abs = mach_absolute_time() - start;
+
+	mach_timebase_info(&tb);
+	return abs * tb.numer / tb.denom;
+}
+
+T_DECL(decmpfs_readahead_contents,
+    "compressed files read back intact with and without read-ahead")
+{
+	char *buf;
+	uint64_t issued;
+	int fd;
+
+	dra_setup();
+	dra_save_chunks();
+	buf = malloc(DRA_READ_SIZE);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+
+	dra_set_int("vfs.decmpfs.ra_chunks", 0);
+	fd = dra_compressed_copy();
+	issued = dra_get_quad("vfs.decmpfs.ra_issued");
+	(void)dra_read_sequential(fd, buf);
+	T_EXPECT_EQ(dra_get_quad("vfs.decmpfs.ra_issued"), issued,
+	    "nothing queued with read-ahead off");
+	close(fd);
+
+	dra_set_int("vfs.decmpfs.ra_chunks", dra_saved_chunks > 0 ? dra_saved_chunks : 8);
+	fd = dra_compressed_copy();
+	issued = dra_get_quad("vfs.decmpfs.ra_issued");
+	(void)dra_read_sequential(fd, buf);
+	T_PASS("sequential read matches with read-ahead on");
+	if (dra_get_int("vfs.decmpfs.ra_threads") > 0) {
+		T_EXPECT_GT(dra_get_quad("vfs.decmpfs.ra_issued"), issued,
+		    "sequential reader queued read-ahead");
+	}
+
+	/* reads at random offsets, some landing on chunks decompressed ahead */
+	srandom(42);
+	for (int i = 0; i < DRA_RANDOM_READS; i++) {
+		off_t off = random() % (DRA_FILE_SIZE - DRA_READ_SIZE);
+		ssize_t n = pread(fd, buf, DRA_READ_SIZE, off);
+
+		T_QUIET; T_ASSERT_EQ(n, (ssize_t)DRA_READ_SIZE, "pread at %lld", off);
+		T_QUIET; T_ASSERT_EQ(memcmp(buf, dra_expected + off, DRA_READ_SIZE), 0,
+		    "contents at %lld", off);
+	}
+	T_PASS("random reads match");
+	close(fd);
+	free(buf);
+}
+
+T_DECL(decmpfs_readahead_perf,
+    "sequential read throughput of a compressed file with and without read-ahead",
+    T_META_TAG_PERF)
+{
+	uint64_t off_ns, on_ns;
+	char *buf;
+	int fd, chunks;
+
+	dra_setup();
+	dra_save_chunks();
+	chunks = dra_saved_chunks > 0 ? dra_saved_chunks : 8;
+	buf = malloc(DRA_READ_SIZE);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+
+	dra_set_int("vfs.decmpfs.ra_chunks", 0);
+	fd = dra_compressed_copy();
+	off_ns = dra_read_sequential(fd, buf);
+	close(fd);
+
+	dra_set_int("vfs.decmpfs.ra_chunks", chunks);
+	fd = dra_compressed_copy();
+	on_ns = dra_read_sequential(fd, buf);
+	close(fd);
+
+	T_PERF("decmpfs_sequential_no_readahead", (double)DRA_FILE_SIZE * 1e3 / off_ns,
+	    "MB/s", "32KB preads of a compressed file, ra_chunks=0");
+	T_PERF("decmpfs_sequential_readahead", (double)DRA_FILE_SIZE * 1e3 / on_ns,
+	    "MB/s", "32KB preads of a compressed file, read-ahead on");
+	T_LOG("%d read-ahead threads, %d chunks: %.1f MB/s without, %.1f MB/s with (x%.2f)",
+	    dra_get_int("vfs.decmpfs.ra_threads"), chunks,
+	    (double)DRA_FILE_SIZE * 1e3 / off_ns, (double)DRA_FILE_SIZE * 1e3 / on_ns,
+	    (double)off_ns / on_ns);
+
+	free(buf);
+}
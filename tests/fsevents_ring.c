@@ -0,0 +1,296 @@
+/*
+ * fsevents_ring: Watches a directory through /dev/fsevents with a path
+ * prefix filter and the shared event ring (FSEVENTS_MAP_RING), checks
+ * that only events under the prefix arrive and that interned directory
+ * ids resolve to the right paths, and compares how many events of a
+ * burst each of read() and the ring delivers.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <sys/event.h>
+#include <sys/fsevents.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_ASROOT(true),
+    T_META_CHECK_LEAKS(false));
+
+#define FSR_RING_SIZE           (1024 * 1024)
+#define FSR_FILES               64
+#define FSR_BURST               20000
+#define FSR_READ_BUFSIZE        (64 * 1024)
+
+typedef struct {
+	char            dirs[FSE_RING_DIRS][MAXPATHLEN];
+	uint64_t        events;
+	uint64_t        creates_watched;
+	uint64_t        creates_unwatched;
+	uint64_t        dropped;
+	uint64_t        bytes;
+} fsr_state_t;
+
+static char fsr_watched[MAXPATHLEN];
+static char fsr_unwatched[MAXPATHLEN];
+
+static void
+fsr_setup(void)
+{
+	char path[MAXPATHLEN];
+	int err;
+
+	snprintf(path, sizeof(path), "%s/fsevents_ring", dt_tmpdir());
+	err = mkpath_np(path, 0755);
+	T_QUIET; T_ASSERT_TRUE(err == 0 || err == EEXIST, "mkpath_np(%s)", path);
+	/* the kernel reports real paths */
+	T_QUIET; T_ASSERT_NOTNULL(realpath(path, fsr_watched), "realpath(%s)", path);
+	strlcpy(fsr_unwatched, fsr_watched, sizeof(fsr_unwatched));
+	strlcat(fsr_watched, "/watched", sizeof(fsr_watched));
+	strlcat(fsr_unwatched, "/watched.not", sizeof(fsr_unwatched));
+	err = mkdir(fsr_watched, 0755);
+	T_QUIET; T_ASSERT_TRUE(err == 0 || errno == EEXIST, "mkdir(%s)", fsr_watched);
+	err = mkdir(fsr_unwatched, 0755);
+	T_QUIET; T_ASSERT_TRUE(err == 0 || errno == EEXIST, "mkdir(%s)", fsr_unwatched);
+}
+
+static int
+fsr_clone(void)
+{
+	int8_t events[FSE_MAX_EVENTS];
+	fsevent_clone_args args;
+	int devfd, fd = -1;
+
+	devfd = open("/dev/fsevents", O_RDONLY);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(devfd, "open(/dev/fsevents)");
+
+	memset(events, FSE_REPORT, sizeof(events));
+	args.event_list = events;
+	args.num_events = FSE_MAX_EVENTS;
+	args.event_queue_depth = 4096;
+	args.fd = &fd;
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ioctl(devfd, FSEVENTS_CLONE, &args), "FSEVENTS_CLONE");
+	close(devfd);
+	return fd;
+}
+
+static void
+fsr_filter(int fd, const char *prefix)
+{
+	fsevent_prefix_filter_args args = {
+		.num_prefixes = 1,
+		.size = (uint32_t)strlen(prefix) + 1,
+		.prefixes = (uint64_t)(uintptr_t)prefix,
+	};
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ioctl(fd, FSEVENTS_PREFIX_FILTER, &args),
+	    "FSEVENTS_PREFIX_FILTER(%s)", prefix);
+}
+
+static struct fsevent_ring_hdr *
+fsr_map(int fd)
+{
+	fsevent_ring_args args = { .size = FSR_RING_SIZE };
+	struct fsevent_ring_hdr *hdr;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ioctl(fd, FSEVENTS_MAP_RING, &args), "FSEVENTS_MAP_RING");
+	hdr = (struct fsevent_ring_hdr *)(uintptr_t)args.addr;
+	T_QUIET; T_ASSERT_EQ(hdr->fr_magic, (uint32_t)FSE_RING_MAGIC, "ring magic");
+	T_QUIET; T_ASSERT_GE(hdr->fr_size, (uint64_t)FSR_RING_SIZE, "ring size");
+	T_QUIET; T_ASSERT_EQ(hdr->fr_size & (hdr->fr_size - 1), 0ULL, "ring size is a power of 2");
+	return hdr;
+}
+
+/*
+ * Consumes every record in the ring, resolving event paths through the
+ * interned directories.
+ */
+static void
+fsr_drain(struct fsevent_ring_hdr *hdr, fsr_state_t *st)
+{
+	const char *area = (const char *)hdr + hdr->fr_hdr_size;
+	uint64_t head = atomic_load_explicit((_Atomic uint64_t *)&hdr->fr_head, memory_order_acquire);
+	uint64_t tail = hdr->fr_tail;
+	char path[MAXPATHLEN];
+
+	while (tail < head) {
+		const struct fsevent_ring_rec *rec = (const void *)(area + (tail & (hdr->fr_size - 1)));
+
+		/* a pad's length can be truncated; it always runs to the end */
+		if (rec->frr_kind != FSE_RING_PAD) {
+			T_QUIET; T_ASSERT_EQ(rec->frr_len % 8, 0, "records are 8 byte aligned");
+			T_QUIET; T_ASSERT_GT(rec->frr_len, 0, "record has a length");
+		}
+
+		switch (rec->frr_kind) {
+		case FSE_RING_PAD:
+			break;
+		case FSE_RING_DIR: {
+			const struct fsevent_ring_dir *frd = (const void *)rec;
+
+			T_QUIET; T_ASSERT_LT(frd->frd_id, FSE_RING_DIRS, "directory id");
+			strlcpy(st->dirs[frd->frd_id], frd->frd_path, MAXPATHLEN);
+			break;
+		}
+		case FSE_RING_EVENT:
+		case FSE_RING_DEST: {
+			const struct fsevent_ring_event *fre = (const void *)rec;
+			int type = fre->fre_type & FSE_TYPE_MASK;
+
+			if (type == FSE_EVENTS_DROPPED) {
+				st->dropped++;
+				break;
+			}
+			if (fre->fre_dir == FSE_RING_NO_DIR) {
+				strlcpy(path, fre->fre_name, sizeof(path));
+			} else {
+				snprintf(path, sizeof(path), "%s/%s",
+				    strcmp(st->dirs[fre->fre_dir], "/") ? st->dirs[fre->fre_dir] : "",
+				    fre->fre_name);
+			}
+			if (rec->frr_kind == FSE_RING_EVENT) {
+				st->events++;
+			}
+			if (type == FSE_CREATE_FILE) {
+				if (strncmp(path, fsr_watched, strlen(fsr_watched)) == 0 &&
+				    path[strlen(fsr_watched)] == '/') {
+					st->creates_watched++;
+				} else if (strncmp(path, fsr_unwatched, strlen(fsr_unwatched)) == 0) {
+					st->creates_unwatched++;
+				}
+			}
+			break;
+		}
+		default:
+			T_ASSERT_FAIL("unknown record kind %d", rec->frr_kind);
+		}
+		st->bytes += rec->frr_len;
+		tail += (rec->frr_kind == FSE_RING_PAD) ?
+		    hdr->fr_size - (tail & (hdr->fr_size - 1)) : rec->frr_len;
+	}
+	atomic_store_explicit((_Atomic uint64_t *)&hdr->fr_tail, tail, memory_order_release);
+}
+
+static void
+fsr_create_files(const char *dir, int count, const char *tag)
+{
+	char path[MAXPATHLEN];
+	int fd;
+
+	for (int i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "%s/%s.%d", dir, tag, i);
+		fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", path);
+		close(fd);
+		unlink(path);
+	}
+}
+
+/* Waits for the fd to be readable, or for a second to pass. */
+static bool
+fsr_wait(int fd)
+{
+	struct kevent64_s kev;
+	struct timespec ts = { .tv_sec = 1 };
+	int kq, n;
+
+	kq = kqueue();
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(kq, "kqueue");
+	EV_SET64(&kev, fd, EVFILT_READ, EV_ADD, 0, 0, 0, 0, 0);
+	n = kevent64(kq, &kev, 1, &kev, 1, 0, &ts);
+	close(kq);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "kevent64");
+	return n > 0;
+}
+
+T_DECL(fsevents_ring_filter,
+    "the event ring delivers only events under the prefix, with interned directories")
+{
+	static fsr_state_t st;
+	struct fsevent_ring_hdr *hdr;
+	char buf[4096];
+	int fd;
+
+	fsr_setup();
+	fd = fsr_clone();
+	fsr_filter(fd, fsr_watched);
+	hdr = fsr_map(fd);
+
+	T_ASSERT_POSIX_FAILURE(read(fd, buf, sizeof(buf)), EINVAL, "read() is refused once mapped");
+
+	fsr_create_files(fsr_unwatched, FSR_FILES, "unwatched");
+	fsr_create_files(fsr_watched, FSR_FILES, "watched");
+
+	while (st.creates_watched < FSR_FILES && fsr_wait(fd)) {
+		fsr_drain(hdr, &st);
+	}
+	fsr_drain(hdr, &st);
+
+	T_EXPECT_EQ(st.creates_watched, (uint64_t)FSR_FILES, "every create under the prefix arrived");
+	T_EXPECT_EQ(st.creates_unwatched, 0ULL, "nothing from the sibling with a longer name");
+	T_EXPECT_EQ(st.dropped, 0ULL, "nothing dropped");
+	T_LOG("%llu events in %llu bytes", st.events, st.bytes);
+
+	/* a relative prefix is refused */
+	fsevent_prefix_filter_args bad = { .num_prefixes = 1, .size = 4, .prefixes = (uint64_t)(uintptr_t)"tmp" };
+	T_EXPECT_POSIX_FAILURE(ioctl(fd, FSEVENTS_PREFIX_FILTER, &bad), EINVAL, "relative prefix");
+	T_EXPECT_POSIX_FAILURE(ioctl(fd, FSEVENTS_MAP_RING, &(fsevent_ring_args){ .size = FSR_RING_SIZE }),
+	    EBUSY, "one ring per watcher");
+
+	close(fd);
+}
+
+T_DECL(fsevents_ring_perf,
+    "events of a burst delivered to a lagging consumer, read() against the ring",
+    T_META_TAG_PERF)
+{
+	static fsr_state_t st;
+	struct fsevent_ring_hdr *hdr;
+	char *buf;
+	uint64_t read_bytes = 0;
+	ssize_t n;
+	int rfd, mfd, flags;
+
+	fsr_setup();
+	buf = malloc(FSR_READ_BUFSIZE);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+
+	rfd = fsr_clone();
+	fsr_filter(rfd, fsr_watched);
+	mfd = fsr_clone();
+	fsr_filter(mfd, fsr_watched);
+	hdr = fsr_map(mfd);
+
+	/* neither consumer reads until the burst is over */
+	fsr_create_files(fsr_watched, FSR_BURST, "burst");
+	sleep(1);
+
+	flags = fcntl(rfd, F_GETFL);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fcntl(rfd, F_SETFL, flags | O_NONBLOCK), "O_NONBLOCK");
+	while (fsr_wait(rfd) && (n = read(rfd, buf, FSR_READ_BUFSIZE)) > 0) {
+		read_bytes += (uint64_t)n;
+	}
+	fsr_drain(hdr, &st);
+
+	T_PERF("fsevents_ring_bytes_per_event", st.events ? (double)st.bytes / st.events : 0.0,
+	    "bytes", "ring bytes per delivered event");
+	T_PERF("fsevents_ring_dropped", (double)hdr->fr_dropped, "events",
+	    "events of the burst the ring dropped");
+	T_LOG("burst of %d creates (+ deletes): ring delivered %llu events in %llu bytes, "
+	    "dropped %llu; read() returned %llu bytes", FSR_BURST, st.events, st.bytes,
+	    hdr->fr_dropped, read_bytes);
+
+	close(rfd);
+	close(mfd);
+	free(buf);
+}
@@ -0,0 +1,236 @@
+/*
+ * getattrlistatv: Checks that getattrlistatv(2) returns one entry per
+ * path, in order, with errors reported in place, and measures it against
+ * calling fstatat() once per path.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <mach/mach_time.h>
+#include <sys/attr.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/vnode.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_CHECK_LEAKS(false));
+
+#define ATV_DIRS                16
+#define ATV_FILES               256
+#define ATV_PATHS               (ATV_DIRS * ATV_FILES)
+#define ATV_ROUNDS              20
+#define ATV_BUFSIZE             (256 * 1024)
+
+typedef struct {
+	uint32_t        error;
+	fsobj_type_t    objtype;
+	uint64_t        fileid;
+	char            name[MAXPATHLEN];
+} atv_entry_t;
+
+static struct attrlist atv_attrs = {
+	.bitmapcount = ATTR_BIT_MAP_COUNT,
+	.commonattr = ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_ERROR | ATTR_CMN_NAME |
+	    ATTR_CMN_OBJTYPE | ATTR_CMN_FILEID,
+};
+
+static int atv_dirfd = -1;
+static char *atv_paths;
+static size_t atv_paths_size;
+
+static void
+atv_setup(void)
+{
+	char path[PATH_MAX];
+	size_t off = 0;
+	int err, fd;
+
+	if (atv_dirfd != -1) {
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%s/getattrlistatv", dt_tmpdir());
+	err = mkpath_np(path, 0755);
+	T_QUIET; T_ASSERT_TRUE(err == 0 || err == EEXIST, "mkpath_np(%s)", path);
+	atv_dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(atv_dirfd, "open(%s)", path);
+
+	atv_paths = malloc(ATV_PATHS * 32);
+	T_QUIET; T_ASSERT_NOTNULL(atv_paths, "malloc");
+
+	for (int d = 0; d < ATV_DIRS; d++) {
+		snprintf(path, sizeof(path), "dir.%d", d);
+		err = mkdirat(atv_dirfd, path, 0755);
+		T_QUIET; T_ASSERT_TRUE(err == 0 || errno == EEXIST, "mkdirat(%s)", path);
+		for (int f = 0; f < ATV_FILES; f++) {
+			char *file = atv_paths + off;
+
+			off += (size_t)snprintf(file, 32, "dir.%d/file.%d", d, f) + 1;
+			fd = openat(atv_dirfd, file, O_CREAT | O_RDWR, 0644);
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "openat(%s)", file);
+			close(fd);
+		}
+	}
+	atv_paths_size = off;
+}
+
+/*
+ * Unpacks the entry at *cursor, in the layout atv_attrs asks for, and
+ * advances *cursor past it.
+ */
+static void
+atv_unpack(char **cursor, atv_entry_t *e)
+{
+	char *entry = *cursor, *field;
+	attribute_set_t returned;
+	attrreference_t name;
+	uint32_t length;
+
+	memset(e, 0, sizeof(*e));
+	memcpy(&length, entry, sizeof(length));
+	field = entry + sizeof(length);
+	memcpy(&returned, field, sizeof(returned));
+	field += sizeof(returned);
+
+	if (returned.commonattr & ATTR_CMN_ERROR) {
+		memcpy(&e->error, field, sizeof(e->error));
+		field += sizeof(e->error);
+	}
+	if (returned.commonattr & ATTR_CMN_NAME) {
+		memcpy(&name, field, sizeof(name));
+		strlcpy(e->name, field + name.attr_dataoffset,
+		    MIN(sizeof(e->name), name.attr_length));
+		field += sizeof(name);
+	}
+	if (returned.commonattr & ATTR_CMN_OBJTYPE) {
+		memcpy(&e->objtype, field, sizeof(e->objtype));
+		field += sizeof(e->objtype);
+	}
+	if (returned.commonattr & ATTR_CMN_FILEID) {
+		memcpy(&e->fileid, field, sizeof(e->fileid));
+		field += sizeof(e->fileid);
+	}
+	*cursor = entry + length;
+}
+
+T_DECL(getattrlistatv_order,
+    "getattrlistatv returns one entry per path in order, errors included")
+{
+	static const char paths[] = "dir.0/file.0\0dir.0/missing\0dir.1\0dir.1/file.3";
+	char *buf, *cursor;
+	atv_entry_t e;
+	struct stat st;
+	int n;
+
+	atv_setup();
+	buf = malloc(ATV_BUFSIZE);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+
+	n = getattrlistatv(atv_dirfd, paths, sizeof(paths), &atv_attrs, buf,
+	    ATV_BUFSIZE, 0);
+	T_ASSERT_POSIX_SUCCESS(n, "getattrlistatv");
+	T_ASSERT_EQ(n, 4, "one entry per path");
+
+	cursor = buf;
+	atv_unpack(&cursor, &e);
+	T_ASSERT_POSIX_SUCCESS(fstatat(atv_dirfd, "dir.0/file.0", &st, 0), "fstatat");
+	T_EXPECT_EQ(e.error, 0U, "first path found");
+	T_EXPECT_EQ_STR(e.name, "dir.0/file.0", "name is the path as passed");
+	T_EXPECT_EQ(e.objtype, (fsobj_type_t)VREG, "regular file");
+	T_EXPECT_EQ(e.fileid, (uint64_t)st.st_ino, "file id matches fstatat");
+
+	atv_unpack(&cursor, &e);
+	T_EXPECT_EQ(e.error, (uint32_t)ENOENT, "missing path reports ENOENT");
+	T_EXPECT_EQ_STR(e.name, "dir.0/missing", "error entry names the path");
+
+	atv_unpack(&cursor, &e);
+	T_EXPECT_EQ(e.objtype, (fsobj_type_t)VDIR, "directory");
+
+	atv_unpack(&cursor, &e);
+	T_ASSERT_POSIX_SUCCESS(fstatat(atv_dirfd, "dir.1/file.3", &st, 0), "fstatat");
+	T_EXPECT_EQ(e.fileid, (uint64_t)st.st_ino, "file id matches fstatat");
+
+	/* a buffer with room for only part of the list stops early */
+	n = getattrlistatv(atv_dirfd, atv_paths, atv_paths_size, &atv_attrs,
+	    buf, 1024, 0);
+	T_ASSERT_POSIX_SUCCESS(n, "getattrlistatv into a small buffer");
+	T_EXPECT_GT(n, 0, "some entries fit");
+	T_EXPECT_LT(n, ATV_PATHS, "not all entries fit");
+
+	T_ASSERT_POSIX_FAILURE(getattrlistatv(atv_dirfd, "unterminated", 12,
+	    &atv_attrs, buf, ATV_BUFSIZE, 0), EINVAL, "unterminated path list");
+
+	free(buf);
+}
+
+static double
+atv_rate(uint64_t abs)
+{
+	mach_timebase_info_data_t tb;
+
+	mach_timebase_info(&tb);
+	return (double)ATV_PATHS * ATV_ROUNDS * 1e9 /
+	       ((double)abs * tb.numer / tb.denom);
+}
+
+T_DECL(getattrlistatv_perf,
+    "paths resolved per second, getattrlistatv against fstatat",
+    T_META_TAG_PERF)
+{
+	char *buf, *path, *cursor;
+	atv_entry_t e;
+	struct stat st;
+	uint64_t start, stat_abs, atv_abs;
+	size_t off;
+	int n;
+
+	atv_setup();
+	buf = malloc(ATV_BUFSIZE);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+
+	/* warm the name cache */
+	for (path = atv_paths; path < atv_paths + atv_paths_size; path += strlen(path) + 1) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(fstatat(atv_dirfd, path, &st, 0), "fstatat");
+	}
+
+	start = mach_absolute_time();
+	for (int r = 0; r < ATV_ROUNDS; r++) {
+		for (path = atv_paths; path < atv_paths + atv_paths_size; path += strlen(path) + 1) {
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(fstatat(atv_dirfd, path, &st, 0), "fstatat");
+		}
+	}
+	stat_abs = mach_absolute_time() - start;
+
+	start = mach_absolute_time();
+	for (int r = 0; r < ATV_ROUNDS; r++) {
+		for (off = 0; off < atv_paths_size;) {
+			n = getattrlistatv(atv_dirfd, atv_paths + off, atv_paths_size - off,
+			    &atv_attrs, buf, ATV_BUFSIZE, 0);
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "getattrlistatv");
+			cursor = buf;
+			for (int i = 0; i < n; i++) {
+				atv_unpack(&cursor, &e);
+				T_QUIET; T_ASSERT_EQ(e.error, 0U, "%s", atv_paths + off);
+				off += strlen(atv_paths + off) + 1;
+			}
+		}
+	}
+	atv_abs = mach_absolute_time() - start;
+
+	T_PERF("getattrlistatv_fstatat", atv_rate(stat_abs), "paths/s",
+	    "one fstatat() per path");
+	T_PERF("getattrlistatv_batched", atv_rate(atv_abs), "paths/s",
+	    "getattrlistatv() over the whole list");
+	T_LOG("%d paths: fstatat %.0f paths/s, getattrlistatv %.0f paths/s (x%.2f)",
+	    ATV_PATHS, atv_rate(stat_abs), atv_rate(atv_abs),
+	    atv_rate(atv_abs) / atv_rate(stat_abs));
+
+	free(buf);
+}
@@ -0,0 +1,321 @@
+/*
+ * getattrlistbulk_prefetch: Lists directories with getattrlistbulk(2) with
+ * attribute prefetching and the attribute cache (vfs.attrlist.*) turned
+ * on for local mounts, and checks the listings match the serial ones,
+ * including with buffers that fill part way through a window and after
+ * the directory changes.  Then measures entries/s listing a directory of
+ * a million entries serially, prefetched, and again from the cache.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <mach/mach_time.h>
+#include <sys/attr.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_ASROOT(true),
+    T_META_CHECK_LEAKS(false));
+
+#define GAB_FILES               2000
+#define GAB_PERF_FILES          (1000 * 1000)
+#define GAB_BUFSIZE             (128 * 1024)
+
+typedef struct {
+	char            name[64];
+	uint64_t        fileid;
+	off_t           size;
+} gab_entry_t;
+
+/*
+ * Without ATTR_CMN_OBJTYPE, getattrlistbulk(2) takes the readdir fallback
+ * whatever the filesystem.
+ */
+static struct attrlist gab_attrs = {
+	.bitmapcount = ATTR_BIT_MAP_COUNT,
+	.commonattr = ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_NAME | ATTR_CMN_FILEID,
+	.fileattr = ATTR_FILE_TOTALSIZE,
+};
+
+static const char *gab_sysctls[] = {
+	"vfs.attrlist.local",
+	"vfs.attrlist.prefetch_window",
+	"vfs.attrlist.cache_ttl_ms",
+};
+#define GAB_NSYSCTLS    (sizeof(gab_sysctls) / sizeof(gab_sysctls[0]))
+
+static int gab_saved[GAB_NSYSCTLS];
+static int gab_have_saved;
+
+static int
+gab_get_int(const char *name)
+{
+	int value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "sysctlbyname(%s)", name);
+	return value;
+}
+
+static void
+gab_set_int(const char *name, int value)
+{
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, NULL, NULL, &value, sizeof(value)),
+	    "sysctlbyname(%s, %d)", name, value);
+}
+
+static uint64_t
+gab_get_quad(const char *name)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "sysctlbyname(%s)", name);
+	return value;
+}
+
+static void
+gab_restore(void)
+{
+	for (size_t i = 0; i < GAB_NSYSCTLS; i++) {
+		gab_set_int(gab_sysctls[i], gab_saved[i]);
+	}
+}
+
+static void
+gab_save(void)
+{
+	if (!gab_have_saved) {
+		for (size_t i = 0; i < GAB_NSYSCTLS; i++) {
+			gab_saved[i] = gab_get_int(gab_sysctls[i]);
+		}
+		gab_have_saved = 1;
+		T_ATEND(gab_restore);
+	}
+}
+
+static void
+gab_mode(int local, int window, int ttl_ms)
+{
+	gab_set_int("vfs.attrlist.local", local);
+	gab_set_int("vfs.attrlist.prefetch_window", window);
+	gab_set_int("vfs.attrlist.cache_ttl_ms", ttl_ms);
+}
+
+/*
+ * Creates a directory of nfiles files, file.N being N bytes long.
+ */
+static void
+gab_make_dir(const char *name, int nfiles, char *path, size_t pathlen)
+{
+	char file[64];
+	int err, dirfd, fd;
+
+	snprintf(path, pathlen, "%s/getattrlistbulk_prefetch/%s", dt_tmpdir(), name);
+	err = mkpath_np(path, 0755);
+	T_QUIET; T_ASSERT_TRUE(err == 0 || err == EEXIST, "mkpath_np(%s)", path);
+	dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(dirfd, "open(%s)", path);
+
+	for (int i = 0; i < nfiles; i++) {
+		snprintf(file, sizeof(file), "file.%d", i);
+		fd = openat(dirfd, file, O_CREAT | O_RDWR, 0644);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "openat(%s)", file);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(ftruncate(fd, i % 4096), "ftruncate");
+		close(fd);
+	}
+	close(dirfd);
+}
+
+static int
+gab_entry_cmp(const void *a, const void *b)
+{
+	return strcmp(((const gab_entry_t *)a)->name, ((const gab_entry_t *)b)->name);
+}
+
+/*
+ * Lists path with getattrlistbulk into entries (if not NULL, sorted by
+ * name), bufsize bytes at a time, and returns the number of entries.
+ */
+static int
+gab_list(const char *path, gab_entry_t *entries, int max, size_t bufsize)
+{
+	char *buf;
+	int dirfd, n, total = 0;
+
+	buf = malloc(bufsize);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+	dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(dirfd, "open(%s)", path);
+
+	while ((n = getattrlistbulk(dirfd, &gab_attrs, buf, bufsize, 0)) > 0) {
+		char *entry = buf;
+
+		for (int i = 0; i < n; i++) {
+			char *cursor = entry + sizeof(uint32_t);
+			attribute_set_t returned;
+			attrreference_t name;
+			uint64_t fileid;
+			off_t size = 0;
+
+			memcpy(&returned, cursor, sizeof(returned));
+			cursor += sizeof(returned);
+			memcpy(&name, cursor, sizeof(name));
+			cursor += sizeof(name);
+			memcpy(&fileid, cursor, sizeof(fileid));
+			cursor += sizeof(fileid);
+			if (returned.fileattr & ATTR_FILE_TOTALSIZE) {
+				memcpy(&size, cursor, sizeof(size));
+			}
+
+			if (entries != NULL) {
+				T_QUIET; T_ASSERT_LT(total, max, "no more entries than files");
+				strlcpy(entries[total].name,
+				    (char *)entry + sizeof(uint32_t) + sizeof(returned) + name.attr_dataoffset,
+				    sizeof(entries[total].name));
+				entries[total].fileid = fileid;
+				entries[total].size = size;
+			}
+			total++;
+			entry += *(uint32_t *)entry;
+		}
+	}
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "getattrlistbulk(%s)", path);
+
+	close(dirfd);
+	free(buf);
+	if (entries != NULL) {
+		qsort(entries, (size_t)total, sizeof(*entries), gab_entry_cmp);
+	}
+	return total;
+}
+
+static void
+gab_expect_same(const gab_entry_t *a, int na, const gab_entry_t *b, int nb, const char *what)
+{
+	T_QUIET; T_ASSERT_EQ(na, nb, "%s: entry count", what);
+	for (int i = 0; i < na; i++) {
+		T_QUIET; T_ASSERT_EQ_STR(a[i].name, b[i].name, "%s: entry %d", what, i);
+		T_QUIET; T_ASSERT_EQ(a[i].fileid, b[i].fileid, "%s: fileid of %s", what, a[i].name);
+		T_QUIET; T_ASSERT_EQ(a[i].size, b[i].size, "%s: size of %s", what, a[i].name);
+	}
+	T_PASS("%s: %d entries match", what, na);
+}
+
+T_DECL(getattrlistbulk_prefetch_listing,
+    "prefetched and cached listings match serial ones")
+{
+	char path[PATH_MAX], file[PATH_MAX];
+	gab_entry_t *serial, *other;
+	uint64_t hits, prefetched;
+	int nserial, n, fd;
+
+	gab_save();
+	if (gab_get_int("vfs.attrlist.prefetch_threads") == 0) {
+		T_SKIP("no attribute prefetch threads");
+	}
+	gab_make_dir("listing", GAB_FILES, path, sizeof(path));
+	serial = calloc(GAB_FILES + 1, sizeof(*serial));
+	other = calloc(GAB_FILES + 1, sizeof(*other));
+	T_QUIET; T_ASSERT_NOTNULL(serial, "calloc");
+	T_QUIET; T_ASSERT_NOTNULL(other, "calloc");
+
+	gab_mode(0, 16, 1000);
+	nserial = gab_list(path, serial, GAB_FILES + 1, GAB_BUFSIZE);
+	T_ASSERT_EQ(nserial, GAB_FILES, "serial listing has every file");
+
+	gab_mode(1, 16, 0);
+	prefetched = gab_get_quad("vfs.attrlist.prefetched");
+	n = gab_list(path, other, GAB_FILES + 1, GAB_BUFSIZE);
+	gab_expect_same(serial, nserial, other, n, "prefetched");
+	T_EXPECT_GT(gab_get_quad("vfs.attrlist.prefetched"), prefetched, "workers packed entries");
+
+	/* buffers that fill part way through a window */
+	n = gab_list(path, other, GAB_FILES + 1, 1000);
+	gab_expect_same(serial, nserial, other, n, "prefetched, small buffer");
+
+	gab_mode(1, 16, 60 * 1000);
+	n = gab_list(path, other, GAB_FILES + 1, GAB_BUFSIZE);
+	gab_expect_same(serial, nserial, other, n, "filling the cache");
+	hits = gab_get_quad("vfs.attrlist.cache_hits");
+	n = gab_list(path, other, GAB_FILES + 1, GAB_BUFSIZE);
+	gab_expect_same(serial, nserial, other, n, "from the cache");
+	T_EXPECT_GE(gab_get_quad("vfs.attrlist.cache_hits") - hits, (uint64_t)GAB_FILES,
+	    "second listing served from the cache");
+
+	/* a change to the directory invalidates what was cached for it */
+	snprintf(file, sizeof(file), "%s/file.0", path);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(unlink(file), "unlink(%s)", file);
+	fd = open(file, O_CREAT | O_RDWR, 0644);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", file);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ftruncate(fd, 12345), "ftruncate");
+	close(fd);
+
+	gab_mode(0, 16, 1000);
+	nserial = gab_list(path, serial, GAB_FILES + 1, GAB_BUFSIZE);
+	gab_mode(1, 16, 60 * 1000);
+	n = gab_list(path, other, GAB_FILES + 1, GAB_BUFSIZE);
+	gab_expect_same(serial, nserial, other, n, "after recreating a file");
+
+	free(serial);
+	free(other);
+}
+
+static double
+gab_rate(const char *path, int nfiles)
+{
+	mach_timebase_info_data_t tb;
+	uint64_t start, ns;
+	int n;
+
+	mach_timebase_info(&tb);
+	start = mach_absolute_time();
+	n = gab_list(path, NULL, 0, GAB_BUFSIZE);
+	ns = (mach_absolute_time() - start) * tb.numer / tb.denom;
+	T_QUIET; T_ASSERT_EQ(n, nfiles, "listed every file");
+	return (double)n * 1e9 / ns;
+}
+
+T_DECL(getattrlistbulk_prefetch_perf,
+    "entries/s listing a million entries serially, prefetched and cached",
+    T_META_TAG_PERF,
+    T_META_TIMEOUT(3600))
+{
+	char path[PATH_MAX];
+	double serial, prefetched, cached;
+
+	gab_save();
+	gab_make_dir("perf", GAB_PERF_FILES, path, sizeof(path));
+
+	gab_mode(0, 16, 1000);
+	(void)gab_rate(path, GAB_PERF_FILES);
+	serial = gab_rate(path, GAB_PERF_FILES);
+
+	gab_mode(1, gab_saved[1] > 1 ? gab_saved[1] : 16, 0);
+	prefetched = gab_rate(path, GAB_PERF_FILES);
+
+	gab_mode(1, gab_saved[1] > 1 ? gab_saved[1] : 16, 60 * 1000);
+	(void)gab_rate(path, GAB_PERF_FILES);
+	cached = gab_rate(path, GAB_PERF_FILES);
+
+	T_PERF("getattrlistbulk_serial", serial, "entries/s",
+	    "readdir and a lookup and getattr per entry, one at a time");
+	T_PERF("getattrlistbulk_prefetch", prefetched, "entries/s",
+	    "lookups and getattrs of a window of entries on the prefetch workers");
+	T_PERF("getattrlistbulk_cached", cached, "entries/s",
+	    "second listing served from the attribute cache");
+	T_LOG("%d entries, %d prefetch threads: serial %.0f/s, prefetched %.0f/s (x%.2f), "
+	    "cached %.0f/s (x%.2f)", GAB_PERF_FILES, gab_get_int("vfs.attrlist.prefetch_threads"),
+	    serial, prefetched, prefetched / serial, cached, cached / serial);
+}
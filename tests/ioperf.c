@@ -11,6 +11,7 @@
 #include <getopt.h>
 #include <spawn.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <sys/sysctl.h>
 #include <mach/mach_time.h>
 #include <mach/mach.h>
@@ -22,6 +23,7 @@
 #endif
 
 #include <darwintest.h>
+#include <darwintest_utils.h>
 #include <stdatomic.h>
 
 #define MAX_THREADS         32
@@ -252,3 +254,176 @@ T_DECL(read_perf, "Sequential Uncached Read Performance", T_META_TYPE_PERF, T_ME
 		    "pthread_join %d", thread_id);
 	}
 }
+
+/*
+ * Read-ahead with several streams on one file: interleaved sequential
+ * readers sharing a descriptor, a strided reader, and concurrent readers
+ * of separate regions, each run with debug.cluster_ra_adaptive off and on.
+ * Each run reads a freshly written file whose pages were never cached.
+ */
+
+#define RA_FILE_SIZE        (64 * 1024 * 1024)
+#define RA_STREAMS          4
+#define RA_READ_SIZE        (32 * 1024)
+#define RA_STRIDE_RECORD    (16 * 1024)
+#define RA_STRIDE           (128 * 1024)
+
+typedef enum {
+	RA_INTERLEAVED,
+	RA_STRIDED,
+	RA_THREADED,
+} ra_pattern_t;
+
+static const char *ra_pattern_names[] = {
+	[RA_INTERLEAVED] = "interleaved",
+	[RA_STRIDED] = "strided",
+	[RA_THREADED] = "threaded",
+};
+
+struct ra_thread_args {
+	int fd;
+	off_t start;
+	char *buf;
+};
+
+static int
+ra_create_file(const char *path)
+{
+	char *buf = malloc(IO_SIZE * 16);
+	int fd;
+
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+	memset(buf, 0x5a, IO_SIZE * 16);
+
+	unlink(path);
+	fd = open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open %s", path);
+
+	/* keep the pages out of the cache so the reads below go to the device */
+	T_QUIET; T_ASSERT_POSIX_ZERO(fcntl(fd, F_NOCACHE, 1), "fcntl F_NOCACHE enable");
+	for (int size = 0; size < RA_FILE_SIZE; size += IO_SIZE * 16) {
+		T_QUIET;
+		T_ASSERT_EQ_LONG(write(fd, buf, IO_SIZE * 16), (long)(IO_SIZE * 16), "write test file");
+	}
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fsync(fd), "fsync");
+	T_QUIET; T_ASSERT_POSIX_ZERO(fcntl(fd, F_NOCACHE, 0), "fcntl F_NOCACHE disable");
+	free(buf);
+
+	return fd;
+}
+
+static void *
+ra_region_thread(void *arg)
+{
+	struct ra_thread_args *args = arg;
+	off_t region = RA_FILE_SIZE / RA_STREAMS;
+
+	for (off_t off = 0; off < region; off += RA_READ_SIZE) {
+		T_QUIET;
+		T_ASSERT_EQ_LONG(pread(args->fd, args->buf, RA_READ_SIZE, args->start + off),
+		    (long)RA_READ_SIZE, "pread");
+	}
+	return NULL;
+}
+
+/* Returns the throughput of one run of the pattern, in MB/s */
+static double
+ra_run_pattern(ra_pattern_t pattern, int adaptive)
+{
+	char path[PATH_MAX];
+	char *buf;
+	off_t region = RA_FILE_SIZE / RA_STREAMS;
+	size_t bytes = 0;
+	uint64_t start, elapsed;
+	int fd;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("debug.cluster_ra_adaptive", NULL, NULL,
+	    &adaptive, sizeof(adaptive)), "sysctl debug.cluster_ra_adaptive=%d", adaptive);
+
+	snprintf(path, sizeof(path), "%s/ioperf_ra.%s.%d", dt_tmpdir(),
+	    ra_pattern_names[pattern], adaptive);
+	fd = ra_create_file(path);
+
+	buf = malloc(RA_READ_SIZE * RA_STREAMS);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+
+	start = mach_absolute_time();
+	switch (pattern) {
+	case RA_INTERLEAVED:
+		/* one descriptor, RA_STREAMS sequential readers taking turns */
+		for (off_t off = 0; off < region; off += RA_READ_SIZE) {
+			for (int s = 0; s < RA_STREAMS; s++) {
+				T_QUIET;
+				T_ASSERT_EQ_LONG(pread(fd, buf, RA_READ_SIZE, s * region + off),
+				    (long)RA_READ_SIZE, "pread");
+				bytes += RA_READ_SIZE;
+			}
+		}
+		break;
+
+	case RA_STRIDED:
+		/* fixed size records at a fixed stride, as a column scan would */
+		for (off_t off = 0; off < RA_FILE_SIZE; off += RA_STRIDE) {
+			T_QUIET;
+			T_ASSERT_EQ_LONG(pread(fd, buf, RA_STRIDE_RECORD, off),
+			    (long)RA_STRIDE_RECORD, "pread");
+			bytes += RA_STRIDE_RECORD;
+		}
+		break;
+
+	case RA_THREADED: {
+		/* RA_STREAMS threads each reading their own region of the file */
+		struct ra_thread_args args[RA_STREAMS];
+		pthread_t thr[RA_STREAMS];
+
+		for (int s = 0; s < RA_STREAMS; s++) {
+			args[s] = (struct ra_thread_args){
+				.fd = fd, .start = s * region, .buf = buf + s * RA_READ_SIZE,
+			};
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thr[s], NULL,
+			    ra_region_thread, &args[s]), "pthread_create");
+		}
+		for (int s = 0; s < RA_STREAMS; s++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thr[s], NULL), "pthread_join");
+		}
+		bytes = RA_FILE_SIZE;
+		break;
+	}
+	}
+	elapsed = mach_absolute_time() - start;
+
+	close(fd);
+	unlink(path);
+	free(buf);
+
+	return (double)bytes / (1024 * 1024) /
+	       ((double)elapsed * timebase_info.numer / timebase_info.denom / NSEC_PER_SEC);
+}
+
+T_DECL(read_ahead_streams, "Read-ahead throughput for multi-stream read patterns",
+    T_META_TYPE_PERF, T_META_CHECK_LEAKS(NO), T_META_ASROOT(YES))
+{
+	int adaptive;
+	size_t size = sizeof(adaptive);
+	char name[64];
+
+	T_ASSERT_MACH_SUCCESS(mach_timebase_info(&timebase_info), "mach_timebase_info");
+
+	if (sysctlbyname("debug.cluster_ra_adaptive", &adaptive, &size, NULL, 0) != 0) {
+		T_SKIP("debug.cluster_ra_adaptive not supported");
+	}
+
+	for (ra_pattern_t p = RA_INTERLEAVED; p <= RA_THREADED; p++) {
+		double fixed = ra_run_pattern(p, 0);
+		double adapt = ra_run_pattern(p, 1);
+
+		snprintf(name, sizeof(name), "read_ahead_%s_fixed", ra_pattern_names[p]);
+		T_PERF(name, fixed, "MB/s", "single stream, fixed window read-ahead");
+		snprintf(name, sizeof(name), "read_ahead_%s_adaptive", ra_pattern_names[p]);
+		T_PERF(name, adapt, "MB/s", "per-stream, latency sized read-ahead");
+		T_LOG("%s: %.1f MB/s fixed, %.1f MB/s adaptive", ra_pattern_names[p], fixed, adapt);
+	}
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("debug.cluster_ra_adaptive", NULL, NULL,
+	    &adaptive, sizeof(adaptive)), "restore debug.cluster_ra_adaptive");
+}
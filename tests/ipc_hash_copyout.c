@@ -0,0 +1,144 @@
+/*
+ * ipc_hash_copyout: Measures how fast send rights the receiver already
+ * holds can be copied out, which goes through the reverse hash of the
+ * receiving space, from one task and from one task per CPU at once.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <sys/mman.h>
+#include <sys/sysctl.h>
+#include <sys/wait.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.ipc"),
+    T_META_CHECK_LEAKS(false));
+
+#define COPYOUT_PORTS           1024
+#define COPYOUT_PER_MSG         16
+#define COPYOUT_MSGS            200000
+#define COPYOUT_TRIM            4096
+
+typedef struct {
+	mach_msg_header_t header;
+	mach_msg_body_t body;
+	mach_msg_port_descriptor_t ports[COPYOUT_PER_MSG];
+	mach_msg_max_trailer_t trailer;
+} copyout_msg_t;
+
+/*
+ * Sends COPYOUT_MSGS messages of COPYOUT_PER_MSG send rights to itself,
+ * and returns the time spent.
+ */
+static uint64_t
+copyout_run(void)
+{
+	mach_port_t ports[COPYOUT_PORTS];
+	mach_port_t rcv;
+	copyout_msg_t msg;
+	uint64_t start;
+	kern_return_t kr;
+	uint32_t next = 0;
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &rcv);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate(rcv)");
+
+	for (int i = 0; i < COPYOUT_PORTS; i++) {
+		kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE,
+		    &ports[i]);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate");
+		kr = mach_port_insert_right(mach_task_self(), ports[i], ports[i],
+		    MACH_MSG_TYPE_MAKE_SEND);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_insert_right");
+	}
+
+	start = mach_absolute_time();
+	for (int m = 0; m < COPYOUT_MSGS; m++) {
+		msg.header = (mach_msg_header_t){
+			.msgh_bits = MACH_MSGH_BITS_SET(MACH_MSG_TYPE_MAKE_SEND,
+			    0, 0, MACH_MSGH_BITS_COMPLEX),
+			.msgh_size = offsetof(copyout_msg_t, trailer),
+			.msgh_remote_port = rcv,
+		};
+		msg.body.msgh_descriptor_count = COPYOUT_PER_MSG;
+		for (int i = 0; i < COPYOUT_PER_MSG; i++) {
+			msg.ports[i] = (mach_msg_port_descriptor_t){
+				.name = ports[next++ % COPYOUT_PORTS],
+				.disposition = MACH_MSG_TYPE_COPY_SEND,
+				.type = MACH_MSG_PORT_DESCRIPTOR,
+			};
+		}
+
+		kr = mach_msg(&msg.header, MACH_SEND_MSG | MACH_RCV_MSG,
+		    msg.header.msgh_size, sizeof(msg), rcv,
+		    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(SEND|RCV)");
+
+		/* every right comes back under its old name, with one more uref */
+		if (next % (COPYOUT_PORTS * COPYOUT_TRIM) == 0) {
+			for (int i = 0; i < COPYOUT_PORTS; i++) {
+				kr = mach_port_mod_refs(mach_task_self(), ports[i],
+				    MACH_PORT_RIGHT_SEND, -COPYOUT_TRIM);
+				T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_mod_refs");
+			}
+		}
+	}
+	return mach_absolute_time() - start;
+}
+
+static double
+copyout_rate(uint64_t abs, int tasks)
+{
+	mach_timebase_info_data_t tb;
+
+	mach_timebase_info(&tb);
+	return (double)COPYOUT_MSGS * COPYOUT_PER_MSG * tasks * 1e9 /
+	       ((double)abs * tb.numer / tb.denom);
+}
+
+T_DECL(ipc_hash_copyout,
+    "send rights copied out per second, one task and one task per CPU",
+    T_META_TAG_PERF)
+{
+	uint64_t *elapsed, slowest = 0;
+	int ncpu;
+	size_t len = sizeof(ncpu);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &len,
+	    NULL, 0), "hw.ncpu");
+
+	elapsed = mmap(NULL, sizeof(uint64_t) * (size_t)ncpu,
+	    PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
+	T_QUIET; T_ASSERT_NE(elapsed, MAP_FAILED, "mmap");
+
+	T_PERF("ipc_hash_copyout_single", copyout_rate(copyout_run(), 1),
+	    "rights/s", "send rights copied out by one task");
+
+	for (int i = 0; i < ncpu; i++) {
+		pid_t pid = fork();
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(pid, "fork");
+		if (pid == 0) {
+			elapsed[i] = copyout_run();
+			exit(0);
+		}
+	}
+	for (int i = 0; i < ncpu; i++) {
+		int status;
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(wait(&status), "wait");
+		T_QUIET; T_ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+		    "child exited cleanly");
+	}
+	for (int i = 0; i < ncpu; i++) {
+		if (elapsed[i] > slowest) {
+			slowest = elapsed[i];
+		}
+	}
+
+	T_PERF("ipc_hash_copyout_concurrent", copyout_rate(slowest, ncpu),
+	    "rights/s", "send rights copied out by one task per CPU at once");
+	T_LOG("%d tasks: %.0f rights/s", ncpu, copyout_rate(slowest, ncpu));
+}
@@ -0,0 +1,140 @@
+/*
+ * ipc_space_growth: Grows an IPC space to a million entries while other
+ * threads keep sending messages and looking up names in it, and reports
+ * how much the growth disturbs them.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.ipc"),
+    T_META_CHECK_LEAKS(false));
+
+#define GROWTH_TARGET           (1024 * 1024)
+#define GROWTH_PINGERS          4
+
+typedef struct {
+	mach_msg_header_t header;
+	mach_msg_max_trailer_t trailer;
+} ping_msg_t;
+
+typedef struct {
+	pthread_t       thread;
+	mach_port_t     port;
+	uint64_t        count;
+	uint64_t        total_abs;
+	uint64_t        max_abs;
+	uint64_t        type_count;
+} pinger_t;
+
+static atomic_bool growth_done;
+
+static double
+abs_to_us(uint64_t abs)
+{
+	mach_timebase_info_data_t tb;
+
+	mach_timebase_info(&tb);
+	return (double)abs * tb.numer / tb.denom / 1000.0;
+}
+
+static void *
+pinger(void *arg)
+{
+	pinger_t *p = arg;
+	mach_port_type_t type;
+	ping_msg_t msg;
+	uint64_t start, elapsed;
+	kern_return_t kr;
+
+	while (!atomic_load_explicit(&growth_done, memory_order_relaxed)) {
+		msg.header = (mach_msg_header_t){
+			.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_MAKE_SEND, 0),
+			.msgh_size = sizeof(mach_msg_header_t),
+			.msgh_remote_port = p->port,
+		};
+
+		start = mach_absolute_time();
+		kr = mach_msg(&msg.header, MACH_SEND_MSG | MACH_RCV_MSG,
+		    sizeof(mach_msg_header_t), sizeof(msg), p->port,
+		    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+		elapsed = mach_absolute_time() - start;
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(SEND|RCV)");
+
+		p->count++;
+		p->total_abs += elapsed;
+		if (elapsed > p->max_abs) {
+			p->max_abs = elapsed;
+		}
+
+		kr = mach_port_type(mach_task_self(), p->port, &type);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_type");
+		p->type_count++;
+	}
+	return NULL;
+}
+
+T_DECL(ipc_space_growth,
+    "mach_msg latency while the IPC space grows to 1M entries",
+    T_META_TAG_PERF)
+{
+	pinger_t pingers[GROWTH_PINGERS] = { };
+	uint64_t start, grow_abs, count = 0, total_abs = 0, max_abs = 0, types = 0;
+	mach_port_t name;
+	kern_return_t kr = KERN_SUCCESS;
+	uint32_t allocated;
+
+	for (int i = 0; i < GROWTH_PINGERS; i++) {
+		kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE,
+		    &pingers[i].port);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate(pinger)");
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&pingers[i].thread, NULL,
+		    pinger, &pingers[i]), "pthread_create");
+	}
+
+	start = mach_absolute_time();
+	for (allocated = 0; allocated < GROWTH_TARGET; allocated++) {
+		kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE,
+		    &name);
+		if (kr != KERN_SUCCESS) {
+			break;
+		}
+	}
+	grow_abs = mach_absolute_time() - start;
+
+	atomic_store(&growth_done, true);
+	for (int i = 0; i < GROWTH_PINGERS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(pingers[i].thread, NULL),
+		    "pthread_join");
+		count += pingers[i].count;
+		total_abs += pingers[i].total_abs;
+		types += pingers[i].type_count;
+		if (pingers[i].max_abs > max_abs) {
+			max_abs = pingers[i].max_abs;
+		}
+	}
+
+	if (kr != KERN_SUCCESS) {
+		/* the space or zone limits may be lower than the target */
+		T_LOG("stopped after %u entries: %s (0x%x)", allocated,
+		    mach_error_string(kr), kr);
+		T_QUIET; T_ASSERT_TRUE(kr == KERN_NO_SPACE ||
+		    kr == KERN_RESOURCE_SHORTAGE, "allocation failed for lack of room");
+	}
+	T_QUIET; T_ASSERT_GT(count, 0ULL, "pingers made progress");
+
+	T_PERF("ipc_space_growth_rate", allocated / (abs_to_us(grow_abs) / 1e6),
+	    "entries/s", "receive rights allocated per second while growing");
+	T_PERF("ipc_space_growth_msg_mean", abs_to_us(total_abs) / count, "us",
+	    "mean mach_msg send+receive latency while growing");
+	T_PERF("ipc_space_growth_msg_max", abs_to_us(max_abs), "us",
+	    "worst mach_msg send+receive latency while growing");
+	T_LOG("%u entries in %.0f ms, %llu messages (mean %.2f us, max %.2f us), "
+	    "%llu mach_port_type calls", allocated, abs_to_us(grow_abs) / 1000.0,
+	    count, abs_to_us(total_abs) / count, abs_to_us(max_abs), types);
+}
@@ -436,3 +436,64 @@ T_DECL(kernel_mtx_perf_test,
 	test_from_kernel_lock_unlock_uncontended();
 	test_from_kernel_lock_unlock_contended();
 }
+
+static void
+set_adaptive_spin_tuning(unsigned int val)
+{
+	int ret = sysctlbyname("kern.lck_mtx_adaptive_spin_tuning", NULL, NULL, &val, sizeof(val));
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ret, "sysctlbyname kern.lck_mtx_adaptive_spin_tuning %u", val);
+}
+
+static unsigned int previous_adaptive_spin_tuning;
+
+static void
+restore_adaptive_spin_tuning(void)
+{
+	set_adaptive_spin_tuning(previous_adaptive_spin_tuning);
+}
+
+static void
+log_lck_mtx_contention(void)
+{
+	size_t size = 0;
+	char *buff;
+	int ret;
+
+	ret = sysctlbyname("kern.lck_mtx_contention", NULL, &size, NULL, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ret, "sysctlbyname kern.lck_mtx_contention size");
+
+	buff = calloc(size + 1, sizeof(char));
+	T_QUIET; T_ASSERT_NOTNULL(buff, "Allocating buffer fo sysctl");
+
+	ret = sysctlbyname("kern.lck_mtx_contention", buff, &size, NULL, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ret, "sysctlbyname kern.lck_mtx_contention");
+
+	T_LOG("kern.lck_mtx_contention:\n%s\n", buff);
+	free(buff);
+}
+
+T_DECL(kernel_mtx_adaptive_spin_test,
+    "Kernel mutex contended performance with and without adaptive spin tuning",
+    T_META_ASROOT(YES), T_META_CHECK_LEAKS(NO))
+{
+	size_t len = sizeof(previous_adaptive_spin_tuning);
+	int ret;
+
+	ret = sysctlbyname("kern.lck_mtx_adaptive_spin_tuning", &previous_adaptive_spin_tuning, &len, NULL, 0);
+	T_ASSERT_POSIX_SUCCESS(ret, "sysctlbyname kern.lck_mtx_adaptive_spin_tuning");
+
+	fix_cpu_frequency();
+
+	T_ATEND(cleanup_cpu_freq);
+	T_ATEND(restore_adaptive_spin_tuning);
+
+	T_LOG("Contended mutex test with fixed spin duration\n");
+	set_adaptive_spin_tuning(0);
+	test_from_kernel_lock_unlock_contended();
+	log_lck_mtx_contention();
+
+	T_LOG("Contended mutex test with adaptive spin tuning\n");
+	set_adaptive_spin_tuning(1);
+	test_from_kernel_lock_unlock_contended();
+	log_lck_mtx_contention();
+}
@@ -0,0 +1,123 @@
+/*
+ * mach_msg_pingpong_perf: Measures the round trip latency of inline
+ * messages of various sizes between two threads.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <mach/mach.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.ipc"),
+    T_META_CHECK_LEAKS(false));
+
+#define PINGPONG_MAX_BODY       (16 * 1024)
+#define PINGPONG_QUIT_ID        0x71756974
+
+typedef struct {
+	mach_msg_header_t header;
+	char body[PINGPONG_MAX_BODY];
+	mach_msg_max_trailer_t trailer;
+} pingpong_msg_t;
+
+static const mach_msg_size_t pingpong_sizes[] = {
+	0, 128, 1024, 2048, 4096, 8192, 16384,
+};
+
+static mach_port_name_t ping_port, pong_port;
+
+static mach_port_name_t
+pingpong_port_create(void)
+{
+	mach_port_name_t port;
+	kern_return_t kr;
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate(RECEIVE)");
+	kr = mach_port_insert_right(mach_task_self(), port, port,
+	    MACH_MSG_TYPE_MAKE_SEND);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_insert_right");
+	return port;
+}
+
+static void
+pingpong_send(pingpong_msg_t *msg, mach_port_name_t port,
+    mach_msg_size_t body_size, mach_msg_id_t id)
+{
+	kern_return_t kr;
+
+	msg->header = (mach_msg_header_t){
+		.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0),
+		.msgh_size = (mach_msg_size_t)sizeof(msg->header) + body_size,
+		.msgh_remote_port = port,
+		.msgh_id = id,
+	};
+	kr = mach_msg(&msg->header, MACH_SEND_MSG, msg->header.msgh_size, 0,
+	    MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(SEND)");
+}
+
+static void
+pingpong_receive(pingpong_msg_t *msg, mach_port_name_t port)
+{
+	kern_return_t kr;
+
+	kr = mach_msg(&msg->header, MACH_RCV_MSG, 0, sizeof(*msg), port,
+	    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(RCV)");
+}
+
+static void *
+pong_thread(void *arg __unused)
+{
+	pingpong_msg_t *msg = malloc(sizeof(*msg));
+	mach_msg_size_t body_size;
+
+	T_QUIET; T_ASSERT_NOTNULL(msg, "malloc");
+
+	for (;;) {
+		pingpong_receive(msg, ping_port);
+		if (msg->header.msgh_id == PINGPONG_QUIT_ID) {
+			break;
+		}
+		body_size = msg->header.msgh_size - (mach_msg_size_t)sizeof(msg->header);
+		pingpong_send(msg, pong_port, body_size, msg->header.msgh_id);
+	}
+
+	free(msg);
+	return NULL;
+}
+
+T_DECL(mach_msg_pingpong_sizes,
+    "round trip latency of inline messages of increasing sizes",
+    T_META_TAG_PERF)
+{
+	pingpong_msg_t *msg = malloc(sizeof(*msg));
+	pthread_t thread;
+
+	T_QUIET; T_ASSERT_NOTNULL(msg, "malloc");
+	memset(msg, 0xa5, sizeof(*msg));
+
+	ping_port = pingpong_port_create();
+	pong_port = pingpong_port_create();
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL,
+	    pong_thread, NULL), "pthread_create");
+
+	for (size_t i = 0; i < sizeof(pingpong_sizes) / sizeof(pingpong_sizes[0]); i++) {
+		mach_msg_size_t body_size = pingpong_sizes[i];
+		dt_stat_time_t s = dt_stat_time_create(
+			"ping-pong round trip, %u bytes body", body_size);
+
+		T_STAT_MEASURE_LOOP(s) {
+			pingpong_send(msg, ping_port, body_size, 0);
+			pingpong_receive(msg, pong_port);
+		}
+		dt_stat_finalize(s);
+	}
+
+	pingpong_send(msg, ping_port, 0, PINGPONG_QUIT_ID);
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+	free(msg);
+}
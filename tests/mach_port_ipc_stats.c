@@ -0,0 +1,113 @@
+/*
+ * mach_port_ipc_stats: Checks the sampled message flow statistics
+ * reported by the MACH_PORT_IPC_* attribute flavors.
+ */
+
+#include <darwintest.h>
+#include <mach/mach.h>
+#include <mach/port.h>
+#include <stdlib.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.ipc"),
+    T_META_CHECK_LEAKS(false));
+
+#define STATS_MSGS              1024
+#define STATS_DEPTH             256
+
+typedef struct {
+	mach_msg_header_t header;
+	uint8_t payload[1024];
+	mach_msg_max_trailer_t trailer;
+} stats_msg_t;
+
+static uint32_t
+histogram_total(mach_port_ipc_histogram_t *h)
+{
+	uint32_t total = 0;
+
+	for (int i = 0; i < MACH_PORT_IPC_HISTOGRAM_BUCKETS; i++) {
+		total += h->mpih_buckets[i];
+	}
+	return total;
+}
+
+T_DECL(mach_port_ipc_stats,
+    "MACH_PORT_IPC_STATS reports queue depth, latency and size histograms")
+{
+	mach_port_limits_t limits = { .mpl_qlimit = MACH_PORT_QLIMIT_LARGE };
+	mach_port_ipc_histogram_t latency, size;
+	mach_port_ipc_stats_t stats;
+	mach_msg_type_number_t count;
+	mach_port_t port;
+	stats_msg_t msg;
+	kern_return_t kr;
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate");
+	kr = mach_port_set_attributes(mach_task_self(), port, MACH_PORT_LIMITS_INFO,
+	    (mach_port_info_t)&limits, MACH_PORT_LIMITS_INFO_COUNT);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_set_attributes(LIMITS)");
+
+	count = MACH_PORT_IPC_STATS_COUNT;
+	kr = mach_port_get_attributes(mach_task_self(), port, MACH_PORT_IPC_STATS,
+	    (mach_port_info_t)&stats, &count);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_get_attributes(IPC_STATS)");
+	if (stats.mpis_sample_rate == 0) {
+		T_SKIP("port statistics are turned off");
+	}
+	T_EXPECT_EQ(stats.mpis_messages, 0ULL, "no messages yet");
+
+	/* queue messages in batches of STATS_DEPTH, with varying sizes */
+	for (int sent = 0; sent < STATS_MSGS; sent += STATS_DEPTH) {
+		for (int i = 0; i < STATS_DEPTH; i++) {
+			msg.header = (mach_msg_header_t){
+				.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_MAKE_SEND, 0),
+				.msgh_size = sizeof(mach_msg_header_t) + 4 * (i % 256),
+				.msgh_remote_port = port,
+			};
+			kr = mach_msg(&msg.header, MACH_SEND_MSG, msg.header.msgh_size,
+			    0, MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+			T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(SEND)");
+		}
+		for (int i = 0; i < STATS_DEPTH; i++) {
+			kr = mach_msg(&msg.header, MACH_RCV_MSG, 0, sizeof(msg), port,
+			    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+			T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(RCV)");
+		}
+	}
+
+	count = MACH_PORT_IPC_STATS_COUNT;
+	kr = mach_port_get_attributes(mach_task_self(), port, MACH_PORT_IPC_STATS,
+	    (mach_port_info_t)&stats, &count);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_get_attributes(IPC_STATS)");
+	T_LOG("rate %u: %llu messages, %u sampled, depth max %u",
+	    stats.mpis_sample_rate, stats.mpis_messages, stats.mpis_sampled,
+	    stats.mpis_depth_max);
+
+	/* counting starts with the first sampled message */
+	T_EXPECT_GT(stats.mpis_messages, (uint64_t)(STATS_MSGS - stats.mpis_sample_rate),
+	    "messages are counted once sampling started");
+	T_EXPECT_LE(stats.mpis_messages, (uint64_t)STATS_MSGS, "no extra messages");
+	T_EXPECT_EQ(stats.mpis_sampled, STATS_MSGS / stats.mpis_sample_rate,
+	    "1 in %u messages sampled", stats.mpis_sample_rate);
+	T_EXPECT_EQ(stats.mpis_depth_max, STATS_DEPTH, "depth high-watermark");
+
+	count = MACH_PORT_IPC_HISTOGRAM_COUNT;
+	kr = mach_port_get_attributes(mach_task_self(), port,
+	    MACH_PORT_IPC_LATENCY_HISTOGRAM, (mach_port_info_t)&latency, &count);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_get_attributes(LATENCY_HISTOGRAM)");
+	T_EXPECT_EQ(histogram_total(&latency), stats.mpis_sampled,
+	    "every sampled message has a latency");
+
+	count = MACH_PORT_IPC_HISTOGRAM_COUNT;
+	kr = mach_port_get_attributes(mach_task_self(), port,
+	    MACH_PORT_IPC_SIZE_HISTOGRAM, (mach_port_info_t)&size, &count);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_get_attributes(SIZE_HISTOGRAM)");
+	T_EXPECT_EQ(histogram_total(&size), stats.mpis_sampled,
+	    "every sampled message has a size");
+
+	count = MACH_PORT_IPC_HISTOGRAM_COUNT - 1;
+	kr = mach_port_get_attributes(mach_task_self(), port,
+	    MACH_PORT_IPC_SIZE_HISTOGRAM, (mach_port_info_t)&size, &count);
+	T_EXPECT_MACH_ERROR(kr, KERN_FAILURE, "short buffer is rejected");
+}
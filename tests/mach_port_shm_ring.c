@@ -0,0 +1,291 @@
+/*
+ * mach_port_shm_ring: Tests the MACH_PORT_SHM_RING port attribute, and
+ * compares round trip latency through shared memory rings with mach_msg.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <mach/mach.h>
+#include <mach/mach_traps.h>
+#include <mach/shm_ring.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.ipc"),
+    T_META_CHECK_LEAKS(false));
+
+#define RING_ENTRY_SIZE         256
+#define RING_ENTRY_COUNT        64
+#define RING_NMSGS              100000
+#define RING_QUIT_ID            0x71756974
+
+static mach_port_name_t
+ring_port_create(uint32_t flags)
+{
+	mach_port_shm_ring_t info = {
+		.msr_entry_size = RING_ENTRY_SIZE,
+		.msr_entry_count = RING_ENTRY_COUNT,
+		.msr_flags = flags,
+	};
+	mach_port_name_t port;
+	kern_return_t kr;
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate(RECEIVE)");
+	kr = mach_port_insert_right(mach_task_self(), port, port,
+	    MACH_MSG_TYPE_MAKE_SEND);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_insert_right");
+	kr = mach_port_set_attributes(mach_task_self(), port, MACH_PORT_SHM_RING,
+	    (mach_port_info_t)&info, MACH_PORT_SHM_RING_COUNT);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_set_attributes(SHM_RING)");
+	return port;
+}
+
+static void
+ring_map(mach_port_name_t port, mach_shm_ring_t *ring)
+{
+	kern_return_t kr;
+
+	kr = mach_port_shm_ring_map(port, ring);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_shm_ring_map");
+}
+
+static void
+ring_send(mach_shm_ring_t *ring, mach_msg_id_t id, const void *data,
+    uint32_t size)
+{
+	kern_return_t kr;
+
+	while ((kr = mach_shm_ring_send(ring, id, data, size)) ==
+	    KERN_RESOURCE_SHORTAGE) {
+		/* ring is full, let the receiver drain it */
+	}
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_shm_ring_send");
+}
+
+T_DECL(mach_port_shm_ring_attributes,
+    "MACH_PORT_SHM_RING validates and reports the ring geometry")
+{
+	mach_port_shm_ring_t info = {
+		.msr_entry_size = RING_ENTRY_SIZE,
+		.msr_entry_count = 3,
+	};
+	mach_msg_type_number_t count = MACH_PORT_SHM_RING_COUNT;
+	mach_shm_ring_t ring;
+	mach_port_name_t port;
+	mach_msg_id_t id;
+	uint64_t value;
+	uint32_t size;
+	kern_return_t kr;
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate(RECEIVE)");
+
+	kr = mach_port_set_attributes(mach_task_self(), port, MACH_PORT_SHM_RING,
+	    (mach_port_info_t)&info, MACH_PORT_SHM_RING_COUNT);
+	T_ASSERT_EQ(kr, KERN_INVALID_VALUE, "entry count must be a power of 2");
+
+	info.msr_entry_count = RING_ENTRY_COUNT;
+	info.msr_flags = MACH_PORT_SHM_RING_MPSC;
+	kr = mach_port_set_attributes(mach_task_self(), port, MACH_PORT_SHM_RING,
+	    (mach_port_info_t)&info, MACH_PORT_SHM_RING_COUNT);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_set_attributes(SHM_RING)");
+
+	kr = mach_port_set_attributes(mach_task_self(), port, MACH_PORT_SHM_RING,
+	    (mach_port_info_t)&info, MACH_PORT_SHM_RING_COUNT);
+	T_ASSERT_EQ(kr, KERN_INVALID_ARGUMENT, "a ring can only be attached once");
+
+	bzero(&info, sizeof(info));
+	kr = mach_port_get_attributes(mach_task_self(), port, MACH_PORT_SHM_RING,
+	    (mach_port_info_t)&info, &count);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_get_attributes(SHM_RING)");
+	T_EXPECT_EQ(info.msr_entry_size, RING_ENTRY_SIZE, "entry size");
+	T_EXPECT_EQ(info.msr_entry_count, RING_ENTRY_COUNT, "entry count");
+	T_EXPECT_EQ(info.msr_flags, MACH_PORT_SHM_RING_MPSC, "flags");
+
+	ring_map(port, &ring);
+	T_EXPECT_EQ(ring.msh_mask, (uint64_t)RING_ENTRY_COUNT - 1,
+	    "map returns the entry count");
+	T_EXPECT_EQ(ring.msh_entry_size, RING_ENTRY_SIZE,
+	    "map returns the entry size");
+
+	/* the geometry isn't read back from the ring, which senders can write */
+	memset(ring.msh_header, 0xff, sizeof(*ring.msh_header));
+	size = sizeof(value);
+	T_EXPECT_FALSE(mach_shm_ring_try_receive(&ring, &id, &value, &size),
+	    "a scribbled header doesn't send the receiver out of the ring");
+
+	mach_port_mod_refs(mach_task_self(), port, MACH_PORT_RIGHT_RECEIVE, -1);
+}
+
+static mach_port_name_t stream_port;
+static mach_shm_ring_t stream_ring;
+
+static void *
+stream_sender(void *arg __unused)
+{
+	mach_shm_ring_t ring;
+
+	ring_map(stream_port, &ring);
+	for (uint64_t i = 0; i < RING_NMSGS; i++) {
+		ring_send(&ring, (mach_msg_id_t)i, &i, sizeof(i));
+	}
+	return NULL;
+}
+
+T_DECL(mach_port_shm_ring_stream,
+    "messages sent through a shared memory ring arrive in order")
+{
+	pthread_t thread;
+	mach_msg_id_t id;
+	uint64_t value;
+	uint32_t size;
+	kern_return_t kr;
+
+	stream_port = ring_port_create(MACH_PORT_SHM_RING_SPSC);
+	ring_map(stream_port, &stream_ring);
+
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL,
+	    stream_sender, NULL), "pthread_create");
+
+	for (uint64_t i = 0; i < RING_NMSGS; i++) {
+		size = sizeof(value);
+		kr = mach_shm_ring_receive(&stream_ring, &id, &value, &size,
+		    MACH_MSG_TIMEOUT_NONE);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_shm_ring_receive");
+		T_QUIET; T_ASSERT_EQ(size, (uint32_t)sizeof(value), "payload size");
+		T_QUIET; T_ASSERT_EQ(value, i, "message %llu in order", i);
+		T_QUIET; T_ASSERT_EQ(id, (mach_msg_id_t)i, "message id");
+	}
+	T_PASS("received %d messages in order", RING_NMSGS);
+
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+
+	size = sizeof(value);
+	kr = mach_shm_ring_receive(&stream_ring, &id, &value, &size, 10);
+	T_ASSERT_EQ(kr, KERN_OPERATION_TIMED_OUT, "empty ring times out");
+}
+
+static mach_port_name_t ping_port, pong_port;
+static mach_shm_ring_t ping_ring, pong_ring;
+
+static void *
+pong_thread(void *arg __unused)
+{
+	mach_shm_ring_t rx, tx;
+	char buf[RING_ENTRY_SIZE];
+	mach_msg_id_t id;
+	uint32_t size;
+	kern_return_t kr;
+
+	ring_map(ping_port, &rx);
+	ring_map(pong_port, &tx);
+	for (;;) {
+		size = sizeof(buf);
+		kr = mach_shm_ring_receive(&rx, &id, buf, &size,
+		    MACH_MSG_TIMEOUT_NONE);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_shm_ring_receive(pong)");
+		if (id == RING_QUIT_ID) {
+			break;
+		}
+		ring_send(&tx, id, buf, size);
+	}
+	return NULL;
+}
+
+static void *
+msg_pong_thread(void *arg __unused)
+{
+	struct {
+		mach_msg_header_t header;
+		char body[RING_ENTRY_SIZE];
+		mach_msg_max_trailer_t trailer;
+	} msg;
+	kern_return_t kr;
+
+	for (;;) {
+		kr = mach_msg(&msg.header, MACH_RCV_MSG, 0, sizeof(msg), ping_port,
+		    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(RCV)");
+		if (msg.header.msgh_id == RING_QUIT_ID) {
+			break;
+		}
+		msg.header.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0);
+		msg.header.msgh_remote_port = pong_port;
+		msg.header.msgh_local_port = MACH_PORT_NULL;
+		kr = mach_msg(&msg.header, MACH_SEND_MSG, msg.header.msgh_size, 0,
+		    MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(SEND)");
+	}
+	return NULL;
+}
+
+T_DECL(mach_port_shm_ring_latency,
+    "round trip latency through shared memory rings vs mach_msg",
+    T_META_TAG_PERF)
+{
+	char buf[RING_ENTRY_SIZE] = { 0 };
+	pthread_t thread;
+	mach_msg_id_t id;
+	uint32_t size;
+	kern_return_t kr;
+	dt_stat_time_t s;
+
+	ping_port = ring_port_create(MACH_PORT_SHM_RING_SPSC);
+	pong_port = ring_port_create(MACH_PORT_SHM_RING_SPSC);
+	ring_map(ping_port, &ping_ring);
+	ring_map(pong_port, &pong_ring);
+
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL,
+	    pong_thread, NULL), "pthread_create");
+
+	s = dt_stat_time_create("shm ring round trip, 64 bytes");
+	T_STAT_MEASURE_LOOP(s) {
+		ring_send(&ping_ring, 1, buf, 64);
+		size = sizeof(buf);
+		kr = mach_shm_ring_receive(&pong_ring, &id, buf, &size,
+		    MACH_MSG_TIMEOUT_NONE);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_shm_ring_receive(ping)");
+	}
+	dt_stat_finalize(s);
+
+	ring_send(&ping_ring, RING_QUIT_ID, buf, 0);
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL,
+	    msg_pong_thread, NULL), "pthread_create");
+
+	s = dt_stat_time_create("mach_msg round trip, 64 bytes");
+	T_STAT_MEASURE_LOOP(s) {
+		struct {
+			mach_msg_header_t header;
+			char body[64];
+			mach_msg_max_trailer_t trailer;
+		} msg = {
+			.header = {
+				.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0),
+				.msgh_size = sizeof(mach_msg_header_t) + 64,
+				.msgh_remote_port = ping_port,
+				.msgh_id = 1,
+			},
+		};
+
+		kr = mach_msg(&msg.header, MACH_SEND_MSG | MACH_RCV_MSG,
+		    msg.header.msgh_size, sizeof(msg), pong_port,
+		    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(SEND|RCV)");
+	}
+	dt_stat_finalize(s);
+
+	mach_msg_header_t quit = {
+		.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0),
+		.msgh_size = sizeof(quit),
+		.msgh_remote_port = ping_port,
+		.msgh_id = RING_QUIT_ID,
+	};
+	kr = mach_msg(&quit, MACH_SEND_MSG, sizeof(quit), 0, MACH_PORT_NULL,
+	    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(SEND quit)");
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+}
@@ -0,0 +1,34 @@
+/*
+ * mpmc: test the MPMC ring interface
+ */
+
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <sys/sysctl.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.mpmc"),
+    T_META_RUN_CONCURRENTLY(true));
+
+static void
+mpmc_run(const char *sysctl, const char *metric)
+{
+	uint64_t count = 1000 * 1000, nsecs = 0;
+	size_t nlen = sizeof(nsecs);
+	int error;
+
+	error = sysctlbyname(sysctl, &nsecs, &nlen, &count, sizeof(count));
+	T_ASSERT_POSIX_SUCCESS(error, "sysctlbyname(%s)", sysctl);
+	T_LOG("%lld elements in %lld ns (%g ns/element)", count, nsecs,
+	    (double)nsecs / count);
+	T_PERF(metric, (double)nsecs / count, "ns",
+	    "average time to hand off one element");
+}
+
+T_DECL(ring, "mpmc_ring", T_META_TAG_PERF)
+{
+	mpmc_run("kern.mpmc_test_ring", "mpmc_ring_handoff");
+}
@@ -0,0 +1,104 @@
+/*
+ * namecache_mountstats: Checks that the per-mount name cache counters
+ * exported by the vfs.namecache.mountstats sysctl move with lookups.
+ */
+
+#include <darwintest.h>
+#include <darwintest_utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_CHECK_LEAKS(false),
+    T_META_ASROOT(true));
+
+#define MOUNTSTATS_LOOKUPS      1000
+
+static int mountstats_enable_saved;
+
+static void
+mountstats_restore(void)
+{
+	(void)sysctlbyname("vfs.namecache.mountstats_enable", NULL, NULL,
+	    &mountstats_enable_saved, sizeof(mountstats_enable_saved));
+}
+
+static struct namecache_mount_stats
+mountstats_for(fsid_t fsid)
+{
+	struct namecache_mount_stats *stats, found = { };
+	size_t len = 0;
+	int ret;
+
+	ret = sysctlbyname("vfs.namecache.mountstats", NULL, &len, NULL, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ret, "vfs.namecache.mountstats size");
+	stats = malloc(len);
+	T_QUIET; T_ASSERT_NOTNULL(stats, "malloc");
+	ret = sysctlbyname("vfs.namecache.mountstats", stats, &len, NULL, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ret, "vfs.namecache.mountstats");
+
+	for (size_t i = 0; i < len / sizeof(*stats); i++) {
+		if (memcmp(&stats[i].nms_fsid, &fsid, sizeof(fsid)) == 0) {
+			found = stats[i];
+			free(stats);
+			return found;
+		}
+	}
+	free(stats);
+	T_ASSERT_FAIL("no name cache counters for the test file system");
+	return found;
+}
+
+T_DECL(namecache_mountstats,
+    "per-mount name cache hit and negative hit counters move with lookups")
+{
+	struct namecache_mount_stats before, after;
+	char path[PATH_MAX], missing[PATH_MAX];
+	struct statfs sfs;
+	struct stat st;
+	size_t len = sizeof(mountstats_enable_saved);
+	int enable = 1;
+	int fd;
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vfs.namecache.mountstats_enable",
+	    &mountstats_enable_saved, &len, &enable, sizeof(enable)),
+	    "enable the per-mount name cache counters");
+	T_ATEND(mountstats_restore);
+
+	snprintf(path, sizeof(path), "%s/namecache_mountstats", dt_tmpdir());
+	snprintf(missing, sizeof(missing), "%s/namecache_mountstats.missing", dt_tmpdir());
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	T_ASSERT_POSIX_SUCCESS(fd, "create %s", path);
+	close(fd);
+	T_ASSERT_POSIX_SUCCESS(statfs(path, &sfs), "statfs");
+
+	/* prime the positive and negative entries */
+	(void)stat(path, &st);
+	(void)stat(missing, &st);
+
+	before = mountstats_for(sfs.f_fsid);
+	for (int i = 0; i < MOUNTSTATS_LOOKUPS; i++) {
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(stat(path, &st), "stat");
+		T_QUIET; T_ASSERT_POSIX_FAILURE(stat(missing, &st), ENOENT, "stat(missing)");
+	}
+	after = mountstats_for(sfs.f_fsid);
+
+	T_LOG("hits +%llu, negative hits +%llu, misses +%llu, evictions +%llu",
+	    after.nms_hits - before.nms_hits,
+	    after.nms_neghits - before.nms_neghits,
+	    after.nms_misses - before.nms_misses,
+	    after.nms_evictions - before.nms_evictions);
+	T_EXPECT_GE(after.nms_hits - before.nms_hits, (uint64_t)MOUNTSTATS_LOOKUPS,
+	    "every stat() of the file hit the cache");
+	T_EXPECT_GE(after.nms_neghits - before.nms_neghits, (uint64_t)MOUNTSTATS_LOOKUPS,
+	    "every stat() of the missing file hit a negative entry");
+
+	unlink(path);
+}
@@ -0,0 +1,139 @@
+/*
+ * namecache_scaling: Measures how stat() and open() of cached paths
+ * scale from one thread to one thread per CPU, which mostly exercises
+ * the name cache lookup in cache_lookup_path().
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_CHECK_LEAKS(false));
+
+#define SCALING_DIRS            16
+#define SCALING_FILES           64
+#define SCALING_OPS             200000
+#define SCALING_THREADS_MAX     64
+
+typedef struct {
+	pthread_t       thread;
+	int             index;
+	int             do_open;
+	uint64_t        elapsed;
+} scaling_worker_t;
+
+static char scaling_paths[SCALING_DIRS * SCALING_FILES][PATH_MAX];
+
+static void
+scaling_setup(void)
+{
+	char dir[PATH_MAX];
+	int err, fd;
+
+	for (int d = 0; d < SCALING_DIRS; d++) {
+		snprintf(dir, sizeof(dir), "%s/namecache.%d/a/b/c", dt_tmpdir(), d);
+		err = mkpath_np(dir, 0755);
+		T_QUIET; T_ASSERT_TRUE(err == 0 || err == EEXIST, "mkpath_np(%s)", dir);
+		for (int f = 0; f < SCALING_FILES; f++) {
+			char *path = scaling_paths[d * SCALING_FILES + f];
+
+			snprintf(path, PATH_MAX, "%s/file.%d", dir, f);
+			fd = open(path, O_CREAT | O_RDWR, 0644);
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", path);
+			close(fd);
+		}
+	}
+}
+
+static void *
+scaling_worker(void *arg)
+{
+	scaling_worker_t *w = arg;
+	uint32_t n = (uint32_t)w->index * 7919;
+	struct stat st;
+	uint64_t start;
+	int fd;
+
+	start = mach_absolute_time();
+	for (int i = 0; i < SCALING_OPS; i++) {
+		const char *path = scaling_paths[n++ % (SCALING_DIRS * SCALING_FILES)];
+
+		if (w->do_open) {
+			fd = open(path, O_RDONLY);
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open");
+			close(fd);
+		} else {
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(stat(path, &st), "stat");
+		}
+	}
+	w->elapsed = mach_absolute_time() - start;
+	return NULL;
+}
+
+static double
+scaling_run(int nthreads, int do_open)
+{
+	scaling_worker_t workers[SCALING_THREADS_MAX];
+	mach_timebase_info_data_t tb;
+	uint64_t slowest = 0;
+
+	for (int i = 0; i < nthreads; i++) {
+		workers[i].index = i;
+		workers[i].do_open = do_open;
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&workers[i].thread, NULL,
+		    scaling_worker, &workers[i]), "pthread_create");
+	}
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(workers[i].thread, NULL),
+		    "pthread_join");
+		if (workers[i].elapsed > slowest) {
+			slowest = workers[i].elapsed;
+		}
+	}
+
+	mach_timebase_info(&tb);
+	return (double)SCALING_OPS * nthreads * 1e9 /
+	       ((double)slowest * tb.numer / tb.denom);
+}
+
+T_DECL(namecache_scaling,
+    "stat() and open() of cached paths per second, one thread and one per CPU",
+    T_META_TAG_PERF)
+{
+	double stat_1, stat_n, open_1, open_n;
+	int ncpu;
+	size_t len = sizeof(ncpu);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &len,
+	    NULL, 0), "hw.ncpu");
+	if (ncpu > SCALING_THREADS_MAX) {
+		ncpu = SCALING_THREADS_MAX;
+	}
+
+	scaling_setup();
+
+	/* warm the name cache */
+	(void)scaling_run(1, 0);
+
+	stat_1 = scaling_run(1, 0);
+	stat_n = scaling_run(ncpu, 0);
+	open_1 = scaling_run(1, 1);
+	open_n = scaling_run(ncpu, 1);
+
+	T_PERF("namecache_stat_single", stat_1, "ops/s", "stat() from one thread");
+	T_PERF("namecache_stat_concurrent", stat_n, "ops/s", "stat() from one thread per CPU");
+	T_PERF("namecache_open_single", open_1, "ops/s", "open()+close() from one thread");
+	T_PERF("namecache_open_concurrent", open_n, "ops/s", "open()+close() from one thread per CPU");
+	T_LOG("%d threads: stat %.0f -> %.0f ops/s (x%.1f), open %.0f -> %.0f ops/s (x%.1f)",
+	    ncpu, stat_1, stat_n, stat_n / stat_1, open_1, open_n, open_n / open_1);
+}
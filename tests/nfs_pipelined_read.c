@@ -0,0 +1,305 @@
+/*
+ * nfs_pipelined_read: Mounts an export of the local nfsd over loopback
+ * with NFSv3/TCP and reads a file written to the exported directory,
+ * checking the contents with one and with several connections per mount
+ * (vfs.generic.nfs.client.nconnect) and with the read-ahead window fixed
+ * at the mount's readahead (read_window_max=0) or adapting to the
+ * measured bandwidth and RTT, then measures sequential read throughput
+ * of each.
+ *
+ * Needs nfsd running with a writable directory exported to localhost;
+ * skips otherwise.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <mach/mach_time.h>
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_ASROOT(true),
+    T_META_CHECK_LEAKS(false));
+
+#define NPR_FILE_SIZE           (128 * 1024 * 1024)
+#define NPR_READ_SIZE           (128 * 1024)
+#define NPR_RANDOM_READS        256
+#define NPR_NCONNECT            4
+#define NPR_WINDOW_MAX          1024
+
+static char npr_export[PATH_MAX];
+static char npr_file[PATH_MAX];
+static char npr_mnt[PATH_MAX];
+static char npr_nfsfile[PATH_MAX];
+static uint64_t *npr_expected;
+
+static int
+npr_get_int(const char *name)
+{
+	int value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "sysctlbyname(%s)", name);
+	return value;
+}
+
+static void
+npr_set_int(const char *name, int value)
+{
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, NULL, NULL, &value, sizeof(value)),
+	    "sysctlbyname(%s, %d)", name, value);
+}
+
+static int npr_saved_nconnect = -1;
+static int npr_saved_window = -1;
+
+static void
+npr_cleanup(void)
+{
+	if (npr_saved_nconnect != -1) {
+		npr_set_int("vfs.generic.nfs.client.nconnect", npr_saved_nconnect);
+		npr_set_int("vfs.generic.nfs.client.read_window_max", npr_saved_window);
+	}
+	if (npr_mnt[0] != '\0') {
+		unmount(npr_mnt, MNT_FORCE);
+	}
+	if (npr_file[0] != '\0') {
+		unlink(npr_file);
+	}
+}
+
+/*
+ * Finds a directory the local nfsd exports that we can write to, or skips.
+ */
+static void
+npr_find_export(void)
+{
+	char line[PATH_MAX + 64];
+	FILE *fp;
+
+	fp = popen("/usr/bin/showmount -e 127.0.0.1 2>/dev/null", "r");
+	T_QUIET; T_ASSERT_NOTNULL(fp, "popen(showmount)");
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *path = strtok(line, " \t\n");
+
+		if (path == NULL || path[0] != '/') {
+			continue;
+		}
+		if (access(path, W_OK) == 0) {
+			strlcpy(npr_export, path, sizeof(npr_export));
+			break;
+		}
+	}
+	pclose(fp);
+	if (npr_export[0] == '\0') {
+		T_SKIP("no writable directory exported to localhost by nfsd");
+	}
+}
+
+static void
+npr_setup(void)
+{
+	int err, fd;
+
+	if (npr_expected != NULL) {
+		return;
+	}
+	npr_find_export();
+	npr_saved_nconnect = npr_get_int("vfs.generic.nfs.client.nconnect");
+	npr_saved_window = npr_get_int("vfs.generic.nfs.client.read_window_max");
+	T_ATEND(npr_cleanup);
+
+	/* every 8 bytes different, so misplaced or stale blocks show */
+	npr_expected = malloc(NPR_FILE_SIZE);
+	T_QUIET; T_ASSERT_NOTNULL(npr_expected, "malloc");
+	for (size_t i = 0; i < NPR_FILE_SIZE / sizeof(uint64_t); i++) {
+		npr_expected[i] = (i * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)getpid();
+	}
+
+	/* written on the server side, read back through the mount */
+	snprintf(npr_file, sizeof(npr_file), "%s/nfs_pipelined_read.%d", npr_export, getpid());
+	fd = open(npr_file, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", npr_file);
+	T_QUIET; T_ASSERT_EQ(write(fd, npr_expected, NPR_FILE_SIZE), (ssize_t)NPR_FILE_SIZE, "write");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fsync(fd), "fsync");
+	close(fd);
+
+	snprintf(npr_mnt, sizeof(npr_mnt), "%s/nfs_pipelined_read", dt_tmpdir());
+	err = mkpath_np(npr_mnt, 0755);
+	T_QUIET; T_ASSERT_TRUE(err == 0 || err == EEXIST, "mkpath_np(%s)", npr_mnt);
+	snprintf(npr_nfsfile, sizeof(npr_nfsfile), "%s/nfs_pipelined_read.%d", npr_mnt, getpid());
+}
+
+/*
+ * Counts established TCP connections to the local nfsd from our side.
+ */
+static int
+npr_nfs_connections(void)
+{
+	char line[256];
+	int count = 0;
+	FILE *fp;
+
+	fp = popen("/usr/sbin/netstat -an -p tcp", "r");
+	T_QUIET; T_ASSERT_NOTNULL(fp, "popen(netstat)");
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char proto[16], local[64], foreign[64], state[32];
+		int recvq, sendq;
+
+		if (sscanf(line, "%15s %d %d %63s %63s %31s", proto, &recvq, &sendq,
+		    local, foreign, state) != 6) {
+			continue;
+		}
+		if (strcmp(foreign, "127.0.0.1.2049") == 0 && strcmp(state, "ESTABLISHED") == 0) {
+			count++;
+		}
+	}
+	pclose(fp);
+	return count;
+}
+
+/*
+ * Mounts the export with nconnect connections and the given read window
+ * limit, so each configuration starts with a cold client cache, and
+ * opens the test file through it.
+ */
+static int
+npr_mount(int nconnect, int window_max)
+{
+	char from[PATH_MAX + 16];
+	char *argv[] = { "/sbin/mount_nfs", "-o", "vers=3,tcp,rsize=32768,readahead=16",
+		         from, npr_mnt, NULL };
+	pid_t pid;
+	int status, fd, before;
+
+	npr_set_int("vfs.generic.nfs.client.nconnect", nconnect);
+	npr_set_int("vfs.generic.nfs.client.read_window_max", window_max);
+
+	before = npr_nfs_connections();
+	snprintf(from, sizeof(from), "127.0.0.1:%s", npr_export);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(dt_launch_tool(&pid, argv, false, NULL, NULL), "mount_nfs");
+	T_QUIET; T_ASSERT_TRUE(dt_waitpid(pid, &status, NULL, 60), "mount_nfs exited");
+	T_QUIET; T_ASSERT_EQ(status, 0, "mount_nfs %s", from);
+	T_EXPECT_GE(npr_nfs_connections() - before, nconnect,
+	    "mount opened %d connection(s) to nfsd", nconnect);
+
+	fd = open(npr_nfsfile, O_RDONLY);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", npr_nfsfile);
+	return fd;
+}
+
+static void
+npr_unmount(int fd)
+{
+	close(fd);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(unmount(npr_mnt, 0), "unmount(%s)", npr_mnt);
+}
+
+/*
+ * Reads the whole file front to back, checking it, and returns the
+ * nanoseconds it took.
+ */
+static uint64_t
+npr_read_sequential(int fd, char *buf)
+{
+	mach_timebase_info_data_t tb;
+	uint64_t start, abs;
+	ssize_t n;
+
+	start = mach_absolute_time();
+	for (off_t off = 0; off < NPR_FILE_SIZE; off += n) {
+		n = pread(fd, buf, NPR_READ_SIZE, off);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(n, "pread at %lld", off);
+		T_QUIET; T_ASSERT_GT(n, 0L, "short file at %lld", off);
+		T_QUIET; T_ASSERT_EQ(memcmp(buf, (char *)npr_expected + off, (size_t)n), 0,
+		    "contents at %lld", off);
+	}
+	abs = mach_absolute_time() - start;
+
+	mach_timebase_info(&tb);
+	return abs * tb.numer / tb.denom;
+}
+
+static void
+npr_read_random(int fd, char *buf)
+{
+	srandom(49);
+	for (int i = 0; i < NPR_RANDOM_READS; i++) {
+		off_t off = random() % (NPR_FILE_SIZE - NPR_READ_SIZE);
+		ssize_t n = pread(fd, buf, NPR_READ_SIZE, off);
+
+		T_QUIET; T_ASSERT_EQ(n, (ssize_t)NPR_READ_SIZE, "pread at %lld", off);
+		T_QUIET; T_ASSERT_EQ(memcmp(buf, (char *)npr_expected + off, NPR_READ_SIZE), 0,
+		    "contents at %lld", off);
+	}
+}
+
+static const struct {
+	int         nconnect;
+	int         window_max;
+	const char *name;
+} npr_configs[] = {
+	{ 1, 0, "nfs_read_1conn_fixed_window" },
+	{ 1, NPR_WINDOW_MAX, "nfs_read_1conn_adaptive_window" },
+	{ NPR_NCONNECT, 0, "nfs_read_4conn_fixed_window" },
+	{ NPR_NCONNECT, NPR_WINDOW_MAX, "nfs_read_4conn_adaptive_window" },
+};
+
+T_DECL(nfs_pipelined_read_contents,
+    "NFS reads come back intact over one or several connections, fixed or adaptive window")
+{
+	char *buf;
+	int fd;
+
+	npr_setup();
+	buf = malloc(NPR_READ_SIZE);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+
+	for (size_t i = 0; i < sizeof(npr_configs) / sizeof(npr_configs[0]); i++) {
+		/* random reads first, so they go to the server rather than the cache */
+		fd = npr_mount(npr_configs[i].nconnect, npr_configs[i].window_max);
+		npr_read_random(fd, buf);
+		(void)npr_read_sequential(fd, buf);
+		T_PASS("%s: random and sequential reads match", npr_configs[i].name);
+		npr_unmount(fd);
+	}
+	free(buf);
+}
+
+T_DECL(nfs_pipelined_read_perf,
+    "NFS sequential read throughput by connection count and read window",
+    T_META_TAG_PERF)
+{
+	uint64_t ns, base = 0;
+	double rate;
+	char *buf;
+	int fd;
+
+	npr_setup();
+	buf = malloc(NPR_READ_SIZE);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+
+	for (size_t i = 0; i < sizeof(npr_configs) / sizeof(npr_configs[0]); i++) {
+		fd = npr_mount(npr_configs[i].nconnect, npr_configs[i].window_max);
+		ns = npr_read_sequential(fd, buf);
+		npr_unmount(fd);
+		if (i == 0) {
+			base = ns;
+		}
+
+		rate = (double)NPR_FILE_SIZE * 1e3 / ns;
+		T_PERF(npr_configs[i].name, rate, "MB/s", "128KB preads over NFSv3/TCP loopback");
+		T_LOG("%s: %.1f MB/s (x%.2f)", npr_configs[i].name, rate, (double)base / ns);
+	}
+	free(buf);
+}
@@ -0,0 +1,465 @@
+/*
+ * nfsrv_reqcache: Runs the NFS server request cache's placement and
+ * sizing policy (bsd/nfs/nfsrvcache_stripe.h) over a user space model of
+ * the cache in nfs_srvcache.c, with pthread mutexes for the stripe locks
+ * and a simulated clock.
+ *
+ * Fuzzes it with clients that reuse each other's XIDs and retransmit
+ * with exponential backoff, checking that requests only ever hit their
+ * own entries, that retransmissions are caught once the cache has
+ * learned how long clients take, that stripes stay within their cap and
+ * that the cache shrinks back once retransmissions stop.  Then measures
+ * lookup throughput from one thread up, striped and with the single
+ * lock and fixed size the cache used to have.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <mach/mach_time.h>
+#include <sys/queue.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../bsd/nfs/nfsrvcache_stripe.h"
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_CHECK_LEAKS(false));
+
+#define NRC_SIZE                64      /* nfsrv_reqcache_size default */
+#define NRC_MAX                 2048    /* nfsrv_reqcache_max default */
+#define NRC_CLIENTS             16
+#define NRC_OUTSTANDING         8       /* requests a client has in flight */
+#define NRC_TIMEO               1000    /* client's initial retransmit timeout */
+#define NRC_RETRIES             3
+#define NRC_MAX_THREADS         16
+#define NRC_PERF_OPS            (1 << 20)
+
+struct nrc_entry {
+	TAILQ_ENTRY(nrc_entry)  ne_lru;
+	LIST_ENTRY(nrc_entry)   ne_hash;
+	uint32_t                ne_client;
+	uint32_t                ne_xid;
+	uint64_t                ne_stamp;       /* rc_timestamp */
+};
+
+struct nrc_stripe {
+	pthread_mutex_t                 ns_lock;
+	LIST_HEAD(, nrc_entry)          *ns_hashtbl;
+	unsigned long                   ns_mask;
+	TAILQ_HEAD(, nrc_entry)         ns_lru;
+	uint32_t                        ns_count;
+} __attribute__((aligned(64)));
+
+/*
+ * With one stripe and a fixed size this is the cache as it was before it
+ * was striped: one lock, and the LRU entry recycled once it's full.
+ */
+struct nrc_cache {
+	int                     nc_nstripes;
+	int                     nc_adaptive;
+	uint32_t                nc_share;
+	uint32_t                nc_cap;
+	pthread_mutex_t         nc_age_lock;    /* nfsrv_reqcache_mutex */
+	struct nrc_stripe       nc_stripes[NFSRC_STRIPES];
+	struct nfsrc_age        nc_age;
+};
+
+/* hashinit() rounds down to a power of 2 */
+static unsigned long
+nrc_hashsize(uint32_t elements)
+{
+	unsigned long size = 1;
+
+	while (size * 2 <= elements) {
+		size *= 2;
+	}
+	return size;
+}
+
+static void
+nrc_init(struct nrc_cache *nc, int nstripes, int adaptive)
+{
+	memset(nc, 0, sizeof(*nc));
+	nc->nc_nstripes = nstripes;
+	nc->nc_adaptive = adaptive;
+	if (nstripes == 1) {
+		nc->nc_share = nc->nc_cap = NRC_SIZE;
+	} else {
+		nc->nc_share = nfsrc_share(NRC_SIZE);
+		nc->nc_cap = nfsrc_share(NRC_MAX);
+	}
+	pthread_mutex_init(&nc->nc_age_lock, NULL);
+	nfsrc_age_init(&nc->nc_age, 0);
+	for (int i = 0; i < nstripes; i++) {
+		struct nrc_stripe *ns = &nc->nc_stripes[i];
+		unsigned long size = nrc_hashsize(nc->nc_cap);
+
+		pthread_mutex_init(&ns->ns_lock, NULL);
+		ns->ns_hashtbl = calloc(size, sizeof(*ns->ns_hashtbl));
+		T_QUIET; T_ASSERT_NOTNULL(ns->ns_hashtbl, "calloc");
+		ns->ns_mask = size - 1;
+		TAILQ_INIT(&ns->ns_lru);
+	}
+}
+
+static void
+nrc_destroy(struct nrc_cache *nc)
+{
+	for (int i = 0; i < nc->nc_nstripes; i++) {
+		struct nrc_stripe *ns = &nc->nc_stripes[i];
+		struct nrc_entry *ne;
+
+		while ((ne = TAILQ_FIRST(&ns->ns_lru)) != NULL) {
+			TAILQ_REMOVE(&ns->ns_lru, ne, ne_lru);
+			free(ne);
+		}
+		free(ns->ns_hashtbl);
+		pthread_mutex_destroy(&ns->ns_lock);
+	}
+	pthread_mutex_destroy(&nc->nc_age_lock);
+}
+
+static uint32_t
+nrc_count(struct nrc_cache *nc)
+{
+	uint32_t count = 0;
+
+	for (int i = 0; i < nc->nc_nstripes; i++) {
+		count += nc->nc_stripes[i].ns_count;
+	}
+	return count;
+}
+
+/*
+ * nfsrv_getcache(): returns whether the request hit, and adds it to the
+ * cache if not.
+ */
+static int
+nrc_request(struct nrc_cache *nc, uint32_t client, uint32_t xid, uint64_t now)
+{
+	uint32_t hash = nfsrc_hash(client, xid);
+	struct nrc_stripe *ns;
+	struct nrc_entry *ne, *fne;
+	uint64_t interval;
+	uint32_t keep;
+	int action;
+
+	if (nc->nc_nstripes == 1) {
+		ns = &nc->nc_stripes[0];
+		hash = (hash << NFSRC_STRIPE_SHIFT) | (hash >> (32 - NFSRC_STRIPE_SHIFT));
+	} else {
+		ns = &nc->nc_stripes[nfsrc_stripe(hash)];
+	}
+
+	pthread_mutex_lock(&ns->ns_lock);
+	LIST_FOREACH(ne, &ns->ns_hashtbl[nfsrc_bucket(hash, ns->ns_mask)], ne_hash) {
+		if (ne->ne_xid == xid && ne->ne_client == client) {
+			interval = now - ne->ne_stamp;
+			ne->ne_stamp = now;
+			TAILQ_REMOVE(&ns->ns_lru, ne, ne_lru);
+			TAILQ_INSERT_TAIL(&ns->ns_lru, ne, ne_lru);
+			pthread_mutex_unlock(&ns->ns_lock);
+			if (nc->nc_adaptive) {
+				pthread_mutex_lock(&nc->nc_age_lock);
+				nfsrc_age_sample(&nc->nc_age, interval, now);
+				pthread_mutex_unlock(&nc->nc_age_lock);
+			}
+			return 1;
+		}
+	}
+
+	if (nc->nc_adaptive && nfsrc_age_stale(&nc->nc_age, now)) {
+		pthread_mutex_lock(&nc->nc_age_lock);
+		if (nfsrc_age_stale(&nc->nc_age, now)) {
+			nfsrc_age_decay(&nc->nc_age, now);
+		}
+		pthread_mutex_unlock(&nc->nc_age_lock);
+	}
+	keep = nc->nc_age.nra_keep;
+	ne = TAILQ_FIRST(&ns->ns_lru);
+	action = nfsrc_admit(ns->ns_count, nc->nc_share, nc->nc_cap, ne != NULL,
+	    ne ? ne->ne_stamp : 0, now, keep);
+	switch (action) {
+	case NFSRC_NEW:
+		ne = malloc(sizeof(*ne));
+		T_QUIET; T_ASSERT_NOTNULL(ne, "malloc");
+		ns->ns_count++;
+		break;
+	case NFSRC_RECYCLE:
+		LIST_REMOVE(ne, ne_hash);
+		TAILQ_REMOVE(&ns->ns_lru, ne, ne_lru);
+		break;
+	default:
+		pthread_mutex_unlock(&ns->ns_lock);
+		return 0;
+	}
+	ne->ne_client = client;
+	ne->ne_xid = xid;
+	ne->ne_stamp = now;
+	TAILQ_INSERT_TAIL(&ns->ns_lru, ne, ne_lru);
+	LIST_INSERT_HEAD(&ns->ns_hashtbl[nfsrc_bucket(hash, ns->ns_mask)], ne, ne_hash);
+
+	fne = TAILQ_FIRST(&ns->ns_lru);
+	if (nc->nc_adaptive && nfsrc_shrink(ns->ns_count, nc->nc_share, fne->ne_stamp, now, keep)) {
+		LIST_REMOVE(fne, ne_hash);
+		TAILQ_REMOVE(&ns->ns_lru, fne, ne_lru);
+		ns->ns_count--;
+	} else {
+		fne = NULL;
+	}
+	pthread_mutex_unlock(&ns->ns_lock);
+	free(fne);
+	return 0;
+}
+
+/*
+ * A request in flight, retransmitted nr_tries times so far and due to be
+ * again at nr_next.
+ */
+struct nrc_inflight {
+	uint32_t        nr_xid;
+	int             nr_tries;
+	uint64_t        nr_next;
+};
+
+struct nrc_stats {
+	uint64_t        ns_new;
+	uint64_t        ns_rexmit[NRC_RETRIES];
+	uint64_t        ns_caught[NRC_RETRIES];
+	uint32_t        ns_peak;
+};
+
+/*
+ * Each client keeps NRC_OUTSTANDING requests in flight, retransmitting
+ * each of them NRC_RETRIES times, timeout doubling, before it gives up
+ * and sends a new one.  XIDs count up from the same start for every
+ * client, so every new request has an XID another client has used.
+ * Requests go out every tick ms, from a random client.
+ */
+static void
+nrc_run(struct nrc_cache *nc, struct nrc_inflight inflight[NRC_CLIENTS][NRC_OUTSTANDING],
+    uint32_t xids[NRC_CLIENTS], uint64_t *now, uint64_t duration, uint64_t tick,
+    int retransmit, struct nrc_stats *st)
+{
+	uint64_t end = *now + duration;
+
+	memset(st, 0, sizeof(*st));
+	for (; *now < end; *now += tick) {
+		uint32_t client = (uint32_t)(random() % NRC_CLIENTS);
+		struct nrc_inflight *nr = &inflight[client][random() % NRC_OUTSTANDING];
+		int hit;
+
+		if (retransmit && nr->nr_next != 0 && nr->nr_next <= *now && nr->nr_tries < NRC_RETRIES) {
+			hit = nrc_request(nc, client, nr->nr_xid, *now);
+			st->ns_rexmit[nr->nr_tries]++;
+			st->ns_caught[nr->nr_tries] += hit;
+			nr->nr_tries++;
+			nr->nr_next = *now + ((uint64_t)NRC_TIMEO << nr->nr_tries);
+		} else if (!retransmit || nr->nr_next == 0 || nr->nr_tries == NRC_RETRIES) {
+			nr->nr_xid = ++xids[client];
+			nr->nr_tries = 0;
+			nr->nr_next = *now + NRC_TIMEO;
+			hit = nrc_request(nc, client, nr->nr_xid, *now);
+			T_QUIET; T_ASSERT_EQ(hit, 0, "new request from client %u xid %u missed",
+			    client, nr->nr_xid);
+			st->ns_new++;
+		} else {
+			continue;
+		}
+
+		for (int i = 0; i < nc->nc_nstripes; i++) {
+			T_QUIET; T_ASSERT_LE(nc->nc_stripes[i].ns_count, nc->nc_cap,
+			    "stripe %d within its cap", i);
+		}
+		if (nrc_count(nc) > st->ns_peak) {
+			st->ns_peak = nrc_count(nc);
+		}
+	}
+}
+
+static double
+nrc_rate(uint64_t caught, uint64_t total)
+{
+	return total ? (double)caught / total : 0;
+}
+
+T_DECL(nfsrv_reqcache_fuzz,
+    "NFS server request cache catches retransmissions, never mixes up clients, and shrinks back")
+{
+	static struct nrc_inflight inflight[NRC_CLIENTS][NRC_OUTSTANDING];
+	static uint32_t xids[NRC_CLIENTS];
+	struct nrc_cache *nc, *fixed;
+	struct nrc_stats st, fst;
+	uint64_t now = 1, fnow = 1;
+	uint32_t peak;
+
+	nc = malloc(sizeof(*nc));
+	fixed = malloc(sizeof(*fixed));
+	T_QUIET; T_ASSERT_NOTNULL(nc, "malloc");
+	T_QUIET; T_ASSERT_NOTNULL(fixed, "malloc");
+	nrc_init(nc, NFSRC_STRIPES, 1);
+	nrc_init(fixed, 1, 0);
+
+	/*
+	 * A request every 2ms with 128 in flight, twice the cache's nominal
+	 * size; run the same load over the old cache.
+	 */
+	srandom(50);
+	nrc_run(nc, inflight, xids, &now, 10 * 60 * 1000, 2, 1, &st);
+	memset(inflight, 0, sizeof(inflight));
+	memset(xids, 0, sizeof(xids));
+	srandom(50);
+	nrc_run(fixed, inflight, xids, &fnow, 10 * 60 * 1000, 2, 1, &fst);
+
+	for (int i = 0; i < NRC_RETRIES; i++) {
+		T_LOG("retransmission %d: %.3f caught, %.3f by a fixed %d entry cache", i + 1,
+		    nrc_rate(st.ns_caught[i], st.ns_rexmit[i]), nrc_rate(fst.ns_caught[i], fst.ns_rexmit[i]),
+		    NRC_SIZE);
+		T_EXPECT_GE(nrc_rate(st.ns_caught[i], st.ns_rexmit[i]), 0.99,
+		    "retransmission %d caught", i + 1);
+		T_EXPECT_GE(nrc_rate(st.ns_caught[i], st.ns_rexmit[i]),
+		    nrc_rate(fst.ns_caught[i], fst.ns_rexmit[i]),
+		    "retransmission %d caught at least as often as by a fixed cache", i + 1);
+	}
+	T_LOG("%llu requests, keep %u ms, peak %u entries", st.ns_new, nc->nc_age.nra_keep, st.ns_peak);
+	T_EXPECT_GT(nc->nc_age.nra_keep, (uint32_t)(2 * NRC_TIMEO), "learned the clients back off");
+	T_EXPECT_LE(st.ns_peak, nc->nc_cap * NFSRC_STRIPES, "stayed within nfsrv_reqcache_max");
+
+	/*
+	 * Once clients stop retransmitting the cache should give entries
+	 * back, down to what NFSRC_MINAGE of requests, one every 20ms, needs.
+	 */
+	peak = st.ns_peak;
+	nrc_run(nc, inflight, xids, &now, 20 * NFSRC_MAXAGE, 20, 0, &st);
+	T_LOG("after retransmissions stop: keep %u ms, %u entries", nc->nc_age.nra_keep, nrc_count(nc));
+	T_EXPECT_EQ(nc->nc_age.nra_keep, (uint32_t)NFSRC_MINAGE, "keep decayed to the minimum");
+	T_EXPECT_LE(nrc_count(nc), (uint32_t)(2 * NFSRC_MINAGE / 20), "cache shrank back");
+	T_EXPECT_LT(nrc_count(nc), peak / 2, "cache shrank to under half its peak");
+
+	nrc_destroy(nc);
+	nrc_destroy(fixed);
+	free(nc);
+	free(fixed);
+}
+
+T_DECL(nfsrv_reqcache_distribution,
+    "NFS server request cache spreads clients and XIDs evenly over stripes and buckets")
+{
+	uint32_t stripes[NFSRC_STRIPES] = { 0 };
+	uint32_t buckets[64] = { 0 };
+	uint32_t n = 0, lo = UINT32_MAX, hi = 0;
+
+	/* a few clients on adjacent addresses sending sequential XIDs */
+	for (uint32_t client = 0x0a000001; client < 0x0a000005; client++) {
+		for (uint32_t xid = 0x12340000; xid < 0x12340000 + 32768; xid++) {
+			uint32_t hash = nfsrc_hash(client, xid);
+
+			stripes[nfsrc_stripe(hash)]++;
+			buckets[nfsrc_bucket(hash, 63)]++;
+			n++;
+		}
+	}
+	for (int i = 0; i < NFSRC_STRIPES; i++) {
+		lo = MIN(lo, stripes[i]);
+		hi = MAX(hi, stripes[i]);
+	}
+	T_LOG("stripes hold %u to %u of %u", lo, hi, n / NFSRC_STRIPES);
+	T_EXPECT_GE(lo, n / NFSRC_STRIPES * 9 / 10, "no stripe underused");
+	T_EXPECT_LE(hi, n / NFSRC_STRIPES * 11 / 10, "no stripe overused");
+
+	lo = UINT32_MAX;
+	hi = 0;
+	for (int i = 0; i < 64; i++) {
+		lo = MIN(lo, buckets[i]);
+		hi = MAX(hi, buckets[i]);
+	}
+	T_LOG("buckets hold %u to %u of %u", lo, hi, n / 64);
+	T_EXPECT_GE(lo, n / 64 * 9 / 10, "no bucket underused");
+	T_EXPECT_LE(hi, n / 64 * 11 / 10, "no bucket overused");
+}
+
+struct nrc_worker {
+	struct nrc_cache        *nw_cache;
+	uint32_t                nw_client;
+};
+
+/*
+ * Sends requests from its own clients, retransmitting one in eight, with
+ * the clock advancing a millisecond every 64 requests.
+ */
+static void *
+nrc_worker(void *arg)
+{
+	struct nrc_worker *nw = arg;
+	uint32_t seed = nw->nw_client;
+
+	for (uint32_t i = 0; i < NRC_PERF_OPS; i++) {
+		uint32_t client = nw->nw_client + (i & 7);
+		uint32_t xid = i >> 3;
+
+		seed = seed * 1103515245 + 12345;
+		if ((seed >> 16) % 8 == 0 && xid > 4) {
+			xid -= 4;
+		}
+		(void)nrc_request(nw->nw_cache, client, xid, i / 64);
+	}
+	return NULL;
+}
+
+static uint64_t
+nrc_time(struct nrc_cache *nc, int nthreads)
+{
+	pthread_t threads[NRC_MAX_THREADS];
+	struct nrc_worker workers[NRC_MAX_THREADS];
+	mach_timebase_info_data_t tb;
+	uint64_t start, abs;
+
+	start = mach_absolute_time();
+	for (int i = 0; i < nthreads; i++) {
+		workers[i].nw_cache = nc;
+		workers[i].nw_client = 0x0a000000 + (uint32_t)i * 8;
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, nrc_worker, &workers[i]),
+		    "pthread_create");
+	}
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+	abs = mach_absolute_time() - start;
+
+	mach_timebase_info(&tb);
+	return abs * tb.numer / tb.denom;
+}
+
+T_DECL(nfsrv_reqcache_perf,
+    "NFS server request cache lookups per second by thread count, one lock and striped",
+    T_META_TAG_PERF)
+{
+	struct nrc_cache *nc;
+	char name[64];
+	uint64_t ns;
+	double rate;
+
+	nc = malloc(sizeof(*nc));
+	T_QUIET; T_ASSERT_NOTNULL(nc, "malloc");
+	for (int n = 1; n <= NRC_MAX_THREADS && n <= dt_ncpu(); n *= 2) {
+		nrc_init(nc, 1, 0);
+		ns = nrc_time(nc, n);
+		nrc_destroy(nc);
+		rate = (double)NRC_PERF_OPS * n * 1e3 / ns;
+		snprintf(name, sizeof(name), "nfsrv_reqcache_1lock_%dthreads", n);
+		T_PERF(name, rate, "Mops/s", "request cache lookups and inserts");
+		T_LOG("%s: %.2f Mops/s", name, rate);
+
+		nrc_init(nc, NFSRC_STRIPES, 1);
+		ns = nrc_time(nc, n);
+		nrc_destroy(nc);
+		rate = (double)NRC_PERF_OPS * n * 1e3 / ns;
+		snprintf(name, sizeof(name), "nfsrv_reqcache_striped_%dthreads", n);
+		T_PERF(name, rate, "Mops/s", "request cache lookups and inserts");
+		T_LOG("%s: %.2f Mops/s", name, rate);
+	}
+	free(nc);
+}
@@ -0,0 +1,91 @@
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <mach/mach.h>
+#include <stdlib.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.ipc"),
+    T_META_CHECK_LEAKS(false));
+
+#define NSETS 10000
+
+typedef struct {
+	mach_msg_header_t header;
+	mach_msg_trailer_t trailer;
+} ps_msg_t;
+
+static mach_port_name_t *port_sets;
+
+static void
+port_sets_cleanup(void)
+{
+	for (int i = 0; i < NSETS; i++) {
+		if (port_sets[i] != MACH_PORT_NULL) {
+			mach_port_mod_refs(mach_task_self(), port_sets[i],
+			    MACH_PORT_RIGHT_PORT_SET, -1);
+		}
+	}
+	free(port_sets);
+}
+
+/*
+ * Every message sent to a port wakes up (or preposts on) each port set the
+ * port is a member of, which walks the whole set-membership link chain of
+ * the port's waitq. Time send + receive of an empty message on a port that
+ * is a member of NSETS port sets, and compare with the same port once it is
+ * removed from all of them.
+ */
+T_DECL(port_set_wakeup_latency,
+    "message wakeup latency for a port that is a member of many port sets",
+    T_META_TAG_PERF)
+{
+	mach_port_name_t port;
+	kern_return_t kr;
+	ps_msg_t msg;
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate(RECEIVE)");
+	kr = mach_port_insert_right(mach_task_self(), port, port,
+	    MACH_MSG_TYPE_MAKE_SEND);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_port_insert_right");
+
+	port_sets = calloc(NSETS, sizeof(mach_port_name_t));
+	T_QUIET; T_ASSERT_NOTNULL(port_sets, "calloc");
+	T_ATEND(port_sets_cleanup);
+
+	for (int i = 0; i < NSETS; i++) {
+		kr = mach_port_allocate(mach_task_self(),
+		    MACH_PORT_RIGHT_PORT_SET, &port_sets[i]);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate(PORT_SET)");
+		kr = mach_port_insert_member(mach_task_self(), port, port_sets[i]);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_insert_member");
+	}
+	T_LOG("port is a member of %d port sets", NSETS);
+
+	for (int pass = 0; pass < 2; pass++) {
+		dt_stat_time_t s = dt_stat_time_create(pass == 0 ?
+		    "send+receive, member of many port sets" :
+		    "send+receive, member of no port set");
+
+		T_STAT_MEASURE_LOOP(s) {
+			msg.header = (mach_msg_header_t){
+				.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0),
+				.msgh_size = sizeof(msg.header),
+				.msgh_remote_port = port,
+			};
+			kr = mach_msg(&msg.header, MACH_SEND_MSG | MACH_RCV_MSG,
+			    sizeof(msg.header), sizeof(msg), port,
+			    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+			T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg");
+		}
+		dt_stat_finalize(s);
+
+		if (pass == 0) {
+			for (int i = 0; i < NSETS; i++) {
+				kr = mach_port_extract_member(mach_task_self(),
+				    port, port_sets[i]);
+				T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_extract_member");
+			}
+		}
+	}
+}
@@ -0,0 +1,160 @@
+/*
+ * pthread_mutex_contention: Measures the throughput of contended
+ * pthread mutexes and os_unfair_locks, which both block through ulocks.
+ *
+ * Threads contend in pairs, each pair on its own lock, so that many
+ * distinct ulocks are waited on at once and spread over the kernel's
+ * ulock hash buckets, as with the many locks of a real process.
+ */
+
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+
+#include <os/lock.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/sysctl.h>
+#include <mach/mach_time.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.ulock"),
+    T_META_CHECK_LEAKS(false));
+
+#define ITERATIONS_PER_THREAD   100000
+#define MAX_THREADS             64
+#define THREADS_PER_LOCK        2
+#define MAX_LOCKS               (MAX_THREADS / THREADS_PER_LOCK)
+
+/* one cache line per lock, so that pairs only contend on their own lock */
+static struct contended_lock {
+	pthread_mutex_t         cl_mutex;
+	os_unfair_lock          cl_unfair_lock;
+	volatile uint64_t       cl_counter;
+} __attribute__((aligned(128))) locks[MAX_LOCKS];
+
+static atomic_int ready_threads;
+static atomic_bool go;
+
+struct contention_args {
+	bool unfair;
+	struct contended_lock *lock;
+};
+
+static void *
+contention_thread(void *arg)
+{
+	struct contention_args *args = arg;
+	struct contended_lock *lock = args->lock;
+
+	atomic_fetch_add(&ready_threads, 1);
+	while (!atomic_load(&go)) {
+		;
+	}
+
+	for (int i = 0; i < ITERATIONS_PER_THREAD; i++) {
+		if (args->unfair) {
+			os_unfair_lock_lock(&lock->cl_unfair_lock);
+			lock->cl_counter++;
+			os_unfair_lock_unlock(&lock->cl_unfair_lock);
+		} else {
+			pthread_mutex_lock(&lock->cl_mutex);
+			lock->cl_counter++;
+			pthread_mutex_unlock(&lock->cl_mutex);
+		}
+	}
+	return NULL;
+}
+
+/* Returns the average cost in ns of one lock/unlock pair */
+static double
+run_contention(int nthreads, bool unfair)
+{
+	struct contention_args args[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	int nlocks = (nthreads + THREADS_PER_LOCK - 1) / THREADS_PER_LOCK;
+	mach_timebase_info_data_t tb;
+	uint64_t start, end, total = 0;
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_timebase_info(&tb), "mach_timebase_info");
+
+	for (int i = 0; i < nlocks; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_mutex_init(&locks[i].cl_mutex, NULL),
+		    "pthread_mutex_init");
+		locks[i].cl_unfair_lock = OS_UNFAIR_LOCK_INIT;
+		locks[i].cl_counter = 0;
+	}
+	atomic_store(&ready_threads, 0);
+	atomic_store(&go, false);
+
+	for (int i = 0; i < nthreads; i++) {
+		args[i].unfair = unfair;
+		args[i].lock = &locks[i / THREADS_PER_LOCK];
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL,
+		    contention_thread, &args[i]), "pthread_create");
+	}
+	while (atomic_load(&ready_threads) < nthreads) {
+		;
+	}
+
+	start = mach_absolute_time();
+	atomic_store(&go, true);
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+	end = mach_absolute_time();
+
+	for (int i = 0; i < nlocks; i++) {
+		total += locks[i].cl_counter;
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_mutex_destroy(&locks[i].cl_mutex),
+		    "pthread_mutex_destroy");
+	}
+	T_QUIET; T_ASSERT_EQ(total, (uint64_t)nthreads * ITERATIONS_PER_THREAD,
+	    "no lost increments");
+
+	return (double)(end - start) * tb.numer / tb.denom /
+	       ((double)nthreads * ITERATIONS_PER_THREAD);
+}
+
+static void
+contention_bench(bool unfair)
+{
+	const char *name = unfair ? "os_unfair_lock" : "pthread_mutex";
+	int ncpu = 0;
+	size_t len = sizeof(ncpu);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &len, NULL, 0),
+	    "sysctlbyname(hw.ncpu)");
+
+	for (int nthreads = THREADS_PER_LOCK; nthreads <= MAX_THREADS; nthreads *= 2) {
+		char metric[64];
+		double ns;
+
+		ns = run_contention(nthreads, unfair);
+		snprintf(metric, sizeof(metric), "%s_%d_locks", name, nthreads / THREADS_PER_LOCK);
+		T_LOG("%s: %d threads on %d locks, %.1f ns per lock/unlock", name,
+		    nthreads, nthreads / THREADS_PER_LOCK, ns);
+		T_PERF(metric, ns, "ns", "average lock/unlock time, pairs of threads per lock");
+
+		if (nthreads >= 2 * ncpu) {
+			break;
+		}
+	}
+}
+
+T_DECL(pthread_mutex_contention,
+    "pthread_mutex lock/unlock throughput, many contended mutexes",
+    T_META_TAG_PERF)
+{
+	contention_bench(false);
+}
+
+T_DECL(os_unfair_lock_contention,
+    "os_unfair_lock lock/unlock throughput, many contended locks",
+    T_META_TAG_PERF)
+{
+	contention_bench(true);
+}
@@ -0,0 +1,200 @@
+/*
+ * rw_lock_turnstile: Tests priority inheritance and reader fairness
+ * of kernel lck_rw_t locks, through the kern.test_rw_* sysctls.
+ */
+
+#ifdef T_NAMESPACE
+#undef T_NAMESPACE
+#endif
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/sysctl.h>
+#include <sys/types.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.turnstiles_test"),
+    T_META_ASROOT(true), T_META_CHECK_LEAKS(false));
+
+#define LOW_PRI                 31
+#define HIGH_PRI                47
+#define HOLD_MS                 3000
+#define NWRITERS                4
+#define MAX_READER_WAIT_NS      (1000ull * 1000 * 1000)
+#define READER_ITER             2000
+#define NREADERS                4
+
+static int
+rw_hold_exclusive(int hold_ms)
+{
+	int max_pri = 0;
+	size_t len = sizeof(max_pri);
+	int ret;
+
+	ret = sysctlbyname("kern.test_rw_hold_exclusive", &max_pri, &len,
+	    &hold_ms, sizeof(hold_ms));
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ret, "kern.test_rw_hold_exclusive");
+	return max_pri;
+}
+
+static void
+set_pri(int pri)
+{
+	struct sched_param param;
+	int policy, ret;
+
+	ret = pthread_getschedparam(pthread_self(), &policy, &param);
+	T_QUIET; T_ASSERT_POSIX_ZERO(ret, "pthread_getschedparam");
+
+	param.sched_priority = pri;
+
+	/* this sets both sched and base pri */
+	ret = pthread_setschedparam(pthread_self(), policy, &param);
+	T_QUIET; T_ASSERT_POSIX_ZERO(ret, "pthread_setschedparam");
+}
+
+static void *
+low_pri_writer(void *arg)
+{
+	int *max_pri = arg;
+
+	set_pri(LOW_PRI);
+	*max_pri = rw_hold_exclusive(HOLD_MS);
+	return NULL;
+}
+
+T_DECL(rw_lock_exclusive_owner_push,
+    "a writer blocked on a rw lock pushes on the exclusive owner")
+{
+	pthread_t thread;
+	int max_pri = 0;
+
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL,
+	    low_pri_writer, &max_pri), "pthread_create");
+
+	set_pri(HIGH_PRI);
+
+	/* let the low priority thread take the lock */
+	usleep(500 * 1000);
+
+	rw_hold_exclusive(0);
+
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+
+	T_EXPECT_GE(max_pri, HIGH_PRI,
+	    "exclusive owner (base pri %d) ran at pri %d while a pri %d writer waited",
+	    LOW_PRI, max_pri, HIGH_PRI);
+}
+
+static atomic_bool writers_stop;
+
+static void *
+writer_loop(void *arg __unused)
+{
+	while (!atomic_load(&writers_stop)) {
+		rw_hold_exclusive(1);
+	}
+	return NULL;
+}
+
+T_DECL(rw_lock_reader_bounded_wait,
+    "readers make progress on a rw lock hammered by writers",
+    T_META_TAG_PERF)
+{
+	pthread_t writers[NWRITERS];
+	uint64_t max_wait = 0;
+	size_t len = sizeof(max_wait);
+	int iter = READER_ITER;
+	int ret;
+
+	for (int i = 0; i < NWRITERS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&writers[i], NULL,
+		    writer_loop, NULL), "pthread_create");
+	}
+
+	ret = sysctlbyname("kern.test_rw_shared_max_wait", &max_wait, &len,
+	    &iter, sizeof(iter));
+	T_ASSERT_POSIX_SUCCESS(ret, "kern.test_rw_shared_max_wait");
+
+	atomic_store(&writers_stop, true);
+	for (int i = 0; i < NWRITERS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(writers[i], NULL), "pthread_join");
+	}
+
+	T_LOG("longest reader wait with %d writers: %llu ns", NWRITERS, max_wait);
+	T_PERF("rw_reader_max_wait", max_wait, "ns",
+	    "longest wait of a reader against contending writers");
+	T_EXPECT_LT(max_wait, MAX_READER_WAIT_NS,
+	    "reader was not starved by writers");
+}
+
+static uint64_t
+rw_readers_starved(void)
+{
+	uint64_t starved = 0;
+	size_t len = sizeof(starved);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.test_rw_readers_starved",
+	    &starved, &len, NULL, 0), "kern.test_rw_readers_starved");
+	return starved;
+}
+
+static void *
+reader_loop(void *arg)
+{
+	uint64_t *max_wait = arg;
+	size_t len = sizeof(*max_wait);
+	int iter = READER_ITER;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("kern.test_rw_shared_max_wait",
+	    max_wait, &len, &iter, sizeof(iter)), "kern.test_rw_shared_max_wait");
+	return NULL;
+}
+
+T_DECL(rw_lock_readers_starvation_bound,
+    "starved readers join shared holds instead of deferring to writers forever",
+    T_META_TAG_PERF)
+{
+	pthread_t writers[NWRITERS], readers[NREADERS];
+	uint64_t max_wait[NREADERS] = { 0 };
+	uint64_t starved_before, starved_after, worst = 0;
+
+	atomic_store(&writers_stop, false);
+	starved_before = rw_readers_starved();
+
+	for (int i = 0; i < NWRITERS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&writers[i], NULL,
+		    writer_loop, NULL), "pthread_create");
+	}
+	for (int i = 0; i < NREADERS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&readers[i], NULL,
+		    reader_loop, &max_wait[i]), "pthread_create");
+	}
+
+	for (int i = 0; i < NREADERS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(readers[i], NULL), "pthread_join");
+		if (max_wait[i] > worst) {
+			worst = max_wait[i];
+		}
+	}
+	atomic_store(&writers_stop, true);
+	for (int i = 0; i < NWRITERS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(writers[i], NULL), "pthread_join");
+	}
+
+	starved_after = rw_readers_starved();
+
+	T_LOG("longest reader wait with %d readers and %d writers: %llu ns, "
+	    "%llu starved acquisitions", NREADERS, NWRITERS, worst,
+	    starved_after - starved_before);
+	T_PERF("rw_readers_max_wait", worst, "ns",
+	    "longest wait of concurrent readers against contending writers");
+	T_EXPECT_GT(starved_after, starved_before,
+	    "readers reached the starvation bound and joined a shared hold");
+	T_EXPECT_LT(worst, MAX_READER_WAIT_NS,
+	    "readers were not starved by writers");
+}
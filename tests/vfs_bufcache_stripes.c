@@ -0,0 +1,179 @@
+/*
+ * vfs_bufcache_stripes: Runs a metadata-heavy workload (create, stat,
+ * rename and unlink of small files, one directory per thread) and reports
+ * its rate along with how often the buffer cache stripe locks were found
+ * held (vfs.bufcache.lock_contended out of vfs.bufcache.lock_acquisitions).
+ *
+ * Booting with bufstripes=1 puts the whole buffer cache behind one lock,
+ * as it was before it was striped, to compare against.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <darwintest_utils.h>
+#include <mach/mach_time.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_CHECK_LEAKS(false));
+
+#define BCS_MAX_THREADS         16
+#define BCS_FILES               512
+#define BCS_ROUNDS              4
+
+typedef struct {
+	uint64_t        locks;
+	uint64_t        contended;
+} bcs_counts_t;
+
+static char bcs_root[PATH_MAX];
+
+static uint64_t
+bcs_sysctl_quad(const char *name)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "sysctlbyname(%s)", name);
+	return value;
+}
+
+static void
+bcs_counts(bcs_counts_t *c)
+{
+	c->locks = bcs_sysctl_quad("vfs.bufcache.lock_acquisitions");
+	c->contended = bcs_sysctl_quad("vfs.bufcache.lock_contended");
+}
+
+static void *
+bcs_worker(void *arg)
+{
+	int id = (int)(uintptr_t)arg;
+	char dir[PATH_MAX], path[PATH_MAX], path2[PATH_MAX];
+	struct stat st;
+	int fd, err;
+
+	snprintf(dir, sizeof(dir), "%s/t%d", bcs_root, id);
+	err = mkdir(dir, 0755);
+	T_QUIET; T_ASSERT_TRUE(err == 0 || errno == EEXIST, "mkdir(%s)", dir);
+
+	for (int r = 0; r < BCS_ROUNDS; r++) {
+		for (int f = 0; f < BCS_FILES; f++) {
+			snprintf(path, sizeof(path), "%s/f%d", dir, f);
+			fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", path);
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(fchmod(fd, 0600), "fchmod");
+			close(fd);
+		}
+		for (int f = 0; f < BCS_FILES; f++) {
+			snprintf(path, sizeof(path), "%s/f%d", dir, f);
+			snprintf(path2, sizeof(path2), "%s/g%d", dir, f);
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(stat(path, &st), "stat(%s)", path);
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(rename(path, path2), "rename(%s)", path);
+		}
+		for (int f = 0; f < BCS_FILES; f++) {
+			snprintf(path2, sizeof(path2), "%s/g%d", dir, f);
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(unlink(path2), "unlink(%s)", path2);
+		}
+	}
+	rmdir(dir);
+	return NULL;
+}
+
+/*
+ * Runs the workload on nthreads threads, returns metadata operations
+ * per second and the stripe lock counts it caused in *delta.
+ */
+static double
+bcs_run(int nthreads, bcs_counts_t *delta)
+{
+	pthread_t threads[BCS_MAX_THREADS];
+	mach_timebase_info_data_t tb;
+	bcs_counts_t before, after;
+	uint64_t start, abs;
+
+	bcs_counts(&before);
+	start = mach_absolute_time();
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL,
+		    bcs_worker, (void *)(uintptr_t)i), "pthread_create");
+	}
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+	abs = mach_absolute_time() - start;
+	bcs_counts(&after);
+
+	delta->locks = after.locks - before.locks;
+	delta->contended = after.contended - before.contended;
+
+	mach_timebase_info(&tb);
+	/* open+fchmod, stat+rename and unlink of every file, every round */
+	return (double)nthreads * BCS_ROUNDS * BCS_FILES * 5 * 1e9 /
+	       ((double)abs * tb.numer / tb.denom);
+}
+
+static void
+bcs_setup(void)
+{
+	int err;
+
+	snprintf(bcs_root, sizeof(bcs_root), "%s/vfs_bufcache_stripes", dt_tmpdir());
+	err = mkpath_np(bcs_root, 0755);
+	T_QUIET; T_ASSERT_TRUE(err == 0 || err == EEXIST, "mkpath_np(%s)", bcs_root);
+}
+
+T_DECL(bufcache_stripes_sysctl,
+    "the buffer cache reports a power of 2 stripes and counts their locks")
+{
+	bcs_counts_t delta;
+	int stripes = 0;
+	size_t size = sizeof(stripes);
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vfs.bufcache.stripes", &stripes, &size,
+	    NULL, 0), "vfs.bufcache.stripes");
+	T_EXPECT_GT(stripes, 0, "at least one stripe");
+	T_EXPECT_EQ(stripes & (stripes - 1), 0, "stripes (%d) is a power of 2", stripes);
+
+	bcs_setup();
+	(void)bcs_run(1, &delta);
+	T_EXPECT_LE(delta.contended, delta.locks, "contended acquisitions are a subset");
+}
+
+T_DECL(bufcache_stripes_perf,
+    "metadata operations per second and stripe lock contention by thread count",
+    T_META_TAG_PERF)
+{
+	bcs_counts_t delta;
+	int stripes = 0, ncpu = dt_ncpu();
+	size_t size = sizeof(stripes);
+	char name[64];
+	double rate;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vfs.bufcache.stripes", &stripes,
+	    &size, NULL, 0), "vfs.bufcache.stripes");
+	bcs_setup();
+
+	for (int n = 1; n <= BCS_MAX_THREADS && n <= 2 * ncpu; n *= 2) {
+		rate = bcs_run(n, &delta);
+
+		snprintf(name, sizeof(name), "bufcache_metadata_%dthr", n);
+		T_PERF(name, rate, "ops/s", "create/stat/rename/unlink, one directory per thread");
+		snprintf(name, sizeof(name), "bufcache_contended_%dthr", n);
+		T_PERF(name, delta.locks ? (double)delta.contended * 100 / delta.locks : 0.0,
+		    "%", "stripe lock acquisitions that found the lock held");
+
+		T_LOG("%d stripes, %d threads: %.0f ops/s, %llu of %llu stripe lock "
+		    "acquisitions contended", stripes, n, rate, delta.contended, delta.locks);
+	}
+}
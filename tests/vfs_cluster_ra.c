@@ -0,0 +1,366 @@
+/*
+ * vfs_cluster_ra: Replays read traces through the cluster read-ahead
+ * stream policy (bsd/vfs/vfs_cluster_ra.h) in user space, against a
+ * model of cluster_read_ahead() and a page cache, and compares it with
+ * the single-stream, fixed-window behaviour (debug.cluster_ra_adaptive=0).
+ *
+ * Set CLUSTER_RA_TRACE to a file of "offset length" lines (bytes) to
+ * replay a captured trace through both and log the results.
+ */
+
+#include <darwintest.h>
+#include <darwintest_utils.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../bsd/vfs/vfs_cluster_ra.h"
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.vfs"),
+    T_META_RUN_CONCURRENTLY(true));
+
+#define SIM_PAGE_SIZE           4096
+#define SIM_FILE_PAGES          (64 * 1024)
+#define SIM_IO_PAGES            256     /* one max-sized I/O */
+#define SIM_DEF_PAGES           512     /* MAX_PREFETCH */
+#define SIM_MAX_PAGES           2048    /* 4 * MAX_PREFETCH */
+#define SIM_THINK_NS            20000   /* between reads */
+
+typedef struct {
+	bool            adaptive;
+	uint32_t        latency_us;
+	uint64_t        now;
+	struct cl_rastreams ras;
+	uint8_t         cached[SIM_FILE_PAGES];
+	uint8_t         prefetched[SIM_FILE_PAGES];
+	uint64_t        read_pages;
+	uint64_t        miss_pages;
+	uint64_t        prefetch_pages;
+	int             max_ralen;
+} sim_t;
+
+static sim_t *
+sim_create(bool adaptive, uint32_t latency_us)
+{
+	sim_t *sim = calloc(1, sizeof(*sim));
+
+	T_QUIET; T_ASSERT_NOTNULL(sim, "calloc");
+	sim->adaptive = adaptive;
+	sim->latency_us = latency_us;
+	cl_ra_init(&sim->ras);
+	return sim;
+}
+
+static void
+sim_prefetch(sim_t *sim, int64_t b_addr, int64_t pages)
+{
+	for (int64_t p = b_addr; p < b_addr + pages && p < SIM_FILE_PAGES; p++) {
+		if (!sim->cached[p]) {
+			sim->cached[p] = 1;
+			sim->prefetched[p] = 1;
+			sim->prefetch_pages++;
+		}
+	}
+}
+
+static uint64_t
+sim_unused_prefetch(sim_t *sim)
+{
+	uint64_t unused = 0;
+
+	for (int p = 0; p < SIM_FILE_PAGES; p++) {
+		unused += sim->prefetched[p];
+	}
+	return unused;
+}
+
+/* cluster_read_ahead_strided() */
+static void
+sim_read_ahead_strided(sim_t *sim, struct cl_rastream *s, int64_t b_addr, int64_t e_addr)
+{
+	int64_t rec_pages = e_addr - b_addr + 1, r_addr;
+	int window = cl_ra_window(&sim->ras, s, sim->latency_us, SIM_DEF_PAGES,
+	    SIM_IO_PAGES, SIM_MAX_PAGES);
+	int depth = (int)(window / rec_pages);
+
+	if (e_addr <= s->cl_maxra) {
+		cl_ra_hit(&sim->ras);
+	}
+	depth = depth < 1 ? 1 : (depth > CL_RA_STRIDE_DEPTH ? CL_RA_STRIDE_DEPTH : depth);
+	for (int k = 1; k <= depth; k++) {
+		r_addr = cl_ra_stride_record(s, b_addr, e_addr, k);
+		if (r_addr >= SIM_FILE_PAGES) {
+			break;
+		}
+		if (r_addr <= s->cl_maxra) {
+			continue;
+		}
+		sim_prefetch(sim, r_addr, rec_pages);
+		s->cl_maxra = r_addr + rec_pages - 1;
+	}
+}
+
+/* cluster_read_ahead() */
+static void
+sim_read_ahead(sim_t *sim, struct cl_rastream *s, int64_t b_addr, int64_t e_addr)
+{
+	int64_t r_addr, read_size;
+	int window;
+
+	if (b_addr == s->cl_lastr && b_addr == e_addr) {
+		return;
+	}
+	if (s->cl_lastr == -1 || (b_addr != s->cl_lastr && b_addr != s->cl_lastr + 1)) {
+		if (sim->adaptive) {
+			if (cl_ra_is_strided(s, b_addr)) {
+				sim_read_ahead_strided(sim, s, b_addr, e_addr);
+				return;
+			}
+			if (s->cl_lastr != -1 && s->cl_maxra > s->cl_lastr) {
+				cl_ra_wasted(&sim->ras);
+			}
+		}
+		s->cl_ralen = 0;
+		s->cl_maxra = 0;
+		return;
+	}
+	if (sim->adaptive && e_addr <= s->cl_maxra) {
+		cl_ra_hit(&sim->ras);
+	}
+	window = sim->adaptive ? cl_ra_window(&sim->ras, s, sim->latency_us,
+	    SIM_DEF_PAGES, SIM_IO_PAGES, SIM_MAX_PAGES) : SIM_DEF_PAGES;
+	if (window <= 1) {
+		return;
+	}
+	if (e_addr < s->cl_maxra && s->cl_ralen >= 4 &&
+	    (s->cl_maxra - e_addr) > (s->cl_ralen / 4)) {
+		return;
+	}
+	r_addr = (e_addr > s->cl_maxra ? e_addr : s->cl_maxra) + 1;
+	if (r_addr >= SIM_FILE_PAGES || sim->cached[r_addr]) {
+		return;
+	}
+	s->cl_ralen = s->cl_ralen ? (window < (s->cl_ralen << 1) ? window : (s->cl_ralen << 1)) : 1;
+	read_size = e_addr + 1 - b_addr;
+	if (read_size > s->cl_ralen) {
+		s->cl_ralen = (int)(read_size > window ? window : read_size);
+	}
+	if (s->cl_ralen > sim->max_ralen) {
+		sim->max_ralen = s->cl_ralen;
+	}
+	sim_prefetch(sim, r_addr, s->cl_ralen);
+	s->cl_maxra = r_addr + s->cl_ralen - 1;
+}
+
+/* one read(2) of [b_addr, e_addr] through cluster_read_copy() */
+static void
+sim_read(sim_t *sim, int64_t b_addr, int64_t e_addr)
+{
+	struct cl_rastream *s;
+	int64_t wasted;
+	bool missed = false;
+	int idx = 0;
+
+	if (e_addr >= SIM_FILE_PAGES) {
+		e_addr = SIM_FILE_PAGES - 1;
+	}
+	if (b_addr > e_addr) {
+		return;
+	}
+
+	if (sim->adaptive) {
+		idx = cl_ra_select(&sim->ras, b_addr, &wasted);
+		if (wasted) {
+			cl_ra_wasted(&sim->ras);
+		}
+		cl_ra_note_read(&sim->ras.cl_streams[idx], b_addr, e_addr, sim->now);
+	}
+	s = &sim->ras.cl_streams[idx];
+
+	for (int64_t p = b_addr; p <= e_addr; p++) {
+		if (!sim->cached[p]) {
+			sim->cached[p] = 1;
+			sim->miss_pages++;
+			missed = true;
+		}
+		sim->prefetched[p] = 0;
+	}
+	sim->read_pages += (uint64_t)(e_addr - b_addr + 1);
+	if (missed && e_addr < s->cl_maxra) {
+		s->cl_maxra = 0;
+		if (sim->adaptive) {
+			cl_ra_wasted(&sim->ras);
+		}
+	}
+
+	sim_read_ahead(sim, s, b_addr, e_addr);
+	if (e_addr < s->cl_lastr) {
+		s->cl_maxra = 0;
+	}
+	s->cl_lastr = e_addr;
+
+	sim->now += SIM_THINK_NS + (missed ? (uint64_t)sim->latency_us * 1000 : 0);
+}
+
+static double
+sim_miss_pct(sim_t *sim)
+{
+	return 100.0 * (double)sim->miss_pages / (double)sim->read_pages;
+}
+
+static void
+sim_log(const char *name, sim_t *sim)
+{
+	T_LOG("%s (%s): %llu pages read, %.1f%% missed, %llu prefetched, "
+	    "%llu unused, back-off %d, largest prefetch %d pages", name,
+	    sim->adaptive ? "adaptive" : "fixed", sim->read_pages,
+	    sim_miss_pct(sim), sim->prefetch_pages, sim_unused_prefetch(sim),
+	    sim->ras.cl_waste, sim->max_ralen);
+}
+
+/* 4 readers of 8 pages each, interleaved on one file descriptor */
+static void
+trace_interleaved(sim_t *sim)
+{
+	for (int i = 0; i < 1024; i++) {
+		for (int r = 0; r < 4; r++) {
+			int64_t b = (int64_t)r * (SIM_FILE_PAGES / 4) + (int64_t)i * 8;
+			sim_read(sim, b, b + 7);
+		}
+	}
+}
+
+/* 4 page records every 32 pages */
+static void
+trace_strided(sim_t *sim)
+{
+	for (int64_t b = 0; b + 4 <= SIM_FILE_PAGES; b += 32) {
+		sim_read(sim, b, b + 3);
+	}
+}
+
+/* short sequential bursts at pseudo-random places */
+static void
+trace_bursts(sim_t *sim)
+{
+	uint32_t seed = 1;
+
+	for (int i = 0; i < 48; i++) {
+		seed = seed * 1103515245 + 12345;
+		int64_t b = (int64_t)((seed >> 8) % (SIM_FILE_PAGES - 1024));
+		for (int j = 0; j < 64; j++) {
+			sim_read(sim, b + j * 8, b + j * 8 + 7);
+		}
+	}
+}
+
+/* one sequential reader */
+static void
+trace_sequential(sim_t *sim)
+{
+	for (int64_t b = 0; b + 16 <= SIM_FILE_PAGES; b += 16) {
+		sim_read(sim, b, b + 15);
+	}
+}
+
+T_DECL(cluster_ra_interleaved,
+    "interleaved sequential streams each get their own read-ahead")
+{
+	sim_t *fixed = sim_create(false, 5000), *adaptive = sim_create(true, 5000);
+
+	trace_interleaved(fixed);
+	trace_interleaved(adaptive);
+	sim_log("interleaved", fixed);
+	sim_log("interleaved", adaptive);
+
+	T_EXPECT_GT(sim_miss_pct(fixed), 50.0, "one stream thrashes between readers");
+	T_EXPECT_LT(sim_miss_pct(adaptive), 5.0, "per-stream read-ahead covers all readers");
+	free(fixed);
+	free(adaptive);
+}
+
+T_DECL(cluster_ra_strided,
+    "a strided stream is detected and its next records prefetched")
+{
+	sim_t *fixed = sim_create(false, 5000), *adaptive = sim_create(true, 5000);
+
+	trace_strided(fixed);
+	trace_strided(adaptive);
+	sim_log("strided", fixed);
+	sim_log("strided", adaptive);
+
+	T_EXPECT_EQ(fixed->miss_pages, fixed->read_pages, "no read-ahead without stride detection");
+	T_EXPECT_LT(sim_miss_pct(adaptive), 5.0, "records are prefetched once the stride repeats");
+	T_EXPECT_EQ(sim_unused_prefetch(adaptive), 0ULL, "only records that get read are prefetched");
+	free(fixed);
+	free(adaptive);
+}
+
+T_DECL(cluster_ra_backoff,
+    "read-ahead that goes unused shrinks the window")
+{
+	/* no latency measured yet, so both start from MAX_PREFETCH */
+	sim_t *fixed = sim_create(false, 0), *adaptive = sim_create(true, 0);
+
+	trace_bursts(fixed);
+	trace_bursts(adaptive);
+	sim_log("bursts", fixed);
+	sim_log("bursts", adaptive);
+
+	T_EXPECT_GT(adaptive->ras.cl_waste, 0, "back-off engaged");
+	T_EXPECT_LT(sim_unused_prefetch(adaptive), sim_unused_prefetch(fixed),
+	    "fewer prefetched pages wasted than with the fixed window");
+	free(fixed);
+	free(adaptive);
+}
+
+T_DECL(cluster_ra_latency,
+    "the window follows the device latency")
+{
+	sim_t *fast = sim_create(true, 100), *slow = sim_create(true, 20000);
+
+	trace_sequential(fast);
+	trace_sequential(slow);
+	sim_log("sequential, 100us", fast);
+	sim_log("sequential, 20ms", slow);
+
+	T_EXPECT_LE(fast->max_ralen, SIM_IO_PAGES, "a fast device needs about one I/O ahead");
+	T_EXPECT_GT(slow->max_ralen, SIM_DEF_PAGES, "a slow device gets more than MAX_PREFETCH");
+	T_EXPECT_LT(sim_miss_pct(slow), 5.0, "and stays ahead of the reader");
+	free(fast);
+	free(slow);
+}
+
+T_DECL(cluster_ra_replay,
+    "replay a captured trace from CLUSTER_RA_TRACE")
+{
+	const char *path = getenv("CLUSTER_RA_TRACE");
+	sim_t *sims[2];
+	unsigned long long off, len;
+	FILE *f;
+
+	if (path == NULL) {
+		T_SKIP("CLUSTER_RA_TRACE not set");
+	}
+	f = fopen(path, "r");
+	T_ASSERT_NOTNULL(f, "fopen(%s)", path);
+
+	sims[0] = sim_create(false, 5000);
+	sims[1] = sim_create(true, 5000);
+	while (fscanf(f, "%llu %llu", &off, &len) == 2) {
+		if (len == 0) {
+			continue;
+		}
+		for (int i = 0; i < 2; i++) {
+			sim_read(sims[i], (int64_t)(off / SIM_PAGE_SIZE),
+			    (int64_t)((off + len - 1) / SIM_PAGE_SIZE));
+		}
+	}
+	fclose(f);
+
+	for (int i = 0; i < 2; i++) {
+		sim_log(path, sims[i]);
+		free(sims[i]);
+	}
+}
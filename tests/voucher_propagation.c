@@ -0,0 +1,189 @@
+/*
+ * voucher_propagation: Measures the cost of carrying a voucher on
+ * messages, which goes through send preprocessing and receive
+ * auto-redeem of the bank attribute on every message, from one thread
+ * and from one thread per CPU.
+ *
+ * Modelled on voucher_traps.c.
+ */
+
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/mach_voucher.h>
+#include <bank/bank_types.h>
+#include <pthread.h>
+#include <sys/sysctl.h>
+#include <stdlib.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("xnu.ipc"),
+    T_META_CHECK_LEAKS(false));
+
+#define PROPAGATION_MSGS        200000
+#define PROPAGATION_THREADS_MAX 64
+
+typedef struct {
+	mach_msg_header_t header;
+	mach_msg_max_trailer_t trailer;
+} propagation_msg_t;
+
+typedef struct {
+	pthread_t       thread;
+	mach_port_t     voucher;
+	uint64_t        elapsed;
+} propagation_worker_t;
+
+static mach_port_t
+get_bank_voucher(void)
+{
+	mach_voucher_attr_recipe_data_t r = {
+		.key = MACH_VOUCHER_ATTR_KEY_BANK,
+		.command = MACH_VOUCHER_ATTR_BANK_CREATE
+	};
+	mach_port_t port = MACH_PORT_NULL;
+	kern_return_t kr = host_create_mach_voucher(mach_host_self(),
+	    (mach_voucher_attr_raw_recipe_array_t)&r,
+	    sizeof(r), &port);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "Create bank voucher");
+
+	return port;
+}
+
+/*
+ * Sends PROPAGATION_MSGS messages carrying `voucher` to a private port and
+ * receives them back with MACH_RCV_VOUCHER, and returns the time spent.
+ */
+static uint64_t
+propagation_run(mach_port_t voucher)
+{
+	propagation_msg_t msg;
+	mach_port_t port;
+	uint64_t start;
+	kern_return_t kr;
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate");
+
+	start = mach_absolute_time();
+	for (int i = 0; i < PROPAGATION_MSGS; i++) {
+		msg.header = (mach_msg_header_t){
+			.msgh_bits = MACH_MSGH_BITS_SET(MACH_MSG_TYPE_MAKE_SEND, 0,
+			    voucher ? MACH_MSG_TYPE_COPY_SEND : 0, 0),
+			.msgh_size = sizeof(mach_msg_header_t),
+			.msgh_remote_port = port,
+			.msgh_voucher_port = voucher,
+		};
+
+		kr = mach_msg(&msg.header, MACH_SEND_MSG | MACH_RCV_MSG | MACH_RCV_VOUCHER,
+		    sizeof(mach_msg_header_t), sizeof(msg), port,
+		    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_msg(SEND|RCV)");
+
+		if (MACH_PORT_VALID(msg.header.msgh_voucher_port)) {
+			kr = mach_port_deallocate(mach_task_self(),
+			    msg.header.msgh_voucher_port);
+			T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_deallocate(voucher)");
+		}
+	}
+	start = mach_absolute_time() - start;
+
+	kr = mach_port_mod_refs(mach_task_self(), port, MACH_PORT_RIGHT_RECEIVE, -1);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_mod_refs");
+	return start;
+}
+
+static double
+propagation_rate(uint64_t abs, int threads)
+{
+	mach_timebase_info_data_t tb;
+
+	mach_timebase_info(&tb);
+	return (double)PROPAGATION_MSGS * threads * 1e9 /
+	       ((double)abs * tb.numer / tb.denom);
+}
+
+static void *
+propagation_worker(void *arg)
+{
+	propagation_worker_t *w = arg;
+
+	w->elapsed = propagation_run(w->voucher);
+	return NULL;
+}
+
+T_DECL(voucher_propagation_redeem,
+    "a voucher received twice is redeemed to the same voucher")
+{
+	mach_port_t voucher = get_bank_voucher();
+	mach_port_t received[2];
+	propagation_msg_t msg;
+	mach_port_t port;
+	kern_return_t kr;
+
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate");
+
+	for (int i = 0; i < 2; i++) {
+		msg.header = (mach_msg_header_t){
+			.msgh_bits = MACH_MSGH_BITS_SET(MACH_MSG_TYPE_MAKE_SEND, 0,
+			    MACH_MSG_TYPE_COPY_SEND, 0),
+			.msgh_size = sizeof(mach_msg_header_t),
+			.msgh_remote_port = port,
+			.msgh_voucher_port = voucher,
+		};
+		kr = mach_msg(&msg.header, MACH_SEND_MSG | MACH_RCV_MSG | MACH_RCV_VOUCHER,
+		    sizeof(mach_msg_header_t), sizeof(msg), port,
+		    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+		T_ASSERT_MACH_SUCCESS(kr, "round trip %d", i);
+		received[i] = msg.header.msgh_voucher_port;
+		T_ASSERT_TRUE(MACH_PORT_VALID(received[i]), "received a voucher");
+	}
+
+	/* identical vouchers share a port, so they come out under one name */
+	T_ASSERT_EQ(received[0], received[1], "both messages carry the same voucher");
+}
+
+T_DECL(voucher_propagation_perf,
+    "messages/s with and without a voucher, one thread and one thread per CPU",
+    T_META_TAG_PERF)
+{
+	propagation_worker_t workers[PROPAGATION_THREADS_MAX];
+	mach_port_t voucher = get_bank_voucher();
+	uint64_t plain_abs, voucher_abs, slowest = 0;
+	int ncpu;
+	size_t len = sizeof(ncpu);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.ncpu", &ncpu, &len,
+	    NULL, 0), "hw.ncpu");
+	if (ncpu > PROPAGATION_THREADS_MAX) {
+		ncpu = PROPAGATION_THREADS_MAX;
+	}
+
+	plain_abs = propagation_run(MACH_PORT_NULL);
+	voucher_abs = propagation_run(voucher);
+
+	T_PERF("voucher_propagation_none", propagation_rate(plain_abs, 1),
+	    "msgs/s", "send + receive without a voucher");
+	T_PERF("voucher_propagation_single", propagation_rate(voucher_abs, 1),
+	    "msgs/s", "send + receive + redeem of a bank voucher, one thread");
+
+	for (int i = 0; i < ncpu; i++) {
+		workers[i].voucher = voucher;
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&workers[i].thread, NULL,
+		    propagation_worker, &workers[i]), "pthread_create");
+	}
+	for (int i = 0; i < ncpu; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(workers[i].thread, NULL),
+		    "pthread_join");
+		if (workers[i].elapsed > slowest) {
+			slowest = workers[i].elapsed;
+		}
+	}
+
+	T_PERF("voucher_propagation_concurrent", propagation_rate(slowest, ncpu),
+	    "msgs/s", "send + receive + redeem of one bank voucher, one thread per CPU");
+	T_LOG("none: %.0f msgs/s, voucher: %.0f msgs/s, %d threads: %.0f msgs/s",
+	    propagation_rate(plain_abs, 1), propagation_rate(voucher_abs, 1),
+	    ncpu, propagation_rate(slowest, ncpu));
+}
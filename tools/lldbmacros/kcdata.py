@@ -98,6 +98,7 @@ kcdata_type_def = {
     'STACKSHOT_KCTYPE_SYS_SHAREDCACHE_LAYOUT' : 0x927,
     'STACKSHOT_KCTYPE_THREAD_DISPATCH_QUEUE_LABEL' : 0x928,
     'STACKSHOT_KCTYPE_THREAD_TURNSTILEINFO' : 0x929,
+    'STACKSHOT_KCTYPE_IPC_PORT_STATS' : 0x92a,
 
     'STACKSHOT_KCTYPE_TASK_DELTA_SNAPSHOT': 0x940,
     'STACKSHOT_KCTYPE_THREAD_DELTA_SNAPSHOT': 0x941,
@@ -1013,6 +1014,19 @@ KNOWN_TYPES_COLLECTION[GetTypeForName('STACKSHOT_KCTYPE_THREAD_TURNSTILEINFO')]
             ),
             'thread_turnstileinfo')
 
+KNOWN_TYPES_COLLECTION[GetTypeForName('STACKSHOT_KCTYPE_IPC_PORT_STATS')] = KCTypeDescription(GetTypeForName('STACKSHOT_KCTYPE_IPC_PORT_STATS'),
+            (
+                        KCSubTypeElement.FromBasicCtype('ipss_port', KCSUBTYPE_TYPE.KC_ST_UINT64, 0),
+                        KCSubTypeElement.FromBasicCtype('ipss_owner', KCSUBTYPE_TYPE.KC_ST_UINT64, 8),
+                        KCSubTypeElement.FromBasicCtype('ipss_messages', KCSUBTYPE_TYPE.KC_ST_UINT64, 16),
+                        KCSubTypeElement.FromBasicCtype('ipss_receiver_name', KCSUBTYPE_TYPE.KC_ST_UINT32, 24),
+                        KCSubTypeElement.FromBasicCtype('ipss_sampled', KCSUBTYPE_TYPE.KC_ST_UINT32, 28),
+                        KCSubTypeElement.FromBasicCtype('ipss_depth_max', KCSUBTYPE_TYPE.KC_ST_UINT32, 32),
+                        KCSubTypeElement('ipss_latency', KCSUBTYPE_TYPE.KC_ST_UINT32, KCSubTypeElement.GetSizeForArray(16, 4), 36, 1),
+                        KCSubTypeElement('ipss_size', KCSUBTYPE_TYPE.KC_ST_UINT32, KCSubTypeElement.GetSizeForArray(16, 4), 100, 1),
+            ),
+            'ipc_port_stats')
+
 KNOWN_TYPES_COLLECTION[GetTypeForName('STACKSHOT_KCTYPE_THREAD_GROUP_SNAPSHOT')] = KCTypeDescription(GetTypeForName('STACKSHOT_KCTYPE_THREAD_GROUP'),
             (
                         KCSubTypeElement.FromBasicCtype('tgs_id', KCSUBTYPE_TYPE.KC_ST_UINT64, 0),